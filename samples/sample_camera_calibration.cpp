@@ -30,8 +30,10 @@ int main(int argc, char *argv[])
 
     // Not found
     if (!fs.isOpened()) {
-        // Image buffer
-        std::vector<cv::Mat> images;
+        // Chessboard detector (searches half-size frames on a thread)
+        cv::Size size(PAT_COLS, PAT_ROWS);
+        ARDroneCalibrator calibrator;
+        calibrator.open(size, CHESS_SIZE, 0.5);
         std::cout << "Press Space key to capture an image" << std::endl;
         std::cout << "Press Esc to exit" << std::endl;
 
@@ -44,14 +46,9 @@ int main(int argc, char *argv[])
             // Get an image
             frame = ardrone.getImage();
 
-            // Convert to grayscale
-            cv::Mat gray;
-            cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
-
             // Detect a chessboard
-            cv::Size size(PAT_COLS, PAT_ROWS);
             std::vector<cv::Point2f> corners;
-            bool found = cv::findChessboardCorners(gray, size, corners, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE | cv::CALIB_CB_FAST_CHECK);
+            bool found = calibrator.push(frame, &corners) != 0;
 
             // Chessboard detected
             if (found) {
@@ -60,51 +57,27 @@ int main(int argc, char *argv[])
 
                 // Space key was pressed
                 if (key == ' ') {
-                    // Add to buffer
-                    images.push_back(gray);
+                    // Keep the refined corners
+                    calibrator.capture();
                 }
             }
 
             // Show the image
             std::ostringstream stream;
-            stream << "Captured " << images.size() << " image(s).";
+            stream << "Captured " << calibrator.getCount() << " image(s).";
             cv::putText(frame, stream.str(), cv::Point(10, 20), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 0), 1, cv::LINE_AA);
             cv::imshow("Camera Calibration", frame);
         }
 
-        // We have enough samples
-        if (images.size() > 4) {
-            cv::Size size(PAT_COLS, PAT_ROWS);
-            std::vector< std::vector<cv::Point2f> > corners2D;
-            std::vector< std::vector<cv::Point3f> > corners3D;
-
-            for (size_t i = 0; i < images.size(); i++) {
-                // Detect a chessboard
-                std::vector<cv::Point2f> tmp_corners2D;
-                bool found = cv::findChessboardCorners(images[i], size, tmp_corners2D);
-
-                // Chessboard detected
-                if (found) {
-                    // Convert the corners to sub-pixel
-                    cv::cornerSubPix(images[i], tmp_corners2D, cvSize(11, 11), cvSize(-1, -1), cv::TermCriteria(cv::TermCriteria::EPS | cv::TermCriteria::COUNT, 30, 0.1));
-                    corners2D.push_back(tmp_corners2D);
-
-                    // Set the 3D position of patterns
-                    const float squareSize = CHESS_SIZE;
-                    std::vector<cv::Point3f> tmp_corners3D;
-                    for (int j = 0; j < size.height; j++) {
-                        for (int k = 0; k < size.width; k++) {
-                            tmp_corners3D.push_back(cv::Point3f((float)(k*squareSize), (float)(j*squareSize), 0.0));
-                        }
-                    }
-                    corners3D.push_back(tmp_corners3D);
-                }
-            }
+        // Stop the detector
+        calibrator.close();
 
+        // We have enough samples
+        if (calibrator.getCount() > 4) {
             // Estimate camera parameters
             cv::Mat cameraMatrix, distCoeffs;
-            std::vector<cv::Mat> rvec, tvec;
-            cv::calibrateCamera(corners3D, corners2D, images[0].size(), cameraMatrix, distCoeffs, rvec, tvec);
+            double rms = calibrator.calibrate(&cameraMatrix, &distCoeffs);
+            std::cout << "RMS error = " << rms << std::endl;
             std::cout << cameraMatrix << std::endl;
             std::cout << distCoeffs << std::endl;
 
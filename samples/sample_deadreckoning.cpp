@@ -22,8 +22,8 @@ int main(int argc, char *argv[])
     // Map
     cv::Mat map = cv::Mat::zeros(500, 500, CV_8UC3);
 
-    // Position matrix
-    cv::Mat P = cv::Mat::zeros(3, 1, CV_64FC1);
+    // Dead-reckoning on the Navdata thread
+    ardrone.startOdometry();
 
     // Main loop
     while (1) {
@@ -34,59 +34,44 @@ int main(int argc, char *argv[])
         // Get an image
         cv::Mat image = ardrone.getImage();
 
-        // Altitude
-        double altitude = ardrone.getAltitude();
-
-        // Orientations
-        double roll = ardrone.getRoll();
-        double pitch = ardrone.getPitch();
-        double yaw = ardrone.getYaw();
-
-        // Velocities
-        double vx, vy, vz;
-        double velocity = ardrone.getVelocity(&vx, &vy, &vz);
-        cv::Mat V = (cv::Mat1f(3, 1) << vx, vy, vz);
-
-        // Rotation matrices
-        cv::Mat RZ = (cv::Mat1f(3, 3) << cos(yaw), -sin(yaw), 0.0,
-                                         sin(yaw),  cos(yaw), 0.0,
-                                              0.0,       0.0, 1.0);
-        cv::Mat RY = (cv::Mat1f(3, 3) << cos(pitch), 0.0, sin(pitch),
-                                                0.0, 1.0,        0.0,
-                                        -sin(pitch), 0.0, cos(pitch));
-        cv::Mat RX = (cv::Mat1f(3, 3) << 1.0,       0.0,        0.0,
-                                         0.0, cos(roll), -sin(roll),
-                                         0.0, sin(roll),  cos(roll));
-
-        // Time [s]
-        static int64 last = cv::getTickCount();
-        double dt = (cv::getTickCount() - last) / cv::getTickFrequency();
-        last = cv::getTickCount();
-
-        // Dead-reckoning
-        P = P + RZ * RY * RX * V * dt;
-
-        // Position (x, y, z)
-        double pos[3] = { P.at<double>(0, 0), P.at<double>(1, 0), P.at<double>(2, 0) };
+        // Position (x, y, z) integrated at the Navdata rate
+        ARDRONE_POSE pose;
+        ardrone.getPose(&pose);
+        double pos[3] = { pose.x, pose.y, pose.z };
         std::cout << "x = " << pos[0] << "[m], " << "y = " << pos[1] << "[m], " << "z = " << pos[2] << "[m]" << std::endl;
 
+        // Reset the position
+        if (key == 'r') ardrone.resetPose();
+
         // Take off / Landing 
         if (key == ' ') {
             if (ardrone.onGround()) ardrone.takeoff();
             else                    ardrone.landing();
         }
 
+        // Hold the current position on the command thread
+        static bool hold = false;
+        if (key == 'h' && !hold && ardrone.startController()) {
+            ARDRONE_SETPOINT setpoint = { pose.x, pose.y, pose.z, pose.yaw, 0.0, 0.0, 0.0, 0.0, ARDRONE_CONTROL_ALL };
+            ardrone.setSetpoint(setpoint);
+            hold = true;
+        }
+
         // Move
         double x = 0.0, y = 0.0, z = 0.0, r = 0.0;
-        if (key == 'i' || key == CV_VK_UP)    vx =  1.0;
-        if (key == 'k' || key == CV_VK_DOWN)  vx = -1.0;
-        if (key == 'u' || key == CV_VK_LEFT)  vr =  1.0;
-        if (key == 'o' || key == CV_VK_RIGHT) vr = -1.0;
-        if (key == 'j') vy =  1.0;
-        if (key == 'l') vy = -1.0;
-        if (key == 'q') vz =  1.0;
-        if (key == 'a') vz = -1.0;
-        ardrone.move3D(x, y, z, r);
+        if (key == 'i' || key == CV_VK_UP)    x =  1.0;
+        if (key == 'k' || key == CV_VK_DOWN)  x = -1.0;
+        if (key == 'u' || key == CV_VK_LEFT)  r =  1.0;
+        if (key == 'o' || key == CV_VK_RIGHT) r = -1.0;
+        if (key == 'j') y =  1.0;
+        if (key == 'l') y = -1.0;
+        if (key == 'q') z =  1.0;
+        if (key == 'a') z = -1.0;
+        if (hold && (x != 0.0 || y != 0.0 || z != 0.0 || r != 0.0)) {
+            ardrone.stopController();
+            hold = false;
+        }
+        if (!hold) ardrone.move3D(x, y, z, r);
 
         // Change camera
         static int mode = 0;
@@ -0,0 +1,53 @@
+#include "ardrone/ardrone.h"
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Argument values)
+// Description  : This is the entry point of the program.
+// Return value : SUCCESS:0  ERROR:-1
+// --------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    // AR.Drone fleet class (1 I/O thread + 2 decoder threads for all drones)
+    ARDroneFleet fleet(2);
+
+    // Initialize (pass IP addresses as arguments)
+    for (int i = 1; i < argc; i++) {
+        if (!fleet.open(argv[i])) std::cout << "Failed to initialize " << argv[i] << "." << std::endl;
+    }
+    if (argc < 2) fleet.open();
+
+    // No drone
+    if (fleet.size() < 1) {
+        std::cout << "Failed to initialize." << std::endl;
+        return -1;
+    }
+
+    // Main loop
+    while (1) {
+        // Key input
+        int key = cv::waitKey(33);
+        if (key == 0x1b) break;
+
+        for (int i = 0; i < fleet.size(); i++) {
+            // Each handle has the ARDrone API
+            ARDrone *ardrone = fleet[i];
+
+            // Take off / Landing
+            if (key == ' ') {
+                if (ardrone->onGround()) ardrone->takeoff();
+                else                     ardrone->landing();
+            }
+
+            // Display the image
+            std::ostringstream name;
+            name << "camera" << i;
+            cv::Mat image = ardrone->getImage();
+            cv::imshow(name.str(), image);
+        }
+    }
+
+    // See you
+    fleet.close();
+
+    return 0;
+}
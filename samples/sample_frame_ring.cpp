@@ -0,0 +1,82 @@
+#include "ardrone/ardrone.h"
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Argument values)
+// Description  : This is the entry point of the program.
+//                Run it once to share the camera, and again with "-reader"
+//                in other processes to see the frames without copying them.
+// Return value : SUCCESS:0  ERROR:-1
+// --------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    // Reader
+    if (argc > 1 && !strcmp(argv[1], "-reader")) {
+        // Map the ring
+        ARDroneFrameRing ring;
+        if (!ring.open("/cvdrone")) {
+            std::cout << "Failed to open the ring." << std::endl;
+            return -1;
+        }
+
+        // Main loop
+        uint64_t last = 0;
+        while (1) {
+            // Key input
+            int key = cv::waitKey(1);
+            if (key == 0x1b) break;
+
+            // Get the latest frame (the image points to the shared memory)
+            cv::Mat image;
+            ARDRONE_FRAME_META meta;
+            if (!ring.read(&image, &meta, last)) continue;
+            last = meta.seq;
+
+            // Display the image (skip it if the writer overwrote it meanwhile)
+            cv::Mat display = image.clone();
+            if (!ring.isValid(meta)) continue;
+            std::ostringstream text;
+            text << "#" << meta.seq << " navdata " << meta.navdata_sequence << " camera " << meta.channel;
+            cv::putText(display, text.str(), cv::Point(10, 20), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 0), 1);
+            cv::imshow("reader", display);
+        }
+
+        return 0;
+    }
+
+    // AR.Drone class
+    ARDrone ardrone;
+
+    // Initialize
+    if (!ardrone.open()) {
+        std::cout << "Failed to initialize." << std::endl;
+        return -1;
+    }
+
+    // Share decoded frames
+    if (!ardrone.startFrameRing("/cvdrone")) {
+        std::cout << "Failed to create the ring." << std::endl;
+        ardrone.close();
+        return -1;
+    }
+
+    // Main loop
+    while (1) {
+        // Key input
+        int key = cv::waitKey(33);
+        if (key == 0x1b) break;
+
+        // Change camera
+        static int mode = 0;
+        if (key == 'c') ardrone.setCamera(++mode % 4);
+
+        // Display the image
+        cv::Mat image = ardrone.getImage();
+        cv::imshow("camera", image);
+    }
+
+    // See you
+    ardrone.stopFrameRing();
+    ardrone.close();
+
+    return 0;
+}
\ No newline at end of file
@@ -16,22 +16,22 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    // Initialize detector
-    cv::HOGDescriptor hog;
-    hog.setSVMDetector(cv::HOGDescriptor::getDefaultPeopleDetector());
+    // Initialize detector (half size, 2 pyramid levels per frame, on its own thread)
+    ARDroneHOGDetector hog;
+    hog.open(0.5, 2, 1.2);
 
     // Main loop
     while (1) {
         // Key input
-        int key = cv::waitKey(1);
+        int key = cv::waitKey(33);
         if (key == 0x1b) break;
 
         // Get an image
         cv::Mat image = ardrone.getImage();
 
-        // Detect
+        // Detect (results arrive asynchronously and are tracked in between)
         std::vector<cv::Rect> found;
-        hog.detectMultiScale(image, found, 0, cv::Size(4, 4), cv::Size(0, 0), 1.5, 2.0);
+        hog.push(image, &found);
 
         // Show bounding rect
         std::vector<cv::Rect>::const_iterator it;
@@ -40,10 +40,19 @@ int main(int argc, char *argv[])
             cv::rectangle(image, r.tl(), r.br(), cv::Scalar(255, 0, 0), 2);
         }
 
+        // Show timings
+        ARDRONE_HOG_TIMING timing = hog.getTiming();
+        char str[128];
+        sprintf(str, "convert %.1f  track %.1f  scan %.1f  group %.1f ms (%d levels)", timing.convert, timing.track, timing.scan, timing.group, timing.levels);
+        cv::putText(image, str, cv::Point(10, 20), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255, 0, 0), 1);
+
         // Display the image
         cv::imshow("hog", image); 
     }
 
+    // Stop detector
+    hog.close();
+
     // See you
     ardrone.close();
 
@@ -46,39 +46,12 @@ int main(int argc, char *argv[])
     cv::createTrackbar("V min", "binalized", &minV, 255);
     cv::resizeWindow("binalized", 0, 0);
 
-    // Kalman filter
-    cv::KalmanFilter kalman(4, 2, 0);
-
-    // Sampling time [s]
-    const double dt = 1.0;
-
-    // Transition matrix (x, y, vx, vy)
-    cv::Mat1f A(4, 4);
-    A << 1.0, 0.0,  dt, 0.0,
-         0.0, 1.0, 0.0,  dt,
-         0.0, 0.0, 1.0, 0.0,
-         0.0, 0.0, 0.0, 1.0;
-    kalman.transitionMatrix = A;
-
-    // Measurement matrix (x, y)
-    cv::Mat1f H(2, 4);
-    H << 1, 0, 0, 0,
-         0, 1, 0, 0;
-    kalman.measurementMatrix = H;
-
-    // Process noise covariance (x, y, vx, vy)
-    cv::Mat1f Q(4, 4);
-    Q << 1e-5,  0.0,  0.0,  0.0,
-          0.0, 1e-5,  0.0,  0.0,
-          0.0,  0.0, 1e-5,  0.0,
-          0.0,  0.0,  0.0, 1e-5;
-    kalman.processNoiseCov = Q;
-
-    // Measurement noise covariance (x, y)
-    cv::Mat1f R(2, 2);
-    R << 1e-1,  0.0,
-          0.0, 1e-1;
-    kalman.measurementNoiseCov = R;
+    // Colour-blob tracker (buffers are reused for each frame)
+    ARDroneBlobTracker tracker;
+
+    // Kalman filter (x, y, vx, vy) predicts the window to be searched
+    // (process noise 1 [px/frame], measurement noise 2 [px])
+    tracker.setKalman(true, 1.0, 2.0);
 
     // Main loop
     while (1) {
@@ -89,64 +62,23 @@ int main(int argc, char *argv[])
         // Get an image
         cv::Mat image = ardrone.getImage();
 
-        // HSV image
-        cv::Mat hsv;
-        cv::cvtColor(image, hsv, cv::COLOR_BGR2HSV_FULL);
-
-        // Binalize
-        cv::Mat binalized;
-        cv::Scalar lower(minH, minS, minV);
-        cv::Scalar upper(maxH, maxS, maxV);
-        cv::inRange(hsv, lower, upper, binalized);
+        // Find the largest blob
+        tracker.setThresholds(minH, maxH, minS, maxS, minV, maxV);
+        ARDRONE_BLOB blob;
+        tracker.track(image, &blob);
 
         // Show result
-        cv::imshow("binalized", binalized);
-
-        // De-noising
-        cv::Mat kernel = getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
-        cv::morphologyEx(binalized, binalized, cv::MORPH_CLOSE, kernel);
-        //cv::imshow("morphologyEx", binalized);
-
-        // Detect contours
-        std::vector< std::vector<cv::Point> > contours;
-        cv::findContours(binalized.clone(), contours, cv::RETR_CCOMP, cv::CHAIN_APPROX_SIMPLE);
-
-        // Find the largest contour
-        int contour_index = -1;
-        double max_area = 0.0;
-        for (size_t i = 0; i < contours.size(); i++) {
-            double area = fabs(cv::contourArea(contours[i]));
-            if (area > max_area) {
-                contour_index = i;
-                max_area = area;
-            }
-        }
-
-        // Object detected
-        if (contour_index >= 0) {
-            // Moments
-            cv::Moments moments = cv::moments(contours[contour_index], true);
-            double marker_y = (int)(moments.m01 / moments.m00);
-            double marker_x = (int)(moments.m10 / moments.m00);
+        cv::imshow("binalized", tracker.getMask());
 
-            // Measurements
-            cv::Mat measurement = (cv::Mat1f(2, 1) << marker_x, marker_y);
+        // Show the predicted search window
+        cv::rectangle(image, tracker.getSearchWindow(), cv::Scalar(0, 255, 255));
 
-            // Correction
-            cv::Mat estimated = kalman.correct(measurement);
-
-            // Show result
-            cv::Rect rect = cv::boundingRect(contours[contour_index]);
-            cv::rectangle(image, rect, cv::Scalar(0, 255, 0));
+        // Object detected
+        if (blob.found) {
+            cv::rectangle(image, blob.rect, cv::Scalar(0, 255, 0));
+            cv::circle(image, cv::Point(cvRound(blob.center.x), cvRound(blob.center.y)), 3, cv::Scalar(0, 255, 0), 2);
         }
 
-        // Prediction
-        cv::Mat1f prediction = kalman.predict();
-        int radius = 1e+3 * kalman.errorCovPre.at<float>(0, 0);
-
-        // Show predicted position
-        cv::circle(image, cv::Point(prediction(0, 0), prediction(0, 1)), radius, cv::Scalar(0, 255, 0), 2);
-
         // Display the image
         cv::imshow("camera", image);
     }
@@ -21,8 +21,8 @@
 
 // Global variables
 ARDrone ardrone;
-cv::Mat mapx, mapy;
 CameraCalibration calibration;
+MarkerDetector *detector = NULL;
 
 // --------------------------------------------------------------------------
 // buildProjectionMatrix(Camera matrix, Screen width, Screen height)
@@ -85,10 +85,12 @@ void display(void)
 	// Clear the buffers
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// Get an image
-	cv::Mat image_raw = ardrone.getImage();
-	cv::Mat image;
-	cv::remap(image_raw, image, mapx, mapy, cv::INTER_LINEAR);
+	// Get an image (rectified by the decoder)
+	cv::Mat image = ardrone.getImage();
+
+	// Luma of the same frame for the marker detector (no BGRA conversion)
+	static cv::Mat luma;
+	if (!ardrone.getLuma(&luma)) cv::cvtColor(image, luma, cv::COLOR_BGR2GRAY);
 
 	// Show the image
 	cv::Mat rgb;
@@ -97,24 +99,12 @@ void display(void)
 	glDepthMask(GL_FALSE);
 	glDrawPixels(rgb.cols, rgb.rows, GL_RGB, GL_UNSIGNED_BYTE, rgb.data);
 
-	// Convert to BGRA
-	cv::Mat bgra;
-	cv::cvtColor(image, bgra, cv::COLOR_BGR2BGRA);
-
-	// Prepare for marker detection
-	BGRAVideoFrame frame;
-	frame.width = bgra.cols;
-	frame.height = bgra.rows;
-	frame.data = bgra.data;
-	frame.stride = bgra.step;
-
-	// Detect marker(s)
-	MarkerDetector detector(calibration);
-	detector.processFrame(frame);
-	std::vector<Transformation> transformations = detector.getTransformations();
+	// Detect marker(s) on the half-size image (buffers and poses are kept across frames)
+	detector->processFrame(luma, 2);
+	std::vector<Transformation> transformations = detector->getTransformations();
 
 	// Calculate projection matrix
-	Matrix44 projectionMatrix = buildProjectionMatrix(calibration.getIntrinsic(), frame.width, frame.height);
+	Matrix44 projectionMatrix = buildProjectionMatrix(calibration.getIntrinsic(), luma.cols, luma.rows);
 
 	// Apply the projection matrix
 	glMatrixMode(GL_PROJECTION);
@@ -341,8 +331,11 @@ int main(int argc, char *argv[])
 	rfs["intrinsic"] >> cameraMatrix;
 	rfs["distortion"] >> distCoeffs;
 
-	// Create undistort map
-	cv::initUndistortRectifyMap(cameraMatrix, distCoeffs, cv::Mat(), cameraMatrix, frame.size(), CV_32FC1, mapx, mapy);
+	// Rectify the frames on the decoder thread
+	if (!ardrone.startUndistort(filename.c_str(), 0)) {
+		std::cout << "Failed to load the camera parameters" << std::endl;
+		return -1;
+	}
 
 	// Set camera parameters
 	float fx = cameraMatrix.at<double>(0, 0);
@@ -352,6 +345,10 @@ int main(int argc, char *argv[])
 	//calibration = CameraCalibration(fx, fy, cx, cy);
     calibration = CameraCalibration(fx, fy, frame.cols / 2, frame.rows / 2);
 
+	// Marker detector (full detection every 5 frames, the corners are tracked in between)
+	detector = new MarkerDetector(calibration);
+	detector->setDetectionInterval(5);
+
 	// Initialize GLUT
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
@@ -0,0 +1,117 @@
+#include "ardrone/ardrone.h"
+
+// Number of iterations
+#define NUM_LOOPS (1000000)
+
+// Elapsed time per loop [ns]
+static double elapsed(int64 start)
+{
+    return (cv::getTickCount() - start) / cv::getTickFrequency() / NUM_LOOPS * 1.0e9;
+}
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Argument values)
+// Description  : This is the entry point of the program.
+//                Compares cv::Mat based 3x3 / 4x4 math with ARMath.
+// Return value : SUCCESS:0  ERROR:-1
+// --------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    // Random attitudes and velocities
+    cv::RNG rng;
+    std::vector<cv::Vec3f> angles(256), velocities(256);
+    for (size_t i = 0; i < angles.size(); i++) {
+        angles[i] = cv::Vec3f(rng.uniform(-0.5f, 0.5f), rng.uniform(-0.5f, 0.5f), rng.uniform(-3.0f, 3.0f));
+        velocities[i] = cv::Vec3f(rng.uniform(-1.0f, 1.0f), rng.uniform(-1.0f, 1.0f), rng.uniform(-1.0f, 1.0f));
+    }
+    const float dt = 0.005f;
+
+    // Dead-reckoning with cv::Mat (as sample_deadreckoning did)
+    cv::Mat P = cv::Mat::zeros(3, 1, CV_32FC1);
+    int64 start = cv::getTickCount();
+    for (int i = 0; i < NUM_LOOPS; i++) {
+        const cv::Vec3f &a = angles[i & 255], &v = velocities[i & 255];
+        float roll = a[0], pitch = a[1], yaw = a[2];
+        cv::Mat V = (cv::Mat1f(3, 1) << v[0], v[1], v[2]);
+        cv::Mat RZ = (cv::Mat1f(3, 3) << cos(yaw), -sin(yaw), 0.0, sin(yaw), cos(yaw), 0.0, 0.0, 0.0, 1.0);
+        cv::Mat RY = (cv::Mat1f(3, 3) << cos(pitch), 0.0, sin(pitch), 0.0, 1.0, 0.0, -sin(pitch), 0.0, cos(pitch));
+        cv::Mat RX = (cv::Mat1f(3, 3) << 1.0, 0.0, 0.0, 0.0, cos(roll), -sin(roll), 0.0, sin(roll), cos(roll));
+        P = P + RZ * RY * RX * V * dt;
+    }
+    double t0 = elapsed(start);
+
+    // Dead-reckoning with ARMath
+    ARMath::Vec3 Q = ARMath::vec3(0.0f, 0.0f, 0.0f);
+    start = cv::getTickCount();
+    for (int i = 0; i < NUM_LOOPS; i++) {
+        const cv::Vec3f &a = angles[i & 255], &v = velocities[i & 255];
+        Q += ARMath::fromEuler(a[0], a[1], a[2]) * ARMath::vec3(v[0], v[1], v[2]) * dt;
+    }
+    double t1 = elapsed(start);
+    std::cout << "Euler -> R, R * v      : cv::Mat " << t0 << " [ns], ARMath " << t1 << " [ns], x" << t0 / t1 << std::endl;
+    std::cout << "  positions : (" << P.at<float>(0) << ", " << P.at<float>(1) << ", " << P.at<float>(2) << ") / (" << Q.x << ", " << Q.y << ", " << Q.z << ")" << std::endl;
+
+    // Rotation vector -> matrix (as MarkerDetector::estimatePosition did)
+    float sum0 = 0.0f;
+    start = cv::getTickCount();
+    for (int i = 0; i < NUM_LOOPS; i++) {
+        cv::Mat rvec = (cv::Mat_<double>(3, 1) << angles[i & 255][0], angles[i & 255][1], angles[i & 255][2]);
+        cv::Mat Rvec;
+        rvec.convertTo(Rvec, CV_32F);
+        cv::Mat_<float> rotMat(3, 3);
+        cv::Rodrigues(Rvec, rotMat);
+        sum0 += rotMat(0, 1);
+    }
+    t0 = elapsed(start);
+
+    float sum1 = 0.0f;
+    start = cv::getTickCount();
+    for (int i = 0; i < NUM_LOOPS; i++) {
+        ARMath::Mat33 R = ARMath::fromRotationVector(ARMath::vec3(angles[i & 255][0], angles[i & 255][1], angles[i & 255][2]));
+        sum1 += R.m[0][1];
+    }
+    t1 = elapsed(start);
+    std::cout << "Rodrigues              : cv::Mat " << t0 << " [ns], ARMath " << t1 << " [ns], x" << t0 / t1 << " (" << sum0 << " / " << sum1 << ")" << std::endl;
+
+    // 4x4 products
+    cv::Mat A = cv::Mat::eye(4, 4, CV_32FC1), B(4, 4, CV_32FC1);
+    rng.fill(B, cv::RNG::UNIFORM, -1.0f, 1.0f);
+    B *= 0.5f;
+    start = cv::getTickCount();
+    for (int i = 0; i < NUM_LOOPS; i++) {
+        A = A * B;
+        if ((i & 15) == 15) A = cv::Mat::eye(4, 4, CV_32FC1);
+    }
+    t0 = elapsed(start);
+
+    ARMath::Mat44 C = ARMath::identity44(), D;
+    memcpy(D.m, B.ptr<float>(), sizeof(D.m));
+    start = cv::getTickCount();
+    for (int i = 0; i < NUM_LOOPS; i++) {
+        C = C * D;
+        if ((i & 15) == 15) C = ARMath::identity44();
+    }
+    t1 = elapsed(start);
+    std::cout << "4x4 * 4x4              : cv::Mat " << t0 << " [ns], ARMath " << t1 << " [ns], x" << t0 / t1 << std::endl;
+
+    // Quaternion attitude
+    float sum2 = 0.0f;
+    start = cv::getTickCount();
+    for (int i = 0; i < NUM_LOOPS; i++) {
+        const cv::Vec3f &a = angles[i & 255], &v = velocities[i & 255];
+        ARMath::Vec3 w = ARMath::rotate(ARMath::quatFromEuler(a[0], a[1], a[2]), ARMath::vec3(v[0], v[1], v[2]));
+        sum2 += w.x;
+    }
+    t1 = elapsed(start);
+    std::cout << "Euler -> q, q * v * q' : ARMath " << t1 << " [ns] (" << sum2 << ")" << std::endl;
+
+    #if defined(ARMATH_SSE)
+    std::cout << "SIMD : SSE" << std::endl;
+    #elif defined(ARMATH_NEON)
+    std::cout << "SIMD : NEON" << std::endl;
+    #else
+    std::cout << "SIMD : none" << std::endl;
+    #endif
+
+    return 0;
+}
\ No newline at end of file
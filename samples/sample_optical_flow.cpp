@@ -16,47 +16,43 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    // Get an image
-    cv::Mat prev_image = ardrone.getImage();
+    // Optical-flow odometry (features and pyramids are kept across frames)
+    ARDroneOpticalFlow odometry;
+    odometry.setFeatures(200, 80);
 
     while (1) {
         // Key input
         int key = cv::waitKey(33);
         if (key == 0x1b) break;
 
-        // Get an image
-        cv::Mat image = ardrone.getImage();
+        // Get an image with the Navdata at its capture
+        ARDRONE_FRAME_INFO info;
+        cv::Mat image = ardrone.getImage(&info);
 
-        // Convert the camera image to grayscale
-        cv::Mat prev_gray, new_gray;
-        cv::cvtColor(image, new_gray, cv::COLOR_BGR2GRAY);
-        cv::cvtColor(prev_image, prev_gray, cv::COLOR_BGR2GRAY);
-
-        // Detect corners
-        int max_corners = 50;
-        std::vector<cv::Point2f> prev_corners;
-        std::vector<cv::Point2f> new_corners;
-        cv::goodFeaturesToTrack(prev_gray, prev_corners, max_corners, 0.1, 5.0);
-        cv::goodFeaturesToTrack(new_gray, new_corners, max_corners, 0.1, 5.0);
-
-        // Calclate optical flow
-        std::vector<unsigned char> status;
-        std::vector<float> errors;
-        cv::calcOpticalFlowPyrLK(prev_gray, new_gray, prev_corners, new_corners, status, errors);
-
-        // Save the last frame
-        image.copyTo(prev_image);
+        // Track the features
+        ARDRONE_FLOW flow;
+        odometry.update(image, &flow, &info);
 
         // Draw optical flow
-        for (size_t i = 0; i < status.size(); i++) {
-            cv::Point p0(ceil(prev_corners[i].x), ceil(prev_corners[i].y));
-            cv::Point p1(ceil(new_corners[i].x), ceil(new_corners[i].y));
-            cv::line(image, p0, p1, cv::Scalar(0, 255, 0), 2);
+        std::vector<cv::Point2f> prev_corners, new_corners;
+        odometry.getTracks(&prev_corners, &new_corners);
+        for (size_t i = 0; i < new_corners.size(); i++) {
+            cv::line(image, prev_corners[i], new_corners[i], cv::Scalar(0, 255, 0), 2);
         }
 
+        // Velocity fused with the Navdata (bottom camera)
+        double vx, vy;
+        odometry.fuse(flow, info, &vx, &vy);
+        char str[128];
+        sprintf(str, "features %d (+%d)  shift %+.1f %+.1f px  v %+.2f %+.2f m/s", flow.inliers, flow.detected, flow.shift.x, flow.shift.y, vx, vy);
+        cv::putText(image, str, cv::Point(10, 20), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 0), 1);
+
         // Change camera
         static int mode = 0;
-        if (key == 'c') ardrone.setCamera(++mode % 4);
+        if (key == 'c') {
+            ardrone.setCamera(++mode % 4);
+            odometry.reset();
+        }
 
         // Display the image
         cv::imshow("camera", image);
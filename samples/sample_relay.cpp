@@ -0,0 +1,46 @@
+#include "ardrone/ardrone.h"
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Argument values)
+// Description  : This is the entry point of the program.
+// Return value : SUCCESS:0  ERROR:-1
+// --------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    // AR.Drone class
+    ARDrone ardrone;
+
+    // Initialize
+    if (!ardrone.open()) {
+        std::cout << "Failed to initialize." << std::endl;
+        return -1;
+    }
+
+    // Re-stream the video on 127.0.0.1:5555
+    // "-raw" sends plain H.264 for media players (e.g. ffplay -f h264 tcp://127.0.0.1:5555)
+    bool pave = !(argc > 1 && !strcmp(argv[1], "-raw"));
+    if (!ardrone.startRelay("127.0.0.1", ARDRONE_VIDEO_PORT, pave)) {
+        std::cout << "Failed to start the relay." << std::endl;
+        ardrone.close();
+        return -1;
+    }
+
+    // Main loop
+    while (1) {
+        // Key input
+        int key = cv::waitKey(33);
+        if (key == 0x1b) break;
+
+        // Get an image
+        cv::Mat image = ardrone.getImage();
+
+        // Display the image
+        cv::imshow("camera", image);
+    }
+
+    // See you
+    ardrone.stopRelay();
+    ardrone.close();
+
+    return 0;
+}
\ No newline at end of file
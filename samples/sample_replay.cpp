@@ -0,0 +1,93 @@
+#include "ardrone/ardrone.h"
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Argument values)
+// Description  : This is the entry point of the program.
+//                Usage: sample_replay                  (fly and press 'r' to record)
+//                       sample_replay [log] [speed]    (replay, speed 0 = as fast as possible)
+// Return value : SUCCESS:0  ERROR:-1
+// --------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    // AR.Drone class
+    ARDrone ardrone;
+
+    // Replay a log
+    if (argc > 1) {
+        double speed = (argc > 2) ? atof(argv[2]) : 1.0;
+        if (!ardrone.openLog(argv[1], speed)) {
+            std::cout << "Failed to open " << argv[1] << "." << std::endl;
+            return -1;
+        }
+
+        // Count decoded frames
+        int frames = 0;
+        int64 start = cv::getTickCount();
+        while (!ardrone.endOfLog()) {
+            if (ardrone.willGetNewImage()) {
+                cv::Mat image = ardrone.getImage();
+                frames++;
+
+                // Display only in real time
+                if (speed > 0.0) cv::imshow("camera", image);
+            }
+            if (speed > 0.0 && cv::waitKey(1) == 0x1b) break;
+            else if (speed <= 0.0) msleep(1);
+        }
+        double elapsed = (cv::getTickCount() - start) / cv::getTickFrequency();
+        std::cout << frames << " frames in " << elapsed << " [s] (" << frames / elapsed << " [fps])" << std::endl;
+
+        return 0;
+    }
+
+    // Initialize
+    if (!ardrone.open()) {
+        std::cout << "Failed to initialize." << std::endl;
+        return -1;
+    }
+
+    // Main loop
+    bool recording = false;
+    while (1) {
+        // Key input
+        int key = cv::waitKey(33);
+        if (key == 0x1b) break;
+
+        // Start / Stop recording
+        if (key == 'r') {
+            if (!recording) recording = (ardrone.startRecord("session.cvdlog") != 0);
+            else {
+                ardrone.stopRecord();
+                recording = false;
+            }
+            std::cout << (recording ? "Recording" : "Stopped") << std::endl;
+        }
+
+        // Take off / Landing
+        if (key == ' ') {
+            if (ardrone.onGround()) ardrone.takeoff();
+            else                    ardrone.landing();
+        }
+
+        // Move
+        double vx = 0.0, vy = 0.0, vz = 0.0, vr = 0.0;
+        if (key == 'i' || key == CV_VK_UP)    vx =  1.0;
+        if (key == 'k' || key == CV_VK_DOWN)  vx = -1.0;
+        if (key == 'u' || key == CV_VK_LEFT)  vr =  1.0;
+        if (key == 'o' || key == CV_VK_RIGHT) vr = -1.0;
+        if (key == 'j') vy =  1.0;
+        if (key == 'l') vy = -1.0;
+        if (key == 'q') vz =  1.0;
+        if (key == 'a') vz = -1.0;
+        ardrone.move3D(vx, vy, vz, vr);
+
+        // Display the image
+        cv::Mat image = ardrone.getImage();
+        cv::imshow("camera", image);
+    }
+
+    // See you
+    ardrone.close();
+
+    return 0;
+}
\ No newline at end of file
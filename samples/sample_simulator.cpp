@@ -0,0 +1,93 @@
+#include "ardrone/ardrone.h"
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Argument values)
+// Description  : This is the entry point of the program.
+//                Usage: sample_simulator [number of drones] [H.264 file]
+// Return value : SUCCESS:0  ERROR:-1
+// --------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    // Number of drones and a video file
+    int num = (argc > 1) ? MAX(atoi(argv[1]), 1) : 1;
+    const char *video_file = (argc > 2) ? argv[2] : NULL;
+
+    // Simulated drones on 127.0.0.1, 127.0.0.2, ...
+    std::vector<ARDroneSimulator*> simulators;
+    std::vector<std::string> addrs;
+    for (int i = 0; i < num; i++) {
+        std::ostringstream addr;
+        addr << "127.0.0." << (i + 1);
+        ARDroneSimulator *simulator = new ARDroneSimulator;
+        if (!simulator->open(addr.str().c_str(), "2.4.8", video_file)) {
+            std::cout << "Failed to start a simulator on " << addr.str() << "." << std::endl;
+            delete simulator;
+            continue;
+        }
+        simulators.push_back(simulator);
+        addrs.push_back(addr.str());
+    }
+
+    // Connect to them
+    ARDroneFleet fleet(2);
+    for (size_t i = 0; i < addrs.size(); i++) {
+        if (!fleet.open(addrs[i].c_str())) std::cout << "Failed to initialize " << addrs[i] << "." << std::endl;
+    }
+    if (fleet.size() < 1) {
+        std::cout << "Failed to initialize." << std::endl;
+        return -1;
+    }
+
+    // Main loop
+    int64 start = cv::getTickCount();
+    while (1) {
+        // Key input
+        int key = cv::waitKey(33);
+        if (key == 0x1b) break;
+
+        for (int i = 0; i < fleet.size(); i++) {
+            ARDrone *ardrone = fleet[i];
+
+            // Take off / Landing
+            if (key == ' ') {
+                if (ardrone->onGround()) ardrone->takeoff();
+                else                     ardrone->landing();
+            }
+
+            // Move
+            double vx = 0.0, vy = 0.0, vz = 0.0, vr = 0.0;
+            if (key == 'i' || key == CV_VK_UP)    vx =  1.0;
+            if (key == 'k' || key == CV_VK_DOWN)  vx = -1.0;
+            if (key == 'u' || key == CV_VK_LEFT)  vr =  1.0;
+            if (key == 'o' || key == CV_VK_RIGHT) vr = -1.0;
+            if (key == 'j') vy =  1.0;
+            if (key == 'l') vy = -1.0;
+            if (key == 'q') vz =  1.0;
+            if (key == 'a') vz = -1.0;
+            ardrone->move3D(vx, vy, vz, vr);
+
+            // Display the first camera only
+            if (i == 0) {
+                cv::Mat image = ardrone->getImage();
+                cv::imshow("camera", image);
+            }
+        }
+
+        // Throughput seen by the simulators
+        double elapsed = (cv::getTickCount() - start) / cv::getTickFrequency();
+        unsigned int commands = 0, navdata = 0, frames = 0;
+        for (size_t i = 0; i < simulators.size(); i++) {
+            commands += simulators[i]->getCommandCount();
+            navdata  += simulators[i]->getNavdataCount();
+            frames   += simulators[i]->getFrameCount();
+        }
+        std::cout << fleet.size() << " drones, altitude = " << fleet[0]->getAltitude() << " [m], ";
+        std::cout << commands / elapsed << " [AT/s], " << navdata / elapsed << " [navdata/s], " << frames / elapsed << " [frames/s]\r" << std::flush;
+    }
+
+    // See you
+    fleet.close();
+    for (size_t i = 0; i < simulators.size(); i++) delete simulators[i];
+
+    return 0;
+}
\ No newline at end of file
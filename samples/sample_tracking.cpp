@@ -71,6 +71,9 @@ int main(int argc, char *argv[])
     cv::createTrackbar("V min", "binalized", &minV, 255);
     cv::resizeWindow("binalized", 0, 0);
 
+    // Colour-blob tracker (buffers are reused for each frame)
+    ARDroneBlobTracker tracker;
+
     // Main loop
     while (1) {
         // Key input
@@ -105,48 +108,22 @@ int main(int argc, char *argv[])
         // Get an image
         cv::Mat image = ardrone.getImage();
 
-        // HSV image
-        cv::Mat hsv;
-        cv::cvtColor(image, hsv, cv::COLOR_BGR2HSV_FULL);
-
-        // Binalize
-        cv::Mat binalized;
-        cv::Scalar lower(minH, minS, minV);
-        cv::Scalar upper(maxH, maxS, maxV);
-        cv::inRange(hsv, lower, upper, binalized);
+        // Find the largest blob
+        tracker.setThresholds(minH, maxH, minS, maxS, minV, maxV);
+        ARDRONE_BLOB blob;
+        tracker.track(image, &blob);
 
         // Show result
-        cv::imshow("binalized", binalized);
-
-        // De-noising
-        cv::Mat kernel = getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
-        cv::morphologyEx(binalized, binalized, cv::MORPH_CLOSE, kernel);
-        //cv::imshow("morphologyEx", binalized);
-
-        // Detect contours
-        std::vector< std::vector<cv::Point> > contours;
-        cv::findContours(binalized.clone(), contours, cv::RETR_CCOMP, cv::CHAIN_APPROX_SIMPLE);
-
-        // Find largest contour
-        int contour_index = -1;
-        double max_area = 0.0;
-        for (size_t i = 0; i < contours.size(); i++) {
-            double area = fabs(cv::contourArea(contours[i]));
-            if (area > max_area) {
-                contour_index = i;
-                max_area = area;
-            }
-        }
+        cv::imshow("binalized", tracker.getMask());
 
         // Object detected
-        if (contour_index >= 0) {
-            // Moments
-            cv::Moments moments = cv::moments(contours[contour_index], true);
-            double marker_y = (int)(moments.m01 / moments.m00);
-            double marker_x = (int)(moments.m10 / moments.m00);
+        if (blob.found) {
+            // Center of the blob
+            double marker_y = blob.center.y;
+            double marker_x = blob.center.x;
 
             // Show result
-            cv::Rect rect = cv::boundingRect(contours[contour_index]);
+            cv::Rect rect = blob.rect;
             cv::rectangle(image, rect, cv::Scalar(0, 255, 0));
 
             // Tracking
@@ -154,8 +131,8 @@ int main(int argc, char *argv[])
                 const double kp = 0.005;
                 vx = 0.1;
                 vy = 0.0;
-                vz = kp * (binalized.rows / 2 - marker_y);
-                vr = kp * (binalized.cols / 2 - marker_x);
+                vz = kp * (image.rows / 2 - marker_y);
+                vr = kp * (image.cols / 2 - marker_x);
             }
         }
 
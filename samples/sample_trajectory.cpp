@@ -0,0 +1,78 @@
+#include "ardrone/ardrone.h"
+
+// Progress of the trajectory (called from the command thread)
+static void onProgress(int event, const ARDRONE_TRAJECTORY_PROGRESS &progress, void *arg)
+{
+    if (event & ARDRONE_TRAJECTORY_WAYPOINT)  printf("Waypoint %d / %d (%.1f [s])\n", progress.waypoint, progress.waypoints, progress.elapsed);
+    if (event & ARDRONE_TRAJECTORY_FINISHED)  printf("Finished (error = %.2f [m])\n", progress.error);
+    if (event & ARDRONE_TRAJECTORY_PREEMPTED) printf("Preempted at waypoint %d\n", progress.waypoint);
+}
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Argument values)
+// Description  : This is the entry point of the program.
+//                Flies a survey pattern with the trajectory executor.
+// Return value : SUCCESS:0  ERROR:-1
+// --------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    // AR.Drone class
+    ARDrone ardrone;
+
+    // Initialize
+    if (!ardrone.open()) {
+        std::cout << "Failed to initialize." << std::endl;
+        return -1;
+    }
+
+    // Battery
+    std::cout << "Battery = " << ardrone.getBatteryPercentage() << " [%]" << std::endl;
+
+    // State for the controller
+    ardrone.startEstimator();
+
+    // Lawnmower pattern (2m x 2m, 1m altitude, stops at the corners)
+    ARDroneTrajectory survey;
+    for (int i = 0; i < 3; i++) {
+        double y = i * 1.0;
+        double x0 = (i % 2) ? 2.0 : 0.0, x1 = (i % 2) ? 0.0 : 2.0;
+        survey.addWaypoint(x0, y, 1.0, 0.0, 0.5, 0.5);
+        survey.addWaypoint(x1, y, 1.0, 0.0, 0.5, 0.5);
+    }
+
+    // Main loop
+    while (1) {
+        // Key input
+        int key = cv::waitKey(33);
+        if (key == 0x1b) break;
+
+        // Get an image
+        cv::Mat image = ardrone.getImage();
+
+        // Take off / Landing 
+        if (key == ' ') {
+            if (ardrone.onGround()) ardrone.takeoff();
+            else                    ardrone.landing();
+        }
+
+        // Start / stop the survey
+        if (key == 's' && !ardrone.onGround()) ardrone.startTrajectory(survey, onProgress);
+        if (key == 'h') ardrone.stopTrajectory();
+
+        // Progress
+        ARDRONE_TRAJECTORY_PROGRESS progress;
+        if (ardrone.getTrajectoryProgress(&progress)) {
+            char str[64];
+            sprintf(str, "%d / %d  %.1f / %.1f [s]", progress.waypoint, progress.waypoints, progress.elapsed, progress.duration);
+            cv::putText(image, str, cv::Point(10, 20), cv::FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(0, 255, 0));
+        }
+
+        // Display the image
+        cv::imshow("camera", image);
+    }
+
+    // See you
+    ardrone.close();
+
+    return 0;
+}
\ No newline at end of file
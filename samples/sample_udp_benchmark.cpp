@@ -0,0 +1,114 @@
+#include "ardrone/ardrone.h"
+
+// Number of datagrams and their size
+#define NUM_PACKETS (100000)
+#define PACKET_SIZE (500)
+
+// Echo server running on the loopback interface
+static volatile bool quit = false;
+static void *echo(void *arg)
+{
+    UDPSocket *server = (UDPSocket*)arg;
+
+    // Buffers
+    static char buf[UDP_MAX_BATCH][2048];
+    UDP_PACKET packets[UDP_MAX_BATCH];
+
+    while (!quit) {
+        // Receive and send back
+        for (int i = 0; i < UDP_MAX_BATCH; i++) {
+            packets[i].data = buf[i];
+            packets[i].capacity = sizeof(buf[i]);
+        }
+        int n = server->receiveMany(packets, UDP_MAX_BATCH, 100);
+        if (n > 0) server->sendMany(packets, n);
+    }
+
+    return NULL;
+}
+
+// Wait until a datagram arrives (a lost one must not hang the loop)
+static bool readable(SOCKET sock, int timeout_ms)
+{
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    return select((int)sock + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Argument values)
+// Description  : This is the entry point of the program.
+//                Compares one-by-one send/receive with batched sendMany/receiveMany.
+// Return value : SUCCESS:0  ERROR:-1
+// --------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    // Client and echo server on the loopback interface
+    UDPSocket client, server;
+    if (!client.open("127.0.0.1", 50002, "127.0.0.1", 50001) || !server.open("127.0.0.1", 50001, "127.0.0.1", 50002)) {
+        std::cout << "Failed to open the sockets." << std::endl;
+        return -1;
+    }
+
+    // Start the echo server
+    pthread_t thread;
+    pthread_create(&thread, NULL, echo, &server);
+
+    // Buffers
+    static char buf[UDP_MAX_BATCH][2048];
+    UDP_PACKET packets[UDP_MAX_BATCH];
+    for (int i = 0; i < UDP_MAX_BATCH; i++) memset(buf[i], 'x', PACKET_SIZE);
+
+    // One by one
+    int received = 0;
+    int64 start = cv::getTickCount();
+    for (int i = 0; i < NUM_PACKETS; i++) {
+        client.send2(buf[0], PACKET_SIZE);
+        if (readable(client.getSocket(), 100) && client.receive(buf[1], sizeof(buf[1])) > 0) received++;
+    }
+    double elapsed = (cv::getTickCount() - start) / cv::getTickFrequency();
+    std::cout << "send2/receive        : " << elapsed << " [s], " << NUM_PACKETS / elapsed << " [packets/s], received " << received << std::endl;
+
+    // Batched
+    received = 0;
+    double latency = 0.0;
+    start = cv::getTickCount();
+    for (int i = 0; i < NUM_PACKETS; i += UDP_MAX_BATCH) {
+        // Send a batch
+        int n = MIN(UDP_MAX_BATCH, NUM_PACKETS - i);
+        for (int j = 0; j < n; j++) {
+            packets[j].data = buf[j];
+            packets[j].capacity = sizeof(buf[j]);
+            packets[j].size = PACKET_SIZE;
+        }
+        double sent = gettime();
+        client.sendMany(packets, n);
+
+        // Receive the echoes
+        int m = 0;
+        while (m < n) {
+            int k = client.receiveMany(packets + m, n - m, 100);
+            if (k < 1) break;
+            for (int j = m; j < m + k; j++) latency += packets[j].timestamp - sent;
+            m += k;
+        }
+        received += m;
+    }
+    elapsed = (cv::getTickCount() - start) / cv::getTickFrequency();
+    std::cout << "sendMany/receiveMany : " << elapsed << " [s], " << NUM_PACKETS / elapsed << " [packets/s], received " << received << std::endl;
+    if (received > 0) std::cout << "Mean round trip (kernel timestamp) : " << latency / received * 1.0e6 << " [us]" << std::endl;
+
+    // Stop the echo server
+    quit = true;
+    pthread_join(thread, NULL);
+
+    // See you
+    client.close();
+    server.close();
+
+    return 0;
+}
\ No newline at end of file
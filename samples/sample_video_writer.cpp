@@ -19,17 +19,18 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    // Image of AR.Drone's camera
-    cv::Mat image = ardrone.getImage();
-    
     // Video name
     std::time_t t = std::time(NULL);
     std::tm *local = std::localtime(&t);
     std::ostringstream stream;
-    stream << 1900 + local->tm_year << "-" << 1 + local->tm_mon << "-" << local->tm_mday << "-" << local->tm_hour << "-" << local->tm_min << "-" << local->tm_sec << ".avi";
+    stream << 1900 + local->tm_year << "-" << 1 + local->tm_mon << "-" << local->tm_mday << "-" << local->tm_hour << "-" << local->tm_min << "-" << local->tm_sec << ".mp4";
 
-    // Create a video writer
-    cv::VideoWriter writer(stream.str(), cv::VideoWriter::fourcc('D', 'I', 'B', ' '), 30, cv::Size(image.cols, image.rows));
+    // Write the H.264 stream as is (no re-encoding, timestamps from the drone)
+    if (!ardrone.startRemux(stream.str().c_str())) {
+        std::cout << "Failed to create " << stream.str() << "." << std::endl;
+        ardrone.close();
+        return -1;
+    }
 
     // Main loop
     while (1) {
@@ -38,17 +39,14 @@ int main(int argc, char *argv[])
         if (key == 0x1b) break;
 
         // Get an image
-        image = ardrone.getImage();
-
-        // Write a frame
-        writer << image;
+        cv::Mat image = ardrone.getImage();
 
         // Display the image
         imshow("camera", image);
     }
 
     // Output the video
-    writer.release();
+    ardrone.stopRemux();
 
     // See you
     ardrone.close();
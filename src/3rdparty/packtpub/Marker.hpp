@@ -17,6 +17,8 @@
 // Standard includes:
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <climits>
 #include <opencv2/opencv.hpp>
 
 ////////////////////////////////////////////////////////////////////
@@ -38,6 +40,18 @@ public:
   static int hammDistMarker(cv::Mat bits);
   static int mat2id(const cv::Mat &bits);
   static int getMarkerId(cv::Mat &in,int &nRotations);
+
+  // The inner 5x5 cells packed in 25 bits (bit y*5+x is set for a white cell)
+  typedef unsigned int Code;
+
+  static Code rotateCode(Code code);            // Same as rotate()
+  static int  popcount(Code code);
+  static int  hammDistCode(Code code);          // Same as hammDistMarker() for the default dictionary
+  static int  code2id(Code code);               // Same as mat2id()
+
+  // Use another dictionary (empty = the default one). The id is the index in the dictionary
+  // and codes within maxCorrection bits of an entry are corrected.
+  static void setDictionary(const std::vector<Code>& codes, int maxCorrection = 0);
   
 public:
   
@@ -51,6 +65,23 @@ public:
 
   // Helper function to draw the marker contour over the image
   void drawContour(cv::Mat& image, cv::Scalar color = CV_RGB(0,250,0)) const;
+
+private:
+  struct Dictionary
+  {
+    std::vector<Code> codes;   // Empty = default
+    int maxCorrection;
+  };
+  static Dictionary& dictionary();
+
+  // Lookup tables built once
+  struct Tables
+  {
+    Code rotation[5][32];      // Rotated position of each row pattern
+    int  rowDistance[32];      // Distance of a row pattern to the nearest default word
+    Tables();
+  };
+  static const Tables& tables();
 };
 
 #include "DebugHelpers.hpp"
@@ -128,6 +159,104 @@ int Marker::mat2id(const cv::Mat &bits)
   return val;
 }
 
+Marker::Tables::Tables()
+{
+  // Words of the default dictionary (one per row)
+  int ids[4][5]=
+  {
+    {1,0,0,0,0},
+    {1,0,1,1,1},
+    {0,1,0,0,1},
+    {0,1,1,1,0}
+  };
+
+  for (int v=0;v<32;v++)
+  {
+    // Cell (x,y) moves to (4-y,x) like rotate()
+    for (int y=0;y<5;y++)
+    {
+      rotation[y][v] = 0;
+      for (int x=0;x<5;x++)
+      {
+        if (v & (1 << x))
+          rotation[y][v] |= 1u << (x*5 + (4-y));
+      }
+    }
+
+    // Hamming distance to the nearest word
+    rowDistance[v] = 5;
+    for (int p=0;p<4;p++)
+    {
+      int word=0;
+      for (int x=0;x<5;x++)
+        word |= ids[p][x] << x;
+      rowDistance[v] = std::min(rowDistance[v], popcount(v ^ word));
+    }
+  }
+}
+
+const Marker::Tables& Marker::tables()
+{
+  static const Tables t;
+  return t;
+}
+
+Marker::Dictionary& Marker::dictionary()
+{
+  static Dictionary d = { std::vector<Code>(), 0 };
+  return d;
+}
+
+void Marker::setDictionary(const std::vector<Code>& codes, int maxCorrection)
+{
+  dictionary().codes = codes;
+  dictionary().maxCorrection = std::max(0, maxCorrection);
+}
+
+int Marker::popcount(Code code)
+{
+#if defined(__GNUC__)
+  return __builtin_popcount(code);
+#else
+  code = code - ((code >> 1) & 0x55555555);
+  code = (code & 0x33333333) + ((code >> 2) & 0x33333333);
+  return (((code + (code >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#endif
+}
+
+Marker::Code Marker::rotateCode(Code code)
+{
+  const Tables& t = tables();
+  return t.rotation[0][ code        & 0x1F]
+       | t.rotation[1][(code >>  5) & 0x1F]
+       | t.rotation[2][(code >> 10) & 0x1F]
+       | t.rotation[3][(code >> 15) & 0x1F]
+       | t.rotation[4][(code >> 20) & 0x1F];
+}
+
+int Marker::hammDistCode(Code code)
+{
+  const Tables& t = tables();
+  return t.rowDistance[ code        & 0x1F]
+       + t.rowDistance[(code >>  5) & 0x1F]
+       + t.rowDistance[(code >> 10) & 0x1F]
+       + t.rowDistance[(code >> 15) & 0x1F]
+       + t.rowDistance[(code >> 20) & 0x1F];
+}
+
+int Marker::code2id(Code code)
+{
+  int val=0;
+  for (int y=0;y<5;y++)
+  {
+    val<<=1;
+    if (code & (1u << (y*5 + 1))) val|=1;
+    val<<=1;
+    if (code & (1u << (y*5 + 3))) val|=1;
+  }
+  return val;
+}
+
 int Marker::getMarkerId(cv::Mat &markerImage,int &nRotations)
 {
   assert(markerImage.rows == markerImage.cols);
@@ -146,7 +275,24 @@ int Marker::getMarkerId(cv::Mat &markerImage,int &nRotations)
   //the external border should be entirely black
   
   int cellSize = markerImage.rows / 7;
-  
+  int half = (cellSize*cellSize) / 2;
+
+  // Count the white pixels of all cells in one pass
+  int counts[7][7] = {{0}};
+  for (int y=0;y<cellSize*7;y++)
+  {
+    const uchar* row = grey.ptr<uchar>(y);
+    int* count = counts[y / cellSize];
+    for (int cx=0;cx<7;cx++)
+    {
+      const uchar* cell = row + cx*cellSize;
+      int nZ = 0;
+      for (int x=0;x<cellSize;x++)
+        nZ += cell[x] != 0;
+      count[cx] += nZ;
+    }
+  }
+
   for (int y=0;y<7;y++)
   {
     int inc=6;
@@ -155,62 +301,67 @@ int Marker::getMarkerId(cv::Mat &markerImage,int &nRotations)
     
     for (int x=0;x<7;x+=inc)
     {
-      int cellX = x * cellSize;
-      int cellY = y * cellSize;
-      cv::Mat cell = grey(cv::Rect(cellX,cellY,cellSize,cellSize));
-      
-      int nZ = cv::countNonZero(cell);
-
-      if (nZ > (cellSize*cellSize) / 2)
+      if (counts[y][x] > half)
       {
         return -1;//can not be a marker because the border element is not black!
       }
     }
   }
   
-  cv::Mat bitMatrix = cv::Mat::zeros(5,5,CV_8UC1);
-  
   //get information(for each inner square, determine if it is  black or white)  
+  Code code = 0;
   for (int y=0;y<5;y++)
   {
     for (int x=0;x<5;x++)
     {
-      int cellX = (x+1)*cellSize;
-      int cellY = (y+1)*cellSize;
-      cv::Mat cell = grey(cv::Rect(cellX,cellY,cellSize,cellSize));
-      
-      int nZ = cv::countNonZero(cell);
-      if (nZ> (cellSize*cellSize) /2) 
-        bitMatrix.at<uchar>(y,x) = 1;
+      if (counts[y+1][x+1] > half)
+        code |= 1u << (y*5 + x);
     }
   }
   
   //check all possible rotations
-  cv::Mat rotations[4];
-  int distances[4];
-  
-  rotations[0] = bitMatrix;  
-  distances[0] = hammDistMarker(rotations[0]);
-  
-  std::pair<int,int> minDist(distances[0],0);
-  
-  for (int i=1; i<4; i++)
+  const Dictionary& dict = dictionary();
+  std::pair<int,int> minDist(INT_MAX,0);
+  int index = -1;
+
+  for (int i=0; i<4; i++)
   {
+    if (i > 0)
+      code = rotateCode(code);
+
     //get the hamming distance to the nearest possible word
-    rotations[i] = rotate(rotations[i-1]);
-    distances[i] = hammDistMarker(rotations[i]);
-    
-    if (distances[i] < minDist.first)
+    if (dict.codes.empty())
+    {
+      int dist = hammDistCode(code);
+      if (dist < minDist.first)
+      {
+        minDist.first  = dist;
+        minDist.second = i;
+        index = code2id(code);
+      }
+    }
+    else
     {
-      minDist.first  = distances[i];
-      minDist.second = i;
+      for (size_t j=0; j<dict.codes.size(); j++)
+      {
+        int dist = popcount(code ^ dict.codes[j]);
+        if (dist < minDist.first)
+        {
+          minDist.first  = dist;
+          minDist.second = i;
+          index = (int)j;
+        }
+      }
     }
+
+    if (minDist.first == 0)
+      break;
   }
   
   nRotations = minDist.second;
-  if (minDist.first == 0)
+  if (minDist.first <= dict.maxCorrection)
   {
-    return mat2id(rotations[minDist.second]);
+    return index;
   }
   
   return -1;
@@ -22,6 +22,7 @@
 // File includes:
 #include "BGRAVideoFrame.h"
 #include "CameraCalibration.hpp"
+#include "../../ardrone/matrix.h"
 
 ////////////////////////////////////////////////////////////////////
 // Forward declaration:
@@ -45,6 +46,14 @@ public:
   
   //! Searches for markes and fills the list of transformation for found markers
   void processFrame(const BGRAVideoFrame& frame);
+
+  //! Same as above for a grayscale image (e.g. the Y plane of the decoder).
+  //! Candidates are searched in the image decimated by 'decimation' and refined in full resolution.
+  void processFrame(const cv::Mat& grayscale, int decimation = 1);
+
+  //! Runs the full detection only every 'frames' frames of processFrame(grayscale).
+  //! In between, the corners of the last markers are tracked by the optical flow.
+  void setDetectionInterval(int frames);
   
   const std::vector<Transformation>& getTransformations() const;
   
@@ -53,6 +62,9 @@ protected:
   //! Main marker detection routine
   bool findMarkers(const BGRAVideoFrame& frame, std::vector<Marker>& detectedMarkers);
 
+  //! Marker detection routine for a grayscale image
+  bool findMarkers(const cv::Mat& grayscale, std::vector<Marker>& detectedMarkers, int decimation);
+
   //! Converts image to grayscale
   void prepareImage(const cv::Mat& bgraMat, cv::Mat& grayscale) const;
 
@@ -71,6 +83,12 @@ protected:
   //! Calculates marker poses in 3D
   void estimatePosition(std::vector<Marker>& detectedMarkers);
 
+  //! Closed-form pose of a square marker from its plane (initial guess of solvePnP)
+  bool estimateSquarePose(const std::vector<cv::Point2f>& points, cv::Mat& rvec, cv::Mat& tvec);
+
+  //! Moves the corners of the markers into a new frame
+  bool trackMarkers(const cv::Mat& grayscale, std::vector<Marker>& markers);
+
 private:
   float m_minContourLengthAllowed;
   
@@ -80,10 +98,32 @@ private:
   std::vector<Transformation> m_transformations;
   
   cv::Mat m_grayscaleImage;
+  cv::Mat m_decimatedImage;
   cv::Mat m_thresholdImg;  
   cv::Mat canonicalMarkerImage;
 
+  // Buffers reused across frames
+  ContoursVector           m_allContours;
   ContoursVector           m_contours;
+  PointsVector             m_approxCurve;
+  std::vector<Marker>      m_markers;
+
+  // Poses of the last frame (seeds of solvePnP)
+  struct TrackedPose
+  {
+    int id;
+    cv::Mat rvec;
+    cv::Mat tvec;
+  };
+  std::vector<TrackedPose> m_poses;
+
+  // Corner tracking between the detections
+  int m_detectionInterval;
+  int m_frameCount;
+  cv::Mat m_prevGrayscale;
+  std::vector<cv::Point2f> m_prevCorners, m_nextCorners, m_backCorners, m_normalizedCorners;
+  std::vector<uchar> m_status, m_backStatus;
+  std::vector<float> m_errors;
   std::vector<cv::Point3f> m_markerCorners3d;
   std::vector<cv::Point2f> m_markerCorners2d;
 };
@@ -104,6 +144,8 @@ private:
 MarkerDetector::MarkerDetector(CameraCalibration calibration)
     : m_minContourLengthAllowed(100)
     , markerSize(100,100)
+    , m_detectionInterval(1)
+    , m_frameCount(0)
 {
     cv::Mat(3,3, CV_32F, const_cast<float*>(&calibration.getIntrinsic().data[0])).copyTo(camMatrix);
     cv::Mat(4,1, CV_32F, const_cast<float*>(&calibration.getDistorsion().data[0])).copyTo(distCoeff);
@@ -142,6 +184,71 @@ void MarkerDetector::processFrame(const BGRAVideoFrame& frame)
     }
 }
 
+void MarkerDetector::processFrame(const cv::Mat& grayscale, int decimation)
+{
+    // Track the last markers and detect them again every N frames (or when lost)
+    bool tracked = false;
+    if (m_detectionInterval > 1 && (m_frameCount % m_detectionInterval) != 0)
+    {
+        tracked = trackMarkers(grayscale, m_markers);
+    }
+
+    if (tracked)
+        estimatePosition(m_markers);
+    else
+        findMarkers(grayscale, m_markers, decimation);
+
+    grayscale.copyTo(m_prevGrayscale);
+    m_frameCount = tracked ? m_frameCount + 1 : 1;
+
+    m_transformations.clear();
+    for (size_t i=0; i<m_markers.size(); i++)
+    {
+        m_transformations.push_back(m_markers[i].transformation);
+    }
+}
+
+void MarkerDetector::setDetectionInterval(int frames)
+{
+    m_detectionInterval = std::max(1, frames);
+    m_frameCount = 0;
+}
+
+bool MarkerDetector::trackMarkers(const cv::Mat& grayscale, std::vector<Marker>& markers)
+{
+    if (markers.empty() || m_prevGrayscale.size() != grayscale.size())
+        return false;
+
+    m_prevCorners.clear();
+    for (size_t i=0; i<markers.size(); i++)
+    {
+        m_prevCorners.insert(m_prevCorners.end(), markers[i].points.begin(), markers[i].points.end());
+    }
+
+    // Forward and backward flow (a corner has to come back to where it was)
+    cv::Size winSize(11, 11);
+    cv::calcOpticalFlowPyrLK(m_prevGrayscale, grayscale, m_prevCorners, m_nextCorners, m_status, m_errors, winSize, 2);
+    cv::calcOpticalFlowPyrLK(grayscale, m_prevGrayscale, m_nextCorners, m_backCorners, m_backStatus, m_errors, winSize, 2);
+
+    for (size_t i=0; i<m_prevCorners.size(); i++)
+    {
+        cv::Point2f d = m_backCorners[i] - m_prevCorners[i];
+        if (!m_status[i] || !m_backStatus[i] || d.dot(d) > 1.0f)
+            return false;
+    }
+
+    // All corners followed
+    for (size_t i=0; i<markers.size(); i++)
+    {
+        for (int c=0; c<4; c++)
+        {
+            markers[i].points[c] = m_nextCorners[i*4 + c];
+        }
+    }
+
+    return true;
+}
+
 const std::vector<Transformation>& MarkerDetector::getTransformations() const
 {
     return m_transformations;
@@ -175,6 +282,61 @@ bool MarkerDetector::findMarkers(const BGRAVideoFrame& frame, std::vector<Marker
     return false;
 }
 
+bool MarkerDetector::findMarkers(const cv::Mat& grayscale, std::vector<Marker>& detectedMarkers, int decimation)
+{
+    assert(grayscale.type() == CV_8UC1);
+
+    // Search the candidates in a decimated image
+    const cv::Mat* searchImage = &grayscale;
+    if (decimation > 1)
+    {
+        cv::resize(grayscale, m_decimatedImage, cv::Size(grayscale.cols / decimation, grayscale.rows / decimation), 0, 0, cv::INTER_NEAREST);
+        searchImage = &m_decimatedImage;
+    }
+    else
+    {
+        decimation = 1;
+    }
+
+    // Make it binary (the local mean follows the lighting)
+    cv::adaptiveThreshold(*searchImage, m_thresholdImg, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY_INV, 7, 7);
+
+    // Detect contours (only their vertices are stored)
+    cv::findContours(m_thresholdImg, m_allContours, CV_RETR_LIST, CV_CHAIN_APPROX_SIMPLE);
+
+    m_contours.clear();
+    double minContourLengthAllowed = searchImage->cols / 5;
+    for (size_t i=0; i<m_allContours.size(); i++)
+    {
+        if (cv::arcLength(m_allContours[i], true) > minContourLengthAllowed)
+        {
+            m_contours.push_back(m_allContours[i]);
+        }
+    }
+
+    // Find closed contours that can be approximated with 4 points
+    findCandidates(m_contours, detectedMarkers);
+
+    // Back to the full resolution (the corners are refined there)
+    for (size_t i=0; i<detectedMarkers.size(); i++)
+    {
+        for (int c=0; c<4; c++)
+        {
+            detectedMarkers[i].points[c] *= (float)decimation;
+        }
+    }
+
+    // Find is them are markers
+    recognizeMarkers(grayscale, detectedMarkers);
+
+    // Calculate their poses
+    estimatePosition(detectedMarkers);
+
+    //sort by id
+    std::sort(detectedMarkers.begin(), detectedMarkers.end());
+    return !detectedMarkers.empty();
+}
+
 void MarkerDetector::prepareImage(const cv::Mat& bgraMat, cv::Mat& grayscale) const
 {
     // Convert to grayscale
@@ -232,14 +394,14 @@ void MarkerDetector::findCandidates
     std::vector<Marker>& detectedMarkers
 ) 
 {
-    std::vector<cv::Point>  approxCurve;
+    std::vector<cv::Point>& approxCurve = m_approxCurve;
     std::vector<Marker>     possibleMarkers;
 
     // For each contour, analyze if it is a parallelepiped likely to be the marker
     for (size_t i=0; i<contours.size(); i++)
     {
-        // Approximate to a polygon
-        double eps = contours[i].size() * 0.05;
+        // Approximate to a polygon (by the perimeter since contours may hold only their vertices)
+        double eps = cv::arcLength(contours[i], true) * 0.05;
         cv::approxPolyDP(contours[i], approxCurve, eps, true);
 
         // We interested only in polygons that contains only four points
@@ -428,33 +590,97 @@ void MarkerDetector::recognizeMarkers(const cv::Mat& grayscale, std::vector<Mark
 
 void MarkerDetector::estimatePosition(std::vector<Marker>& detectedMarkers)
 {
+    std::vector<TrackedPose> poses;
+
     for (size_t i=0; i<detectedMarkers.size(); i++)
     {					
         Marker& m = detectedMarkers[i];
 
-        cv::Mat Rvec;
-        cv::Mat_<float> Tvec;
+        // Start from the pose in the last frame, or from the plane of the square
         cv::Mat raux,taux;
-        cv::solvePnP(m_markerCorners3d, m.points, camMatrix, distCoeff,raux,taux);
-        raux.convertTo(Rvec,CV_32F);
-        taux.convertTo(Tvec ,CV_32F);
+        bool guess = false;
+        for (size_t j=0; j<m_poses.size() && !guess; j++)
+        {
+            if (m_poses[j].id == m.id)
+            {
+                m_poses[j].rvec.copyTo(raux);
+                m_poses[j].tvec.copyTo(taux);
+                guess = true;
+            }
+        }
+        if (!guess)
+            guess = estimateSquarePose(m.points, raux, taux);
+
+        cv::solvePnP(m_markerCorners3d, m.points, camMatrix, distCoeff,raux,taux,guess,cv::SOLVEPNP_ITERATIVE);
+
+        TrackedPose pose;
+        pose.id = m.id;
+        pose.rvec = raux;
+        pose.tvec = taux;
+        poses.push_back(pose);
 
-        cv::Mat_<float> rotMat(3,3); 
-        cv::Rodrigues(Rvec, rotMat);
+        // Rotation on the stack instead of cv::Rodrigues into a cv::Mat_<float>
+        const double* r = raux.ptr<double>();
+        const double* t = taux.ptr<double>();
+        ARMath::Mat33 rotMat = ARMath::fromRotationVector(ARMath::vec3((float)r[0], (float)r[1], (float)r[2]));
 
         // Copy to transformation matrix
         for (int col=0; col<3; col++)
         {
             for (int row=0; row<3; row++)
             {        
-                m.transformation.r().mat[row][col] = rotMat(row,col); // Copy rotation component
+                m.transformation.r().mat[row][col] = rotMat.m[row][col]; // Copy rotation component
             }
-            m.transformation.t().data[col] = Tvec(col); // Copy translation component
+            m.transformation.t().data[col] = (float)t[col]; // Copy translation component
         }
 
         // Since solvePnP finds camera location, w.r.t to marker pose, to get marker pose w.r.t to the camera we invert it.
         m.transformation = m.transformation.getInverted();
     }
+
+    m_poses.swap(poses);
+}
+
+bool MarkerDetector::estimateSquarePose(const std::vector<cv::Point2f>& points, cv::Mat& rvec, cv::Mat& tvec)
+{
+    // Normalized image coordinates
+    cv::undistortPoints(points, m_normalizedCorners, camMatrix, distCoeff);
+
+    // Homography from the marker plane (z = 0)
+    cv::Point2f src[4], dst[4];
+    for (int c=0; c<4; c++)
+    {
+        src[c] = cv::Point2f(m_markerCorners3d[c].x, m_markerCorners3d[c].y);
+        dst[c] = m_normalizedCorners[c];
+    }
+    cv::Mat H = cv::getPerspectiveTransform(src, dst);
+
+    // H = lambda * [r1 r2 t]
+    const double* h = H.ptr<double>();
+    ARMath::Vec3 h1 = ARMath::vec3((float)h[0], (float)h[3], (float)h[6]);
+    ARMath::Vec3 h2 = ARMath::vec3((float)h[1], (float)h[4], (float)h[7]);
+    float n1 = ARMath::norm(h1), n2 = ARMath::norm(h2);
+    if (n1 < 1e-9f || n2 < 1e-9f)
+        return false;
+
+    // The marker is in front of the camera
+    double lambda = 2.0 / (n1 + n2);
+    if (h[8] < 0)
+        lambda = -lambda;
+
+    // Closest rotation matrix (r1 and r2 symmetric about their bisector)
+    ARMath::Vec3 a = ARMath::normalize(h1 * (float)lambda);
+    ARMath::Vec3 b = ARMath::normalize(h2 * (float)lambda);
+    ARMath::Vec3 r3 = ARMath::normalize(ARMath::cross(a, b));
+    ARMath::Vec3 c = ARMath::normalize(a + b);
+    ARMath::Vec3 d = ARMath::normalize(ARMath::cross(r3, c));
+    ARMath::Vec3 r1 = (c - d) * 0.70710678f;
+    ARMath::Vec3 r2 = (c + d) * 0.70710678f;
+    ARMath::Vec3 r = ARMath::toRotationVector(ARMath::quatFromMat33(ARMath::fromColumns(r1, r2, r3)));
+
+    rvec = (cv::Mat_<double>(3,1) << r.x, r.y, r.z);
+    tvec = (cv::Mat_<double>(3,1) << h[2] * lambda, h[5] * lambda, h[8] * lambda);
+    return true;
 }
 
 #endif
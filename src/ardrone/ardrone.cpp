@@ -37,6 +37,10 @@ ARDrone::ARDrone(const char *ardrone_addr)
     // IP Address
     strncpy(ip, ARDRONE_DEFAULT_ADDR, 16);
 
+    // Local IP address and network device (not bound)
+    memset(localIp, 0, sizeof(localIp));
+    memset(netDevice, 0, sizeof(netDevice));
+
     // Sequence number
     seq = 0;
 
@@ -48,17 +52,55 @@ ARDrone::ARDrone(const char *ardrone_addr)
 
     // Navdata
     memset(&navdata, 0, sizeof(navdata));
+    navdataTime = 0.0;
 
     // Configurations
     memset(&config, 0, sizeof(config));
 
     // Video
-    pFormatCtx  = NULL;
     pCodecCtx   = NULL;
     pFrame      = NULL;
     pFrameBGR   = NULL;
     bufferBGR   = NULL;
     pConvertCtx = NULL;
+    newImage    = false;
+    streamOffset = 0;
+    memset(&frameInfo, 0, sizeof(frameInfo));
+
+    // Not managed by ARDroneFleet
+    managed = false;
+
+    // Session recording / replay
+    recorder    = NULL;
+    replayLog   = NULL;
+    replaySpeed = 1.0;
+    replayEnd   = false;
+
+    // Passthrough video recording
+    remuxer = NULL;
+
+    // Local video relay
+    relay = NULL;
+
+    // Shared decoded frames
+    frameRing = NULL;
+    undistorter = NULL;
+
+    // Dead-reckoning
+    odometry = NULL;
+
+    // State estimator
+    estimator = NULL;
+
+    // Closed-loop controller
+    controller = NULL;
+    controlSource = 0;
+    schedChanged = false;
+
+    // Trajectory
+    trajectory = NULL;
+    trajectoryCallback = NULL;
+    trajectoryArg = NULL;
 
     // Thread for AT command
     threadCommand = NULL;
@@ -72,6 +114,9 @@ ARDrone::ARDrone(const char *ardrone_addr)
     threadVideo = NULL;
     mutexVideo  = NULL;
 
+    // Thread for replay
+    threadReplay = NULL;
+
     // Open if the IP address was specified
     if (ardrone_addr != NULL) {
         open(ardrone_addr);
@@ -91,11 +136,15 @@ ARDrone::~ARDrone()
 // --------------------------------------------------------------------------
 //! @brief   Initialize the AR.Drone.
 //! @param   ardrone_addr IP address of AR.Drone
+//! @param   local_addr Local IP address to be bound (NULL for any)
+//! @param   device Network device to be bound, e.g. "wlan1" (NULL for any, Linux only)
 //! @return  Result of initialization
 //! @retval  1 Success
 //! @retval  0 Failure
+//! @note    Bind each drone to its own network device when several drones
+//!          share the same IP address (192.168.1.1) on different interfaces.
 // --------------------------------------------------------------------------
-int ARDrone::open(const char *ardrone_addr)
+int ARDrone::open(const char *ardrone_addr, const char *local_addr, const char *device)
 {
     // Initialize FFmpeg
     av_register_all();
@@ -105,6 +154,10 @@ int ARDrone::open(const char *ardrone_addr)
     // Save IP address
     strncpy(ip, ardrone_addr, 16);
 
+    // Save local IP address and network device
+    strncpy(localIp, local_addr ? local_addr : "", 15);
+    strncpy(netDevice, device ? device : "", 15);
+
     // Get version information
     if (!getVersionInfo()) return 0;
     std::cout << "AR.Drone Ver. " << version.major << "." << version.minor << "." << version.revision << "." << std::endl;
@@ -154,12 +207,27 @@ int ARDrone::update(void)
 // --------------------------------------------------------------------------
 void ARDrone::close(void)
 {
+    // Stop the controller
+    stopController();
+
     // Stop AR.Drone
     if (!onGround()) landing();
 
     // Stop LED animation
     setLED(ARDRONE_LED_ANIM_STANDARD);
 
+    // Stop recording
+    stopRecord();
+    stopRemux();
+    stopRelay();
+    stopFrameRing();
+    stopUndistort();
+    stopOdometry();
+    stopEstimator();
+
+    // Finalize replay
+    finalizeReplay();
+
     // Finalize video
     finalizeVideo();
 
@@ -50,6 +50,12 @@
 #include <stdarg.h>
 #include <math.h>
 
+// C++ STL
+#include <map>
+#include <string>
+#include <vector>
+#include <deque>
+
 // OpenCV 1.0
 //#include <opencv/cv.h>
 //#include <opencv/highgui.h>
@@ -67,12 +73,18 @@ extern "C" {
 // POSIX threads
 #include <pthread.h>
 
+// Fixed-size vectors, matrices and quaternions
+#include "matrix.h"
+
 // Win32 <-> GCC
 #ifdef _WIN32
 #include <windows.h>
 #include <winsock.h>
 #define socklen_t int
 #define msleep(ms) Sleep((DWORD)ms)
+#if defined(_MSC_VER) && (_MSC_VER < 1900)
+#define snprintf _snprintf
+#endif
 #else
 #include <errno.h>
 #include <fcntl.h>
@@ -81,6 +93,9 @@ extern "C" {
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 typedef int SOCKET;
 #define INVALID_SOCKET (-1)
 #define SOCKET_ERROR   (-1)
@@ -89,6 +104,20 @@ inline void msleep(unsigned long ms) {
 }
 #endif
 
+// Current time [s] (same clock as kernel receive timestamps)
+inline double gettime(void) {
+    #ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    unsigned long long t = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (t - 116444736000000000ULL) * 1.0e-7;
+    #else
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+    #endif
+}
+
 // Macro definitions
 #define ARDRONE_VERSION_1           (1)             // AR.Drone 1.0
 #define ARDRONE_VERSION_2           (2)             // AR.Drone 2.0
@@ -290,15 +319,87 @@ enum ARDRONE_LED_ANIMATION_ID {
     ARDRONE_NB_LED_ANIM_MAYDAY                    = 21
 };
 
+// Maximum number of packets of batched UDP I/O
+#define UDP_MAX_BATCH (32)
+
+// UDP packet for batched I/O
+struct UDP_PACKET {
+    void   *data;                           // Buffer
+    size_t capacity;                        // Size of the buffer
+    int    size;                            // Size of received data (or data to be sent)
+    double timestamp;                       // Received time [s] (kernel timestamp if available)
+};
+
+// Types of session log records
+enum ARDRONE_LOG_TYPE {
+    ARDRONE_LOG_VERSION = 1,                // version.txt
+    ARDRONE_LOG_CONFIG  = 2,                // Configuration dump
+    ARDRONE_LOG_NAVDATA = 3,                // Received Navdata datagram
+    ARDRONE_LOG_COMMAND = 4,                // Sent AT command datagram
+    ARDRONE_LOG_VIDEO   = 5                 // Received video (PaVE header + H.264 frame, or UVLC picture)
+};
+
+// Session log records
+#pragma pack(push, 1)
+struct ARDRONE_LOG_RECORD {
+    double   timestamp;                     // Host time [s]
+    uint32_t type;                          // ARDRONE_LOG_TYPE
+    uint32_t size;                          // Size of the following data (padded to 8 bytes in the file)
+};
+struct ARDRONE_LOG_INDEX {
+    double   timestamp;                     // Host time [s]
+    uint64_t offset;                        // Offset of the data in the file
+    uint32_t type;                          // ARDRONE_LOG_TYPE
+    uint32_t size;                          // Size of the data
+};
+#pragma pack(pop)
+
+// Session recorder (appends records, writes the index on close)
+class ARDroneRecorder {
+public:
+    ARDroneRecorder();                      // Constructor
+    virtual ~ARDroneRecorder();             // Destructor
+    int  open(const char *filename);        // Create a log file
+    int  write(int type, const void *data, size_t size, const void *data2 = NULL, size_t size2 = 0, double timestamp = 0.0); // Append a record (data + data2)
+    void close(void);                       // Write the index and close
+private:
+    FILE *file;                             // Log file
+    uint64_t offset;                        // Current size of the file
+    std::vector<ARDRONE_LOG_INDEX> index;   // Index
+    pthread_mutex_t *mutexRecord;           // Mutex
+};
+
+// Session log reader (memory-mapped)
+class ARDroneLog {
+public:
+    ARDroneLog();                           // Constructor
+    virtual ~ARDroneLog();                  // Destructor
+    int  open(const char *filename);        // Map a log file
+    size_t size(void);                      // Number of records
+    const ARDRONE_LOG_INDEX& operator [] (size_t i); // Record
+    const uint8_t* data(size_t i);          // Data of a record
+    size_t find(double timestamp);          // First record at or after the time
+    void close(void);                       // Unmap
+private:
+    uint8_t *map;                           // Mapped file
+    size_t length;                          // Size of the file
+    std::vector<ARDRONE_LOG_INDEX> index;   // Index
+    #ifdef _WIN32
+    HANDLE hFile, hMap;                     // Handles
+    #endif
+};
+
 // TCP Class
 class TCPSocket {
 public:
     TCPSocket();                            // Constructor
     virtual ~TCPSocket();                   // Destructor
-    int  open(const char *addr, int port);  // Initialize
+    int  open(const char *addr, int port, const char *local_addr = NULL, int local_port = 0, const char *device = NULL); // Initialize
     int  send2(void *data, size_t size);    // Send data
     int  sendf(const char *str, ...);       // Send with format
     int  receive(void *data, size_t size);  // Receive data
+    int  receiveAny(void *data, size_t size); // Receive available data
+    SOCKET getSocket(void);                 // Socket descriptor
     void close(void);                       // Finalize
 private:
     SOCKET sock;                            // Socket
@@ -310,14 +411,20 @@ class UDPSocket {
 public:
     UDPSocket();                            // Constructor
     virtual ~UDPSocket();                   // Destructor
-    int  open(const char *addr, int port);  // Initialize
+    int  open(const char *addr, int port, const char *local_addr = NULL, int local_port = 0, const char *device = NULL); // Initialize
     int  send2(void *data, size_t size);    // Send data
     int  sendf(const char *str, ...);       // Send with format
     int  receive(void *data, size_t size);  // Receive data
+    int  sendMany(UDP_PACKET *packets, int count);                      // Send packets at once
+    int  receiveMany(UDP_PACKET *packets, int count, int timeout = -1); // Receive packets at once
+    SOCKET getSocket(void);                 // Socket descriptor
+    void setRecorder(ARDroneRecorder *recorder, int type); // Record sent data
     void close(void);                       // Finalize
 private:
     SOCKET sock;                            // Socket
     sockaddr_in server_addr, client_addr;   // Server/Client IP adrress
+    ARDroneRecorder *recorder;              // Recorder of sent data
+    int recordType;                         // Type of records
 };
 
 // Navdata
@@ -1009,6 +1116,445 @@ struct ARDRONE_CONFIG {
     } rescue;
 };
 
+// PaVE (Parrot Video Encapsulation) header
+#pragma pack(push, 1)
+struct ARDRONE_PAVE {
+    uint8_t  signature[4];              // "PaVE"
+    uint8_t  version;                   // Version code
+    uint8_t  video_codec;               // Codec of the following frame
+    uint16_t header_size;               // Size of the header
+    uint32_t payload_size;              // Size of the following frame
+    uint16_t encoded_stream_width;      // Width of the encoded stream
+    uint16_t encoded_stream_height;     // Height of the encoded stream
+    uint16_t display_width;             // Width of the decoded stream
+    uint16_t display_height;            // Height of the decoded stream
+    uint32_t frame_number;              // Frame position inside the current stream
+    uint32_t timestamp;                 // Timestamp [ms]
+    uint8_t  total_chuncks;             // Number of UDP packets containing the current decodable payload
+    uint8_t  chunck_index;              // Position of the packet
+    uint8_t  frame_type;                // I-frame, P-frame
+    uint8_t  control;                   // Special commands like end-of-stream or advertised frames
+    uint32_t stream_byte_position_lw;   // Byte position of the current payload in the encoded stream (lower 32-bit)
+    uint32_t stream_byte_position_uw;   // Byte position of the current payload in the encoded stream (upper 32-bit)
+    uint16_t stream_id;                 // Stream ID
+    uint8_t  total_slices;              // Number of slices composing the current frame
+    uint8_t  slice_index;               // Position of the current slice in the frame
+    uint8_t  header1_size;              // H.264 only : size of SPS inside payload
+    uint8_t  header2_size;              // H.264 only : size of PPS inside payload
+    uint8_t  reserved2[2];              // Padding to align on 48 bytes
+    uint32_t advertised_size;           // Size of frames announced as advertised frames
+    uint8_t  reserved3[12];             // Padding to align on 64 bytes
+};
+#pragma pack(pop)
+
+// PaVE frame types
+enum ARDRONE_PAVE_FRAME_TYPE {
+    ARDRONE_PAVE_FRAME_UNKNOWN = 0,
+    ARDRONE_PAVE_FRAME_IDR     = 1,
+    ARDRONE_PAVE_FRAME_I       = 2,
+    ARDRONE_PAVE_FRAME_P       = 3,
+    ARDRONE_PAVE_FRAME_HEADERS = 4
+};
+
+// Video packet (a PaVE frame of AR.Drone 2.0 or a UVLC picture of AR.Drone 1.0)
+struct ARDRONE_VIDEO_PACKET {
+    ARDRONE_PAVE         header;        // PaVE header (only payload_size is valid for AR.Drone 1.0)
+    std::vector<uint8_t> data;          // Payload
+    double               timestamp;     // Received time [s]
+};
+
+// How the capture time of a frame was found
+enum ARDRONE_SYNC_TYPE {
+    ARDRONE_SYNC_NONE         = 0,      // No Navdata yet
+    ARDRONE_SYNC_FRAME_NUMBER = 1,      // Navdata video_stream.frame_number reached the PaVE frame number
+    ARDRONE_SYNC_DRONE_TIME   = 2,      // PaVE timestamp located on the Navdata time option
+    ARDRONE_SYNC_RECEIVED     = 3       // Received time of the frame
+};
+
+// Navigation state at the capture of a frame
+struct ARDRONE_FRAME_INFO {
+    double   timestamp;                 // Capture time [s] (same clock as getNavdataTime())
+    uint32_t frame_number;              // PaVE frame number (only for AR.Drone 2.0)
+    uint32_t pave_timestamp;            // PaVE timestamp [ms] (only for AR.Drone 2.0)
+    int      sync;                      // How the capture time was found (ARDRONE_SYNC_TYPE)
+    double   roll, pitch, yaw;          // Attitude [rad] (same as getRoll(), getPitch() and getYaw())
+    double   altitude;                  // Altitude [m]
+    double   vx, vy, vz;                // Velocity [m/s] (same as getVelocity())
+};
+
+// H.264 remuxer (writes PaVE frames into MP4/MKV without re-encoding)
+class ARDroneRemuxer {
+public:
+    ARDroneRemuxer();                       // Constructor
+    virtual ~ARDroneRemuxer();              // Destructor
+    int  open(const char *filename, int max_queue = 256); // Start writing (the container is chosen by the extension)
+    int  push(const ARDRONE_VIDEO_PACKET &packet);          // Queue a frame (copied)
+    int  getDropCount(void);                // Number of dropped frames
+    void close(void);                       // Flush and write the trailer
+private:
+    std::string filename;                   // Output file
+    AVFormatContext *pFormatCtx;            // Muxer
+    AVStream *pStream;                      // Video stream
+    uint32_t firstTimestamp;                // PaVE timestamp of the first frame [ms]
+    int64_t lastDts;                        // Last written DTS
+    bool headerWritten;                     // avformat_write_header() succeeded
+    bool failed;                            // The stream could not be created (nothing is written)
+    std::deque<ARDRONE_VIDEO_PACKET> queue; // Frames to be written
+    int maxQueue;                           // Maximum number of queued frames
+    int drops;                              // Number of dropped frames
+    bool waitKeyFrame;                      // Frames were dropped
+    bool quit;                              // Stop request
+    pthread_t *threadWrite;                 // Thread
+    pthread_mutex_t *mutexWrite;            // Mutex
+    pthread_cond_t *condWrite;              // Condition
+    int  initStream(const ARDRONE_VIDEO_PACKET &packet);
+    int  writePacket(const ARDRONE_VIDEO_PACKET &packet);
+    void loopWrite(void);
+    static void *runWrite(void *args) {
+        reinterpret_cast<ARDroneRemuxer*>(args)->loopWrite();
+        return NULL;
+    }
+};
+
+// Local video relay (re-streams the H.264 frames to many local consumers over TCP)
+class ARDroneRelay {
+public:
+    ARDroneRelay();                         // Constructor
+    virtual ~ARDroneRelay();                // Destructor
+    int  open(const char *addr = "127.0.0.1", int port = ARDRONE_VIDEO_PORT, bool pave = true); // Start serving (pave = false sends Annex-B H.264)
+    int  push(const ARDRONE_VIDEO_PACKET &packet); // Send a frame to all consumers
+    int  getClientCount(void);              // Number of consumers
+    void close(void);                       // Stop serving
+private:
+    struct CLIENT {
+        SOCKET sock;                        // Socket
+        std::vector<uint8_t> output;        // Not sent yet
+        bool waitKeyFrame;                  // Frames were dropped (or just connected)
+    };
+    SOCKET sockServer;                      // Listener
+    std::vector<CLIENT> clients;            // Consumers
+    bool pave;                              // Send PaVE headers
+    bool quit;                              // Stop request
+    pthread_t *threadRelay;                 // Thread
+    pthread_mutex_t *mutexRelay;            // Mutex
+    void flush(CLIENT *client);
+    void loopRelay(void);
+    static void *runRelay(void *args) {
+        reinterpret_cast<ARDroneRelay*>(args)->loopRelay();
+        return NULL;
+    }
+};
+
+// Metadata of a shared frame
+struct ARDRONE_FRAME_META {
+    uint64_t seq;                       // Sequence number of the frame (1, 2, ...)
+    double   timestamp;                 // Time when decoded [s]
+    uint32_t pave_timestamp;            // PaVE timestamp [ms] (only for AR.Drone 2.0)
+    uint32_t frame_number;              // PaVE frame number (only for AR.Drone 2.0)
+    uint32_t navdata_sequence;          // Sequence number of the latest Navdata
+    int32_t  channel;                   // Camera channel
+    int32_t  width;                     // Width of the image [px]
+    int32_t  height;                    // Height of the image [px]
+    int32_t  step;                      // Bytes per row (BGR)
+    int32_t  reserved;                  // Padding to align on 8 bytes
+};
+
+// Shared-memory ring of decoded frames (one writer process, any number of readers)
+class ARDroneFrameRing {
+public:
+    ARDroneFrameRing();                     // Constructor
+    virtual ~ARDroneFrameRing();            // Destructor
+    int  create(const char *name, int slots = 4, int width = 640, int height = 360); // Create a ring (writer)
+    int  open(const char *name);            // Map an existing ring (reader)
+    int  write(const uint8_t *bgr, const ARDRONE_FRAME_META &meta); // Publish a frame (writer)
+    int  read(cv::Mat *image, ARDRONE_FRAME_META *meta, uint64_t after = 0); // Map the latest frame newer than "after" (reader)
+    bool isValid(const ARDRONE_FRAME_META &meta); // The mapped frame has not been overwritten
+    void close(void);                       // Unmap (the writer removes the ring)
+private:
+    std::string name;                       // Name of the shared memory
+    uint8_t *map;                           // Mapped memory
+    size_t length;                          // Size of the mapping
+    bool writer;                            // Created by this process
+    uint64_t seq;                           // Sequence number of the last written frame
+    #ifdef _WIN32
+    HANDLE hMap;                            // Handle
+    #endif
+    uint8_t* slot(uint64_t seq);            // Slot of a frame
+};
+
+// Lens undistortion with precomputed fixed-point maps (one calibration per camera channel)
+class ARDroneUndistorter {
+public:
+    ARDroneUndistorter();                   // Constructor
+    virtual ~ARDroneUndistorter();          // Destructor
+    int  load(const char *filename = "camera.xml", int channel = 0); // "intrinsic" and "distortion" (see sample_camera_calibration)
+    int  setCalibration(int channel, const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs);
+    bool hasCalibration(int channel);       // Calibrated channel
+    int  remap(const cv::Mat &src, cv::Mat &dst, int channel = 0); // Rectify an image (src and dst must differ)
+    int  undistortPoints(const std::vector<cv::Point2f> &src, std::vector<cv::Point2f> *dst, int channel = 0); // Raw -> rectified pixels
+    cv::Mat getCameraMatrix(int channel = 0); // Camera matrix of the rectified image
+private:
+    struct CHANNEL {
+        cv::Mat cameraMatrix, distCoeffs;   // Calibration
+        cv::Size size;                      // Size of the maps
+        cv::Mat map1, map2;                 // CV_16SC2 / CV_16UC1
+    };
+    std::map<int, CHANNEL> channels;        // Video channel -> calibration
+};
+
+// Pose from the dead-reckoning
+struct ARDRONE_POSE {
+    double   time;                      // Received time of the latest Navdata [s]
+    double   x, y, z;                   // Position [m] (z = altitude)
+    double   vx, vy, vz;                // Velocity in the world frame [m/s]
+    double   roll, pitch, yaw;          // Attitude [rad]
+    double   distance;                  // Travelled distance [m]
+    uint64_t samples;                   // Number of integrated Navdata
+};
+
+// Dead-reckoning at the Navdata rate (one writer, lock-free readers)
+class ARDroneOdometry {
+public:
+    ARDroneOdometry();                      // Constructor
+    virtual ~ARDroneOdometry();             // Destructor
+    void reset(double x = 0.0, double y = 0.0); // Restart from a position (call from the writer)
+    void update(double time, double drone_time, double roll, double pitch, double yaw, double altitude, double vx, double vy, double vz, bool has_vz = true); // Integrate a Navdata
+    int  getPose(ARDRONE_POSE *pose);       // Latest pose (any thread)
+private:
+    ARDRONE_POSE current;                   // Pose of the writer
+    double lastDroneTime;                   // Time option of the last Navdata [s]
+    ARMath::Vec3 lastVelocity;              // World velocity of the last Navdata [m/s]
+    volatile uint32_t seq;                  // Odd while the published pose is written
+    ARDRONE_POSE published;                 // Pose for the readers
+    void publish(void);
+};
+
+// Extended Kalman filter with N states (fixed size, no heap allocation)
+template <int N>
+class ARDroneEKF {
+public:
+    typedef ARMath::Matrix<N, 1> State;
+    typedef ARMath::Matrix<N, N> Covariance;
+    State x;                                // State
+    Covariance P;                           // Covariance of the state
+
+    // Set the state and its covariance
+    void init(const State &x0, const Covariance &P0) {
+        x = x0;
+        P = P0;
+    }
+
+    // Propagate with the predicted state and the Jacobian F of the motion model
+    void predict(const State &x_pred, const Covariance &F, const Covariance &Q) {
+        x = x_pred;
+        P = F * P * ARMath::transpose(F) + Q;
+    }
+
+    // Correct with an innovation (z - h(x)) and the Jacobian H of the measurement model
+    // (returns false when the squared Mahalanobis distance exceeds the gate, 0 = no gate)
+    template <int M>
+    bool correct(const ARMath::Matrix<M, 1> &y, const ARMath::Matrix<M, N> &H, const ARMath::Matrix<M, M> &R, double gate = 0.0) {
+        ARMath::Matrix<N, M> PHt = P * ARMath::transpose(H);
+        ARMath::Matrix<M, M> S = H * PHt + R, Si;
+        if (!ARMath::invert(S, &Si)) return false;
+        if (gate > 0.0 && (ARMath::transpose(y) * Si * y)(0, 0) > gate) return false;
+        ARMath::Matrix<N, M> K = PHt * Si;
+        x = x + K * y;
+
+        // Joseph form keeps P symmetric and positive definite
+        Covariance IKH = Covariance::eye() - K * H;
+        P = IKH * P * ARMath::transpose(IKH) + K * R * ARMath::transpose(K);
+        return true;
+    }
+};
+
+// State fused by the estimator
+struct ARDRONE_ESTIMATE {
+    double   time;                      // Received time of the latest Navdata [s]
+    double   x, y, z;                   // Position [m] (z = altitude)
+    double   vx, vy, vz;                // Velocity in the world frame [m/s]
+    double   roll, pitch, yaw;          // Attitude [rad] (roll and pitch are from the Navdata)
+    double   gyro_bias;                 // Bias of the yaw rate [rad/s]
+    double   sigma_x, sigma_y, sigma_z; // Standard deviations of the position [m]
+    double   sigma_yaw;                 // Standard deviation of the yaw [rad]
+    uint64_t steps;                     // Number of Navdata fused
+    uint64_t visions;                   // Number of vision measurements fused
+    uint64_t dropped;                   // Number of vision measurements older than the history
+};
+
+// State estimator fusing Navdata, magnetometer, GPS and vision with an EKF (one writer, lock-free readers)
+class ARDroneEstimator {
+public:
+    ARDroneEstimator();                     // Constructor
+    virtual ~ARDroneEstimator();            // Destructor
+    void reset(void);                       // Forget the state (call from the writer)
+    void update(const ARDRONE_NAVDATA &navdata, unsigned int options, double time, double drone_time); // Fuse a Navdata (options = 1 << tag of the received options)
+    int  addVision(double time, double x, double y, double z, double sigma); // Position seen at a capture time [s] (any thread, fused by the next update())
+    int  getEstimate(ARDRONE_ESTIMATE *estimate); // Latest state (any thread)
+private:
+    enum { STATES = 8, HISTORY = 256, STEP_VISIONS = 4, PENDING = 16 };
+    typedef ARDroneEKF<STATES> EKF;
+
+    // Measurements of a Navdata
+    struct INPUT {
+        bool   hasGyro, hasVz, hasHeading, hasGPS;
+        double gyro;                        // Yaw rate [rad/s]
+        double vx, vy;                      // Velocity in the body frame [m/s]
+        double altitude, vz;                // Altitude [m] and its rate [m/s]
+        double yaw;                         // Heading of the magnetometer or the demo option [rad]
+        double gx, gy, gsigma;              // GPS in the world frame [m]
+        double roll, pitch;                 // Attitude [rad]
+    };
+
+    // Vision measurement
+    struct VISION {
+        double time, x, y, z, sigma;
+    };
+
+    // Navdata step kept to re-fuse late vision measurements
+    struct STEP {
+        double time, dt;
+        INPUT input;
+        int visions;
+        VISION vision[STEP_VISIONS];
+        EKF::State x;                       // State after the step
+        EKF::Covariance P;
+    };
+
+    EKF ekf;
+    STEP history[HISTORY];                  // Ring of the latest steps
+    int first, count;
+    double lastDroneTime;
+    bool hasOrigin;                         // GPS origin
+    double lat0, lon0;
+    VISION pending[PENDING];                // Queued by addVision()
+    int pendings;
+    pthread_mutex_t *mutexPending;
+    ARDRONE_ESTIMATE current;               // State of the writer
+    volatile uint32_t seq;                  // Odd while the published state is written
+    ARDRONE_ESTIMATE published;             // State for the readers
+
+    STEP &step(int i) { return history[(first + i) % HISTORY]; }
+    void process(STEP &s, const EKF::State &x, const EKF::Covariance &P);
+    void insert(const VISION &vision);
+    void publish(void);
+};
+
+// Control modes (bits of ARDRONE_SETPOINT::mode, cleared bits only use the feed-forward)
+enum ARDRONE_CONTROL_MODE {
+    ARDRONE_CONTROL_VELOCITY = 0,       // Horizontal velocity only
+    ARDRONE_CONTROL_POSITION = 1,       // Hold the horizontal position
+    ARDRONE_CONTROL_ALTITUDE = 2,       // Hold the altitude
+    ARDRONE_CONTROL_YAW      = 4,       // Hold the yaw
+    ARDRONE_CONTROL_ALL      = 7
+};
+
+// Loops of the controller
+enum ARDRONE_CONTROL_AXIS {
+    ARDRONE_AXIS_POSITION = 0,          // Position error [m] -> velocity [m/s]
+    ARDRONE_AXIS_VELOCITY,              // Velocity error [m/s] -> tilt [rad]
+    ARDRONE_AXIS_ALTITUDE,              // Altitude error [m] -> vertical velocity [m/s]
+    ARDRONE_AXIS_YAW,                   // Yaw error [rad] -> yaw rate [rad/s]
+    ARDRONE_AXIS_NUM
+};
+
+// Setpoint of the controller (world frame)
+struct ARDRONE_SETPOINT {
+    double x, y, z;                     // Position [m]
+    double yaw;                         // Yaw [rad]
+    double vx, vy, vz;                  // Feed-forward velocity [m/s]
+    double vyaw;                        // Feed-forward yaw rate [rad/s]
+    int    mode;                        // ARDRONE_CONTROL_MODE bits
+};
+
+// Progressive command (same as AT*PCMD, -1.0 to +1.0)
+struct ARDRONE_PCMD {
+    int   mode;                         // 0 = hover, 1 = use the angles
+    float roll, pitch, gaz, yaw;
+};
+
+// Cascaded PID controller (setpoints from any thread, run at a fixed rate by the command thread)
+class ARDroneController {
+public:
+    ARDroneController(double rate = 50.0);  // Constructor (rate [Hz])
+    virtual ~ARDroneController();           // Destructor
+    void   setGains(int axis, double kp, double ki = 0.0, double kd = 0.0); // Gains of a loop
+    void   setLimits(double max_speed, double max_tilt, double max_vz, double max_vyaw); // [m/s], [rad], [m/s], [rad/s]
+    void   setSetpoint(const ARDRONE_SETPOINT &setpoint); // New setpoint (any thread)
+    void   getSetpoint(ARDRONE_SETPOINT *setpoint);
+    double getPeriod(void);                 // Period of the loop [s]
+    void   reset(void);                     // Clear the integrators
+    void   update(const ARDRONE_POSE &pose, double dt, ARDRONE_PCMD *cmd); // Run a step
+private:
+    struct GAIN {
+        double kp, ki, kd;
+    };
+    struct PID {
+        double integral, last;
+        bool first;
+    };
+    enum { POS_X, POS_Y, VEL_X, VEL_Y, ALT, YAW, PIDS };
+    double period;
+    GAIN gains[ARDRONE_AXIS_NUM];
+    double maxSpeed, maxTilt, maxVz, maxVyaw;
+    ARDRONE_SETPOINT setpoint;
+    PID pids[PIDS];
+    pthread_mutex_t *mutexSetpoint;
+    double pid(const GAIN &gain, PID &state, double error, double dt, double limit);
+};
+
+// Waypoint of a trajectory (world frame)
+struct ARDRONE_WAYPOINT {
+    double x, y, z;                     // Position [m]
+    double yaw;                         // Yaw [rad]
+    double speed;                       // Average speed to this waypoint [m/s]
+    double hold;                        // Time to stay at this waypoint [s] (> 0 stops here)
+};
+
+// Events of a trajectory (bits)
+enum ARDRONE_TRAJECTORY_EVENT {
+    ARDRONE_TRAJECTORY_WAYPOINT  = 1,   // Reached a waypoint
+    ARDRONE_TRAJECTORY_FINISHED  = 2,   // Reached the last waypoint
+    ARDRONE_TRAJECTORY_PREEMPTED = 4    // Replaced or stopped before the end
+};
+
+// Progress of a trajectory
+struct ARDRONE_TRAJECTORY_PROGRESS {
+    int    waypoint;                    // Waypoints reached
+    int    waypoints;                   // Number of waypoints
+    double elapsed;                     // Time along the trajectory [s] (slowed down while lagging)
+    double duration;                    // Planned duration [s]
+    double error;                       // Distance from the setpoint [m]
+};
+
+// Progress callback (called from the command thread, or from the thread preempting it; must not block)
+typedef void (*ARDRONE_TRAJECTORY_CALLBACK)(int event, const ARDRONE_TRAJECTORY_PROGRESS &progress, void *arg);
+
+// Time-parameterised trajectory (cubic spline through waypoints, sampled ahead of time)
+class ARDroneTrajectory {
+public:
+    ARDroneTrajectory();                    // Constructor
+    virtual ~ARDroneTrajectory();           // Destructor
+    void   clear(void);
+    void   addWaypoint(const ARDRONE_WAYPOINT &waypoint);
+    void   addWaypoint(double x, double y, double z, double yaw, double speed = 0.5, double hold = 0.0);
+    int    getWaypoints(void);
+    int    build(const ARDRONE_SETPOINT &start, double period); // Sample from the start point
+    double getDuration(void);               // [s]
+    int    advance(const ARDRONE_POSE &pose, double dt, ARDRONE_SETPOINT *setpoint); // Returns events
+    void   getProgress(ARDRONE_TRAJECTORY_PROGRESS *progress);
+private:
+    std::vector<ARDRONE_WAYPOINT> waypoints;
+    std::vector<ARDRONE_SETPOINT> samples;  // Setpoints every period
+    std::vector<int> reached;               // Waypoints reached at each sample
+    double period;
+    double elapsed, error;
+    int waypoint;
+};
+
+// Configuration profile ("category:key" -> value)
+typedef std::map<std::string, std::string> ARDRONE_CONFIG_PROFILE;
+
 // Version information
 struct ARDRONE_VERSION {
     int major;
@@ -1034,15 +1580,20 @@ private:
     IplImage *image;
 };
 
+// Forward declaration
+class ARDroneFleet;
+
 // AR.Drone class
 class ARDrone {
+    friend class ARDroneFleet;
+
 public:
     // Constructor / Destructor
     ARDrone(const char *ardrone_addr = NULL);
     virtual ~ARDrone();
 
-    // Initialize
-    virtual int open(const char *ardrone_addr = ARDRONE_DEFAULT_ADDR);
+    // Initialize (optionally bound to a local IP address and/or a network device)
+    virtual int open(const char *ardrone_addr = ARDRONE_DEFAULT_ADDR, const char *local_addr = NULL, const char *device = NULL);
 
     // Update
     virtual int update(void);
@@ -1052,6 +1603,8 @@ public:
 
     // Get an image
     virtual ARDRONE_IMAGE getImage(void);
+    virtual ARDRONE_IMAGE getImage(ARDRONE_FRAME_INFO *info);  // With the Navdata interpolated at its capture
+    virtual int getLuma(cv::Mat *luma, ARDRONE_FRAME_INFO *info = NULL); // Y plane of the decoder (no BGR conversion)
     virtual ARDrone& operator >> (cv::Mat &image);
     virtual bool willGetNewImage(void);
 
@@ -1065,6 +1618,7 @@ public:
     virtual double getAltitude(void);   // Altitude    [m]
     virtual double getVelocity(double *vx = NULL, double *vy = NULL, double *vz = NULL); // Velocity [m/s]
     virtual int    getPosition(double *latitude = NULL, double *longitude = NULL, double *elevation = NULL); // GPS (only for AR.Drone 2.0)
+    virtual double getNavdataTime(void); // Received time of the latest Navdata [s]
 
     // Battery charge [%]
     virtual int getBatteryPercentage(void);
@@ -1094,10 +1648,66 @@ public:
     virtual void setVideoRecord(bool activate);     // Video recording (only for AR.Drone 2.0)
     virtual void setOutdoorMode(bool activate);     // Outdoor mode (experimental)
 
+    // Configurations (only changed values are written)
+    virtual int setConfig(const char *key, const char *value);                                  // Write a value
+    virtual std::string getConfigValue(const char *key);                                        // Read a value
+    virtual int diffConfig(const ARDRONE_CONFIG_PROFILE &profile, ARDRONE_CONFIG_PROFILE *diff); // Compare a profile
+    virtual int applyConfig(const ARDRONE_CONFIG_PROFILE &profile);                              // Push a profile
+
+    // Session recording / replay (speed 0 = as fast as possible)
+    virtual int  startRecord(const char *filename);
+    virtual void stopRecord(void);
+    virtual int  openLog(const char *filename, double speed = 1.0);
+    virtual bool endOfLog(void);
+
+    // Remux the H.264 stream into MP4/MKV without decoding (only for AR.Drone 2.0)
+    virtual int  startRemux(const char *filename);
+    virtual void stopRemux(void);
+
+    // Re-stream the H.264 frames to local consumers (only for AR.Drone 2.0)
+    virtual int  startRelay(const char *addr = "127.0.0.1", int port = ARDRONE_VIDEO_PORT, bool pave = true);
+    virtual void stopRelay(void);
+
+    // Share decoded frames with other processes through shared memory
+    virtual int  startFrameRing(const char *name, int slots = 4);
+    virtual void stopFrameRing(void);
+
+    // Rectify the decoded frames with a calibration file (call for each camera channel, only for AR.Drone 2.0)
+    virtual int  startUndistort(const char *filename = "camera.xml", int channel = 0);
+    virtual void stopUndistort(void);
+    virtual int  undistortPoints(const std::vector<cv::Point2f> &src, std::vector<cv::Point2f> *dst, int channel = 0);
+
+    // Dead-reckoning on the Navdata thread (getPose() does not lock)
+    virtual int  startOdometry(void);
+    virtual void stopOdometry(void);
+    virtual int  getPose(ARDRONE_POSE *pose);
+    virtual void resetPose(double x = 0.0, double y = 0.0);
+
+    // EKF state estimator on the Navdata thread (getEstimate() does not lock)
+    virtual int  startEstimator(void);
+    virtual void stopEstimator(void);
+    virtual int  getEstimate(ARDRONE_ESTIMATE *estimate);
+    virtual int  addVision(double time, double x, double y, double z, double sigma = 0.1); // Position [m] seen at ARDRONE_FRAME_INFO::timestamp
+
+    // Closed-loop control on the command thread (uses the estimator, or the odometry; move() is not needed meanwhile)
+    virtual int  startController(double rate = 50.0);
+    virtual void stopController(void);
+    virtual int  setSetpoint(const ARDRONE_SETPOINT &setpoint);
+    virtual int  setControlGains(int axis, double kp, double ki = 0.0, double kd = 0.0);
+
+    // Trajectory streamed by the controller (starts the controller if needed, preempts the running one)
+    virtual int  startTrajectory(const ARDroneTrajectory &trajectory, ARDRONE_TRAJECTORY_CALLBACK callback = NULL, void *arg = NULL);
+    virtual void stopTrajectory(void);      // Holds the current setpoint
+    virtual int  getTrajectoryProgress(ARDRONE_TRAJECTORY_PROGRESS *progress);
+
 protected:
     // IP address
     char ip[16];
 
+    // Local IP address and network device to be bound
+    char localIp[16];
+    char netDevice[16];
+
     // Sequence number
     unsigned long int seq;
 
@@ -1108,23 +1718,81 @@ protected:
     UDPSocket sockCommand;
     UDPSocket sockNavdata;
     UDPSocket sockVideo;
+    TCPSocket sockStream;
 
     // Version information
     ARDRONE_VERSION version;
 
     // Navigation data
     ARDRONE_NAVDATA navdata;
+    double navdataTime;
+
+    // History of Navdata to find the state at the capture of frames
+    struct NAVDATA_SAMPLE {
+        double time;                    // Received time [s]
+        double droneTime;               // Time option [s] (negative if not sent)
+        int64_t frameNumber;            // video_stream.frame_number (negative if not sent)
+        double roll, pitch, yaw;        // Attitude [rad]
+        double altitude;                // Altitude [m]
+        double vx, vy, vz;              // Velocity [m/s]
+    };
+    std::deque<NAVDATA_SAMPLE> navdataHistory;
 
     // Configurations
     ARDRONE_CONFIG config;
+    std::map<std::string, std::string> configShadow;
 
     // Video
-    AVFormatContext *pFormatCtx;
     AVCodecContext  *pCodecCtx;
     AVFrame         *pFrame, *pFrameBGR;
     uint8_t         *bufferBGR;
     SwsContext      *pConvertCtx;
     bool            newImage;
+    ARDRONE_FRAME_INFO frameInfo;
+    cv::Mat         bufferLuma, bufferRaw;
+    std::vector<uint8_t> streamBuffer;
+    size_t          streamOffset;           // Read offset in streamBuffer
+
+    // Driven by ARDroneFleet (no threads of its own)
+    bool managed;
+
+    // Session recording / replay
+    ARDroneRecorder *recorder;
+    ARDroneLog *replayLog;
+    double replaySpeed;
+    bool replayEnd;
+
+    // Passthrough video recording
+    ARDroneRemuxer *remuxer;
+
+    // Local video relay
+    ARDroneRelay *relay;
+
+    // Shared decoded frames
+    ARDroneFrameRing *frameRing;
+
+    // Lens undistortion on the decoder thread
+    ARDroneUndistorter *undistorter;
+
+    // Dead-reckoning on the Navdata thread
+    ARDroneOdometry *odometry;
+
+    // EKF state estimator on the Navdata thread
+    ARDroneEstimator *estimator;
+
+    // Closed-loop controller on the command thread
+    ARDroneController *controller;
+    int controlSource;                      // Source of the last state (getControlState())
+    bool schedChanged;                      // Command thread made real-time
+    int schedPolicy;                        // Its previous scheduling
+    sched_param schedParam;
+    virtual int  getControlState(ARDRONE_POSE *pose);
+    virtual void runController(double now, double dt);
+
+    // Trajectory on the command thread
+    ARDroneTrajectory *trajectory;
+    ARDRONE_TRAJECTORY_CALLBACK trajectoryCallback;
+    void *trajectoryArg;
 
     // Thread for AT command
     pthread_t *threadCommand;
@@ -1153,18 +1821,39 @@ protected:
         return NULL;
     }
 
+    // Thread for replay
+    pthread_t *threadReplay;
+    virtual void loopReplay(void);
+    static void *runReplay(void *args) {
+        reinterpret_cast<ARDrone*>(args)->loopReplay();
+        return NULL;
+    }
+
     // Initialize (internal)
     virtual int initCommand(void);
     virtual int initNavdata(void);
     virtual int initVideo(void);
+    virtual int initDecoder(const ARDRONE_PAVE &header);
 
     // Get informations (internal)
     virtual int getVersionInfo(void);
     virtual int getNavdata(void);
     virtual int getVideo(void);
     virtual int getConfig(void);
+    virtual void parseConfig(char *buf);
+
+    // Process received data (internal)
+    virtual int parseNavdata(const char *buf, int size, double timestamp = 0.0);
+    virtual int receiveVideo(void);
+    virtual int extractVideo(ARDRONE_VIDEO_PACKET *packet);
+    virtual int decodeVideo(const ARDRONE_VIDEO_PACKET &packet);
+    virtual void recordVideo(const ARDRONE_VIDEO_PACKET &packet);
+    virtual void shareFrame(const ARDRONE_PAVE &header);
+    virtual void syncFrame(const ARDRONE_VIDEO_PACKET &packet, ARDRONE_FRAME_INFO *info);
 
     // Send commands (internal)
+    virtual int  sendConfig(const char *key, const char *value);
+    virtual int  waitConfigAck(int set);
     virtual void resetWatchDog(void);
     virtual void resetEmergency(void);
 
@@ -1172,6 +1861,473 @@ protected:
     virtual void finalizeCommand(void);
     virtual void finalizeNavdata(void);
     virtual void finalizeVideo(void);
+    virtual void finalizeReplay(void);
+};
+
+// AR.Drone fleet class (drives many drones from one I/O thread)
+class ARDroneFleet {
+public:
+    // Constructor / Destructor
+    ARDroneFleet(int nb_decoders = 2);
+    virtual ~ARDroneFleet();
+
+    // Add a drone (returns a handle with the ARDrone API)
+    virtual ARDrone* open(const char *ardrone_addr = ARDRONE_DEFAULT_ADDR, const char *local_addr = NULL, const char *device = NULL);
+
+    // Remove a drone / all drones
+    virtual void close(ARDrone *ardrone);
+    virtual void close(void);
+
+    // Get drones
+    virtual int size(void);
+    virtual ARDrone* operator [] (int index);
+
+protected:
+    // A drone and its pending video packets
+    struct ENTRY {
+        unsigned int id;                            // Unique ID
+        ARDrone *drone;                             // Drone
+        std::deque<ARDRONE_VIDEO_PACKET> packets;   // Packets to be decoded
+        bool queued;                                // In the ready queue
+        bool busy;                                  // Being decoded
+        bool waitKeyFrame;                          // Packets were dropped
+        bool videoLost;                             // Video socket closed (not watched any more)
+    };
+
+    // Drones
+    std::vector<ENTRY*> entries;
+    std::deque<ENTRY*> ready;
+    unsigned int lastId;
+
+    // Event loop
+    int epfd;
+    bool quit;
+    int64 lastTick;
+
+    // Thread for I/O
+    pthread_t *threadIO;
+    pthread_mutex_t *mutexFleet;
+    virtual void loopIO(void);
+    static void *runIO(void *args) {
+        reinterpret_cast<ARDroneFleet*>(args)->loopIO();
+        return NULL;
+    }
+
+    // Threads for decoding
+    std::vector<pthread_t*> threadDecoders;
+    pthread_cond_t *condDecode;
+    pthread_cond_t *condIdle;
+    virtual void loopDecode(void);
+    static void *runDecode(void *args) {
+        reinterpret_cast<ARDroneFleet*>(args)->loopDecode();
+        return NULL;
+    }
+
+    // Internal
+    virtual ENTRY* find(unsigned int id);
+    virtual void tick(void);
+    virtual void handleNavdata(ENTRY *entry);
+    virtual void handleVideo(ENTRY *entry);
+};
+
+// Simulated AR.Drone speaking the network protocol on the local host
+class ARDroneSimulator {
+public:
+    // Constructor / Destructor
+    ARDroneSimulator();
+    virtual ~ARDroneSimulator();
+
+    // Start serving (use 127.x.x.x addresses to run many simulators on a host)
+    // video_file : Annex-B H.264 stream (2.x) or concatenated UVLC pictures (1.x), played in a loop
+    virtual int open(const char *addr = "127.0.0.1", const char *version = "2.4.8", const char *video_file = NULL);
+
+    // Stop serving
+    virtual void close(void);
+
+    // Rates (navdata 0 = follow general:navdata_demo, 15Hz or 200Hz)
+    virtual void setNavdataRate(int hz);
+    virtual void setVideoRate(int fps);
+
+    // Configurations served on the control port
+    virtual void setConfigValue(const char *key, const char *value);
+    virtual std::string getConfigValue(const char *key);
+
+    // Statistics
+    virtual unsigned int getCommandCount(void);     // Received AT commands
+    virtual unsigned int getNavdataCount(void);     // Sent Navdata packets
+    virtual unsigned int getFrameCount(void);       // Sent video frames
+
+protected:
+    // A TCP connection
+    struct CLIENT {
+        SOCKET sock;                    // Socket
+        int port;                       // Accepted on this port
+        std::string input;              // Received but not handled (FTP)
+        std::vector<uint8_t> output;    // Not sent yet
+        SOCKET passive;                 // FTP data listener
+        double retrDeadline;            // RETR waiting for the data connection (0 = none)
+        bool waitKeyFrame;              // Frames were dropped
+    };
+
+    // IP address and version
+    char ip[16];
+    ARDRONE_VERSION version;
+
+    // Sockets
+    SOCKET sockFtp, sockControl, sockStream;    // TCP listeners
+    SOCKET sockNavdata, sockVideo, sockCommand; // UDP
+    std::vector<CLIENT> clients;
+    sockaddr_in navdataClient, videoClient;
+    bool hasNavdataClient, hasVideoClient;
+
+    // Simulated drone
+    unsigned int state;
+    unsigned int sequence;
+    unsigned int lastSeq;
+    unsigned int lastRef;
+    int pcmdFlag;
+    float pcmd[4];
+    double altitude, roll, pitch, yaw;
+    double vx, vy, vz;
+    double battery;
+    double lastCommand;
+
+    // Configurations
+    ARDRONE_CONFIG_PROFILE configs;
+
+    // Video frames
+    std::vector<ARDRONE_VIDEO_PACKET> frames;
+    size_t frameIndex;
+    uint64_t streamPosition;
+
+    // Rates and timings
+    int navdataRate, videoRate;
+    double startTime, lastUpdate, nextNavdata, nextVideo;
+
+    // Statistics
+    unsigned int commandCount, navdataCount, frameCount;
+
+    // Thread
+    bool quit;
+    pthread_t *threadSim;
+    pthread_mutex_t *mutexSim;
+    virtual void loopSim(void);
+    static void *runSim(void *args) {
+        reinterpret_cast<ARDroneSimulator*>(args)->loopSim();
+        return NULL;
+    }
+
+    // Internal
+    virtual int loadVideo(const char *filename);
+    virtual void update(double now);
+    virtual void handleCommand(const char *command);
+    virtual void handleFtp(CLIENT *client);
+    virtual void finishRetr(CLIENT *client, bool accepted);
+    virtual void flush(CLIENT *client);
+    virtual void sendNavdata(double now);
+    virtual void sendVideo(double now);
+    virtual void sendConfigs(void);
+};
+
+// A colour blob
+struct ARDRONE_BLOB {
+    int         found;                  // Detected
+    cv::Rect    rect;                   // Bounding box [px]
+    cv::Point2d center;                 // Centroid [px]
+    int         area;                   // Number of pixels
+};
+
+// Colour-blob tracker (HSV thresholds like cv::COLOR_BGR2HSV_FULL + cv::inRange)
+class ARDroneBlobTracker {
+public:
+    // Constructor / Destructor
+    ARDroneBlobTracker();
+    virtual ~ARDroneBlobTracker();
+
+    // Parameters (minH > maxH selects hues across 255/0, e.g. red)
+    virtual void setThresholds(int minH, int maxH, int minS, int maxS, int minV, int maxV);
+    virtual void setMinArea(int area);              // Smaller blobs are noise
+    virtual void setSearchMargin(int margin);       // Search around the last blob [px] (0 = whole image)
+    virtual void setClosing(int size);              // Closing before labeling [px] (0 = none)
+    virtual void setKalman(bool enable, double process_noise = 1.0, double measurement_noise = 2.0); // Search the predicted window
+
+    // Find the largest blob in a BGR image
+    virtual int  track(const cv::Mat &image, ARDRONE_BLOB *blob);
+    virtual int  track(const cv::Mat &image, ARDRONE_BLOB *blob, const cv::Rect &window); // Search the window first
+    virtual void reset(void);                       // Forget the last blob
+
+    // Binarized image and the area searched by the last track()
+    virtual const cv::Mat& getMask(void);
+    virtual cv::Rect getSearchWindow(void);
+
+protected:
+    // Thresholds
+    int minH, maxH, minS, maxS, minV, maxV;
+    std::vector<uint8_t> table;         // BGR (6 bits each) -> in range, 1 bit per color
+    bool tableValid;
+
+    // Parameters
+    int minArea, margin, closing;
+
+    // Buffers reused for each frame
+    cv::Mat mask, labels, stats, centroids, kernel, work;
+
+    // Last blob and search window
+    ARDRONE_BLOB last;
+    cv::Size lastSize;
+    cv::Rect window;
+
+    // Kalman prediction
+    cv::KalmanFilter kalman;
+    bool useKalman, kalmanInit;
+    int lost;
+
+    // Internal
+    virtual void buildTable(void);
+    virtual void threshold(const cv::Mat &image, const cv::Rect &rect);
+    virtual int  search(const cv::Rect &rect, ARDRONE_BLOB *blob);
+    virtual cv::Rect predict(void);
+    virtual void update(const ARDRONE_BLOB &blob);
+};
+
+// Frame-to-frame motion from the optical flow
+struct ARDRONE_FLOW {
+    int         valid;                  // Motion was estimated
+    int         tracked;                // Features followed from the last frame
+    int         inliers;                // Features agreeing with the motion
+    int         detected;               // Features newly detected (0 = not re-detected)
+    cv::Point2d shift;                  // Motion of the image center [px]
+    double      rotation;               // Rotation around the optical axis [rad]
+    double      scale;                  // Scale (> 1 = getting closer)
+    double      dt;                     // Time from the last frame [s]
+    int         hasVelocity;            // vx and vy are valid (needs the Navdata at the capture)
+    double      vx, vy;                 // Velocity from the flow [m/s] (same axes as getVelocity())
+};
+
+// Sparse optical-flow odometry (features and pyramids are kept across frames)
+class ARDroneOpticalFlow {
+public:
+    // Constructor / Destructor
+    ARDroneOpticalFlow();
+    virtual ~ARDroneOpticalFlow();
+
+    // Parameters
+    virtual void setFeatures(int max_corners = 200, int min_corners = 80, double quality = 0.01, double min_distance = 10.0);
+    virtual void setWindow(int size = 21, int levels = 3);          // Lucas-Kanade window [px] and pyramid levels
+    virtual void setFocalLength(double fx, double fy = 0.0);        // [px] (0 = bottom camera)
+    virtual void setFusionGain(double gain);                        // Weight of the flow in fuse() (0-1)
+
+    // Track a BGR or gray image (info = Navdata at its capture, see ARDrone::getImage(ARDRONE_FRAME_INFO*))
+    virtual int  update(const cv::Mat &image, ARDRONE_FLOW *flow, const ARDRONE_FRAME_INFO *info = NULL);
+    virtual void reset(void);
+
+    // Velocity fused with the Navdata [m/s]
+    virtual int  fuse(const ARDRONE_FLOW &flow, const ARDRONE_FRAME_INFO &info, double *vx, double *vy);
+
+    // Features followed by the last update()
+    virtual int  getTracks(std::vector<cv::Point2f> *prev, std::vector<cv::Point2f> *curr);
+
+protected:
+    // Parameters
+    int maxCorners, minCorners;
+    double quality, minDistance;
+    int winSize, maxLevel;
+    double fx, fy;
+    double gain;
+
+    // Last frame
+    bool hasPrev;
+    std::vector<cv::Mat> prevPyramid;
+    std::vector<cv::Point2f> points;    // Features to be tracked
+    ARDRONE_FRAME_INFO prevInfo;
+    double prevTime;
+
+    // Buffers reused for each frame
+    cv::Mat gray, mask;
+    std::vector<cv::Mat> pyramid;
+    std::vector<cv::Point2f> next, corners, prevTracks, tracks;
+    std::vector<uchar> status, inliers;
+    std::vector<float> errors, residuals, sorted;
+};
+
+// Incremental mosaic of the ground (bottom camera)
+class ARDroneMosaic {
+public:
+    // Constructor / Destructor
+    ARDroneMosaic();
+    virtual ~ARDroneMosaic();
+
+    // Parameters
+    virtual void setFeatures(int max_features = 500);                     // ORB features in a frame
+    virtual void setKeyframe(int min_inliers = 60, double max_shift = 0.3); // New keyframe on fewer inliers or a larger shift (ratio of the image)
+
+    // Locate a frame and blend it when it becomes a keyframe (info = Navdata at its capture for the yaw prior)
+    virtual int  add(const cv::Mat &image, const ARDRONE_FRAME_INFO *info = NULL);
+    virtual void reset(void);
+
+    // Results
+    virtual int  getMosaic(cv::Mat *mosaic, double scale = 1.0);          // Tiles put together
+    virtual cv::Mat getPose(void);                                        // Last frame -> canvas
+    virtual int  getKeyframeCount(void);
+
+protected:
+    // A tile of the canvas
+    struct TILE {
+        cv::Mat image;                  // BGR
+        cv::Mat weight;                 // Sum of the blending weights
+    };
+    std::map<std::pair<int, int>, TILE> tiles;
+
+    // Parameters
+    int maxFeatures, minInliers;
+    double maxShift;
+
+    // Keyframe (features and index are built once)
+    std::vector<cv::KeyPoint> keyPoints;
+    cv::Mat keyDescriptors;
+    cv::Ptr<cv::DescriptorMatcher> matcher;
+    cv::Mat keyPose;                    // Keyframe -> canvas
+    double keyYaw;
+    int keyCount;
+
+    // Last blended keyframe (kept while following an unplaced one after being lost)
+    std::vector<cv::KeyPoint> anchorPoints;
+    cv::Mat anchorDescriptors;
+    cv::Ptr<cv::DescriptorMatcher> anchorMatcher;
+    cv::Mat anchorPose;
+    double anchorYaw;
+    bool anchored;                      // The keyframe is registered on the canvas
+
+    // Last frame
+    cv::Mat pose;                       // Frame -> canvas
+    int lost;
+
+    // Buffers reused for each frame
+    cv::Ptr<cv::ORB> orb;
+    cv::Mat gray, descriptors, feather, warpImage, warpWeight;
+    std::vector<cv::KeyPoint> keypoints;
+    std::vector<std::vector<cv::DMatch> > knn;
+    std::vector<cv::Point2f> src, dst, shifts;
+    std::vector<uchar> status;
+
+    // Internal
+    virtual int  locate(const std::vector<cv::KeyPoint> &points, cv::DescriptorMatcher &index, double dyaw, bool use_prior, cv::Mat *H);
+    virtual void addKeyframe(const cv::Mat &image, double yaw);
+    virtual void blend(const cv::Mat &image, const cv::Mat &G);
+    virtual void makeFeather(const cv::Size &size);
+};
+
+// Time spent by each stage of ARDroneHOGDetector [ms]
+struct ARDRONE_HOG_TIMING {
+    double convert;                     // Gray and downscale (caller)
+    double track;                       // Moving the detections (caller)
+    double scan;                        // HOG on the levels of a frame (thread)
+    double group;                       // Grouping the hits of all levels (thread)
+    int    levels;                      // Pyramid levels
+};
+
+// HOG person detector (downscaled, pyramid levels spread over frames, on its own thread)
+class ARDroneHOGDetector {
+public:
+    // Constructor / Destructor
+    ARDroneHOGDetector();
+    virtual ~ARDroneHOGDetector();
+
+    // Start / Stop the detector thread
+    virtual int  open(double scale = 0.5, int levels_per_frame = 2, double level_scale = 1.2);
+    virtual void close(void);
+
+    // Give a BGR or gray image and get the people found so far (moved to this image)
+    virtual int  push(const cv::Mat &image, std::vector<cv::Rect> *found);
+
+    // Timings of the stages
+    virtual ARDRONE_HOG_TIMING getTiming(void);
+
+protected:
+    // Parameters
+    double scale, levelScale;
+    int levelsPerFrame;
+
+    // Detector (used by the thread)
+    cv::HOGDescriptor hog;
+    int levelCount, nextLevel;
+    std::vector<cv::Rect> sweep;        // Hits of the levels scanned so far
+
+    // Shared with the thread
+    cv::Mat job;                        // Frame to be scanned
+    bool busy;                          // The thread has a frame
+    std::vector<cv::Rect> results;      // Grouped hits of all levels
+    bool hasResults;
+    ARDRONE_HOG_TIMING timing;
+
+    // Tracking (caller)
+    cv::Mat full, gray, prevGray;
+    std::vector<cv::Rect2d> detections;
+    std::vector<cv::Point2f> points, moved;
+    std::vector<uchar> status;
+    std::vector<float> errors, dx, dy;
+    virtual void track(void);
+
+    // Thread
+    bool quit;
+    pthread_t *threadDetect;
+    pthread_mutex_t *mutexDetect;
+    pthread_cond_t *condDetect;
+    virtual void loopDetect(void);
+    static void *runDetect(void *args) {
+        reinterpret_cast<ARDroneHOGDetector*>(args)->loopDetect();
+        return NULL;
+    }
+};
+
+// Camera calibration with a chessboard (detected on a thread, corners cached)
+class ARDroneCalibrator {
+public:
+    // Constructor / Destructor
+    ARDroneCalibrator();
+    virtual ~ARDroneCalibrator();
+
+    // Start / Stop the detector thread (pattern = inner corners, square size [mm])
+    virtual int  open(cv::Size pattern = cv::Size(10, 7), double square_size = 24.0, double scale = 0.5);
+    virtual void close(void);
+
+    // Give a live frame and get the corners of the latest detection
+    virtual int  push(const cv::Mat &image, std::vector<cv::Point2f> *corners);
+
+    // Views
+    virtual int  capture(void);                                 // Keep the latest detection
+    virtual int  addImages(const std::vector<cv::Mat> &images); // Search stored images in parallel
+    virtual int  getCount(void);
+
+    // Estimate the camera parameters (returns the RMS error [px])
+    virtual double calibrate(cv::Mat *camera_matrix, cv::Mat *dist_coeffs);
+
+protected:
+    // Parameters
+    cv::Size pattern;
+    double squareSize, scale;
+
+    // Views
+    std::vector< std::vector<cv::Point2f> > imagePoints;
+    cv::Size imageSize;
+
+    // Shared with the thread
+    cv::Mat job;                        // Frame to be searched
+    bool busy;                          // The thread has a frame
+    bool found;                         // Result of the latest detection
+    std::vector<cv::Point2f> corners;   // Refined corners of the latest detection
+    cv::Size cornersSize;               // Size of its image
+
+    // Thread
+    bool quit;
+    pthread_t *threadDetect;
+    pthread_mutex_t *mutexDetect;
+    pthread_cond_t *condDetect;
+    virtual void loopDetect(void);
+    static void *runDetect(void *args) {
+        reinterpret_cast<ARDroneCalibrator*>(args)->loopDetect();
+        return NULL;
+    }
 };
 
 #ifdef _WIN32
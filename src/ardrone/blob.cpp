@@ -0,0 +1,423 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   blob.cpp
+//! @brief  Colour-blob tracker
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// The HSV conversion and the thresholds are folded into one table indexed by
+// the upper 6 bits of B, G and R (2^18 colors, 1 bit each = 32 KB, fits in L1).
+#define BLOB_LEVELS         (64)
+#define BLOB_INDEX(b, g, r) ((((b) >> 2) << 12) | (((g) >> 2) << 6) | ((r) >> 2))
+
+// Kalman prediction
+#define BLOB_MAX_SPEED      (10.0)          // Uncertainty of the velocity of a new blob [px/frame]
+#define BLOB_MAX_LOST       (15)            // Frames to keep predicting a lost blob
+
+// --------------------------------------------------------------------------
+//! @brief   Convert a BGR color into HSV like cv::COLOR_BGR2HSV_FULL.
+//! @param   b Blue
+//! @param   g Green
+//! @param   r Red
+//! @param   h Hue (0-255)
+//! @param   s Saturation (0-255)
+//! @param   v Value (0-255)
+//! @return  None
+// --------------------------------------------------------------------------
+static void toHSV(int b, int g, int r, int *h, int *s, int *v)
+{
+    int max = MAX(MAX(b, g), r);
+    int min = MIN(MIN(b, g), r);
+    int diff = max - min;
+
+    // Value and saturation
+    *v = max;
+    *s = (max > 0) ? (diff * 255 + max / 2) / max : 0;
+
+    // Hue [deg]
+    double hue = 0.0;
+    if (diff > 0) {
+        if      (max == r) hue = 60.0 * (g - b) / diff;
+        else if (max == g) hue = 120.0 + 60.0 * (b - r) / diff;
+        else               hue = 240.0 + 60.0 * (r - g) / diff;
+        if (hue < 0.0) hue += 360.0;
+    }
+    *h = cvRound(hue * 256.0 / 360.0) & 0xFF;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneBlobTracker class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneBlobTracker::ARDroneBlobTracker()
+{
+    minH = minS = minV = 0;
+    maxH = maxS = maxV = 255;
+    tableValid = false;
+    minArea = 30;
+    margin = 48;
+    closing = 3;
+    last = ARDRONE_BLOB();
+    useKalman = false;
+    kalmanInit = false;
+    lost = 0;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneBlobTracker class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneBlobTracker::~ARDroneBlobTracker()
+{
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the HSV thresholds (same as cv::inRange on cv::COLOR_BGR2HSV_FULL).
+//! @param   minH Lower hue (0-255)
+//! @param   maxH Upper hue (0-255, smaller than minH for hues across 0)
+//! @param   minS Lower saturation (0-255)
+//! @param   maxS Upper saturation (0-255)
+//! @param   minV Lower value (0-255)
+//! @param   maxV Upper value (0-255)
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneBlobTracker::setThresholds(int minH, int maxH, int minS, int maxS, int minV, int maxV)
+{
+    // Not changed
+    if (tableValid && this->minH == minH && this->maxH == maxH && this->minS == minS && this->maxS == maxS && this->minV == minV && this->maxV == maxV) return;
+
+    this->minH = minH; this->maxH = maxH;
+    this->minS = minS; this->maxS = maxS;
+    this->minV = minV; this->maxV = maxV;
+    tableValid = false;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the smallest blob.
+//! @param   area Number of pixels
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneBlobTracker::setMinArea(int area)
+{
+    minArea = MAX(1, area);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the search area around the last blob.
+//! @param   margin Margin added to each side of the last bounding box [px] (0 = whole image)
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneBlobTracker::setSearchMargin(int margin)
+{
+    this->margin = MAX(0, margin);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the closing applied to the mask.
+//! @param   size Size of the structuring element [px] (0 = none)
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneBlobTracker::setClosing(int size)
+{
+    closing = MAX(0, size);
+    kernel.release();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Predict the blob with a Kalman filter to narrow the search.
+//! @param   enable Use the filter
+//! @param   process_noise Change of the velocity per frame [px/frame]
+//! @param   measurement_noise Error of the centroid [px]
+//! @return  None
+//! @note    The state is (x, y, vx, vy) with a constant velocity model.
+// --------------------------------------------------------------------------
+void ARDroneBlobTracker::setKalman(bool enable, double process_noise, double measurement_noise)
+{
+    useKalman = enable;
+    kalmanInit = false;
+    lost = 0;
+
+    // Constant velocity model in frames
+    kalman.init(4, 2, 0, CV_32F);
+    kalman.transitionMatrix = (cv::Mat_<float>(4, 4) << 1, 0, 1, 0,
+                                                        0, 1, 0, 1,
+                                                        0, 0, 1, 0,
+                                                        0, 0, 0, 1);
+    cv::setIdentity(kalman.measurementMatrix);
+    float q = (float)(process_noise * process_noise);
+    float r = (float)(measurement_noise * measurement_noise);
+    kalman.processNoiseCov = (cv::Mat_<float>(4, 4) << q * 0.25f, 0, q * 0.5f, 0,
+                                                       0, q * 0.25f, 0, q * 0.5f,
+                                                       q * 0.5f, 0, q, 0,
+                                                       0, q * 0.5f, 0, q);
+    cv::setIdentity(kalman.measurementNoiseCov, cv::Scalar::all(r));
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the area searched by the last track().
+//! @return  Search window [px]
+// --------------------------------------------------------------------------
+cv::Rect ARDroneBlobTracker::getSearchWindow(void)
+{
+    return window;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Forget the last blob (the next search covers the whole image).
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneBlobTracker::reset(void)
+{
+    last = ARDRONE_BLOB();
+    kalmanInit = false;
+    lost = 0;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the binarized image.
+//! @return  Mask of the last search area (zero outside)
+// --------------------------------------------------------------------------
+const cv::Mat& ARDroneBlobTracker::getMask(void)
+{
+    return mask;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Build the table from the thresholds.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneBlobTracker::buildTable(void)
+{
+    table.assign(BLOB_LEVELS * BLOB_LEVELS * BLOB_LEVELS / 8, 0);
+
+    // Classify the center of each cell
+    for (int b = 2; b < 256; b += 4) {
+        for (int g = 2; g < 256; g += 4) {
+            for (int r = 2; r < 256; r += 4) {
+                int h, s, v;
+                toHSV(b, g, r, &h, &s, &v);
+                bool hue = (minH <= maxH) ? (minH <= h && h <= maxH) : (h >= minH || h <= maxH);
+                if (hue && minS <= s && s <= maxS && minV <= v && v <= maxV) {
+                    int index = BLOB_INDEX(b, g, r);
+                    table[index >> 3] |= (uint8_t)(1 << (index & 7));
+                }
+            }
+        }
+    }
+
+    tableValid = true;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Binarize a part of the image in one pass.
+//! @param   image BGR image
+//! @param   rect Area to be binarized
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneBlobTracker::threshold(const cv::Mat &image, const cv::Rect &rect)
+{
+    const uint8_t *bits = &table[0];
+    for (int y = rect.y; y < rect.y + rect.height; y++) {
+        const uint8_t *src = image.ptr<uint8_t>(y) + rect.x * 3;
+        uint8_t *dst = mask.ptr<uint8_t>(y) + rect.x;
+        for (int x = 0; x < rect.width; x++, src += 3) {
+            int index = BLOB_INDEX(src[0], src[1], src[2]);
+            dst[x] = (uint8_t)(0 - ((bits[index >> 3] >> (index & 7)) & 1));
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Find the largest blob in a part of the mask.
+//! @param   rect Area to be searched
+//! @param   blob The largest blob
+//! @return  Result of this function
+//! @retval  1 Found
+//! @retval  0 Not found
+// --------------------------------------------------------------------------
+int ARDroneBlobTracker::search(const cv::Rect &rect, ARDRONE_BLOB *blob)
+{
+    // Close small gaps
+    cv::Mat area = mask(rect);
+    if (closing > 1) {
+        if (kernel.empty()) kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(closing, closing));
+        cv::Mat closed = work(rect);
+        cv::morphologyEx(area, closed, cv::MORPH_CLOSE, kernel);
+        area = closed;
+    }
+
+    // Label connected pixels (the label image is a view of a preallocated buffer)
+    cv::Mat label = labels(rect);
+    int n = cv::connectedComponentsWithStats(area, label, stats, centroids, 8, CV_32S);
+
+    // The largest one
+    int best = -1, bestArea = minArea - 1;
+    for (int i = 1; i < n; i++) {
+        int size = stats.at<int>(i, cv::CC_STAT_AREA);
+        if (size > bestArea) {
+            best = i;
+            bestArea = size;
+        }
+    }
+    if (best < 0) return 0;
+
+    // In image coordinates
+    blob->found  = 1;
+    blob->area   = bestArea;
+    blob->rect   = cv::Rect(stats.at<int>(best, cv::CC_STAT_LEFT) + rect.x, stats.at<int>(best, cv::CC_STAT_TOP) + rect.y,
+                            stats.at<int>(best, cv::CC_STAT_WIDTH), stats.at<int>(best, cv::CC_STAT_HEIGHT));
+    blob->center = cv::Point2d(centroids.at<double>(best, 0) + rect.x, centroids.at<double>(best, 1) + rect.y);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Find the largest blob.
+//! @param   image BGR image
+//! @param   blob The largest blob (found = 0 if nothing)
+//! @return  Result of this function
+//! @retval  1 Found
+//! @retval  0 Not found
+//! @note    While tracking, only the predicted window (Kalman filter) or the area
+//!          around the last blob is searched, then the whole image if it was lost.
+// --------------------------------------------------------------------------
+int ARDroneBlobTracker::track(const cv::Mat &image, ARDRONE_BLOB *blob)
+{
+    // Search where the blob is expected
+    int found = track(image, blob, predict());
+
+    // Follow it
+    update(*blob);
+
+    return found;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Find the largest blob in a window first.
+//! @param   image BGR image
+//! @param   blob The largest blob (found = 0 if nothing)
+//! @param   window Area to be searched first (e.g. from an external predictor, empty = whole image)
+//! @return  Result of this function
+//! @retval  1 Found
+//! @retval  0 Not found
+// --------------------------------------------------------------------------
+int ARDroneBlobTracker::track(const cv::Mat &image, ARDRONE_BLOB *blob, const cv::Rect &window)
+{
+    *blob = ARDRONE_BLOB();
+
+    // Not a BGR image
+    if (image.empty() || image.type() != CV_8UC3) return 0;
+
+    // Prepare the table and buffers (only when changed)
+    if (!tableValid) buildTable();
+    if (mask.size() != image.size()) {
+        mask.create(image.size(), CV_8UC1);
+        work.create(image.size(), CV_8UC1);
+        labels.create(image.size(), CV_32SC1);
+        reset();
+    }
+    cv::Rect whole(0, 0, image.cols, image.rows);
+
+    // Search the window
+    cv::Rect rect = window & whole;
+    if (rect.area() > 0 && rect.area() < whole.area()) {
+        mask.setTo(0);
+        threshold(image, rect);
+        this->window = rect;
+        if (search(rect, blob)) {
+            last = *blob;
+            return 1;
+        }
+    }
+
+    // Search the whole image
+    threshold(image, whole);
+    this->window = whole;
+    search(whole, blob);
+    last = *blob;
+
+    return blob->found;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Predict the area to be searched.
+//! @return  Search window (empty = whole image)
+// --------------------------------------------------------------------------
+cv::Rect ARDroneBlobTracker::predict(void)
+{
+    // Kalman prediction (3 sigma of the position plus the blob and the margin)
+    if (useKalman && kalmanInit) {
+        const cv::Mat &state = kalman.predict();
+        double x = state.at<float>(0), y = state.at<float>(1);
+        double w = 3.0 * sqrt(kalman.errorCovPre.at<float>(0, 0)) + last.rect.width  * 0.5 + margin;
+        double h = 3.0 * sqrt(kalman.errorCovPre.at<float>(1, 1)) + last.rect.height * 0.5 + margin;
+        if (!last.found) {
+            w += lastSize.width  * 0.5;
+            h += lastSize.height * 0.5;
+        }
+        return cv::Rect(cvRound(x - w), cvRound(y - h), cvRound(w * 2.0), cvRound(h * 2.0));
+    }
+
+    // Around the last blob
+    if (last.found && margin > 0) {
+        return cv::Rect(last.rect.x - margin, last.rect.y - margin, last.rect.width + margin * 2, last.rect.height + margin * 2);
+    }
+
+    // Whole image
+    return cv::Rect();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Update the Kalman filter with the result.
+//! @param   blob The blob found (or not) in this frame
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneBlobTracker::update(const ARDRONE_BLOB &blob)
+{
+    if (!useKalman) return;
+
+    // Measured
+    if (blob.found) {
+        // (Re)start from the blob (velocity unknown)
+        if (!kalmanInit || lost > 0) {
+            kalman.statePost = (cv::Mat_<float>(4, 1) << (float)blob.center.x, (float)blob.center.y, 0.0f, 0.0f);
+            cv::setIdentity(kalman.errorCovPost, cv::Scalar::all(BLOB_MAX_SPEED * BLOB_MAX_SPEED));
+            kalman.errorCovPost.at<float>(0, 0) = kalman.measurementNoiseCov.at<float>(0, 0);
+            kalman.errorCovPost.at<float>(1, 1) = kalman.measurementNoiseCov.at<float>(1, 1);
+            kalmanInit = true;
+        }
+        else {
+            kalman.correct((cv::Mat_<float>(2, 1) << (float)blob.center.x, (float)blob.center.y));
+        }
+        lastSize = blob.rect.size();
+        lost = 0;
+    }
+    // Lost (the prediction goes on and its window grows)
+    else if (kalmanInit) {
+        kalman.statePre.copyTo(kalman.statePost);
+        kalman.errorCovPre.copyTo(kalman.errorCovPost);
+        if (++lost > BLOB_MAX_LOST) kalmanInit = false;
+    }
+}
@@ -0,0 +1,357 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   calibration.cpp
+//! @brief  Camera calibration with a chessboard
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// Corner refinement at full resolution
+#define CALIB_SUBPIX_WINDOW     (11)        // Half size of the window [px]
+#define CALIB_SUBPIX_ITERATIONS (30)
+#define CALIB_SUBPIX_EPSILON    (0.1)
+
+// --------------------------------------------------------------------------
+//! @brief   Find a chessboard on a downscaled image and refine it at full resolution.
+//! @param   gray Grayscale image
+//! @param   pattern Inner corners of the chessboard (columns, rows)
+//! @param   scale Scale of the image to be searched
+//! @param   small Buffer for the downscaled image
+//! @param   corners Corners at full resolution
+//! @return  Result of this function
+//! @retval  1 Found
+//! @retval  0 Not found
+// --------------------------------------------------------------------------
+static int findChessboard(const cv::Mat &gray, cv::Size pattern, double scale, cv::Mat &small, std::vector<cv::Point2f> *corners)
+{
+    // Search the downscaled image
+    const cv::Mat *src = &gray;
+    if (scale < 1.0) {
+        cv::resize(gray, small, cv::Size(), scale, scale, cv::INTER_AREA);
+        src = &small;
+    }
+    if (!cv::findChessboardCorners(*src, pattern, *corners, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE | cv::CALIB_CB_FAST_CHECK)) return 0;
+
+    // Back to full resolution
+    if (scale < 1.0) {
+        for (size_t i = 0; i < corners->size(); i++) (*corners)[i] *= (float)(1.0 / scale);
+    }
+
+    // Refine only the found ones
+    cv::cornerSubPix(gray, *corners, cv::Size(CALIB_SUBPIX_WINDOW, CALIB_SUBPIX_WINDOW), cv::Size(-1, -1),
+                     cv::TermCriteria(cv::TermCriteria::EPS | cv::TermCriteria::COUNT, CALIB_SUBPIX_ITERATIONS, CALIB_SUBPIX_EPSILON));
+
+    return 1;
+}
+
+// Chessboards of many images in parallel
+class ChessboardBody : public cv::ParallelLoopBody {
+public:
+    ChessboardBody(const std::vector<cv::Mat> &images, cv::Size pattern, double scale, std::vector< std::vector<cv::Point2f> > &corners, std::vector<int> &found)
+        : images(images), pattern(pattern), scale(scale), corners(corners), found(found) {}
+    void operator()(const cv::Range &range) const {
+        cv::Mat gray, small;
+        for (int i = range.start; i < range.end; i++) {
+            if (images[i].channels() == 3) cv::cvtColor(images[i], gray, cv::COLOR_BGR2GRAY);
+            else gray = images[i];
+            found[i] = findChessboard(gray, pattern, scale, small, &corners[i]);
+        }
+    }
+private:
+    const std::vector<cv::Mat> &images;
+    cv::Size pattern;
+    double scale;
+    std::vector< std::vector<cv::Point2f> > &corners;
+    std::vector<int> &found;
+};
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneCalibrator class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneCalibrator::ARDroneCalibrator()
+{
+    pattern = cv::Size(10, 7);
+    squareSize = 24.0;
+    scale = 0.5;
+    found = false;
+    busy = false;
+    quit = false;
+    threadDetect = NULL;
+    mutexDetect = NULL;
+    condDetect = NULL;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneCalibrator class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneCalibrator::~ARDroneCalibrator()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start the detector thread.
+//! @param   pattern Inner corners of the chessboard (columns, rows)
+//! @param   square_size Size of a square [mm]
+//! @param   scale Scale of the image to be searched (corners are refined at full resolution)
+//! @return  Result of initialization
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneCalibrator::open(cv::Size pattern, double square_size, double scale)
+{
+    // Stop the previous thread
+    close();
+
+    // Parameters
+    this->pattern = pattern;
+    squareSize = square_size;
+    this->scale = MAX(0.1, MIN(1.0, scale));
+
+    // Reset the state
+    imagePoints.clear();
+    imageSize = cv::Size();
+    corners.clear();
+    found = false;
+    busy = false;
+    quit = false;
+
+    // Create a mutex and a condition
+    mutexDetect = new pthread_mutex_t;
+    pthread_mutex_init(mutexDetect, NULL);
+    condDetect = new pthread_cond_t;
+    pthread_cond_init(condDetect, NULL);
+
+    // Create a thread
+    threadDetect = new pthread_t;
+    if (pthread_create(threadDetect, NULL, runDetect, this) != 0) {
+        CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+        delete threadDetect;
+        threadDetect = NULL;
+        close();
+        return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Give a live frame to the detector.
+//! @param   image BGR or gray image
+//! @param   corners Corners of the latest detection (empty = not found)
+//! @return  Result of this function
+//! @retval  1 The chessboard was found in the latest detection
+//! @retval  0 Not found
+//! @note    The frame is taken only when the thread is idle, so the UI loop never waits.
+// --------------------------------------------------------------------------
+int ARDroneCalibrator::push(const cv::Mat &image, std::vector<cv::Point2f> *corners)
+{
+    if (corners) corners->clear();
+
+    // Not opened
+    if (!threadDetect || image.empty()) return 0;
+
+    pthread_mutex_lock(mutexDetect);
+
+    // Hand the frame to the thread
+    if (!busy) {
+        if (image.channels() == 3) cv::cvtColor(image, job, cv::COLOR_BGR2GRAY);
+        else image.copyTo(job);
+        busy = true;
+        pthread_cond_signal(condDetect);
+    }
+
+    // Latest result
+    int result = found ? 1 : 0;
+    if (found && corners) *corners = this->corners;
+
+    pthread_mutex_unlock(mutexDetect);
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Keep the latest detection as a view.
+//! @return  Number of views (0 = nothing found)
+//! @note    The refined corners are cached, so they are not detected again.
+// --------------------------------------------------------------------------
+int ARDroneCalibrator::capture(void)
+{
+    if (!mutexDetect) return 0;
+
+    pthread_mutex_lock(mutexDetect);
+    int count = 0;
+    if (found) {
+        imagePoints.push_back(corners);
+        imageSize = cornersSize;
+        count = (int)imagePoints.size();
+    }
+    pthread_mutex_unlock(mutexDetect);
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Add stored images as views.
+//! @param   images BGR or gray images
+//! @return  Number of images with the chessboard
+//! @note    The images are searched in parallel.
+// --------------------------------------------------------------------------
+int ARDroneCalibrator::addImages(const std::vector<cv::Mat> &images)
+{
+    if (images.empty()) return 0;
+
+    // Search them in parallel
+    std::vector< std::vector<cv::Point2f> > points(images.size());
+    std::vector<int> results(images.size(), 0);
+    cv::parallel_for_(cv::Range(0, (int)images.size()), ChessboardBody(images, pattern, scale, points, results));
+
+    // Keep the found ones
+    int count = 0;
+    if (mutexDetect) pthread_mutex_lock(mutexDetect);
+    for (size_t i = 0; i < images.size(); i++) {
+        if (!results[i]) continue;
+        imagePoints.push_back(points[i]);
+        imageSize = images[i].size();
+        count++;
+    }
+    if (mutexDetect) pthread_mutex_unlock(mutexDetect);
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the number of views.
+//! @return  Number of views
+// --------------------------------------------------------------------------
+int ARDroneCalibrator::getCount(void)
+{
+    if (mutexDetect) pthread_mutex_lock(mutexDetect);
+    int count = (int)imagePoints.size();
+    if (mutexDetect) pthread_mutex_unlock(mutexDetect);
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Estimate the camera parameters from the views.
+//! @param   camera_matrix 3x3 camera matrix
+//! @param   dist_coeffs Distortion coefficients
+//! @return  RMS re-projection error [px] (negative = failure)
+// --------------------------------------------------------------------------
+double ARDroneCalibrator::calibrate(cv::Mat *camera_matrix, cv::Mat *dist_coeffs)
+{
+    // Views (copied so that the thread can keep running)
+    if (mutexDetect) pthread_mutex_lock(mutexDetect);
+    std::vector< std::vector<cv::Point2f> > points2D = imagePoints;
+    cv::Size size = imageSize;
+    if (mutexDetect) pthread_mutex_unlock(mutexDetect);
+
+    // Not enough views
+    if (points2D.size() < 3) {
+        CVDRONE_ERROR("Calibration needs 3 views at least. (%s, %d)\n", __FILE__, __LINE__);
+        return -1.0;
+    }
+
+    // 3D positions of the corners
+    std::vector<cv::Point3f> board;
+    for (int j = 0; j < pattern.height; j++) {
+        for (int k = 0; k < pattern.width; k++) {
+            board.push_back(cv::Point3f((float)(k * squareSize), (float)(j * squareSize), 0.0f));
+        }
+    }
+    std::vector< std::vector<cv::Point3f> > points3D(points2D.size(), board);
+
+    // Estimate camera parameters
+    std::vector<cv::Mat> rvecs, tvecs;
+    return cv::calibrateCamera(points3D, points2D, size, *camera_matrix, *dist_coeffs, rvecs, tvecs);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop the detector thread.
+//! @return  None
+//! @note    The views are kept.
+// --------------------------------------------------------------------------
+void ARDroneCalibrator::close(void)
+{
+    // Stop the thread
+    if (threadDetect) {
+        pthread_mutex_lock(mutexDetect);
+        quit = true;
+        pthread_cond_signal(condDetect);
+        pthread_mutex_unlock(mutexDetect);
+        pthread_join(*threadDetect, NULL);
+        delete threadDetect;
+        threadDetect = NULL;
+    }
+
+    // Delete the mutex and the condition
+    if (condDetect) {
+        pthread_cond_destroy(condDetect);
+        delete condDetect;
+        condDetect = NULL;
+    }
+    if (mutexDetect) {
+        pthread_mutex_destroy(mutexDetect);
+        delete mutexDetect;
+        mutexDetect = NULL;
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Thread function for detection.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneCalibrator::loopDetect(void)
+{
+    cv::Mat gray, small;
+    std::vector<cv::Point2f> points;
+
+    while (1) {
+        // Wait for a frame
+        pthread_mutex_lock(mutexDetect);
+        while (!quit && !busy) pthread_cond_wait(condDetect, mutexDetect);
+        if (quit) {
+            pthread_mutex_unlock(mutexDetect);
+            break;
+        }
+        cv::swap(gray, job);
+        pthread_mutex_unlock(mutexDetect);
+
+        // Find the chessboard
+        int result = findChessboard(gray, pattern, scale, small, &points);
+
+        // Publish the result
+        pthread_mutex_lock(mutexDetect);
+        found = (result != 0);
+        if (found) {
+            corners.swap(points);
+            cornersSize = gray.size();
+        }
+        busy = false;
+        pthread_mutex_unlock(mutexDetect);
+    }
+}
@@ -36,7 +36,7 @@
 int ARDrone::initCommand(void)
 {
     // Open the IP address and port
-    if (!sockCommand.open(ip, ARDRONE_AT_PORT)) {
+    if (!sockCommand.open(ip, ARDRONE_AT_PORT, localIp, 0, netDevice)) {
         CVDRONE_ERROR("UDPSocket::open(port=%d) failed. (%s, %d)\n", ARDRONE_AT_PORT, __FILE__, __LINE__);
         return 0;
     }
@@ -176,29 +176,85 @@ int ARDrone::initCommand(void)
     mutexCommand = new pthread_mutex_t;
     pthread_mutex_init(mutexCommand, NULL);
 
-    // Create a thread
-    threadCommand = new pthread_t;
-    if (pthread_create(threadCommand, NULL, runCommand, this) != 0) {
-        CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
-        return 0;
+    // Create a thread (ARDroneFleet drives managed drones by itself)
+    if (!managed) {
+        threadCommand = new pthread_t;
+        if (pthread_create(threadCommand, NULL, runCommand, this) != 0) {
+            CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
     }
 
     return 1;
 }
 
+// --------------------------------------------------------------------------
+//! @brief   Get the monotonic time.
+//! @return  Time [s] (not affected by the clock adjustments)
+// --------------------------------------------------------------------------
+static double monotime(void)
+{
+    #ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / frequency.QuadPart;
+    #else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+    #endif
+}
+
 // --------------------------------------------------------------------------
 //! @brief   Thread function for AT command.
 //! @return  None
 // --------------------------------------------------------------------------
 void ARDrone::loopCommand(void)
 {
+    double next = monotime(), lastWatchdog = 0.0, lastControl = 0.0;
+
     while (1) {
+        double tick = monotime();
+
+        // Not cancelled while the mutex is locked
+        int state;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
         // Reset Watch-Dog every 100ms
-        if (mutexCommand) pthread_mutex_lock(mutexCommand);
-        sockCommand.sendf("AT*COMWDG=%d\r", ++seq);
-        if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+        if (tick - lastWatchdog >= 0.1) {
+            if (mutexCommand) pthread_mutex_lock(mutexCommand);
+            sockCommand.sendf("AT*COMWDG=%d\r", ++seq);
+            if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+            lastWatchdog = tick;
+        }
+
+        // Closed-loop control (wall-clock time to compare with the Navdata)
+        double period = 0.1;
+        if (controller) {
+            runController(gettime(), (lastControl > 0.0) ? tick - lastControl : 0.0);
+            lastControl = tick;
+            if (mutexCommand) pthread_mutex_lock(mutexCommand);
+            if (controller) period = controller->getPeriod();
+            if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+        }
+        else lastControl = 0.0;
+
+        pthread_setcancelstate(state, NULL);
         pthread_testcancel();
-        msleep(100);
+
+        // Sleep until the next period (fixed rate without drift)
+        next += period;
+        if (next < tick) next = tick + period;
+        #ifdef _WIN32
+        double wait = next - monotime();
+        if (wait > 0.0) Sleep((DWORD)(wait * 1000.0));
+        #else
+        timespec ts;
+        ts.tv_sec = (time_t)next;
+        ts.tv_nsec = (long)((next - (double)ts.tv_sec) * 1.0e9);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        #endif
     }
 }
 
@@ -305,23 +361,15 @@ void ARDrone::move3D(double vx, double vy, double vz, double vr)
 // --------------------------------------------------------------------------
 void ARDrone::setCamera(int channel)
 {
-    // Enable mutex lock
-    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    char value[16];
 
     // AR.Drone 2.0
-    if (version.major == ARDRONE_VERSION_2) {
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", ++seq, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        sockCommand.sendf("AT*CONFIG=%d,\"video:video_channel\",\"%d\"\r", ++seq, channel % 2);
-    }
+    if (version.major == ARDRONE_VERSION_2) sprintf(value, "%d", channel % 2);
     // AR.Drone 1.0
-    else {
-        sockCommand.sendf("AT*CONFIG=%d,\"video:video_channel\",\"%d\"\r", ++seq, channel % 4);
-    }
-
-    // Disable mutex lock
-    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+    else                                    sprintf(value, "%d", channel % 4);
 
-    msleep(100);
+    // Write the configuration if it was changed
+    setConfig("video:video_channel", value);
 }
 
 // --------------------------------------------------------------------------
@@ -418,24 +466,20 @@ void ARDrone::setVideoRecord(bool activate)
 {
     // AR.Drone 2.0
     if (version.major == ARDRONE_VERSION_2) {
+        // Output video with MP4_360P_H264_720P_CODEC / H264_360P_CODEC
+        ARDRONE_CONFIG_PROFILE profile;
+        profile["video:video_on_usb"] = activate ? "TRUE" : "FALSE";
+        profile["video:video_codec"]  = activate ? "130"  : "129";
+
+        // The drone already has the values
+        if (!diffConfig(profile, NULL)) return;
+
         // Finalize video
         finalizeVideo();
 
         // Enable/Disable video recording
-        if (mutexCommand) pthread_mutex_lock(mutexCommand);
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", ++seq, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        if (activate) sockCommand.sendf("AT*CONFIG=%d,\"video:video_on_usb\",\"TRUE\"\r",  ++seq);
-        else          sockCommand.sendf("AT*CONFIG=%d,\"video:video_on_usb\",\"FALSE\"\r", ++seq);
-        if (mutexCommand) pthread_mutex_unlock(mutexCommand);
-        msleep(100);
-
-        // Output video with MP4_360P_H264_720P_CODEC / H264_360P_CODEC
-        if (mutexCommand) pthread_mutex_lock(mutexCommand);
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", ++seq, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        if (activate) sockCommand.sendf("AT*CONFIG=%d,\"video:video_codec\",\"%d\"\r", ++seq, 0x82);
-        else          sockCommand.sendf("AT*CONFIG=%d,\"video:video_codec\",\"%d\"\r", ++seq, 0x81);
-        if (mutexCommand) pthread_mutex_unlock(mutexCommand);
-        msleep(100);
+        setConfig("video:video_on_usb", profile["video:video_on_usb"].c_str());
+        setConfig("video:video_codec",  profile["video:video_codec"].c_str());
 
         // Initialize video
         initVideo();
@@ -449,40 +493,11 @@ void ARDrone::setVideoRecord(bool activate)
 // --------------------------------------------------------------------------
 void ARDrone::setOutdoorMode(bool activate)
 {
-    // AR.Drone 2.0
-    if (version.major == ARDRONE_VERSION_2) {
-        // Enable/Disable outdoor mode
-        if (mutexCommand) pthread_mutex_lock(mutexCommand);
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", ++seq, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        if (activate) sockCommand.sendf("AT*CONFIG=%d,\"control:outdoor\",\"TRUE\"\r",  ++seq);
-        else          sockCommand.sendf("AT*CONFIG=%d,\"control:outdoor\",\"FALSE\"\r", ++seq);
-        if (mutexCommand) pthread_mutex_unlock(mutexCommand);
-        msleep(100);
+    // Enable/Disable outdoor mode
+    setConfig("control:outdoor", activate ? "TRUE" : "FALSE");
 
-        // Without/With shell
-        if (mutexCommand) pthread_mutex_lock(mutexCommand);
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", ++seq, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        if (activate) sockCommand.sendf("AT*CONFIG=%d,\"control:flight_without_shell\",\"TRUE\"\r",  ++seq);
-        else          sockCommand.sendf("AT*CONFIG=%d,\"control:flight_without_shell\",\"FALSE\"\r", ++seq);
-        if (mutexCommand) pthread_mutex_unlock(mutexCommand);
-        msleep(100);
-    }
-    // AR.Drone 1.0
-    else {
-        // Enable/Disable outdoor mode
-        if (mutexCommand) pthread_mutex_lock(mutexCommand);
-        if (activate) sockCommand.sendf("AT*CONFIG=%d,\"control:outdoor\",\"TRUE\"\r",  ++seq);
-        else          sockCommand.sendf("AT*CONFIG=%d,\"control:outdoor\",\"FALSE\"\r", ++seq);
-        if (mutexCommand) pthread_mutex_unlock(mutexCommand);
-        msleep(100);
-
-        // Without/With shell
-        if (mutexCommand) pthread_mutex_lock(mutexCommand);
-        if (activate) sockCommand.sendf("AT*CONFIG=%d,\"control:flight_without_shell\",\"TRUE\"\r",  ++seq);
-        else          sockCommand.sendf("AT*CONFIG=%d,\"control:flight_without_shell\",\"FALSE\"\r", ++seq);
-        if (mutexCommand) pthread_mutex_unlock(mutexCommand);
-        msleep(100);
-    }
+    // Without/With shell
+    setConfig("control:flight_without_shell", activate ? "TRUE" : "FALSE");
 }
 
 // --------------------------------------------------------------------------
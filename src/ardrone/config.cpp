@@ -27,6 +27,10 @@
 
 #include "ardrone.h"
 
+// Acknowledgement of AT*CONFIG
+#define CONFIG_ACK_TIMEOUT  (0.5)   // Shortest timeout [s]
+#define CONFIG_ACK_PERIODS  (8.0)   // Navdata periods to wait
+
 // --------------------------------------------------------------------------
 //! @brief   Parse a configuration string.
 //! @param   str Configuration string
@@ -206,6 +210,60 @@ void parse(const char *str, ARDRONE_CONFIG *config)
     }
 }
 
+// --------------------------------------------------------------------------
+//! @brief   Split a configuration string into "category:key" and value.
+//! @param   str Configuration string
+//! @param   key A pointer to the key string
+//! @param   val A pointer to the value string
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+static int split(const char *str, std::string *key, std::string *val)
+{
+    // Split key and value
+    char tmp_key[256] = {'\0'}, tmp_val[256] = {'\0'};
+    if (sscanf(str, "%255s = %255[^\r\n]", tmp_key, tmp_val) < 1) return 0;
+    if (!strchr(tmp_key, ':')) return 0;
+
+    *key = tmp_key;
+    *val = tmp_val;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Compare two configuration values.
+//! @param   a Configuration value
+//! @param   b Configuration value
+//! @return  Result of this function
+//! @retval  1 Same value
+//! @retval  0 Different value
+//! @note    Numbers are compared by value ("1000" == "1.000000e+03"),
+//!          booleans are compared without case.
+// --------------------------------------------------------------------------
+static int compare(const std::string &a, const std::string &b)
+{
+    // Exactly the same
+    if (a == b) return 1;
+
+    // Numbers
+    char *end_a = NULL, *end_b = NULL;
+    double num_a = strtod(a.c_str(), &end_a);
+    double num_b = strtod(b.c_str(), &end_b);
+    if (!a.empty() && !b.empty() && *end_a == '\0' && *end_b == '\0') {
+        return fabs(num_a - num_b) <= 1.0e-6 * MAX(1.0, fabs(num_a));
+    }
+
+    // Booleans or strings
+    if (a.size() != b.size()) return 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (tolower(a[i]) != tolower(b[i])) return 0;
+    }
+
+    return 1;
+}
+
 // --------------------------------------------------------------------------
 //! @brief   Get current configurations of AR.Drone.
 //! @return  Result of this function
@@ -216,14 +274,14 @@ int ARDrone::getConfig(void)
 {
     // Open the IP address and port
     TCPSocket sockConfig;
-    if (!sockConfig.open(ip, ARDRONE_CONTROL_PORT)) {
+    if (!sockConfig.open(ip, ARDRONE_CONTROL_PORT, localIp, 0, netDevice)) {
         CVDRONE_ERROR("TCPSocket::open(port=%d) failed. (%s, %d)\n", ARDRONE_CONTROL_PORT, __FILE__, __LINE__);
         return 0;
     }
 
     // Send requests
     UDPSocket tmpCommand;
-    tmpCommand.open(ip, ARDRONE_AT_PORT);
+    tmpCommand.open(ip, ARDRONE_AT_PORT, localIp, 0, netDevice);
     tmpCommand.sendf("AT*CTRL=%d,5,0\r", ++seq);
     tmpCommand.sendf("AT*CTRL=%d,4,0\r", ++seq);
     msleep(500);
@@ -244,16 +302,11 @@ int ARDrone::getConfig(void)
         }
         #endif
 
-        // Clear config struct
-        memset(&config, 0, sizeof(config));
+        // Record it
+        if (recorder) recorder->write(ARDRONE_LOG_CONFIG, buf, size);
 
-        // Parsing configurations
-        char *token = strtok(buf, "\n");
-        if (token != NULL) parse(token, &config);
-        while (token != NULL) {
-            token = strtok(NULL, "\n");
-            if (token != NULL) parse(token, &config);
-        }
+        // Parse it
+        parseConfig(buf);
     }
 
     #if 0
@@ -400,4 +453,219 @@ int ARDrone::getConfig(void)
     sockConfig.close();
 
     return 1;
-}
\ No newline at end of file
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Parse a configuration dump.
+//! @param   buf Configuration dump ("key = value" lines, modified)
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::parseConfig(char *buf)
+{
+    // Enable mutex lock
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+
+    // Clear config struct and its shadow
+    memset(&config, 0, sizeof(config));
+    configShadow.clear();
+
+    // Parsing configurations
+    char *token = strtok(buf, "\n");
+    while (token != NULL) {
+        parse(token, &config);
+
+        // Remember the raw value to suppress redundant writes
+        std::string key, val;
+        if (split(token, &key, &val)) configShadow[key] = val;
+
+        token = strtok(NULL, "\n");
+    }
+
+    // Disable mutex lock
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Write a configuration if it differs from the drone's value.
+//! @param   key Configuration key ("category:key")
+//! @param   value Configuration value
+//! @return  Result of this function
+//! @retval  1 Success (or the drone already has the value)
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDrone::setConfig(const char *key, const char *value)
+{
+    // Skip the value that the drone already has
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    std::map<std::string, std::string>::const_iterator it = configShadow.find(key);
+    int same = (it != configShadow.end()) && compare(it->second, value);
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+    if (same) return 1;
+
+    // Send it
+    return sendConfig(key, value);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get a configuration value from the local shadow.
+//! @param   key Configuration key ("category:key")
+//! @return  Configuration value (empty if unknown)
+// --------------------------------------------------------------------------
+std::string ARDrone::getConfigValue(const char *key)
+{
+    std::string value;
+
+    // Look up the shadow
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    std::map<std::string, std::string>::const_iterator it = configShadow.find(key);
+    if (it != configShadow.end()) value = it->second;
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    return value;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Compare a configuration profile with the drone's values.
+//! @param   profile Configuration profile (key -> value)
+//! @param   diff A pointer to the keys whose values differ
+//! @return  Number of keys whose values differ
+// --------------------------------------------------------------------------
+int ARDrone::diffConfig(const ARDRONE_CONFIG_PROFILE &profile, ARDRONE_CONFIG_PROFILE *diff)
+{
+    int count = 0;
+    if (diff) diff->clear();
+
+    // Compare with the shadow
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    for (ARDRONE_CONFIG_PROFILE::const_iterator it = profile.begin(); it != profile.end(); ++it) {
+        std::map<std::string, std::string>::const_iterator found = configShadow.find(it->first);
+        if (found == configShadow.end() || !compare(found->second, it->second)) {
+            if (diff) (*diff)[it->first] = it->second;
+            count++;
+        }
+    }
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Push a whole configuration profile to the drone.
+//! @param   profile Configuration profile (key -> value)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    Only the keys whose values differ are written.
+// --------------------------------------------------------------------------
+int ARDrone::applyConfig(const ARDRONE_CONFIG_PROFILE &profile)
+{
+    // Get the keys to be written
+    ARDRONE_CONFIG_PROFILE diff;
+    if (!diffConfig(profile, &diff)) return 1;
+
+    // Write them
+    int result = 1;
+    for (ARDRONE_CONFIG_PROFILE::const_iterator it = diff.begin(); it != diff.end(); ++it) {
+        if (!sendConfig(it->first.c_str(), it->second.c_str())) result = 0;
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Wait for the acknowledgement bit of the Navdata.
+//! @param   set 1 to wait for the bit to be set, 0 to be cleared
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Timeout
+//! @note    The timeout covers several Navdata periods (15Hz in demo mode).
+// --------------------------------------------------------------------------
+int ARDrone::waitConfigAck(int set)
+{
+    // Timeout from the Navdata rate
+    pthread_mutex_lock(mutexNavdata);
+    int demo = (navdata.ardrone_state & ARDRONE_NAVDATA_DEMO_MASK) ? 1 : 0;
+    pthread_mutex_unlock(mutexNavdata);
+    double timeout = MAX(CONFIG_ACK_TIMEOUT, CONFIG_ACK_PERIODS / (demo ? 15.0 : 200.0));
+
+    // Poll the Navdata
+    for (double start = gettime(); gettime() - start < timeout; msleep(5)) {
+        pthread_mutex_lock(mutexNavdata);
+        int ack = (navdata.ardrone_state & ARDRONE_COMMAND_MASK) ? 1 : 0;
+        pthread_mutex_unlock(mutexNavdata);
+        if (ack == set) return 1;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Send a configuration and wait for its acknowledgement.
+//! @param   key Configuration key ("category:key")
+//! @param   value Configuration value
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure (not acknowledged)
+// --------------------------------------------------------------------------
+int ARDrone::sendConfig(const char *key, const char *value)
+{
+    // Clear an acknowledgement left by a previous write
+    if (mutexNavdata && !waitConfigAck(0)) {
+        if (mutexCommand) pthread_mutex_lock(mutexCommand);
+        sockCommand.sendf("AT*CTRL=%d,5,0\r", ++seq);
+        if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+        if (!waitConfigAck(0)) {
+            CVDRONE_ERROR("The acknowledgement of AT*CONFIG was not cleared. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
+    }
+
+    // Send the configuration (IDs and value in one batch)
+    char msgIds[256], msgConfig[1024];
+    UDP_PACKET packets[2];
+    int n = 0;
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    if (version.major == ARDRONE_VERSION_2) {
+        packets[n].data = msgIds;
+        packets[n].capacity = sizeof(msgIds);
+        packets[n++].size = snprintf(msgIds, sizeof(msgIds), "AT*CONFIG_IDS=%lu,\"%s\",\"%s\",\"%s\"\r", ++seq, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
+    }
+    packets[n].data = msgConfig;
+    packets[n].capacity = sizeof(msgConfig);
+    packets[n++].size = snprintf(msgConfig, sizeof(msgConfig), "AT*CONFIG=%lu,\"%s\",\"%s\"\r", ++seq, key, value);
+    sockCommand.sendMany(packets, n);
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    // Wait for the acknowledgement
+    int acknowledged = 0;
+    if (mutexNavdata) {
+        acknowledged = waitConfigAck(1);
+
+        // Reset the acknowledgement (the next write waits for it to be cleared)
+        if (acknowledged) {
+            if (mutexCommand) pthread_mutex_lock(mutexCommand);
+            sockCommand.sendf("AT*CTRL=%d,5,0\r", ++seq);
+            if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+        }
+    }
+    // Navdata is not running, so just wait like before
+    else {
+        msleep(100);
+        acknowledged = 1;
+    }
+
+    // Not acknowledged
+    if (!acknowledged) {
+        CVDRONE_ERROR("AT*CONFIG(%s) was not acknowledged. (%s, %d)\n", key, __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Update the shadow and the config struct
+    std::string line = std::string(key) + " = " + value;
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    configShadow[key] = value;
+    parse(line.c_str(), &config);
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    return 1;
+}
@@ -0,0 +1,469 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   controller.cpp
+//! @brief  Closed-loop controller on the command thread
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// Default limits (same as the configuration written by initCommand())
+#define CONTROL_MAX_SPEED   (1.0)                   // Horizontal speed [m/s]
+#define CONTROL_MAX_TILT    (12.0 * DEG_TO_RAD)     // control:euler_angle_max [rad]
+#define CONTROL_MAX_VZ      (0.7)                   // control:control_vz_max [m/s]
+#define CONTROL_MAX_VYAW    (99.0 * DEG_TO_RAD)     // control:control_yaw [rad/s]
+
+// States older than this are not controlled (the drone hovers by itself) [s]
+#define CONTROL_TIMEOUT     (0.5)
+
+// --------------------------------------------------------------------------
+//! @brief   Clamp a value.
+//! @param   value Value
+//! @param   limit Limit (positive)
+//! @return  Clamped value
+// --------------------------------------------------------------------------
+static inline double clamp(double value, double limit)
+{
+    return MAX(-limit, MIN(limit, value));
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneController class
+//! @param   rate Rate of the loop [Hz]
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneController::ARDroneController(double rate)
+{
+    period = 1.0 / MAX(1.0, MIN(200.0, rate));
+
+    // Default gains
+    setGains(ARDRONE_AXIS_POSITION, 0.8);
+    setGains(ARDRONE_AXIS_VELOCITY, 0.15, 0.05, 0.01);
+    setGains(ARDRONE_AXIS_ALTITUDE, 1.0);
+    setGains(ARDRONE_AXIS_YAW, 1.5);
+    setLimits(CONTROL_MAX_SPEED, CONTROL_MAX_TILT, CONTROL_MAX_VZ, CONTROL_MAX_VYAW);
+
+    // Hover where it is
+    memset(&setpoint, 0, sizeof(setpoint));
+    setpoint.mode = ARDRONE_CONTROL_VELOCITY;
+    reset();
+
+    mutexSetpoint = new pthread_mutex_t;
+    pthread_mutex_init(mutexSetpoint, NULL);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneController class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneController::~ARDroneController()
+{
+    pthread_mutex_destroy(mutexSetpoint);
+    delete mutexSetpoint;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the gains of a loop.
+//! @param   axis Loop (ARDRONE_CONTROL_AXIS)
+//! @param   kp Proportional gain
+//! @param   ki Integral gain
+//! @param   kd Derivative gain
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneController::setGains(int axis, double kp, double ki, double kd)
+{
+    if (axis < 0 || axis >= ARDRONE_AXIS_NUM) return;
+    GAIN gain = { kp, ki, kd };
+    gains[axis] = gain;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the limits of the outputs.
+//! @param   max_speed Horizontal speed [m/s]
+//! @param   max_tilt Tilt of control:euler_angle_max [rad]
+//! @param   max_vz Vertical speed of control:control_vz_max [m/s]
+//! @param   max_vyaw Yaw rate of control:control_yaw [rad/s]
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneController::setLimits(double max_speed, double max_tilt, double max_vz, double max_vyaw)
+{
+    maxSpeed = MAX(0.0, max_speed);
+    maxTilt  = MAX(1.0e-3, max_tilt);
+    maxVz    = MAX(1.0e-3, max_vz);
+    maxVyaw  = MAX(1.0e-3, max_vyaw);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Give a new setpoint.
+//! @param   setpoint Setpoint
+//! @return  None
+//! @note    Can be called from any thread (e.g. for each vision result).
+// --------------------------------------------------------------------------
+void ARDroneController::setSetpoint(const ARDRONE_SETPOINT &setpoint)
+{
+    pthread_mutex_lock(mutexSetpoint);
+    this->setpoint = setpoint;
+    pthread_mutex_unlock(mutexSetpoint);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the current setpoint.
+//! @param   setpoint Setpoint
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneController::getSetpoint(ARDRONE_SETPOINT *setpoint)
+{
+    pthread_mutex_lock(mutexSetpoint);
+    *setpoint = this->setpoint;
+    pthread_mutex_unlock(mutexSetpoint);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the period of the loop.
+//! @return  Period [s]
+// --------------------------------------------------------------------------
+double ARDroneController::getPeriod(void)
+{
+    return period;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Clear the integrators.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneController::reset(void)
+{
+    for (int i = 0; i < PIDS; i++) {
+        pids[i].integral = 0.0;
+        pids[i].last = 0.0;
+        pids[i].first = true;
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Run a PID loop.
+//! @param   gain Gains
+//! @param   state Integrator and the last error
+//! @param   error Error
+//! @param   dt Time step [s]
+//! @param   limit Limit of the output
+//! @return  Output
+// --------------------------------------------------------------------------
+double ARDroneController::pid(const GAIN &gain, PID &state, double error, double dt, double limit)
+{
+    // Derivative (not on the first step)
+    double derivative = state.first ? 0.0 : (error - state.last) / dt;
+    state.last = error;
+    state.first = false;
+
+    // Integral (clamped against wind-up)
+    if (gain.ki > 0.0) state.integral = clamp(state.integral + error * dt, limit / gain.ki);
+    else               state.integral = 0.0;
+
+    return clamp(gain.kp * error + gain.ki * state.integral + gain.kd * derivative, limit);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Run a step of the controller.
+//! @param   pose Current state
+//! @param   dt Time from the last step [s]
+//! @param   cmd Progressive command
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneController::update(const ARDRONE_POSE &pose, double dt, ARDRONE_PCMD *cmd)
+{
+    // Late steps are taken as one period
+    if (dt <= 0.0 || dt > 4.0 * period) dt = period;
+
+    // Setpoint
+    ARDRONE_SETPOINT sp;
+    getSetpoint(&sp);
+
+    // Horizontal velocity (position loop + feed-forward)
+    double vx = sp.vx, vy = sp.vy;
+    if (sp.mode & ARDRONE_CONTROL_POSITION) {
+        vx += pid(gains[ARDRONE_AXIS_POSITION], pids[POS_X], sp.x - pose.x, dt, maxSpeed);
+        vy += pid(gains[ARDRONE_AXIS_POSITION], pids[POS_Y], sp.y - pose.y, dt, maxSpeed);
+    }
+    else pids[POS_X].first = pids[POS_Y].first = true;
+    double speed = sqrt(vx * vx + vy * vy);
+    if (speed > maxSpeed) {
+        vx *= maxSpeed / speed;
+        vy *= maxSpeed / speed;
+    }
+
+    // Velocity error in the body frame -> tilt
+    double c = cos(pose.yaw), s = sin(pose.yaw);
+    double ex =  c * (vx - pose.vx) + s * (vy - pose.vy);
+    double ey = -s * (vx - pose.vx) + c * (vy - pose.vy);
+    double ax = pid(gains[ARDRONE_AXIS_VELOCITY], pids[VEL_X], ex, dt, maxTilt);
+    double ay = pid(gains[ARDRONE_AXIS_VELOCITY], pids[VEL_Y], ey, dt, maxTilt);
+
+    // Vertical velocity
+    double vz = sp.vz;
+    if (sp.mode & ARDRONE_CONTROL_ALTITUDE) vz += pid(gains[ARDRONE_AXIS_ALTITUDE], pids[ALT], sp.z - pose.z, dt, maxVz);
+    else                                    pids[ALT].first = true;
+
+    // Yaw rate
+    double vyaw = sp.vyaw;
+    if (sp.mode & ARDRONE_CONTROL_YAW) vyaw += pid(gains[ARDRONE_AXIS_YAW], pids[YAW], atan2(sin(sp.yaw - pose.yaw), cos(sp.yaw - pose.yaw)), dt, maxVyaw);
+    else                               pids[YAW].first = true;
+
+    // Same signs as move3D() (nose down and left roll are negative)
+    cmd->mode  = 1;
+    cmd->roll  = (float)clamp(-ay / maxTilt, 1.0);
+    cmd->pitch = (float)clamp(-ax / maxTilt, 1.0);
+    cmd->gaz   = (float)clamp(vz / maxVz, 1.0);
+    cmd->yaw   = (float)clamp(-vyaw / maxVyaw, 1.0);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start the controller on the command thread.
+//! @param   rate Rate of the loop [Hz]
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    Start the estimator or the odometry to give it the state.
+// --------------------------------------------------------------------------
+int ARDrone::startController(double rate)
+{
+    // ARDroneFleet has no command thread per drone
+    if (managed || !threadCommand) {
+        CVDRONE_ERROR("The controller needs the command thread. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Already started
+    if (controller) stopController();
+    controlSource = 0;
+
+    // Attach it to the command thread
+    ARDroneController *tmp = new ARDroneController(rate);
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    controller = tmp;
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    // Real-time priority if allowed (ignored otherwise, restored by stopController())
+    sched_param param;
+    if (pthread_getschedparam(*threadCommand, &schedPolicy, &schedParam) == 0) {
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+        schedChanged = (pthread_setschedparam(*threadCommand, SCHED_FIFO, &param) == 0);
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop the controller.
+//! @return  None
+//! @note    The drone is left hovering.
+// --------------------------------------------------------------------------
+void ARDrone::stopController(void)
+{
+    // Not started
+    if (!controller) return;
+
+    // Trajectory on it
+    stopTrajectory();
+    ARDroneController *tmp = controller;
+
+    // Detach it from the command thread, and hover
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    controller = NULL;
+    sockCommand.sendf("AT*PCMD=%d,%d,%d,%d,%d,%d\r", ++seq, 0, 0, 0, 0, 0);
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    // Previous scheduling of the command thread
+    if (schedChanged && threadCommand) pthread_setschedparam(*threadCommand, schedPolicy, &schedParam);
+    schedChanged = false;
+
+    delete tmp;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Give a new setpoint to the controller.
+//! @param   setpoint Setpoint
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Not started
+//! @note    The running trajectory is preempted.
+// --------------------------------------------------------------------------
+int ARDrone::setSetpoint(const ARDRONE_SETPOINT &setpoint)
+{
+    stopTrajectory();
+
+    int result = 0;
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    if (controller) {
+        controller->setSetpoint(setpoint);
+        result = 1;
+    }
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the gains of a loop of the controller.
+//! @param   axis Loop (ARDRONE_CONTROL_AXIS)
+//! @param   kp Proportional gain
+//! @param   ki Integral gain
+//! @param   kd Derivative gain
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Not started
+// --------------------------------------------------------------------------
+int ARDrone::setControlGains(int axis, double kp, double ki, double kd)
+{
+    int result = 0;
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    if (controller) {
+        controller->setGains(axis, kp, ki, kd);
+        result = 1;
+    }
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the state for the controller.
+//! @param   pose State from the estimator, or the odometry
+//! @return  Source of the state
+//! @retval  1 Estimator
+//! @retval  2 Odometry
+//! @retval  0 Neither is running
+//! @note    Call it with the command mutex locked (stopEstimator() and
+//!          stopOdometry() take it before deleting them).
+// --------------------------------------------------------------------------
+int ARDrone::getControlState(ARDRONE_POSE *pose)
+{
+    // Estimator
+    ARDRONE_ESTIMATE estimate;
+    if (getEstimate(&estimate)) {
+        memset(pose, 0, sizeof(ARDRONE_POSE));
+        pose->time  = estimate.time;
+        pose->x     = estimate.x;
+        pose->y     = estimate.y;
+        pose->z     = estimate.z;
+        pose->vx    = estimate.vx;
+        pose->vy    = estimate.vy;
+        pose->vz    = estimate.vz;
+        pose->roll  = estimate.roll;
+        pose->pitch = estimate.pitch;
+        pose->yaw   = estimate.yaw;
+        pose->samples = estimate.steps;
+        return 1;
+    }
+
+    // Odometry
+    return getPose(pose) ? 2 : 0;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Run a step of the controller and send the command.
+//! @param   now Current time [s]
+//! @param   dt Time from the last step [s] (0 = first step)
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::runController(double now, double dt)
+{
+    // Flying (before locking the command)
+    bool flying = !onGround();
+
+    // Trajectory events (reported after unlocking)
+    int events = 0;
+    ARDRONE_TRAJECTORY_PROGRESS progress;
+    ARDRONE_TRAJECTORY_CALLBACK callback = NULL;
+    void *arg = NULL;
+    ARDroneTrajectory *finished = NULL;
+
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+
+    // State (under the lock, so the estimator and the odometry are not deleted meanwhile)
+    ARDRONE_POSE pose;
+    int source = controller ? getControlState(&pose) : 0;
+    bool fresh = source && (now - pose.time < CONTROL_TIMEOUT);
+
+    // The estimator and the odometry have their own frames
+    if (controller && source && controlSource && source != controlSource) {
+        // Hold where it is in the new frame
+        ARDRONE_SETPOINT setpoint;
+        controller->getSetpoint(&setpoint);
+        setpoint.x = pose.x;
+        setpoint.y = pose.y;
+        setpoint.z = pose.z;
+        setpoint.yaw = pose.yaw;
+        setpoint.vx = setpoint.vy = setpoint.vz = setpoint.vyaw = 0.0;
+        controller->setSetpoint(setpoint);
+
+        // The trajectory was planned in the old frame
+        if (trajectory) {
+            events = ARDRONE_TRAJECTORY_PREEMPTED;
+            trajectory->getProgress(&progress);
+            callback = trajectoryCallback;
+            arg = trajectoryArg;
+            finished = trajectory;
+            trajectory = NULL;
+            trajectoryCallback = NULL;
+            trajectoryArg = NULL;
+        }
+
+        // Hover for this step
+        fresh = false;
+    }
+    if (source) controlSource = source;
+
+    if (controller && flying) {
+        // Hover while the state is unknown (the trajectory waits)
+        ARDRONE_PCMD cmd = { 0, 0.0f, 0.0f, 0.0f, 0.0f };
+        if (fresh && dt > 0.0) {
+            // Next setpoint of the trajectory
+            if (trajectory) {
+                ARDRONE_SETPOINT setpoint;
+                events = trajectory->advance(pose, dt, &setpoint);
+                controller->setSetpoint(setpoint);
+                trajectory->getProgress(&progress);
+                callback = trajectoryCallback;
+                arg = trajectoryArg;
+                if (events & ARDRONE_TRAJECTORY_FINISHED) {
+                    finished = trajectory;
+                    trajectory = NULL;
+                    trajectoryCallback = NULL;
+                    trajectoryArg = NULL;
+                }
+            }
+            controller->update(pose, dt, &cmd);
+        }
+        else controller->reset();
+
+        // Send a command
+        sockCommand.sendf("AT*PCMD=%d,%d,%d,%d,%d,%d\r", ++seq, cmd.mode, *(int*)(&cmd.roll), *(int*)(&cmd.pitch), *(int*)(&cmd.gaz), *(int*)(&cmd.yaw));
+    }
+    else if (controller) controller->reset();
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    // Progress
+    if (events && callback) callback(events, progress, arg);
+    delete finished;
+}
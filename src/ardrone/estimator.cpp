@@ -0,0 +1,519 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   estimator.cpp
+//! @brief  State estimator fusing Navdata and vision with an EKF
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// State: x, y, z, vx, vy, vz, yaw, bias of the yaw rate
+enum { EST_X, EST_Y, EST_Z, EST_VX, EST_VY, EST_VZ, EST_YAW, EST_BIAS };
+
+// Noise (standard deviations)
+#define EST_ACC_NOISE       (2.0)       // Acceleration (process) [m/s^2]
+#define EST_GYRO_NOISE      (0.02)      // Yaw rate [rad/s]
+#define EST_YAW_WALK        (0.2)       // Yaw without the gyro [rad/sqrt(s)]
+#define EST_BIAS_WALK       (0.001)     // Bias of the yaw rate [rad/s/sqrt(s)]
+#define EST_VEL_NOISE       (0.1)       // Velocity of the Navdata [m/s]
+#define EST_ALT_NOISE       (0.05)      // Altitude [m]
+#define EST_VZ_NOISE        (0.1)       // Vertical velocity [m/s]
+#define EST_YAW_NOISE       (0.05)      // Yaw of the demo option [rad]
+#define EST_HEADING_NOISE   (0.1)       // Heading of the magnetometer [rad]
+#define EST_GPS_UERE        (3.0)       // GPS range error (multiplied by HDOP) [m]
+
+// Gates on the squared Mahalanobis distance (99.9 %)
+#define EST_GATE_1          (10.8)
+#define EST_GATE_2          (13.8)
+#define EST_GATE_3          (16.3)
+
+// Navdata farther apart than this restart the prediction [s]
+#define EST_MAX_DT          (0.5)
+
+// Earth radius [m]
+#define EST_EARTH_RADIUS    (6378137.0)
+
+// --------------------------------------------------------------------------
+//! @brief   Order memory accesses between the writer and the readers.
+//! @return  None
+// --------------------------------------------------------------------------
+static inline void fence(void)
+{
+    #ifdef _MSC_VER
+    MemoryBarrier();
+    #else
+    __sync_synchronize();
+    #endif
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Wrap an angle into [-pi, pi].
+//! @param   angle Angle [rad]
+//! @return  Wrapped angle [rad]
+// --------------------------------------------------------------------------
+static inline double wrap(double angle)
+{
+    return atan2(sin(angle), cos(angle));
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneEstimator class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneEstimator::ARDroneEstimator()
+{
+    mutexPending = new pthread_mutex_t;
+    pthread_mutex_init(mutexPending, NULL);
+    pendings = 0;
+    seq = 0;
+    memset(&published, 0, sizeof(published));
+    reset();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneEstimator class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneEstimator::~ARDroneEstimator()
+{
+    pthread_mutex_destroy(mutexPending);
+    delete mutexPending;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Forget the state.
+//! @return  None
+//! @note    Call from the thread calling update().
+// --------------------------------------------------------------------------
+void ARDroneEstimator::reset(void)
+{
+    first = count = 0;
+    lastDroneTime = -1.0;
+    hasOrigin = false;
+    lat0 = lon0 = 0.0;
+    memset(&current, 0, sizeof(current));
+    publish();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Fuse a Navdata.
+//! @param   navdata Navdata
+//! @param   options Received options (1 << tag)
+//! @param   time Received time [s]
+//! @param   drone_time Time option [s] (negative if not sent)
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneEstimator::update(const ARDRONE_NAVDATA &navdata, unsigned int options, double time, double drone_time)
+{
+    // Measurements (same units as the getters)
+    INPUT in;
+    in.roll     =  navdata.demo.phi   * 0.001 * DEG_TO_RAD;
+    in.pitch    = -navdata.demo.theta * 0.001 * DEG_TO_RAD;
+    in.yaw      = -navdata.demo.psi   * 0.001 * DEG_TO_RAD;
+    in.vx       =  navdata.demo.vx * 0.001;
+    in.vy       = -navdata.demo.vy * 0.001;
+    in.altitude =  navdata.demo.altitude * 0.001;
+
+    // Vertical speed (only sent with the altitude option)
+    in.hasVz = (options & (1u << ARDRONE_NAVDATA_ALTITUDE_TAG)) != 0;
+    in.vz = in.hasVz ? -navdata.altitude.altitude_vz * 0.001 : 0.0;
+
+    // Yaw rate of the gyro
+    in.hasGyro = (options & (1u << ARDRONE_NAVDATA_PHYS_MEASURES_TAG)) != 0;
+    in.gyro = in.hasGyro ? -navdata.phys_measures.phys_gyros[2] * DEG_TO_RAD : 0.0;
+
+    // Heading of the calibrated magnetometer replaces the demo yaw
+    in.hasHeading = (options & (1u << ARDRONE_NAVDATA_MAGNETO_TAG)) && navdata.magneto.magneto_calibration_ok;
+    if (in.hasHeading) in.yaw = -navdata.magneto.heading_fusion_unwrapped * DEG_TO_RAD;
+
+    // GPS (X = north, Y = west) from the first fix
+    in.hasGPS = (options & (1u << ARDRONE_NAVDATA_GPS_TAG)) && navdata.gps.data_available && navdata.gps.num_sattelites >= 4;
+    in.gx = in.gy = in.gsigma = 0.0;
+    if (in.hasGPS) {
+        if (!hasOrigin) {
+            lat0 = navdata.gps.lat;
+            lon0 = navdata.gps.lon;
+            hasOrigin = true;
+        }
+        in.gx =  (navdata.gps.lat - lat0) * DEG_TO_RAD * EST_EARTH_RADIUS;
+        in.gy = -(navdata.gps.lon - lon0) * DEG_TO_RAD * EST_EARTH_RADIUS * cos(lat0 * DEG_TO_RAD);
+        in.gsigma = MAX(1.0, navdata.gps.hdop) * EST_GPS_UERE;
+    }
+
+    // Time step (on the drone's clock when sent)
+    double dt = 0.0;
+    if (count > 0) {
+        if (drone_time >= 0.0 && lastDroneTime >= 0.0) dt = drone_time - lastDroneTime;
+        else                                           dt = time - step(count - 1).time;
+        if (dt < 0.0 || dt > EST_MAX_DT) dt = 0.0;
+    }
+    lastDroneTime = drone_time;
+
+    // New step (the oldest one is overwritten)
+    if (count == HISTORY) first = (first + 1) % HISTORY;
+    else                  count++;
+    STEP &s = step(count - 1);
+    s.time = time;
+    s.dt = dt;
+    s.input = in;
+    s.visions = 0;
+
+    // Start from the previous state, or from the measurements
+    if (count > 1) {
+        const STEP &prev = step(count - 2);
+        process(s, prev.x, prev.P);
+    }
+    else {
+        EKF::State x = EKF::State::zeros();
+        x(EST_Z, 0) = in.altitude;
+        x(EST_YAW, 0) = in.yaw;
+        EKF::Covariance P = EKF::Covariance::zeros();
+        P(EST_X, EST_X) = P(EST_Y, EST_Y) = 1.0e-4;
+        P(EST_Z, EST_Z) = 0.1;
+        P(EST_VX, EST_VX) = P(EST_VY, EST_VY) = P(EST_VZ, EST_VZ) = 1.0;
+        P(EST_YAW, EST_YAW) = 0.1;
+        P(EST_BIAS, EST_BIAS) = 1.0e-4;
+        s.dt = 0.0;
+        process(s, x, P);
+    }
+
+    // Vision measurements queued meanwhile
+    VISION visions[PENDING];
+    pthread_mutex_lock(mutexPending);
+    int n = pendings;
+    for (int i = 0; i < n; i++) visions[i] = pending[i];
+    pendings = 0;
+    pthread_mutex_unlock(mutexPending);
+    for (int i = 0; i < n; i++) insert(visions[i]);
+
+    // Publish the latest state
+    const STEP &latest = step(count - 1);
+    current.time = time;
+    current.x   = latest.x(EST_X, 0);
+    current.y   = latest.x(EST_Y, 0);
+    current.z   = latest.x(EST_Z, 0);
+    current.vx  = latest.x(EST_VX, 0);
+    current.vy  = latest.x(EST_VY, 0);
+    current.vz  = latest.x(EST_VZ, 0);
+    current.roll  = in.roll;
+    current.pitch = in.pitch;
+    current.yaw   = wrap(latest.x(EST_YAW, 0));
+    current.gyro_bias = latest.x(EST_BIAS, 0);
+    current.sigma_x = sqrt(latest.P(EST_X, EST_X));
+    current.sigma_y = sqrt(latest.P(EST_Y, EST_Y));
+    current.sigma_z = sqrt(latest.P(EST_Z, EST_Z));
+    current.sigma_yaw = sqrt(latest.P(EST_YAW, EST_YAW));
+    current.steps++;
+    publish();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Run a step from a state.
+//! @param   s Step (its state is overwritten)
+//! @param   x State before the step
+//! @param   P Covariance before the step
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneEstimator::process(STEP &s, const EKF::State &x, const EKF::Covariance &P)
+{
+    const INPUT &in = s.input;
+    ekf.init(x, P);
+
+    // Prediction (constant velocity, yaw from the gyro)
+    double dt = s.dt;
+    if (dt > 0.0) {
+        EKF::State xp = ekf.x;
+        EKF::Covariance F = EKF::Covariance::eye();
+        EKF::Covariance Q = EKF::Covariance::zeros();
+        double q = EST_ACC_NOISE * EST_ACC_NOISE;
+        for (int i = 0; i < 3; i++) {
+            xp(EST_X + i, 0) += ekf.x(EST_VX + i, 0) * dt;
+            F(EST_X + i, EST_VX + i) = dt;
+            Q(EST_X + i, EST_X + i) = 0.25 * dt * dt * dt * dt * q;
+            Q(EST_X + i, EST_VX + i) = Q(EST_VX + i, EST_X + i) = 0.5 * dt * dt * dt * q;
+            Q(EST_VX + i, EST_VX + i) = dt * dt * q;
+        }
+        if (in.hasGyro) {
+            xp(EST_YAW, 0) += (in.gyro - ekf.x(EST_BIAS, 0)) * dt;
+            F(EST_YAW, EST_BIAS) = -dt;
+            Q(EST_YAW, EST_YAW) = EST_GYRO_NOISE * EST_GYRO_NOISE * dt * dt;
+        }
+        else {
+            Q(EST_YAW, EST_YAW) = EST_YAW_WALK * EST_YAW_WALK * dt;
+        }
+        Q(EST_BIAS, EST_BIAS) = EST_BIAS_WALK * EST_BIAS_WALK * dt;
+        ekf.predict(xp, F, Q);
+    }
+
+    // Velocity in the body frame
+    {
+        double yaw = ekf.x(EST_YAW, 0), c = cos(yaw), sn = sin(yaw);
+        double vx = ekf.x(EST_VX, 0), vy = ekf.x(EST_VY, 0);
+        ARMath::Matrix<2, 1> y;
+        y(0, 0) = in.vx - ( c * vx + sn * vy);
+        y(1, 0) = in.vy - (-sn * vx + c * vy);
+        ARMath::Matrix<2, STATES> H = ARMath::Matrix<2, STATES>::zeros();
+        H(0, EST_VX) =  c; H(0, EST_VY) = sn; H(0, EST_YAW) = -sn * vx + c * vy;
+        H(1, EST_VX) = -sn; H(1, EST_VY) = c; H(1, EST_YAW) = -c * vx - sn * vy;
+        ARMath::Matrix<2, 2> R = ARMath::Matrix<2, 2>::eye();
+        R(0, 0) = R(1, 1) = EST_VEL_NOISE * EST_VEL_NOISE;
+        ekf.correct(y, H, R, EST_GATE_2);
+    }
+
+    // Altitude and its rate
+    if (in.hasVz) {
+        ARMath::Matrix<2, 1> y;
+        y(0, 0) = in.altitude - ekf.x(EST_Z, 0);
+        y(1, 0) = in.vz - ekf.x(EST_VZ, 0);
+        ARMath::Matrix<2, STATES> H = ARMath::Matrix<2, STATES>::zeros();
+        H(0, EST_Z) = 1.0;
+        H(1, EST_VZ) = 1.0;
+        ARMath::Matrix<2, 2> R = ARMath::Matrix<2, 2>::zeros();
+        R(0, 0) = EST_ALT_NOISE * EST_ALT_NOISE;
+        R(1, 1) = EST_VZ_NOISE * EST_VZ_NOISE;
+        ekf.correct(y, H, R, EST_GATE_2);
+    }
+    // Altitude only (demo mode)
+    else {
+        ARMath::Matrix<1, 1> y;
+        y(0, 0) = in.altitude - ekf.x(EST_Z, 0);
+        ARMath::Matrix<1, STATES> H = ARMath::Matrix<1, STATES>::zeros();
+        H(0, EST_Z) = 1.0;
+        ARMath::Matrix<1, 1> R;
+        R(0, 0) = EST_ALT_NOISE * EST_ALT_NOISE;
+        ekf.correct(y, H, R, EST_GATE_1);
+    }
+
+    // Yaw (magnetometer or demo option)
+    {
+        ARMath::Matrix<1, 1> y;
+        y(0, 0) = wrap(in.yaw - ekf.x(EST_YAW, 0));
+        ARMath::Matrix<1, STATES> H = ARMath::Matrix<1, STATES>::zeros();
+        H(0, EST_YAW) = 1.0;
+        ARMath::Matrix<1, 1> R;
+        double sigma = in.hasHeading ? EST_HEADING_NOISE : EST_YAW_NOISE;
+        R(0, 0) = sigma * sigma;
+        ekf.correct(y, H, R, EST_GATE_1);
+    }
+
+    // GPS
+    if (in.hasGPS) {
+        ARMath::Matrix<2, 1> y;
+        y(0, 0) = in.gx - ekf.x(EST_X, 0);
+        y(1, 0) = in.gy - ekf.x(EST_Y, 0);
+        ARMath::Matrix<2, STATES> H = ARMath::Matrix<2, STATES>::zeros();
+        H(0, EST_X) = H(1, EST_Y) = 1.0;
+        ARMath::Matrix<2, 2> R = ARMath::Matrix<2, 2>::eye();
+        R(0, 0) = R(1, 1) = in.gsigma * in.gsigma;
+        ekf.correct(y, H, R, EST_GATE_2);
+    }
+
+    // Vision
+    for (int i = 0; i < s.visions; i++) {
+        const VISION &v = s.vision[i];
+        ARMath::Matrix<3, 1> y;
+        y(0, 0) = v.x - ekf.x(EST_X, 0);
+        y(1, 0) = v.y - ekf.x(EST_Y, 0);
+        y(2, 0) = v.z - ekf.x(EST_Z, 0);
+        ARMath::Matrix<3, STATES> H = ARMath::Matrix<3, STATES>::zeros();
+        H(0, EST_X) = H(1, EST_Y) = H(2, EST_Z) = 1.0;
+        ARMath::Matrix<3, 3> R = ARMath::Matrix<3, 3>::eye();
+        R(0, 0) = R(1, 1) = R(2, 2) = v.sigma * v.sigma;
+        ekf.correct(y, H, R, EST_GATE_3);
+    }
+
+    // Keep the result
+    s.x = ekf.x;
+    s.P = ekf.P;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Fuse a vision measurement at its capture time.
+//! @param   vision Vision measurement
+//! @return  None
+//! @note    The steps after the capture are run again from the step before it.
+// --------------------------------------------------------------------------
+void ARDroneEstimator::insert(const VISION &vision)
+{
+    // The latest step at or before the capture (the oldest one has no state before it)
+    int k = count - 1;
+    while (k > 0 && step(k).time > vision.time) k--;
+    if (k < 1 || step(k).visions >= STEP_VISIONS) {
+        current.dropped++;
+        return;
+    }
+
+    // Attach it to the step
+    STEP &s = step(k);
+    s.vision[s.visions++] = vision;
+    current.visions++;
+
+    // Run the steps again
+    for (int i = k; i < count; i++) {
+        const STEP &prev = step(i - 1);
+        process(step(i), prev.x, prev.P);
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Queue a vision measurement.
+//! @param   time Capture time [s] (same clock as getNavdataTime())
+//! @param   x Position [m]
+//! @param   y Position [m]
+//! @param   z Position [m]
+//! @param   sigma Standard deviation [m]
+//! @return  Result of this function
+//! @retval  1 Queued
+//! @retval  0 The queue is full
+//! @note    It is fused by the next update(), so the caller does not run the filter.
+// --------------------------------------------------------------------------
+int ARDroneEstimator::addVision(double time, double x, double y, double z, double sigma)
+{
+    VISION v = { time, x, y, z, MAX(1.0e-3, sigma) };
+
+    pthread_mutex_lock(mutexPending);
+    int result = 0;
+    if (pendings < PENDING) {
+        pending[pendings++] = v;
+        result = 1;
+    }
+    pthread_mutex_unlock(mutexPending);
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Make the current state visible to the readers.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneEstimator::publish(void)
+{
+    // The sequence number is odd while the state is written
+    seq = seq + 1;
+    fence();
+    published = current;
+    fence();
+    seq = seq + 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the latest state.
+//! @param   estimate Latest state
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 No Navdata has been fused yet
+//! @note    Does not lock, so it can be called from any thread at any rate.
+// --------------------------------------------------------------------------
+int ARDroneEstimator::getEstimate(ARDRONE_ESTIMATE *estimate)
+{
+    // Copy until the writer has not touched it meanwhile
+    ARDRONE_ESTIMATE tmp;
+    uint32_t before, after;
+    do {
+        before = seq;
+        fence();
+        memcpy(&tmp, (const void*)&published, sizeof(tmp));
+        fence();
+        after = seq;
+    } while ((before & 1) || before != after);
+
+    if (estimate) *estimate = tmp;
+
+    return (tmp.steps > 0) ? 1 : 0;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start the state estimator on the Navdata thread.
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    Full Navdata (200 Hz) gives the gyro, magnetometer and GPS options.
+// --------------------------------------------------------------------------
+int ARDrone::startEstimator(void)
+{
+    // Already started
+    if (estimator) return 1;
+
+    // Attach it to the Navdata thread
+    ARDroneEstimator *tmp = new ARDroneEstimator;
+    if (mutexNavdata) pthread_mutex_lock(mutexNavdata);
+    estimator = tmp;
+    if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop the state estimator.
+//! @return  None
+//! @note    Do not call it while other threads are calling getEstimate() or addVision().
+//!          The controller reads it under the command mutex, so it is safe for it.
+// --------------------------------------------------------------------------
+void ARDrone::stopEstimator(void)
+{
+    // Not started
+    if (!estimator) return;
+    ARDroneEstimator *tmp = estimator;
+
+    // Detach it from the Navdata thread and the controller on the command thread
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    if (mutexNavdata) pthread_mutex_lock(mutexNavdata);
+    estimator = NULL;
+    if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    delete tmp;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the state from the estimator.
+//! @param   estimate Latest state
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Not started or no Navdata yet
+//! @note    Does not lock.
+// --------------------------------------------------------------------------
+int ARDrone::getEstimate(ARDRONE_ESTIMATE *estimate)
+{
+    ARDroneEstimator *tmp = estimator;
+    if (!tmp) return 0;
+    return tmp->getEstimate(estimate);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Give a position seen by the camera to the estimator.
+//! @param   time Capture time [s] (ARDRONE_FRAME_INFO::timestamp)
+//! @param   x Position [m]
+//! @param   y Position [m]
+//! @param   z Position [m]
+//! @param   sigma Standard deviation [m]
+//! @return  Result of this function
+//! @retval  1 Queued
+//! @retval  0 Not started or the queue is full
+// --------------------------------------------------------------------------
+int ARDrone::addVision(double time, double x, double y, double z, double sigma)
+{
+    ARDroneEstimator *tmp = estimator;
+    if (!tmp) return 0;
+    return tmp->addVision(time, x, y, z, sigma);
+}
@@ -0,0 +1,537 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   fleet.cpp
+//! @brief  Driving many AR.Drones from one event loop
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// Linux uses epoll, others use select()
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+// Fleet parameters
+#define FLEET_TICK_MS       (100)   // Period of Watch-Dog / Navdata requests [ms]
+#define FLEET_MAX_EVENTS    (64)    // Number of events handled at once
+#define FLEET_MAX_PACKETS   (30)    // Number of queued video packets per drone
+
+// Kinds of sockets (the lowest bit of the event data)
+#define FLEET_EVENT_NAVDATA (0)
+#define FLEET_EVENT_VIDEO   (1)
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneFleet class
+//! @param   nb_decoders Number of threads shared for video decoding
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneFleet::ARDroneFleet(int nb_decoders)
+{
+    // Drones
+    lastId = 0;
+
+    // Event loop
+    quit = false;
+    lastTick = cv::getTickCount();
+    #ifdef __linux__
+    epfd = epoll_create(FLEET_MAX_EVENTS);
+    if (epfd < 0) CVDRONE_ERROR("epoll_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+    #else
+    epfd = -1;
+    #endif
+
+    // Create a mutex and conditions
+    mutexFleet = new pthread_mutex_t;
+    pthread_mutex_init(mutexFleet, NULL);
+    condDecode = new pthread_cond_t;
+    pthread_cond_init(condDecode, NULL);
+    condIdle = new pthread_cond_t;
+    pthread_cond_init(condIdle, NULL);
+
+    // Create a thread for I/O
+    threadIO = new pthread_t;
+    if (pthread_create(threadIO, NULL, runIO, this) != 0) {
+        CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+        delete threadIO;
+        threadIO = NULL;
+    }
+
+    // Create threads for decoding
+    for (int i = 0; i < MAX(1, nb_decoders); i++) {
+        pthread_t *thread = new pthread_t;
+        if (pthread_create(thread, NULL, runDecode, this) != 0) {
+            CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+            delete thread;
+            break;
+        }
+        threadDecoders.push_back(thread);
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneFleet class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneFleet::~ARDroneFleet()
+{
+    // Remove all drones
+    close();
+
+    // Stop the threads
+    pthread_mutex_lock(mutexFleet);
+    quit = true;
+    pthread_cond_broadcast(condDecode);
+    pthread_mutex_unlock(mutexFleet);
+
+    // Destroy the thread for I/O
+    if (threadIO) {
+        pthread_join(*threadIO, NULL);
+        delete threadIO;
+        threadIO = NULL;
+    }
+
+    // Destroy the threads for decoding
+    for (size_t i = 0; i < threadDecoders.size(); i++) {
+        pthread_join(*threadDecoders[i], NULL);
+        delete threadDecoders[i];
+    }
+    threadDecoders.clear();
+
+    // Delete the mutex and conditions
+    pthread_cond_destroy(condIdle);
+    delete condIdle;
+    pthread_cond_destroy(condDecode);
+    delete condDecode;
+    pthread_mutex_destroy(mutexFleet);
+    delete mutexFleet;
+
+    // Close the event loop
+    #ifdef __linux__
+    if (epfd >= 0) ::close(epfd);
+    #endif
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Open an AR.Drone and add it to the fleet.
+//! @param   ardrone_addr IP address of AR.Drone
+//! @param   local_addr Local IP address to be bound (NULL for any)
+//! @param   device Network device to be bound (NULL for any, Linux only)
+//! @return  A handle of the drone
+//! @retval  NULL Failure
+// --------------------------------------------------------------------------
+ARDrone* ARDroneFleet::open(const char *ardrone_addr, const char *local_addr, const char *device)
+{
+    // Initialize without threads
+    ARDrone *drone = new ARDrone();
+    drone->managed = true;
+    if (!drone->open(ardrone_addr, local_addr, device)) {
+        delete drone;
+        return NULL;
+    }
+
+    // Enable mutex lock
+    pthread_mutex_lock(mutexFleet);
+
+    // Add an entry
+    ENTRY *entry = new ENTRY;
+    entry->id = ++lastId;
+    entry->drone = drone;
+    entry->queued = false;
+    entry->busy = false;
+    entry->waitKeyFrame = false;
+    entry->videoLost = false;
+    entries.push_back(entry);
+
+    // Watch the sockets
+    #ifdef __linux__
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((uint64_t)entry->id << 1) | FLEET_EVENT_NAVDATA;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, drone->sockNavdata.getSocket(), &ev);
+    ev.data.u64 = ((uint64_t)entry->id << 1) | FLEET_EVENT_VIDEO;
+    if (drone->version.major == ARDRONE_VERSION_2) epoll_ctl(epfd, EPOLL_CTL_ADD, drone->sockStream.getSocket(), &ev);
+    else                                           epoll_ctl(epfd, EPOLL_CTL_ADD, drone->sockVideo.getSocket(),  &ev);
+    #endif
+
+    // Disable mutex lock
+    pthread_mutex_unlock(mutexFleet);
+
+    // Wait for the first Navdata received by the event loop
+    for (int i = 0; i < 50; i++) {
+        pthread_mutex_lock(drone->mutexNavdata);
+        unsigned int sequence = drone->navdata.sequence;
+        pthread_mutex_unlock(drone->mutexNavdata);
+        if (sequence) break;
+        msleep(10);
+    }
+
+    // Reset emergency
+    drone->resetWatchDog();
+    drone->resetEmergency();
+
+    return drone;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Close an AR.Drone and remove it from the fleet.
+//! @param   ardrone A handle of the drone
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneFleet::close(ARDrone *ardrone)
+{
+    // Enable mutex lock
+    pthread_mutex_lock(mutexFleet);
+
+    // Find the entry
+    ENTRY *entry = NULL;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i]->drone == ardrone) {
+            entry = entries[i];
+            entries.erase(entries.begin() + i);
+            break;
+        }
+    }
+
+    // Not found
+    if (!entry) {
+        pthread_mutex_unlock(mutexFleet);
+        return;
+    }
+
+    // Stop watching the sockets
+    #ifdef __linux__
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(epfd, EPOLL_CTL_DEL, ardrone->sockNavdata.getSocket(), &ev);
+    if (!entry->videoLost) {
+        if (ardrone->version.major == ARDRONE_VERSION_2) epoll_ctl(epfd, EPOLL_CTL_DEL, ardrone->sockStream.getSocket(), &ev);
+        else                                             epoll_ctl(epfd, EPOLL_CTL_DEL, ardrone->sockVideo.getSocket(),  &ev);
+    }
+    #endif
+
+    // Cancel decoding
+    for (size_t i = 0; i < ready.size(); i++) {
+        if (ready[i] == entry) {
+            ready.erase(ready.begin() + i);
+            break;
+        }
+    }
+    entry->packets.clear();
+
+    // Wait for the decoder
+    while (entry->busy) pthread_cond_wait(condIdle, mutexFleet);
+
+    // Disable mutex lock
+    pthread_mutex_unlock(mutexFleet);
+
+    // See you
+    ardrone->close();
+    delete ardrone;
+    delete entry;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Close all AR.Drones.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneFleet::close(void)
+{
+    while (1) {
+        // Get the last drone
+        pthread_mutex_lock(mutexFleet);
+        ARDrone *drone = entries.empty() ? NULL : entries.back()->drone;
+        pthread_mutex_unlock(mutexFleet);
+
+        // Remove it
+        if (!drone) break;
+        close(drone);
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the number of AR.Drones.
+//! @return  Number of drones
+// --------------------------------------------------------------------------
+int ARDroneFleet::size(void)
+{
+    pthread_mutex_lock(mutexFleet);
+    int n = (int)entries.size();
+    pthread_mutex_unlock(mutexFleet);
+    return n;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get an AR.Drone.
+//! @param   index Index of the drone
+//! @return  A handle of the drone
+//! @retval  NULL Out of range
+// --------------------------------------------------------------------------
+ARDrone* ARDroneFleet::operator [] (int index)
+{
+    pthread_mutex_lock(mutexFleet);
+    ARDrone *drone = (index >= 0 && index < (int)entries.size()) ? entries[index]->drone : NULL;
+    pthread_mutex_unlock(mutexFleet);
+    return drone;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Find an entry by its ID.
+//! @param   id ID of the entry
+//! @return  The entry
+//! @retval  NULL Not found (already removed)
+// --------------------------------------------------------------------------
+ARDroneFleet::ENTRY* ARDroneFleet::find(unsigned int id)
+{
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i]->id == id) return entries[i];
+    }
+    return NULL;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Thread function for I/O of all drones.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneFleet::loopIO(void)
+{
+    while (1) {
+        // Time until the next tick [ms]
+        int elapsed = (int)((cv::getTickCount() - lastTick) * 1000 / cv::getTickFrequency());
+        int timeout = MAX(0, FLEET_TICK_MS - elapsed);
+
+        #ifdef __linux__
+        // Wait for events
+        epoll_event events[FLEET_MAX_EVENTS];
+        int n = epoll_wait(epfd, events, FLEET_MAX_EVENTS, timeout);
+
+        // Enable mutex lock
+        pthread_mutex_lock(mutexFleet);
+        if (quit) {
+            pthread_mutex_unlock(mutexFleet);
+            break;
+        }
+
+        // Handle the events
+        for (int i = 0; i < n; i++) {
+            ENTRY *entry = find((unsigned int)(events[i].data.u64 >> 1));
+            if (!entry) continue;
+            if ((events[i].data.u64 & 1) == FLEET_EVENT_VIDEO) handleVideo(entry);
+            else                                                handleNavdata(entry);
+        }
+        #else
+        // Make a set of sockets
+        fd_set fds;
+        FD_ZERO(&fds);
+        SOCKET maxfd = 0;
+        pthread_mutex_lock(mutexFleet);
+        for (size_t i = 0; i < entries.size(); i++) {
+            ARDrone *drone = entries[i]->drone;
+            SOCKET sock[2] = {drone->sockNavdata.getSocket(), (drone->version.major == ARDRONE_VERSION_2) ? drone->sockStream.getSocket() : drone->sockVideo.getSocket()};
+            if (entries[i]->videoLost) sock[1] = INVALID_SOCKET;
+            for (int j = 0; j < 2; j++) {
+                if (sock[j] == INVALID_SOCKET) continue;
+                FD_SET(sock[j], &fds);
+                maxfd = MAX(maxfd, sock[j]);
+            }
+        }
+        bool empty = entries.empty();
+        pthread_mutex_unlock(mutexFleet);
+
+        // Wait for events
+        if (empty) msleep(timeout);
+        else {
+            timeval tv;
+            tv.tv_sec = 0;
+            tv.tv_usec = timeout * 1000;
+            select((int)maxfd + 1, &fds, NULL, NULL, &tv);
+        }
+
+        // Enable mutex lock
+        pthread_mutex_lock(mutexFleet);
+        if (quit) {
+            pthread_mutex_unlock(mutexFleet);
+            break;
+        }
+
+        // Handle the events
+        for (size_t i = 0; i < entries.size() && !empty; i++) {
+            ARDrone *drone = entries[i]->drone;
+            SOCKET sockNavdata = drone->sockNavdata.getSocket();
+            SOCKET sockVideo   = (drone->version.major == ARDRONE_VERSION_2) ? drone->sockStream.getSocket() : drone->sockVideo.getSocket();
+            if (sockNavdata != INVALID_SOCKET && FD_ISSET(sockNavdata, &fds)) handleNavdata(entries[i]);
+            if (sockVideo   != INVALID_SOCKET && !entries[i]->videoLost && FD_ISSET(sockVideo, &fds)) handleVideo(entries[i]);
+        }
+        #endif
+
+        // Periodic requests
+        if (cv::getTickCount() - lastTick >= FLEET_TICK_MS * cv::getTickFrequency() / 1000) {
+            tick();
+            lastTick = cv::getTickCount();
+        }
+
+        // Disable mutex lock
+        pthread_mutex_unlock(mutexFleet);
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Send periodic requests to all drones.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneFleet::tick(void)
+{
+    for (size_t i = 0; i < entries.size(); i++) {
+        ARDrone *drone = entries[i]->drone;
+
+        // Reset Watch-Dog
+        if (drone->mutexCommand) pthread_mutex_lock(drone->mutexCommand);
+        drone->sockCommand.sendf("AT*COMWDG=%d\r", ++drone->seq);
+        if (drone->mutexCommand) pthread_mutex_unlock(drone->mutexCommand);
+
+        // Keep Navdata
+        drone->sockNavdata.sendf("\x01\x00\x00\x00");
+
+        // Keep video (AR.Drone 1.0)
+        if (drone->version.major != ARDRONE_VERSION_2) drone->sockVideo.sendf("\x01\x00\x00\x00");
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Receive Navdata of a drone.
+//! @param   entry The drone
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneFleet::handleNavdata(ENTRY *entry)
+{
+    // Receive all queued packets at once
+    const int n = 8;
+    char buf[n][4096];
+    UDP_PACKET packets[n];
+    for (int i = 0; i < n; i++) {
+        packets[i].data = buf[i];
+        packets[i].capacity = sizeof(buf[i]);
+    }
+    int received = entry->drone->sockNavdata.receiveMany(packets, n, 0);
+
+    // Parse them in order
+    for (int i = 0; i < received; i++) entry->drone->parseNavdata((const char*)packets[i].data, packets[i].size, packets[i].timestamp);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Receive video of a drone and pass it to the decoders.
+//! @param   entry The drone
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneFleet::handleVideo(ENTRY *entry)
+{
+    ARDrone *drone = entry->drone;
+    if (entry->videoLost) return;
+
+    // Connection lost, stop watching it (TCP on 2.0, UDP on 1.0)
+    if (drone->receiveVideo() < 0) {
+        #ifdef __linux__
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        if (drone->version.major == ARDRONE_VERSION_2) epoll_ctl(epfd, EPOLL_CTL_DEL, drone->sockStream.getSocket(), &ev);
+        else                                           epoll_ctl(epfd, EPOLL_CTL_DEL, drone->sockVideo.getSocket(),  &ev);
+        #endif
+        if (drone->version.major == ARDRONE_VERSION_2) drone->sockStream.close();
+        else                                           drone->sockVideo.close();
+        entry->videoLost = true;
+        CVDRONE_ERROR("Video of the drone %u was lost. (%s, %d)\n", entry->id, __FILE__, __LINE__);
+        return;
+    }
+
+    // Queue complete packets
+    ARDRONE_VIDEO_PACKET packet;
+    while (drone->extractVideo(&packet)) {
+        // Decoders are too late, drop them
+        if (entry->packets.size() >= FLEET_MAX_PACKETS) {
+            entry->packets.clear();
+            entry->waitKeyFrame = true;
+        }
+
+        // Restart from a key frame
+        if (entry->waitKeyFrame) {
+            int type = packet.header.frame_type;
+            if (drone->version.major == ARDRONE_VERSION_2 && type != ARDRONE_PAVE_FRAME_IDR && type != ARDRONE_PAVE_FRAME_I) continue;
+            entry->waitKeyFrame = false;
+        }
+
+        // Queue it without copying the payload
+        entry->packets.push_back(ARDRONE_VIDEO_PACKET());
+        entry->packets.back().header = packet.header;
+        entry->packets.back().data.swap(packet.data);
+    }
+
+    // Wake up a decoder
+    if (!entry->packets.empty() && !entry->queued && !entry->busy) {
+        ready.push_back(entry);
+        entry->queued = true;
+        pthread_cond_signal(condDecode);
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Thread function for decoding video of all drones.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneFleet::loopDecode(void)
+{
+    while (1) {
+        // Wait for a drone to be decoded
+        pthread_mutex_lock(mutexFleet);
+        while (!quit && ready.empty()) pthread_cond_wait(condDecode, mutexFleet);
+        if (quit) {
+            pthread_mutex_unlock(mutexFleet);
+            break;
+        }
+
+        // Take its packets (one decoder per drone at a time)
+        ENTRY *entry = ready.front();
+        ready.pop_front();
+        entry->queued = false;
+        entry->busy = true;
+        std::deque<ARDRONE_VIDEO_PACKET> packets;
+        packets.swap(entry->packets);
+        pthread_mutex_unlock(mutexFleet);
+
+        // Decode them
+        for (size_t i = 0; i < packets.size(); i++) {
+            entry->drone->decodeVideo(packets[i]);
+        }
+
+        // Done
+        pthread_mutex_lock(mutexFleet);
+        entry->busy = false;
+        if (!entry->packets.empty()) {
+            ready.push_back(entry);
+            entry->queued = true;
+            pthread_cond_signal(condDecode);
+        }
+        pthread_cond_broadcast(condIdle);
+        pthread_mutex_unlock(mutexFleet);
+    }
+}
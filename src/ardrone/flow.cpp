@@ -0,0 +1,336 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   flow.cpp
+//! @brief  Sparse optical-flow odometry
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// Feature tracking
+#define FLOW_MAX_ERROR      (2.0)           // Smallest residual treated as an outlier [px]
+#define FLOW_MIN_INLIERS    (6)             // Features needed for a motion
+
+// Bottom camera of AR.Drone 2.0 (horizontal field of view [deg])
+#define FLOW_DEFAULT_FOV    (64.0)
+
+// --------------------------------------------------------------------------
+//! @brief   Fit a similarity transform (rotation, scale, translation).
+//! @param   src Points in the last frame
+//! @param   dst Points in this frame
+//! @param   use Points to be used (NULL = all)
+//! @param   center Point where the translation is measured [px]
+//! @param   flow Rotation, scale and shift
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+static int fitSimilarity(const std::vector<cv::Point2f> &src, const std::vector<cv::Point2f> &dst, const std::vector<uchar> *use, const cv::Point2d &center, ARDRONE_FLOW *flow)
+{
+    // Centroids
+    cv::Point2d ms(0.0, 0.0), md(0.0, 0.0);
+    int n = 0;
+    for (size_t i = 0; i < src.size(); i++) {
+        if (use && !(*use)[i]) continue;
+        ms += cv::Point2d(src[i]);
+        md += cv::Point2d(dst[i]);
+        n++;
+    }
+    if (n < 2) return 0;
+    ms *= 1.0 / n;
+    md *= 1.0 / n;
+
+    // Least squares on the centered points
+    double a = 0.0, b = 0.0, norm = 0.0;
+    for (size_t i = 0; i < src.size(); i++) {
+        if (use && !(*use)[i]) continue;
+        cv::Point2d p = cv::Point2d(src[i]) - ms;
+        cv::Point2d q = cv::Point2d(dst[i]) - md;
+        a += p.x * q.x + p.y * q.y;
+        b += p.x * q.y - p.y * q.x;
+        norm += p.x * p.x + p.y * p.y;
+    }
+    if (norm < 1e-6) return 0;
+    a /= norm;
+    b /= norm;
+
+    // Motion of the center
+    cv::Point2d c = center - ms;
+    flow->rotation = atan2(b, a);
+    flow->scale = sqrt(a * a + b * b);
+    flow->shift = md + cv::Point2d(a * c.x - b * c.y, b * c.x + a * c.y) - center;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneOpticalFlow class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneOpticalFlow::ARDroneOpticalFlow()
+{
+    maxCorners = 200;
+    minCorners = 80;
+    quality = 0.01;
+    minDistance = 10.0;
+    winSize = 21;
+    maxLevel = 3;
+    fx = fy = 0.0;
+    gain = 0.5;
+    reset();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneOpticalFlow class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneOpticalFlow::~ARDroneOpticalFlow()
+{
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the features to be tracked.
+//! @param   max_corners Features detected at most
+//! @param   min_corners New features are detected when fewer are tracked
+//! @param   quality Quality level of cv::goodFeaturesToTrack
+//! @param   min_distance Distance between the features [px]
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneOpticalFlow::setFeatures(int max_corners, int min_corners, double quality, double min_distance)
+{
+    maxCorners = MAX(FLOW_MIN_INLIERS, max_corners);
+    minCorners = MAX(FLOW_MIN_INLIERS, MIN(maxCorners, min_corners));
+    this->quality = quality;
+    minDistance = MAX(1.0, min_distance);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the Lucas-Kanade window.
+//! @param   size Window size [px]
+//! @param   levels Pyramid levels above the image
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneOpticalFlow::setWindow(int size, int levels)
+{
+    winSize = MAX(5, size);
+    maxLevel = MAX(0, levels);
+    reset();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the focal length to convert the flow into a velocity.
+//! @param   fx Horizontal focal length [px] (0 = 64 deg of the bottom camera)
+//! @param   fy Vertical focal length [px] (0 = same as fx)
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneOpticalFlow::setFocalLength(double fx, double fy)
+{
+    this->fx = MAX(0.0, fx);
+    this->fy = (fy > 0.0) ? fy : this->fx;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set how much the flow is trusted against the Navdata.
+//! @param   gain Weight of the flow velocity (0 = Navdata only, 1 = flow only)
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneOpticalFlow::setFusionGain(double gain)
+{
+    this->gain = MAX(0.0, MIN(1.0, gain));
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Forget the features and the last frame.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneOpticalFlow::reset(void)
+{
+    points.clear();
+    prevTracks.clear();
+    tracks.clear();
+    hasPrev = false;
+    prevInfo = ARDRONE_FRAME_INFO();
+    prevTime = 0.0;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Track the features into a new frame.
+//! @param   image BGR or gray image
+//! @param   flow Motion from the last frame
+//! @param   info Navdata at the capture (NULL = no velocity)
+//! @return  Result of this function
+//! @retval  1 Motion was estimated
+//! @retval  0 Failure (first frame or too few features)
+//! @note    The features and the pyramid of the last frame are kept, so each frame
+//!          is converted and its pyramid built only once. New features are
+//!          detected only when fewer than min_corners are left.
+// --------------------------------------------------------------------------
+int ARDroneOpticalFlow::update(const cv::Mat &image, ARDRONE_FLOW *flow, const ARDRONE_FRAME_INFO *info)
+{
+    *flow = ARDRONE_FLOW();
+    flow->scale = 1.0;
+
+    // Not an image
+    if (image.empty() || image.depth() != CV_8U) return 0;
+
+    // Gray image (only converted when needed)
+    if (image.channels() == 3) cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+    else if (image.channels() == 4) cv::cvtColor(image, gray, cv::COLOR_BGRA2GRAY);
+    else if (image.channels() != 1) return 0;
+    const cv::Mat &frame = (image.channels() == 1) ? image : gray;
+
+    // Size changed
+    if (hasPrev && prevPyramid[0].size() != frame.size()) reset();
+
+    // Pyramid of this frame (buffers of the frame before last are reused)
+    cv::Size win(winSize, winSize);
+    cv::buildOpticalFlowPyramid(frame, pyramid, win, maxLevel);
+
+    // Time
+    double now = info ? info->timestamp : gettime();
+    if (hasPrev) flow->dt = now - prevTime;
+
+    // Track the features
+    prevTracks.clear();
+    tracks.clear();
+    if (hasPrev && !points.empty()) {
+        cv::calcOpticalFlowPyrLK(prevPyramid, pyramid, points, next, status, errors, win, maxLevel);
+
+        // Keep the tracked ones
+        for (size_t i = 0; i < points.size(); i++) {
+            if (!status[i]) continue;
+            prevTracks.push_back(points[i]);
+            tracks.push_back(next[i]);
+        }
+        flow->tracked = (int)tracks.size();
+
+        // Motion of the image center (fitted twice without the outliers, e.g. moving objects)
+        cv::Point2d center(frame.cols * 0.5, frame.rows * 0.5);
+        if ((int)tracks.size() >= FLOW_MIN_INLIERS && fitSimilarity(prevTracks, tracks, NULL, center, flow)) {
+            double c = cos(flow->rotation) * flow->scale, s = sin(flow->rotation) * flow->scale;
+            residuals.resize(tracks.size());
+            for (size_t i = 0; i < tracks.size(); i++) {
+                cv::Point2d p = cv::Point2d(prevTracks[i]) - center;
+                cv::Point2d q = center + flow->shift + cv::Point2d(c * p.x - s * p.y, s * p.x + c * p.y);
+                residuals[i] = (float)cv::norm(cv::Point2d(tracks[i]) - q);
+            }
+            sorted = residuals;
+            std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+            float limit = MAX((float)FLOW_MAX_ERROR, 3.0f * sorted[sorted.size() / 2]);
+            inliers.resize(tracks.size());
+            for (size_t i = 0; i < tracks.size(); i++) {
+                inliers[i] = (residuals[i] <= limit);
+                flow->inliers += inliers[i];
+            }
+            if (flow->inliers >= FLOW_MIN_INLIERS) flow->valid = fitSimilarity(prevTracks, tracks, &inliers, center, flow);
+
+            // Drop the outliers
+            size_t n = 0;
+            for (size_t i = 0; i < tracks.size(); i++) {
+                if (!inliers[i]) continue;
+                prevTracks[n] = prevTracks[i];
+                tracks[n++] = tracks[i];
+            }
+            prevTracks.resize(n);
+            tracks.resize(n);
+        }
+    }
+
+    // Velocity of the drone (bottom camera, image top = front)
+    if (flow->valid && info && hasPrev && flow->dt > 0.0 && info->altitude > 0.0) {
+        double f = (fx > 0.0) ? fx : (frame.cols * 0.5) / tan(FLOW_DEFAULT_FOV * 0.5 * CV_PI / 180.0);
+        double g = (fy > 0.0) ? fy : f;
+
+        // Take the rotation of the drone away
+        double du = flow->shift.x + f * (info->roll  - prevInfo.roll);
+        double dv = flow->shift.y - g * (info->pitch - prevInfo.pitch);
+
+        // Ground moves against the drone
+        double z = 0.5 * (info->altitude + prevInfo.altitude);
+        flow->vx =  dv * z / (g * flow->dt);
+        flow->vy =  du * z / (f * flow->dt);
+        flow->hasVelocity = 1;
+    }
+
+    // Detect new features when too few are left
+    points.assign(tracks.begin(), tracks.end());
+    if ((int)points.size() < minCorners) {
+        mask.create(frame.size(), CV_8UC1);
+        mask.setTo(255);
+        for (size_t i = 0; i < points.size(); i++) {
+            cv::circle(mask, points[i], cvRound(minDistance), cv::Scalar(0), -1);
+        }
+        cv::goodFeaturesToTrack(frame, corners, maxCorners - (int)points.size(), quality, minDistance, mask);
+        points.insert(points.end(), corners.begin(), corners.end());
+        flow->detected = (int)corners.size();
+    }
+
+    // This frame is the last one
+    pyramid.swap(prevPyramid);
+    prevInfo = info ? *info : ARDRONE_FRAME_INFO();
+    prevTime = now;
+    hasPrev = true;
+
+    return flow->valid;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Fuse the flow velocity with the Navdata velocity.
+//! @param   flow Result of update()
+//! @param   info Navdata at the capture
+//! @param   vx Forward velocity [m/s]
+//! @param   vy Left velocity [m/s]
+//! @return  Result of this function
+//! @retval  1 Fused
+//! @retval  0 Navdata only
+//! @note    The flow is trusted less when fewer features agree.
+// --------------------------------------------------------------------------
+int ARDroneOpticalFlow::fuse(const ARDRONE_FLOW &flow, const ARDRONE_FRAME_INFO &info, double *vx, double *vy)
+{
+    // Navdata only
+    if (!flow.hasVelocity) {
+        if (vx) *vx = info.vx;
+        if (vy) *vy = info.vy;
+        return 0;
+    }
+
+    // Weighted by the features
+    double k = gain * MIN(1.0, (double)flow.inliers / minCorners);
+    if (vx) *vx = info.vx + k * (flow.vx - info.vx);
+    if (vy) *vy = info.vy + k * (flow.vy - info.vy);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the features followed by the last update().
+//! @param   prev Positions in the last frame [px]
+//! @param   curr Positions in this frame [px]
+//! @return  Number of the features
+// --------------------------------------------------------------------------
+int ARDroneOpticalFlow::getTracks(std::vector<cv::Point2f> *prev, std::vector<cv::Point2f> *curr)
+{
+    if (prev) *prev = prevTracks;
+    if (curr) *curr = tracks;
+    return (int)tracks.size();
+}
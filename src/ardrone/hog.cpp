@@ -0,0 +1,340 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   hog.cpp
+//! @brief  Amortised HOG person detector
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// Scanning
+#define HOG_WIN_STRIDE          (8)         // Step of the detection window [px]
+#define HOG_GROUP_THRESHOLD     (1)         // Hits needed to keep a group - 1 (see cv::groupRectangles)
+#define HOG_GROUP_EPS           (0.2)       // Similarity of grouped rectangles
+
+// Tracking between the results
+#define HOG_TRACK_GRID          (4)         // Points per side of a detection
+#define HOG_TRACK_MIN_POINTS    (4)         // Points needed to move a detection
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneHOGDetector class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneHOGDetector::ARDroneHOGDetector()
+{
+    scale = 0.5;
+    levelScale = 1.2;
+    levelsPerFrame = 2;
+    levelCount = 0;
+    nextLevel = 0;
+    hasResults = false;
+    busy = false;
+    quit = false;
+    timing = ARDRONE_HOG_TIMING();
+    threadDetect = NULL;
+    mutexDetect = NULL;
+    condDetect = NULL;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneHOGDetector class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneHOGDetector::~ARDroneHOGDetector()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start the detector thread.
+//! @param   scale Scale of the image to be scanned (e.g. 0.5 = half size)
+//! @param   levels_per_frame Pyramid levels scanned for a frame
+//! @param   level_scale Scale between the pyramid levels
+//! @return  Result of initialization
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    People smaller than 128/scale pixels are not found.
+// --------------------------------------------------------------------------
+int ARDroneHOGDetector::open(double scale, int levels_per_frame, double level_scale)
+{
+    // Stop the previous thread
+    close();
+
+    // Parameters
+    this->scale = MAX(0.1, MIN(1.0, scale));
+    levelsPerFrame = MAX(1, levels_per_frame);
+    levelScale = MAX(1.05, level_scale);
+    hog.setSVMDetector(cv::HOGDescriptor::getDefaultPeopleDetector());
+
+    // Reset the state
+    levelCount = 0;
+    nextLevel = 0;
+    sweep.clear();
+    results.clear();
+    detections.clear();
+    hasResults = false;
+    busy = false;
+    quit = false;
+    timing = ARDRONE_HOG_TIMING();
+    prevGray.release();
+
+    // Create a mutex and a condition
+    mutexDetect = new pthread_mutex_t;
+    pthread_mutex_init(mutexDetect, NULL);
+    condDetect = new pthread_cond_t;
+    pthread_cond_init(condDetect, NULL);
+
+    // Create a thread
+    threadDetect = new pthread_t;
+    if (pthread_create(threadDetect, NULL, runDetect, this) != 0) {
+        CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+        delete threadDetect;
+        threadDetect = NULL;
+        close();
+        return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Give a frame to the detector.
+//! @param   image BGR or gray image
+//! @param   found Detected people moved to this frame [px]
+//! @return  Result of this function
+//! @retval  1 The frame was handed to the detector thread
+//! @retval  0 The thread was busy (only tracked)
+//! @note    The detector scans a few pyramid levels of each frame it takes, so
+//!          results for all levels arrive every few frames. In between, the
+//!          detections are moved by the optical flow.
+// --------------------------------------------------------------------------
+int ARDroneHOGDetector::push(const cv::Mat &image, std::vector<cv::Rect> *found)
+{
+    if (found) found->clear();
+
+    // Not opened
+    if (!threadDetect || image.empty() || image.depth() != CV_8U) return 0;
+
+    // Gray and downscaled
+    double t0 = gettime();
+    if (image.channels() == 3) cv::cvtColor(image, full, cv::COLOR_BGR2GRAY);
+    else if (image.channels() == 4) cv::cvtColor(image, full, cv::COLOR_BGRA2GRAY);
+    else if (image.channels() != 1) return 0;
+    const cv::Mat &src = (image.channels() == 1) ? image : full;
+    cv::resize(src, gray, cv::Size(cvRound(src.cols * scale), cvRound(src.rows * scale)), 0.0, 0.0, cv::INTER_AREA);
+    double t1 = gettime();
+
+    pthread_mutex_lock(mutexDetect);
+
+    // New results (they replace the tracked ones)
+    if (hasResults) {
+        detections.assign(results.begin(), results.end());
+        hasResults = false;
+    }
+
+    // Hand the frame to the thread
+    int queued = 0;
+    if (!busy) {
+        gray.copyTo(job);
+        busy = true;
+        queued = 1;
+        pthread_cond_signal(condDetect);
+    }
+    timing.convert = (t1 - t0) * 1000.0;
+
+    pthread_mutex_unlock(mutexDetect);
+
+    // Move the detections
+    double t2 = gettime();
+    if (!prevGray.empty() && prevGray.size() == gray.size()) track();
+    double t3 = gettime();
+    cv::swap(prevGray, gray);
+
+    pthread_mutex_lock(mutexDetect);
+    timing.track = (t3 - t2) * 1000.0;
+    pthread_mutex_unlock(mutexDetect);
+
+    // Detections in the full image
+    if (found) {
+        for (size_t i = 0; i < detections.size(); i++) {
+            cv::Rect2d r = detections[i];
+            found->push_back(cv::Rect(cvRound(r.x / scale), cvRound(r.y / scale), cvRound(r.width / scale), cvRound(r.height / scale)));
+        }
+    }
+
+    return queued;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Move the detections by the optical flow.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneHOGDetector::track(void)
+{
+    if (detections.empty()) return;
+
+    // Grid points in each detection
+    points.clear();
+    for (size_t i = 0; i < detections.size(); i++) {
+        const cv::Rect2d &r = detections[i];
+        for (int y = 0; y < HOG_TRACK_GRID; y++) {
+            for (int x = 0; x < HOG_TRACK_GRID; x++) {
+                points.push_back(cv::Point2f((float)(r.x + r.width  * (x + 0.5) / HOG_TRACK_GRID),
+                                             (float)(r.y + r.height * (y + 0.5) / HOG_TRACK_GRID)));
+            }
+        }
+    }
+
+    // Optical flow
+    cv::calcOpticalFlowPyrLK(prevGray, gray, points, moved, status, errors, cv::Size(15, 15), 2);
+
+    // Median shift of each detection
+    const int n = HOG_TRACK_GRID * HOG_TRACK_GRID;
+    for (size_t i = 0; i < detections.size(); i++) {
+        dx.clear();
+        dy.clear();
+        for (int j = 0; j < n; j++) {
+            size_t k = i * n + j;
+            if (!status[k]) continue;
+            dx.push_back(moved[k].x - points[k].x);
+            dy.push_back(moved[k].y - points[k].y);
+        }
+        if ((int)dx.size() < HOG_TRACK_MIN_POINTS) continue;
+        std::nth_element(dx.begin(), dx.begin() + dx.size() / 2, dx.end());
+        std::nth_element(dy.begin(), dy.begin() + dy.size() / 2, dy.end());
+        detections[i].x += dx[dx.size() / 2];
+        detections[i].y += dy[dy.size() / 2];
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the time spent by each stage.
+//! @return  Timings of the last frame [ms]
+// --------------------------------------------------------------------------
+ARDRONE_HOG_TIMING ARDroneHOGDetector::getTiming(void)
+{
+    if (!mutexDetect) return timing;
+
+    pthread_mutex_lock(mutexDetect);
+    ARDRONE_HOG_TIMING result = timing;
+    pthread_mutex_unlock(mutexDetect);
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop the detector thread.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneHOGDetector::close(void)
+{
+    // Stop the thread
+    if (threadDetect) {
+        pthread_mutex_lock(mutexDetect);
+        quit = true;
+        pthread_cond_signal(condDetect);
+        pthread_mutex_unlock(mutexDetect);
+        pthread_join(*threadDetect, NULL);
+        delete threadDetect;
+        threadDetect = NULL;
+    }
+
+    // Delete the mutex and the condition
+    if (condDetect) {
+        pthread_cond_destroy(condDetect);
+        delete condDetect;
+        condDetect = NULL;
+    }
+    if (mutexDetect) {
+        pthread_mutex_destroy(mutexDetect);
+        delete mutexDetect;
+        mutexDetect = NULL;
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Thread function for detection.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneHOGDetector::loopDetect(void)
+{
+    cv::Mat frame, level;
+    std::vector<cv::Point> hits;
+    std::vector<double> weights;
+
+    while (1) {
+        // Wait for a frame
+        pthread_mutex_lock(mutexDetect);
+        while (!quit && !busy) pthread_cond_wait(condDetect, mutexDetect);
+        if (quit) {
+            pthread_mutex_unlock(mutexDetect);
+            break;
+        }
+        cv::swap(frame, job);
+        pthread_mutex_unlock(mutexDetect);
+
+        // Number of levels (the window has to fit)
+        double t0 = gettime();
+        cv::Size win = hog.winSize;
+        int count = 0;
+        for (double s = 1.0; frame.cols / s >= win.width && frame.rows / s >= win.height; s *= levelScale) count++;
+        if (count != levelCount) {
+            levelCount = count;
+            nextLevel = 0;
+            sweep.clear();
+        }
+
+        // Scan some of the levels
+        for (int i = 0; i < levelsPerFrame && nextLevel < levelCount; i++, nextLevel++) {
+            double s = pow(levelScale, nextLevel);
+            cv::Size size(cvRound(frame.cols / s), cvRound(frame.rows / s));
+            if (nextLevel > 0) cv::resize(frame, level, size, 0.0, 0.0, cv::INTER_LINEAR);
+            hog.detect((nextLevel > 0) ? level : frame, hits, weights, 0.0, cv::Size(HOG_WIN_STRIDE, HOG_WIN_STRIDE), cv::Size(0, 0));
+            for (size_t j = 0; j < hits.size(); j++) {
+                sweep.push_back(cv::Rect(cvRound(hits[j].x * s), cvRound(hits[j].y * s), cvRound(win.width * s), cvRound(win.height * s)));
+            }
+        }
+        double t1 = gettime();
+
+        // All levels were scanned
+        double t2 = t1;
+        bool done = (nextLevel >= levelCount);
+        if (done) {
+            cv::groupRectangles(sweep, HOG_GROUP_THRESHOLD, HOG_GROUP_EPS);
+            t2 = gettime();
+        }
+
+        pthread_mutex_lock(mutexDetect);
+        if (done) {
+            results.assign(sweep.begin(), sweep.end());
+            hasResults = true;
+            timing.group = (t2 - t1) * 1000.0;
+            sweep.clear();
+            nextLevel = 0;
+        }
+        timing.scan = (t1 - t0) * 1000.0;
+        timing.levels = levelCount;
+        busy = false;
+        pthread_mutex_unlock(mutexDetect);
+    }
+}
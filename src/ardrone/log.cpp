@@ -0,0 +1,567 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   log.cpp
+//! @brief  Recording and replaying sessions
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Layout of a log file
+//   File header  : "CVDRLOG\0", version (uint32), reserved (uint32)
+//   Records      : ARDRONE_LOG_RECORD + data (padded to 8 bytes), ...
+//   Index        : ARDRONE_LOG_INDEX x count (written on close)
+//   Trailer      : index offset (uint64), count (uint64), "CVDRIDX\0"
+// A log without the index (e.g. after a crash) is still readable by scanning.
+#define LOG_MAGIC           "CVDRLOG"
+#define LOG_INDEX_MAGIC     "CVDRIDX"
+#define LOG_VERSION         (1)
+#define LOG_HEADER_SIZE     (16)
+#define LOG_TRAILER_SIZE    (24)
+#define LOG_ALIGN(size)     (((size) + 7) & ~(uint64_t)7)
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneRecorder class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneRecorder::ARDroneRecorder()
+{
+    file = NULL;
+    offset = 0;
+    mutexRecord = NULL;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneRecorder class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneRecorder::~ARDroneRecorder()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Create a log file.
+//! @param   filename File name
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneRecorder::open(const char *filename)
+{
+    // Close the previous one
+    close();
+
+    // Create the file
+    file = fopen(filename, "wb");
+    if (!file) {
+        CVDRONE_ERROR("fopen(%s) was failed. (%s, %d)\n", filename, __FILE__, __LINE__);
+        return 0;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    // File header
+    char header[LOG_HEADER_SIZE] = {0};
+    uint32_t version = LOG_VERSION;
+    memcpy(header, LOG_MAGIC, 8);
+    memcpy(header + 8, &version, 4);
+    fwrite(header, 1, sizeof(header), file);
+    offset = LOG_HEADER_SIZE;
+    index.clear();
+
+    // Create a mutex
+    mutexRecord = new pthread_mutex_t;
+    pthread_mutex_init(mutexRecord, NULL);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Append a record.
+//! @param   type Type of the record (ARDRONE_LOG_TYPE)
+//! @param   data Data
+//! @param   size Size of the data
+//! @param   data2 Data following the first one (e.g. a payload after its header)
+//! @param   size2 Size of data2
+//! @param   timestamp Time of the record [s] (0 = now)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneRecorder::write(int type, const void *data, size_t size, const void *data2, size_t size2, double timestamp)
+{
+    // Not opened
+    if (!file) return 0;
+
+    // Record header
+    ARDRONE_LOG_RECORD record;
+    record.timestamp = (timestamp > 0.0) ? timestamp : gettime();
+    record.type = type;
+    record.size = (uint32_t)(size + size2);
+
+    // Append it
+    static const char padding[8] = {0};
+    if (mutexRecord) pthread_mutex_lock(mutexRecord);
+    fwrite(&record, 1, sizeof(record), file);
+    if (size > 0) fwrite(data, 1, size, file);
+    if (size2 > 0) fwrite(data2, 1, size2, file);
+    fwrite(padding, 1, (size_t)(LOG_ALIGN(record.size) - record.size), file);
+
+    // Index it
+    ARDRONE_LOG_INDEX entry;
+    entry.timestamp = record.timestamp;
+    entry.offset = offset + sizeof(record);
+    entry.type = record.type;
+    entry.size = record.size;
+    index.push_back(entry);
+    offset += sizeof(record) + LOG_ALIGN(record.size);
+    if (mutexRecord) pthread_mutex_unlock(mutexRecord);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Write the index and close the file.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneRecorder::close(void)
+{
+    // Write the index and the trailer
+    if (file) {
+        uint64_t trailer[2] = {offset, (uint64_t)index.size()};
+        if (!index.empty()) fwrite(&index[0], sizeof(ARDRONE_LOG_INDEX), index.size(), file);
+        fwrite(trailer, 1, sizeof(trailer), file);
+        fwrite(LOG_INDEX_MAGIC, 1, 8, file);
+        fclose(file);
+        file = NULL;
+    }
+    index.clear();
+
+    // Delete the mutex
+    if (mutexRecord) {
+        pthread_mutex_destroy(mutexRecord);
+        delete mutexRecord;
+        mutexRecord = NULL;
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneLog class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneLog::ARDroneLog()
+{
+    map = NULL;
+    length = 0;
+    #ifdef _WIN32
+    hFile = INVALID_HANDLE_VALUE;
+    hMap = NULL;
+    #endif
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneLog class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneLog::~ARDroneLog()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Map a log file into memory.
+//! @param   filename File name
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneLog::open(const char *filename)
+{
+    // Close the previous one
+    close();
+
+    // Map the file
+    #ifdef _WIN32
+    hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &size) || size.QuadPart < LOG_HEADER_SIZE) {
+        CVDRONE_ERROR("Failed to open %s. (%s, %d)\n", filename, __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+    length = (size_t)size.QuadPart;
+    hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMap) map = (uint8_t*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    #else
+    int fd = ::open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < LOG_HEADER_SIZE) {
+        CVDRONE_ERROR("Failed to open %s. (%s, %d)\n", filename, __FILE__, __LINE__);
+        if (fd >= 0) ::close(fd);
+        return 0;
+    }
+    length = (size_t)st.st_size;
+    void *addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr != MAP_FAILED) map = (uint8_t*)addr;
+    #endif
+    if (!map) {
+        CVDRONE_ERROR("Failed to map %s. (%s, %d)\n", filename, __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+
+    // Check the file header
+    if (memcmp(map, LOG_MAGIC, 8)) {
+        CVDRONE_ERROR("%s is not a log file. (%s, %d)\n", filename, __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+
+    // Use the index if it was written (and every entry lies in the records)
+    if (length >= LOG_HEADER_SIZE + LOG_TRAILER_SIZE && !memcmp(map + length - 8, LOG_INDEX_MAGIC, 8)) {
+        uint64_t trailer[2];
+        memcpy(trailer, map + length - LOG_TRAILER_SIZE, sizeof(trailer));
+        uint64_t records = trailer[0], count = trailer[1];
+        uint64_t space = length - LOG_TRAILER_SIZE;
+        if (records >= LOG_HEADER_SIZE && records <= space && count <= (space - records) / sizeof(ARDRONE_LOG_INDEX) &&
+            records + count * sizeof(ARDRONE_LOG_INDEX) == space) {
+            index.resize((size_t)count);
+            if (!index.empty()) memcpy(&index[0], map + records, index.size() * sizeof(ARDRONE_LOG_INDEX));
+            for (size_t i = 0; i < index.size(); i++) {
+                const ARDRONE_LOG_INDEX &entry = index[i];
+                if (entry.type < ARDRONE_LOG_VERSION || entry.type > ARDRONE_LOG_VIDEO ||
+                    entry.offset < LOG_HEADER_SIZE + sizeof(ARDRONE_LOG_RECORD) || entry.offset > records || entry.size > records - entry.offset) {
+                    CVDRONE_ERROR("The index of %s is broken, scanning the records. (%s, %d)\n", filename, __FILE__, __LINE__);
+                    index.clear();
+                    break;
+                }
+            }
+            if (!index.empty() || count == 0) return 1;
+        }
+    }
+
+    // Otherwise scan the records
+    uint64_t offset = LOG_HEADER_SIZE;
+    while (offset + sizeof(ARDRONE_LOG_RECORD) <= length) {
+        ARDRONE_LOG_RECORD record;
+        memcpy(&record, map + offset, sizeof(record));
+        if (record.type < ARDRONE_LOG_VERSION || record.type > ARDRONE_LOG_VIDEO) break;
+        if (offset + sizeof(record) + record.size > length) break;
+        ARDRONE_LOG_INDEX entry;
+        entry.timestamp = record.timestamp;
+        entry.offset = offset + sizeof(record);
+        entry.type = record.type;
+        entry.size = record.size;
+        index.push_back(entry);
+        offset += sizeof(record) + LOG_ALIGN(record.size);
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the number of records.
+//! @return  Number of records
+// --------------------------------------------------------------------------
+size_t ARDroneLog::size(void)
+{
+    return index.size();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get a record.
+//! @param   i Index of the record
+//! @return  Timestamp, type and size of the record
+// --------------------------------------------------------------------------
+const ARDRONE_LOG_INDEX& ARDroneLog::operator [] (size_t i)
+{
+    return index[i];
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the data of a record (points into the mapped file).
+//! @param   i Index of the record
+//! @return  Data
+// --------------------------------------------------------------------------
+const uint8_t* ARDroneLog::data(size_t i)
+{
+    return map + index[i].offset;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Find the first record at or after the time.
+//! @param   timestamp Time [s]
+//! @return  Index of the record (size() if none)
+//! @note    Navdata records carry kernel receive times and the others host
+//!          times, so the records are not sorted and are searched in order.
+// --------------------------------------------------------------------------
+size_t ARDroneLog::find(double timestamp)
+{
+    for (size_t i = 0; i < index.size(); i++) {
+        if (index[i].timestamp >= timestamp) return i;
+    }
+    return index.size();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Unmap the log file.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneLog::close(void)
+{
+    #ifdef _WIN32
+    if (map) UnmapViewOfFile(map);
+    if (hMap) CloseHandle(hMap);
+    if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+    hMap = NULL;
+    hFile = INVALID_HANDLE_VALUE;
+    #else
+    if (map) munmap(map, length);
+    #endif
+    map = NULL;
+    length = 0;
+    index.clear();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start recording the session (Navdata, AT commands and video).
+//! @param   filename Log file
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDrone::startRecord(const char *filename)
+{
+    // Stop the previous one
+    stopRecord();
+
+    // Create a log file
+    ARDroneRecorder *tmp = new ARDroneRecorder;
+    if (!tmp->open(filename)) {
+        delete tmp;
+        return 0;
+    }
+
+    // Version information and configurations come first
+    char text[64];
+    sprintf(text, "%d.%d.%d\n", version.major, version.minor, version.revision);
+    tmp->write(ARDRONE_LOG_VERSION, text, strlen(text));
+    std::string dump;
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    for (ARDRONE_CONFIG_PROFILE::const_iterator it = configShadow.begin(); it != configShadow.end(); ++it) {
+        dump += it->first + " = " + it->second + "\n";
+    }
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+    tmp->write(ARDRONE_LOG_CONFIG, dump.c_str(), dump.size());
+
+    // Record the traffic
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    sockCommand.setRecorder(tmp, ARDRONE_LOG_COMMAND);
+    recorder = tmp;
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop recording the session.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::stopRecord(void)
+{
+    // Not recording
+    if (!recorder) return;
+    ARDroneRecorder *tmp = recorder;
+
+    // Detach it from all threads
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    sockCommand.setRecorder(NULL, 0);
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+    if (mutexNavdata) pthread_mutex_lock(mutexNavdata);
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    recorder = NULL;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+    if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
+
+    // Write the index
+    tmp->close();
+    delete tmp;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Open a recorded session instead of a drone.
+//! @param   filename Log file
+//! @param   speed Replay speed (1.0 = real time, 0 = as fast as possible)
+//! @return  Result of initialization
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    Commands are ignored while replaying.
+// --------------------------------------------------------------------------
+int ARDrone::openLog(const char *filename, double speed)
+{
+    // Map the log
+    replayLog = new ARDroneLog;
+    if (!replayLog->open(filename)) return 0;
+    replaySpeed = MAX(speed, 0.0);
+    replayEnd = false;
+
+    // Version information
+    size_t i;
+    for (i = 0; i < replayLog->size() && (*replayLog)[i].type != ARDRONE_LOG_VERSION; i++);
+    if (i == replayLog->size() || sscanf((const char*)replayLog->data(i), "%d.%d.%d", &version.major, &version.minor, &version.revision) != 3) {
+        CVDRONE_ERROR("No version information in %s. (%s, %d)\n", filename, __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Create mutexes (no sockets and no threads except for replay)
+    mutexCommand = new pthread_mutex_t;
+    pthread_mutex_init(mutexCommand, NULL);
+    mutexNavdata = new pthread_mutex_t;
+    pthread_mutex_init(mutexNavdata, NULL);
+    memset(&navdata, 0, sizeof(navdata));
+
+    // Configurations
+    for (i = 0; i < replayLog->size() && (*replayLog)[i].type != ARDRONE_LOG_CONFIG; i++);
+    if (i < replayLog->size()) {
+        std::vector<char> buf(replayLog->data(i), replayLog->data(i) + (*replayLog)[i].size);
+        buf.push_back('\0');
+        parseConfig(&buf[0]);
+    }
+
+    // The first PaVE header gives the size of the stream
+    ARDRONE_PAVE header;
+    memset(&header, 0, sizeof(header));
+    header.encoded_stream_width = 640;
+    header.encoded_stream_height = 368;
+    for (i = 0; i < replayLog->size(); i++) {
+        if ((*replayLog)[i].type == ARDRONE_LOG_VIDEO && (*replayLog)[i].size >= sizeof(header)) {
+            if (version.major == ARDRONE_VERSION_2) memcpy(&header, replayLog->data(i), sizeof(header));
+            break;
+        }
+    }
+
+    // Initialize the decoder
+    if (!initDecoder(header)) return 0;
+
+    // Create a thread
+    threadReplay = new pthread_t;
+    if (pthread_create(threadReplay, NULL, runReplay, this) != 0) {
+        CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+        delete threadReplay;
+        threadReplay = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Check the end of the replayed session.
+//! @return  All records were replayed
+// --------------------------------------------------------------------------
+bool ARDrone::endOfLog(void)
+{
+    return replayEnd;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Thread function for replay.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::loopReplay(void)
+{
+    ARDRONE_VIDEO_PACKET packet;
+    double first = 0.0, start = gettime();
+
+    for (size_t i = 0; i < replayLog->size(); i++) {
+        const ARDRONE_LOG_INDEX &record = (*replayLog)[i];
+        const uint8_t *data = replayLog->data(i);
+        pthread_testcancel();
+
+        // Wait for the time of the record
+        if (i == 0) first = record.timestamp;
+        if (replaySpeed > 0.0) {
+            double wait = start + (record.timestamp - first) / replaySpeed - gettime();
+            if (wait > 0.001) msleep((unsigned long)(wait * 1000.0));
+        }
+
+        // Process it like received data
+        switch (record.type) {
+            case ARDRONE_LOG_NAVDATA:
+                parseNavdata((const char*)data, (int)record.size, record.timestamp);
+                break;
+            case ARDRONE_LOG_VIDEO:
+                if (version.major == ARDRONE_VERSION_2) {
+                    if (record.size < sizeof(packet.header)) break;
+                    memcpy(&packet.header, data, sizeof(packet.header));
+                    packet.data.assign(data + sizeof(packet.header), data + record.size);
+                }
+                else {
+                    memset(&packet.header, 0, sizeof(packet.header));
+                    packet.header.payload_size = record.size;
+                    packet.data.assign(data, data + record.size);
+                }
+                packet.timestamp = record.timestamp;
+                recordVideo(packet);
+                decodeVideo(packet);
+                break;
+            case ARDRONE_LOG_CONFIG: {
+                std::vector<char> buf(data, data + record.size);
+                buf.push_back('\0');
+                parseConfig(&buf[0]);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    replayEnd = true;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Finalize replay.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::finalizeReplay(void)
+{
+    // Destroy the thread
+    if (threadReplay) {
+        pthread_cancel(*threadReplay);
+        pthread_join(*threadReplay, NULL);
+        delete threadReplay;
+        threadReplay = NULL;
+    }
+
+    // Unmap the log
+    if (replayLog) {
+        delete replayLog;
+        replayLog = NULL;
+    }
+}
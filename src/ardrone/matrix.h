@@ -0,0 +1,426 @@
+#ifndef __HEADER_ARDRONE_MATRIX__
+#define __HEADER_ARDRONE_MATRIX__
+
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+// 
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//! @file   matrix.h
+//! @brief  Fixed-size vectors, matrices and quaternions
+//
+// -------------------------------------------------------------------------
+
+// All types are plain aggregates on the stack (no heap allocation) and can
+// be initialized statically, e.g. "const ARMath::Vec3 up = { 0, 0, 1, 0 };".
+// Rows are padded to 4 floats so that they map onto SSE / NEON registers.
+
+#include <math.h>
+
+// SIMD
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 1))
+#define ARMATH_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ARMATH_NEON
+#include <arm_neon.h>
+#endif
+
+namespace ARMath {
+    // 4 floats in a register
+    #if defined(ARMATH_SSE)
+    typedef __m128 Float4;
+    inline Float4 load4(const float *p)                 { return _mm_loadu_ps(p); }
+    inline void   store4(float *p, Float4 a)            { _mm_storeu_ps(p, a); }
+    inline Float4 splat4(float s)                       { return _mm_set1_ps(s); }
+    inline Float4 add4(Float4 a, Float4 b)              { return _mm_add_ps(a, b); }
+    inline Float4 sub4(Float4 a, Float4 b)              { return _mm_sub_ps(a, b); }
+    inline Float4 mul4(Float4 a, Float4 b)              { return _mm_mul_ps(a, b); }
+    inline Float4 madd4(Float4 a, Float4 b, Float4 c)   { return _mm_add_ps(a, _mm_mul_ps(b, c)); }
+    #elif defined(ARMATH_NEON)
+    typedef float32x4_t Float4;
+    inline Float4 load4(const float *p)                 { return vld1q_f32(p); }
+    inline void   store4(float *p, Float4 a)            { vst1q_f32(p, a); }
+    inline Float4 splat4(float s)                       { return vdupq_n_f32(s); }
+    inline Float4 add4(Float4 a, Float4 b)              { return vaddq_f32(a, b); }
+    inline Float4 sub4(Float4 a, Float4 b)              { return vsubq_f32(a, b); }
+    inline Float4 mul4(Float4 a, Float4 b)              { return vmulq_f32(a, b); }
+    inline Float4 madd4(Float4 a, Float4 b, Float4 c)   { return vmlaq_f32(a, b, c); }
+    #else
+    struct Float4 { float v[4]; };
+    inline Float4 load4(const float *p)                 { Float4 r = { { p[0], p[1], p[2], p[3] } }; return r; }
+    inline void   store4(float *p, Float4 a)            { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+    inline Float4 splat4(float s)                       { Float4 r = { { s, s, s, s } }; return r; }
+    inline Float4 add4(Float4 a, Float4 b)              { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+    inline Float4 sub4(Float4 a, Float4 b)              { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+    inline Float4 mul4(Float4 a, Float4 b)              { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+    inline Float4 madd4(Float4 a, Float4 b, Float4 c)   { for (int i = 0; i < 4; i++) a.v[i] += b.v[i] * c.v[i]; return a; }
+    #endif
+
+    // --------------------------------------------------------------------------
+    // 3D vector (w is padding and stays 0)
+    // --------------------------------------------------------------------------
+    struct Vec3 {
+        float x, y, z, w;
+    };
+
+    inline Vec3 vec3(float x, float y, float z) {
+        Vec3 v = { x, y, z, 0.0f };
+        return v;
+    }
+    inline Vec3 operator+(const Vec3 &a, const Vec3 &b) {
+        Vec3 v;
+        store4(&v.x, add4(load4(&a.x), load4(&b.x)));
+        return v;
+    }
+    inline Vec3 operator-(const Vec3 &a, const Vec3 &b) {
+        Vec3 v;
+        store4(&v.x, sub4(load4(&a.x), load4(&b.x)));
+        return v;
+    }
+    inline Vec3 operator*(const Vec3 &a, float s) {
+        Vec3 v;
+        store4(&v.x, mul4(load4(&a.x), splat4(s)));
+        return v;
+    }
+    inline Vec3 operator*(float s, const Vec3 &a) {
+        return a * s;
+    }
+    inline Vec3 operator-(const Vec3 &a) {
+        return vec3(-a.x, -a.y, -a.z);
+    }
+    inline Vec3 &operator+=(Vec3 &a, const Vec3 &b) {
+        return a = a + b;
+    }
+    inline float dot(const Vec3 &a, const Vec3 &b) {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+    inline Vec3 cross(const Vec3 &a, const Vec3 &b) {
+        return vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+    }
+    inline float norm(const Vec3 &a) {
+        return sqrtf(dot(a, a));
+    }
+    inline Vec3 normalize(const Vec3 &a) {
+        float n = norm(a);
+        return (n > 0.0f) ? a * (1.0f / n) : a;
+    }
+
+    // --------------------------------------------------------------------------
+    // 3x3 matrix (row-major, rows padded to 4)
+    // --------------------------------------------------------------------------
+    struct Mat33 {
+        float m[3][4];
+    };
+
+    inline Mat33 mat33(float m00, float m01, float m02, float m10, float m11, float m12, float m20, float m21, float m22) {
+        Mat33 r = { { { m00, m01, m02, 0.0f }, { m10, m11, m12, 0.0f }, { m20, m21, m22, 0.0f } } };
+        return r;
+    }
+    inline Mat33 identity33(void) {
+        return mat33(1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+    }
+    inline Mat33 transpose(const Mat33 &a) {
+        return mat33(a.m[0][0], a.m[1][0], a.m[2][0], a.m[0][1], a.m[1][1], a.m[2][1], a.m[0][2], a.m[1][2], a.m[2][2]);
+    }
+    inline Mat33 operator*(const Mat33 &a, const Mat33 &b) {
+        // Each row of the result is a combination of the rows of b
+        Float4 b0 = load4(b.m[0]), b1 = load4(b.m[1]), b2 = load4(b.m[2]);
+        Mat33 r;
+        for (int i = 0; i < 3; i++) {
+            Float4 row = mul4(splat4(a.m[i][0]), b0);
+            row = madd4(row, splat4(a.m[i][1]), b1);
+            row = madd4(row, splat4(a.m[i][2]), b2);
+            store4(r.m[i], row);
+        }
+        return r;
+    }
+    inline Vec3 operator*(const Mat33 &a, const Vec3 &v) {
+        return vec3(a.m[0][0] * v.x + a.m[0][1] * v.y + a.m[0][2] * v.z,
+                    a.m[1][0] * v.x + a.m[1][1] * v.y + a.m[1][2] * v.z,
+                    a.m[2][0] * v.x + a.m[2][1] * v.y + a.m[2][2] * v.z);
+    }
+    inline Vec3 column(const Mat33 &a, int c) {
+        return vec3(a.m[0][c], a.m[1][c], a.m[2][c]);
+    }
+    inline Mat33 fromColumns(const Vec3 &c0, const Vec3 &c1, const Vec3 &c2) {
+        return mat33(c0.x, c1.x, c2.x, c0.y, c1.y, c2.y, c0.z, c1.z, c2.z);
+    }
+
+    // Rotation of Rz(yaw) * Ry(pitch) * Rx(roll) (body -> world)
+    inline Mat33 fromEuler(float roll, float pitch, float yaw) {
+        float cr = cosf(roll),  sr = sinf(roll);
+        float cp = cosf(pitch), sp = sinf(pitch);
+        float cy = cosf(yaw),   sy = sinf(yaw);
+        return mat33(cy * cp, cy * sp * sr - sy * cr, cy * sp * cr + sy * sr,
+                     sy * cp, sy * sp * sr + cy * cr, sy * sp * cr - cy * sr,
+                         -sp,                cp * sr,                cp * cr);
+    }
+
+    // Rotation of a rotation vector (same as cv::Rodrigues)
+    inline Mat33 fromRotationVector(const Vec3 &r) {
+        float theta = norm(r);
+        if (theta < 1.0e-8f) return mat33(1.0f, -r.z, r.y, r.z, 1.0f, -r.x, -r.y, r.x, 1.0f);
+        Vec3 k = r * (1.0f / theta);
+        float c = cosf(theta), s = sinf(theta), t = 1.0f - c;
+        return mat33(t * k.x * k.x + c,       t * k.x * k.y - s * k.z, t * k.x * k.z + s * k.y,
+                     t * k.x * k.y + s * k.z, t * k.y * k.y + c,       t * k.y * k.z - s * k.x,
+                     t * k.x * k.z - s * k.y, t * k.y * k.z + s * k.x, t * k.z * k.z + c);
+    }
+
+    // --------------------------------------------------------------------------
+    // 4x4 matrix (row-major)
+    // --------------------------------------------------------------------------
+    struct Mat44 {
+        float m[4][4];
+    };
+
+    inline Mat44 identity44(void) {
+        Mat44 r = { { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 0.0f, 1.0f } } };
+        return r;
+    }
+    inline Mat44 transpose(const Mat44 &a) {
+        Mat44 r;
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) r.m[i][j] = a.m[j][i];
+        }
+        return r;
+    }
+    inline Mat44 operator*(const Mat44 &a, const Mat44 &b) {
+        Float4 b0 = load4(b.m[0]), b1 = load4(b.m[1]), b2 = load4(b.m[2]), b3 = load4(b.m[3]);
+        Mat44 r;
+        for (int i = 0; i < 4; i++) {
+            Float4 row = mul4(splat4(a.m[i][0]), b0);
+            row = madd4(row, splat4(a.m[i][1]), b1);
+            row = madd4(row, splat4(a.m[i][2]), b2);
+            row = madd4(row, splat4(a.m[i][3]), b3);
+            store4(r.m[i], row);
+        }
+        return r;
+    }
+
+    // [R t; 0 1]
+    inline Mat44 rigid(const Mat33 &R, const Vec3 &t) {
+        Mat44 r = { { { R.m[0][0], R.m[0][1], R.m[0][2], t.x },
+                      { R.m[1][0], R.m[1][1], R.m[1][2], t.y },
+                      { R.m[2][0], R.m[2][1], R.m[2][2], t.z },
+                      { 0.0f, 0.0f, 0.0f, 1.0f } } };
+        return r;
+    }
+
+    // Inverse of [R t; 0 1] = [R^T -R^T*t; 0 1]
+    inline Mat44 inverseRigid(const Mat44 &a) {
+        Mat33 Rt = mat33(a.m[0][0], a.m[1][0], a.m[2][0], a.m[0][1], a.m[1][1], a.m[2][1], a.m[0][2], a.m[1][2], a.m[2][2]);
+        return rigid(Rt, -(Rt * vec3(a.m[0][3], a.m[1][3], a.m[2][3])));
+    }
+
+    // R*p + t
+    inline Vec3 transformPoint(const Mat44 &a, const Vec3 &p) {
+        return vec3(a.m[0][0] * p.x + a.m[0][1] * p.y + a.m[0][2] * p.z + a.m[0][3],
+                    a.m[1][0] * p.x + a.m[1][1] * p.y + a.m[1][2] * p.z + a.m[1][3],
+                    a.m[2][0] * p.x + a.m[2][1] * p.y + a.m[2][2] * p.z + a.m[2][3]);
+    }
+
+    // --------------------------------------------------------------------------
+    // Quaternion (w + xi + yj + zk)
+    // --------------------------------------------------------------------------
+    struct Quat {
+        float w, x, y, z;
+    };
+
+    inline Quat quat(float w, float x, float y, float z) {
+        Quat q = { w, x, y, z };
+        return q;
+    }
+    inline Quat operator*(const Quat &a, const Quat &b) {
+        return quat(a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+                    a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+                    a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+                    a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w);
+    }
+    inline Quat conjugate(const Quat &q) {
+        return quat(q.w, -q.x, -q.y, -q.z);
+    }
+    inline Quat normalize(const Quat &q) {
+        float n = sqrtf(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+        if (n <= 0.0f) return quat(1.0f, 0.0f, 0.0f, 0.0f);
+        Quat r;
+        store4(&r.w, mul4(load4(&q.w), splat4(1.0f / n)));
+        return r;
+    }
+
+    // Same rotation as fromEuler()
+    inline Quat quatFromEuler(float roll, float pitch, float yaw) {
+        float cr = cosf(roll * 0.5f),  sr = sinf(roll * 0.5f);
+        float cp = cosf(pitch * 0.5f), sp = sinf(pitch * 0.5f);
+        float cy = cosf(yaw * 0.5f),   sy = sinf(yaw * 0.5f);
+        return quat(cy * cp * cr + sy * sp * sr,
+                    cy * cp * sr - sy * sp * cr,
+                    cy * sp * cr + sy * cp * sr,
+                    sy * cp * cr - cy * sp * sr);
+    }
+
+    // Inverse of quatFromEuler()
+    inline void toEuler(const Quat &q, float *roll, float *pitch, float *yaw) {
+        float s = 2.0f * (q.w * q.y - q.z * q.x);
+        if (roll)  *roll  = atan2f(2.0f * (q.w * q.x + q.y * q.z), 1.0f - 2.0f * (q.x * q.x + q.y * q.y));
+        if (pitch) *pitch = asinf(s > 1.0f ? 1.0f : (s < -1.0f ? -1.0f : s));
+        if (yaw)   *yaw   = atan2f(2.0f * (q.w * q.z + q.x * q.y), 1.0f - 2.0f * (q.y * q.y + q.z * q.z));
+    }
+
+    // Rotation of a rotation vector (axis * angle)
+    inline Quat quatFromRotationVector(const Vec3 &r) {
+        float theta = norm(r);
+        if (theta < 1.0e-8f) return normalize(quat(1.0f, 0.5f * r.x, 0.5f * r.y, 0.5f * r.z));
+        float s = sinf(0.5f * theta) / theta;
+        return quat(cosf(0.5f * theta), r.x * s, r.y * s, r.z * s);
+    }
+
+    // Rotation vector of a quaternion (inverse of quatFromRotationVector())
+    inline Vec3 toRotationVector(const Quat &q) {
+        Quat p = (q.w < 0.0f) ? quat(-q.w, -q.x, -q.y, -q.z) : q;
+        float s = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+        if (s < 1.0e-8f) return vec3(2.0f * p.x, 2.0f * p.y, 2.0f * p.z);
+        float k = 2.0f * atan2f(s, p.w) / s;
+        return vec3(p.x * k, p.y * k, p.z * k);
+    }
+
+    // Rotation matrix of a unit quaternion
+    inline Mat33 toMat33(const Quat &q) {
+        float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+        float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+        float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+        return mat33(1.0f - 2.0f * (yy + zz), 2.0f * (xy - wz),        2.0f * (xz + wy),
+                     2.0f * (xy + wz),        1.0f - 2.0f * (xx + zz), 2.0f * (yz - wx),
+                     2.0f * (xz - wy),        2.0f * (yz + wx),        1.0f - 2.0f * (xx + yy));
+    }
+
+    // Unit quaternion of a rotation matrix
+    inline Quat quatFromMat33(const Mat33 &R) {
+        float trace = R.m[0][0] + R.m[1][1] + R.m[2][2];
+        Quat q;
+        if (trace > 0.0f) {
+            float s = 2.0f * sqrtf(1.0f + trace);
+            q = quat(0.25f * s, (R.m[2][1] - R.m[1][2]) / s, (R.m[0][2] - R.m[2][0]) / s, (R.m[1][0] - R.m[0][1]) / s);
+        }
+        else if (R.m[0][0] > R.m[1][1] && R.m[0][0] > R.m[2][2]) {
+            float s = 2.0f * sqrtf(1.0f + R.m[0][0] - R.m[1][1] - R.m[2][2]);
+            q = quat((R.m[2][1] - R.m[1][2]) / s, 0.25f * s, (R.m[0][1] + R.m[1][0]) / s, (R.m[0][2] + R.m[2][0]) / s);
+        }
+        else if (R.m[1][1] > R.m[2][2]) {
+            float s = 2.0f * sqrtf(1.0f + R.m[1][1] - R.m[0][0] - R.m[2][2]);
+            q = quat((R.m[0][2] - R.m[2][0]) / s, (R.m[0][1] + R.m[1][0]) / s, 0.25f * s, (R.m[1][2] + R.m[2][1]) / s);
+        }
+        else {
+            float s = 2.0f * sqrtf(1.0f + R.m[2][2] - R.m[0][0] - R.m[1][1]);
+            q = quat((R.m[1][0] - R.m[0][1]) / s, (R.m[0][2] + R.m[2][0]) / s, (R.m[1][2] + R.m[2][1]) / s, 0.25f * s);
+        }
+        return normalize(q);
+    }
+
+    // Rotate a vector by a unit quaternion
+    inline Vec3 rotate(const Quat &q, const Vec3 &v) {
+        // v + 2w(u x v) + 2u x (u x v)
+        Vec3 u = vec3(q.x, q.y, q.z);
+        Vec3 t = cross(u, v) * 2.0f;
+        return v + t * q.w + cross(u, t);
+    }
+
+    // --------------------------------------------------------------------------
+    // R x C matrix of doubles (for filters, sizes fixed at compile time)
+    // --------------------------------------------------------------------------
+    template <int R, int C>
+    struct Matrix {
+        double m[R][C];
+
+        double &operator()(int r, int c)             { return m[r][c]; }
+        const double &operator()(int r, int c) const { return m[r][c]; }
+
+        static Matrix zeros(void) {
+            Matrix a;
+            for (int i = 0; i < R; i++) for (int j = 0; j < C; j++) a.m[i][j] = 0.0;
+            return a;
+        }
+        static Matrix eye(void) {
+            Matrix a = zeros();
+            for (int i = 0; i < R && i < C; i++) a.m[i][i] = 1.0;
+            return a;
+        }
+    };
+
+    template <int R, int C>
+    inline Matrix<R, C> operator+(const Matrix<R, C> &a, const Matrix<R, C> &b) {
+        Matrix<R, C> r;
+        for (int i = 0; i < R; i++) for (int j = 0; j < C; j++) r.m[i][j] = a.m[i][j] + b.m[i][j];
+        return r;
+    }
+    template <int R, int C>
+    inline Matrix<R, C> operator-(const Matrix<R, C> &a, const Matrix<R, C> &b) {
+        Matrix<R, C> r;
+        for (int i = 0; i < R; i++) for (int j = 0; j < C; j++) r.m[i][j] = a.m[i][j] - b.m[i][j];
+        return r;
+    }
+    template <int R, int K, int C>
+    inline Matrix<R, C> operator*(const Matrix<R, K> &a, const Matrix<K, C> &b) {
+        Matrix<R, C> r = Matrix<R, C>::zeros();
+        for (int i = 0; i < R; i++) {
+            for (int k = 0; k < K; k++) {
+                double aik = a.m[i][k];
+                if (aik == 0.0) continue;   // Jacobians are sparse
+                for (int j = 0; j < C; j++) r.m[i][j] += aik * b.m[k][j];
+            }
+        }
+        return r;
+    }
+    template <int R, int C>
+    inline Matrix<C, R> transpose(const Matrix<R, C> &a) {
+        Matrix<C, R> r;
+        for (int i = 0; i < R; i++) for (int j = 0; j < C; j++) r.m[j][i] = a.m[i][j];
+        return r;
+    }
+
+    // Inverse by Gauss-Jordan elimination (returns false if singular)
+    template <int N>
+    inline bool invert(const Matrix<N, N> &a, Matrix<N, N> *inv) {
+        Matrix<N, N> b = a, r = Matrix<N, N>::eye();
+        for (int c = 0; c < N; c++) {
+            // Pivot
+            int p = c;
+            for (int i = c + 1; i < N; i++) if (fabs(b.m[i][c]) > fabs(b.m[p][c])) p = i;
+            if (fabs(b.m[p][c]) < 1.0e-12) return false;
+            for (int j = 0; j < N; j++) {
+                double t = b.m[c][j]; b.m[c][j] = b.m[p][j]; b.m[p][j] = t;
+                t = r.m[c][j]; r.m[c][j] = r.m[p][j]; r.m[p][j] = t;
+            }
+
+            // Eliminate the column
+            double d = 1.0 / b.m[c][c];
+            for (int j = 0; j < N; j++) { b.m[c][j] *= d; r.m[c][j] *= d; }
+            for (int i = 0; i < N; i++) {
+                if (i == c || b.m[i][c] == 0.0) continue;
+                double f = b.m[i][c];
+                for (int j = 0; j < N; j++) { b.m[i][j] -= f * b.m[c][j]; r.m[i][j] -= f * r.m[c][j]; }
+            }
+        }
+        *inv = r;
+        return true;
+    }
+}
+
+#endif
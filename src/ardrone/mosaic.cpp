@@ -0,0 +1,445 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   mosaic.cpp
+//! @brief  Incremental mosaic builder
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// Canvas
+#define MOSAIC_TILE_SIZE        (512)       // Size of a tile [px]
+#define MOSAIC_MAX_WEIGHT       (4.0f)      // Older keyframes fade out after this weight
+#define MOSAIC_MAX_TILES        (16)        // Tiles a frame may cover (more is a broken homography)
+
+// Registration
+#define MOSAIC_LSH_TABLES       (6)         // LSH index for ORB descriptors
+#define MOSAIC_LSH_KEY_SIZE     (12)
+#define MOSAIC_LSH_PROBES       (1)
+#define MOSAIC_RATIO            (0.8f)      // Ratio test of the 2 nearest neighbours
+#define MOSAIC_MIN_MATCHES      (12)        // Matches needed for a homography
+#define MOSAIC_PRIOR_RADIUS     (24.0)      // Matches disagreeing with the yaw prior [px]
+#define MOSAIC_PRIOR_ANGLE      (15.0)      // Rotation disagreeing with the yaw prior [deg]
+#define MOSAIC_MAX_SCALE        (1.5)       // Scale change between a keyframe and a frame
+#define MOSAIC_MAX_PERSPECTIVE  (1.0e-3)    // Perspective terms of the homography (nearly straight down)
+#define MOSAIC_MAX_LOST         (10)        // Frames before following a new keyframe (not blended until it is located again)
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneMosaic class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneMosaic::ARDroneMosaic()
+{
+    maxFeatures = 500;
+    minInliers = 60;
+    maxShift = 0.3;
+    matcher = cv::makePtr<cv::FlannBasedMatcher>(cv::makePtr<cv::flann::LshIndexParams>(MOSAIC_LSH_TABLES, MOSAIC_LSH_KEY_SIZE, MOSAIC_LSH_PROBES));
+    anchorMatcher = cv::makePtr<cv::FlannBasedMatcher>(cv::makePtr<cv::flann::LshIndexParams>(MOSAIC_LSH_TABLES, MOSAIC_LSH_KEY_SIZE, MOSAIC_LSH_PROBES));
+    reset();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneMosaic class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneMosaic::~ARDroneMosaic()
+{
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the features.
+//! @param   max_features ORB features detected in a frame
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneMosaic::setFeatures(int max_features)
+{
+    maxFeatures = MAX(MOSAIC_MIN_MATCHES, max_features);
+    orb.release();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set when a frame becomes a new keyframe.
+//! @param   min_inliers Fewer inliers against the keyframe
+//! @param   max_shift Moved more than this ratio of the image size
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneMosaic::setKeyframe(int min_inliers, double max_shift)
+{
+    minInliers = MAX(MOSAIC_MIN_MATCHES, min_inliers);
+    maxShift = MAX(0.0, max_shift);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Clear the mosaic.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneMosaic::reset(void)
+{
+    tiles.clear();
+    keyPoints.clear();
+    keyDescriptors.release();
+    matcher->clear();
+    keyCount = 0;
+    keyYaw = 0.0;
+    anchorPoints.clear();
+    anchorDescriptors.release();
+    anchorMatcher->clear();
+    anchorYaw = 0.0;
+    anchored = true;
+    lost = 0;
+    pose = cv::Mat::eye(3, 3, CV_64F);
+    keyPose = cv::Mat::eye(3, 3, CV_64F);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Add a frame to the mosaic.
+//! @param   image BGR image (bottom camera)
+//! @param   info Navdata at the capture for the yaw prior (NULL = none)
+//! @return  Result of this function
+//! @retval  1 The frame was located (and blended if it is a new keyframe)
+//! @retval  0 Failure
+//! @note    Only the frame is described; the keyframe keeps its features and
+//!          LSH index until it is replaced. Only the tiles under a new keyframe
+//!          are updated.
+// --------------------------------------------------------------------------
+int ARDroneMosaic::add(const cv::Mat &image, const ARDRONE_FRAME_INFO *info)
+{
+    // Not a BGR image
+    if (image.empty() || image.type() != CV_8UC3) return 0;
+
+    // Size changed
+    if (feather.size() != image.size()) {
+        reset();
+        makeFeather(image.size());
+    }
+
+    // Describe the frame
+    if (orb.empty()) orb = cv::ORB::create(maxFeatures);
+    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+    orb->detectAndCompute(gray, cv::noArray(), keypoints, descriptors);
+
+    // The first keyframe is the origin
+    double yaw = info ? info->yaw : 0.0;
+    if (keyCount == 0) {
+        if ((int)keypoints.size() < MOSAIC_MIN_MATCHES) return 0;
+        pose = cv::Mat::eye(3, 3, CV_64F);
+        addKeyframe(image, yaw);
+        return 1;
+    }
+
+    // Locate the frame on the keyframe
+    cv::Mat H;
+    int inliers = locate(keyPoints, *matcher, info ? yaw - keyYaw : 0.0, info != NULL, &H);
+
+    // Back on the last blended keyframe after being lost
+    if (!anchored) {
+        cv::Mat A;
+        if (locate(anchorPoints, *anchorMatcher, info ? yaw - anchorYaw : 0.0, info != NULL, &A) > 0) {
+            pose = anchorPose * A.inv();
+            pose /= pose.at<double>(2, 2);
+            anchored = true;
+            lost = 0;
+            addKeyframe(image, yaw);
+            return 1;
+        }
+    }
+
+    if (inliers == 0) {
+        // Follow a new keyframe when lost for a while (its pose is a guess, so it is not blended)
+        if (++lost > MOSAIC_MAX_LOST && (int)keypoints.size() >= MOSAIC_MIN_MATCHES) {
+            if (anchored) {
+                anchorPoints = keyPoints;
+                keyDescriptors.copyTo(anchorDescriptors);
+                anchorMatcher->clear();
+                anchorMatcher->add(std::vector<cv::Mat>(1, anchorDescriptors));
+                anchorMatcher->train();
+                anchorPose = keyPose.clone();
+                anchorYaw = keyYaw;
+                anchored = false;
+            }
+            addKeyframe(image, yaw);
+            lost = 0;
+        }
+        return 0;
+    }
+    lost = 0;
+
+    // Frame to canvas
+    pose = keyPose * H.inv();
+    pose /= pose.at<double>(2, 2);
+
+    // Moved enough (center of the frame on the keyframe)
+    std::vector<cv::Point2f> c(1, cv::Point2f(image.cols * 0.5f, image.rows * 0.5f)), k;
+    cv::perspectiveTransform(c, k, H.inv());
+    double dx = fabs(k[0].x - c[0].x) / image.cols, dy = fabs(k[0].y - c[0].y) / image.rows;
+
+    // New keyframe
+    if (inliers < minInliers || MAX(dx, dy) > maxShift) addKeyframe(image, yaw);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Find the homography from the keyframe to the frame.
+//! @param   points Features of the keyframe
+//! @param   index LSH index of the keyframe
+//! @param   dyaw Yaw from the keyframe [rad]
+//! @param   use_prior Use the yaw
+//! @param   H Homography (keyframe -> frame)
+//! @return  Number of inliers (0 = failure)
+// --------------------------------------------------------------------------
+int ARDroneMosaic::locate(const std::vector<cv::KeyPoint> &points, cv::DescriptorMatcher &index, double dyaw, bool use_prior, cv::Mat *H)
+{
+    if ((int)keypoints.size() < MOSAIC_MIN_MATCHES || points.empty()) return 0;
+
+    // 2 nearest neighbours in the keyframe
+    index.knnMatch(descriptors, knn, 2);
+
+    // Ratio test
+    src.clear();
+    dst.clear();
+    for (size_t i = 0; i < knn.size(); i++) {
+        if (knn[i].empty()) continue;
+        if (knn[i].size() > 1 && knn[i][0].distance > MOSAIC_RATIO * knn[i][1].distance) continue;
+        src.push_back(points[knn[i][0].trainIdx].pt);
+        dst.push_back(keypoints[knn[i][0].queryIdx].pt);
+    }
+    if ((int)src.size() < MOSAIC_MIN_MATCHES) return 0;
+
+    // Yaw prior (the ground turns against the drone around the image center)
+    cv::Point2f center(feather.cols * 0.5f, feather.rows * 0.5f);
+    double cs = cos(-dyaw), sn = sin(-dyaw);
+    if (use_prior) {
+        // Translation left by each match
+        shifts.resize(src.size());
+        std::vector<float> sx(src.size()), sy(src.size());
+        for (size_t i = 0; i < src.size(); i++) {
+            cv::Point2f p = src[i] - center;
+            shifts[i] = dst[i] - center - cv::Point2f((float)(cs * p.x - sn * p.y), (float)(sn * p.x + cs * p.y));
+            sx[i] = shifts[i].x;
+            sy[i] = shifts[i].y;
+        }
+
+        // Keep the matches agreeing with the median
+        std::nth_element(sx.begin(), sx.begin() + sx.size() / 2, sx.end());
+        std::nth_element(sy.begin(), sy.begin() + sy.size() / 2, sy.end());
+        cv::Point2f median(sx[sx.size() / 2], sy[sy.size() / 2]);
+        size_t n = 0;
+        for (size_t i = 0; i < src.size(); i++) {
+            if (cv::norm(shifts[i] - median) > MOSAIC_PRIOR_RADIUS) continue;
+            src[n] = src[i];
+            dst[n++] = dst[i];
+        }
+        src.resize(n);
+        dst.resize(n);
+        if ((int)src.size() < MOSAIC_MIN_MATCHES) return 0;
+    }
+
+    // Homography
+    *H = cv::findHomography(src, dst, cv::RANSAC, 3.0, status);
+    if (H->empty() || fabs(H->at<double>(2, 2)) < DBL_EPSILON) return 0;
+    *H /= H->at<double>(2, 2);
+
+    // Nearly a similarity (the bottom camera looks down at the ground)
+    const cv::Mat &h = *H;
+    double det = h.at<double>(0, 0) * h.at<double>(1, 1) - h.at<double>(0, 1) * h.at<double>(1, 0);
+    if (det < 1.0 / (MOSAIC_MAX_SCALE * MOSAIC_MAX_SCALE) || det > MOSAIC_MAX_SCALE * MOSAIC_MAX_SCALE) return 0;
+    if (fabs(h.at<double>(2, 0)) > MOSAIC_MAX_PERSPECTIVE || fabs(h.at<double>(2, 1)) > MOSAIC_MAX_PERSPECTIVE) return 0;
+
+    // Rotation should follow the yaw
+    if (use_prior) {
+        double angle = atan2(H->at<double>(1, 0), H->at<double>(0, 0)) + dyaw;
+        angle = atan2(sin(angle), cos(angle));
+        if (fabs(angle) > MOSAIC_PRIOR_ANGLE * CV_PI / 180.0) return 0;
+    }
+
+    // Inliers
+    int inliers = cv::countNonZero(status);
+    return (inliers >= MOSAIC_MIN_MATCHES) ? inliers : 0;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Make the frame a keyframe and blend it into the canvas.
+//! @param   image BGR image
+//! @param   yaw Yaw at the capture [rad]
+//! @return  None
+//! @note    The features of the frame are reused for the keyframe. It is not
+//!          blended while the mosaic is lost.
+// --------------------------------------------------------------------------
+void ARDroneMosaic::addKeyframe(const cv::Mat &image, double yaw)
+{
+    // Keep the features and build the index once
+    matcher->clear();
+    keyPoints.swap(keypoints);
+    descriptors.copyTo(keyDescriptors);
+    matcher->add(std::vector<cv::Mat>(1, keyDescriptors));
+    matcher->train();
+    keyPose = pose.clone();
+    keyYaw = yaw;
+
+    // Blend (only where it is registered)
+    if (anchored) {
+        blend(image, keyPose);
+        keyCount++;
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Blend an image into the tiles under it.
+//! @param   image BGR image
+//! @param   G Homography (image -> canvas)
+//! @return  None
+//! @note    Nothing is blended when it would cover more than MOSAIC_MAX_TILES tiles.
+// --------------------------------------------------------------------------
+void ARDroneMosaic::blend(const cv::Mat &image, const cv::Mat &G)
+{
+    // Bounding box on the canvas
+    std::vector<cv::Point2f> corners(4), warped;
+    corners[0] = cv::Point2f(0.0f, 0.0f);
+    corners[1] = cv::Point2f((float)image.cols, 0.0f);
+    corners[2] = cv::Point2f((float)image.cols, (float)image.rows);
+    corners[3] = cv::Point2f(0.0f, (float)image.rows);
+    cv::perspectiveTransform(corners, warped, G);
+
+    // Tiles under the image (too many of them means a broken pose)
+    double x0 = DBL_MAX, y0 = DBL_MAX, x1 = -DBL_MAX, y1 = -DBL_MAX;
+    for (size_t i = 0; i < warped.size(); i++) {
+        if (cvIsNaN(warped[i].x) || cvIsNaN(warped[i].y) || cvIsInf(warped[i].x) || cvIsInf(warped[i].y)) return;
+        x0 = MIN(x0, warped[i].x);
+        y0 = MIN(y0, warped[i].y);
+        x1 = MAX(x1, warped[i].x);
+        y1 = MAX(y1, warped[i].y);
+    }
+    double tiles_x = floor(x1 / MOSAIC_TILE_SIZE) - floor(x0 / MOSAIC_TILE_SIZE) + 1.0;
+    double tiles_y = floor(y1 / MOSAIC_TILE_SIZE) - floor(y0 / MOSAIC_TILE_SIZE) + 1.0;
+    if (tiles_x * tiles_y > MOSAIC_MAX_TILES) return;
+    cv::Rect box = cv::boundingRect(warped);
+    int tx0 = cvFloor((double)box.x / MOSAIC_TILE_SIZE), tx1 = cvFloor((double)(box.x + box.width)  / MOSAIC_TILE_SIZE);
+    int ty0 = cvFloor((double)box.y / MOSAIC_TILE_SIZE), ty1 = cvFloor((double)(box.y + box.height) / MOSAIC_TILE_SIZE);
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            // Part of the tile to be updated
+            cv::Rect area = box & cv::Rect(tx * MOSAIC_TILE_SIZE, ty * MOSAIC_TILE_SIZE, MOSAIC_TILE_SIZE, MOSAIC_TILE_SIZE);
+            if (area.area() <= 0) continue;
+
+            // Create the tile
+            TILE &tile = tiles[std::make_pair(tx, ty)];
+            if (tile.image.empty()) {
+                tile.image = cv::Mat::zeros(MOSAIC_TILE_SIZE, MOSAIC_TILE_SIZE, CV_8UC3);
+                tile.weight = cv::Mat::zeros(MOSAIC_TILE_SIZE, MOSAIC_TILE_SIZE, CV_32FC1);
+            }
+
+            // Warp the image and its weight into the area
+            cv::Mat T = (cv::Mat_<double>(3, 3) << 1, 0, -area.x, 0, 1, -area.y, 0, 0, 1);
+            T = T * G;
+            cv::warpPerspective(image,   warpImage,  T, area.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+            cv::warpPerspective(feather, warpWeight, T, area.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+
+            // Weighted average (feathered at the edges)
+            cv::Rect roi(area.x - tx * MOSAIC_TILE_SIZE, area.y - ty * MOSAIC_TILE_SIZE, area.width, area.height);
+            for (int y = 0; y < roi.height; y++) {
+                const cv::Vec3b *src = warpImage.ptr<cv::Vec3b>(y);
+                const float *wn = warpWeight.ptr<float>(y);
+                cv::Vec3b *dst = tile.image.ptr<cv::Vec3b>(roi.y + y) + roi.x;
+                float *w = tile.weight.ptr<float>(roi.y + y) + roi.x;
+                for (int x = 0; x < roi.width; x++) {
+                    if (wn[x] <= 0.0f) continue;
+                    float a = wn[x] / (w[x] + wn[x]);
+                    for (int c = 0; c < 3; c++) dst[x][c] = cv::saturate_cast<uchar>(dst[x][c] + a * (src[x][c] - dst[x][c]));
+                    w[x] = MIN(w[x] + wn[x], MOSAIC_MAX_WEIGHT);
+                }
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Make the blending weight of a frame.
+//! @param   size Size of the frame
+//! @return  None
+//! @note    1 in the center and falling to 0 at the edges.
+// --------------------------------------------------------------------------
+void ARDroneMosaic::makeFeather(const cv::Size &size)
+{
+    feather.create(size, CV_32FC1);
+    float half = MIN(size.width, size.height) * 0.5f;
+    for (int y = 0; y < size.height; y++) {
+        float *w = feather.ptr<float>(y);
+        for (int x = 0; x < size.width; x++) {
+            float d = (float)MIN(MIN(x + 1, size.width - x), MIN(y + 1, size.height - y));
+            w[x] = MIN(1.0f, d / half);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the mosaic.
+//! @param   mosaic Mosaic image (black where nothing was seen)
+//! @param   scale Scale of the image (e.g. 0.25 for a preview)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure (empty)
+// --------------------------------------------------------------------------
+int ARDroneMosaic::getMosaic(cv::Mat *mosaic, double scale)
+{
+    if (tiles.empty() || scale <= 0.0) return 0;
+
+    // Tiles in use
+    int tx0 = INT_MAX, ty0 = INT_MAX, tx1 = INT_MIN, ty1 = INT_MIN;
+    std::map<std::pair<int, int>, TILE>::iterator it;
+    for (it = tiles.begin(); it != tiles.end(); ++it) {
+        tx0 = MIN(tx0, it->first.first);  tx1 = MAX(tx1, it->first.first);
+        ty0 = MIN(ty0, it->first.second); ty1 = MAX(ty1, it->first.second);
+    }
+
+    // Put them together
+    int size = cvRound(MOSAIC_TILE_SIZE * scale);
+    if (size < 1) return 0;
+    mosaic->create((ty1 - ty0 + 1) * size, (tx1 - tx0 + 1) * size, CV_8UC3);
+    mosaic->setTo(cv::Scalar::all(0));
+    for (it = tiles.begin(); it != tiles.end(); ++it) {
+        cv::Mat roi = (*mosaic)(cv::Rect((it->first.first - tx0) * size, (it->first.second - ty0) * size, size, size));
+        if (size == MOSAIC_TILE_SIZE) it->second.image.copyTo(roi);
+        else cv::resize(it->second.image, roi, roi.size(), 0.0, 0.0, cv::INTER_AREA);
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the homography of the last located frame.
+//! @return  Homography (frame -> canvas, origin at the first keyframe)
+// --------------------------------------------------------------------------
+cv::Mat ARDroneMosaic::getPose(void)
+{
+    return pose.clone();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the number of keyframes blended.
+//! @return  Number of keyframes (not counting the ones followed while lost)
+// --------------------------------------------------------------------------
+int ARDroneMosaic::getKeyframeCount(void)
+{
+    return keyCount;
+}
@@ -27,6 +27,9 @@
 
 #include "ardrone.h"
 
+// Navdata kept to find the state at the capture of frames (2.5 s at 200Hz)
+#define NAVDATA_HISTORY_SIZE (512)
+
 // --------------------------------------------------------------------------
 //! @brief   Initialize Navdata.
 //! @return  Result of initialization
@@ -36,7 +39,7 @@
 int ARDrone::initNavdata(void)
 {
     // Open the IP address and port
-    if (!sockNavdata.open(ip, ARDRONE_NAVDATA_PORT)) {
+    if (!sockNavdata.open(ip, ARDRONE_NAVDATA_PORT, localIp, 0, netDevice)) {
         CVDRONE_ERROR("UDPSocket::open(port=%d) was failed. (%s, %d)\n", ARDRONE_NAVDATA_PORT, __FILE__, __LINE__);
         return 0;
     }
@@ -76,11 +79,13 @@ int ARDrone::initNavdata(void)
     mutexNavdata = new pthread_mutex_t;
     pthread_mutex_init(mutexNavdata, NULL);
 
-    // Create a thread
-    threadNavdata = new pthread_t;
-    if (pthread_create(threadNavdata, NULL, runNavdata, this) != 0) {
-        CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
-        return 0;
+    // Create a thread (ARDroneFleet drives managed drones by itself)
+    if (!managed) {
+        threadNavdata = new pthread_t;
+        if (pthread_create(threadNavdata, NULL, runNavdata, this) != 0) {
+            CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
     }
 
     return 1;
@@ -111,15 +116,44 @@ int ARDrone::getNavdata(void)
     // Send a request
     sockNavdata.sendf("\x01\x00\x00\x00");
 
-    // Receive data
-    char buf[4096] = {'\0'};
-    int size = sockNavdata.receive((void*)&buf, sizeof(buf));
+    // Receive all queued packets at once
+    const int n = 8;
+    char buf[n][4096];
+    UDP_PACKET packets[n];
+    for (int i = 0; i < n; i++) {
+        packets[i].data = buf[i];
+        packets[i].capacity = sizeof(buf[i]);
+    }
+    int received = sockNavdata.receiveMany(packets, n, 1000);
 
+    // Parse them in order
+    for (int i = 0; i < received; i++) parseNavdata((const char*)packets[i].data, packets[i].size, packets[i].timestamp);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Parse a received navdata packet.
+//! @param   buf Received packet
+//! @param   size Size of the packet
+//! @param   timestamp Received time of the packet [s] (0 = now)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDrone::parseNavdata(const char *buf, int size, double timestamp)
+{
     // Received something
     if (size > 0) {
         // Enable mutex lock
         if (mutexNavdata) pthread_mutex_lock(mutexNavdata);
 
+        // Received time
+        navdataTime = (timestamp > 0.0) ? timestamp : gettime();
+
+        // Record it
+        if (recorder) recorder->write(ARDRONE_LOG_NAVDATA, buf, size, NULL, 0, navdataTime);
+
         // Header
         int index = 0;
         memcpy((void*)&(navdata.header),         (const void*)(buf + index), 4); index += 4;
@@ -128,12 +162,15 @@ int ARDrone::getNavdata(void)
         memcpy((void*)&(navdata.vision_defined), (const void*)(buf + index), 4); index += 4;
 
         // Parse navdata
+        bool hasTime = false, hasVideoStream = false;
+        unsigned int options = 0;
         while (index < size) {
             // Tag and data size
             unsigned short tmp_tag, tmp_size;
             memcpy((void*)&tmp_tag,  (const void*)(buf + index), 2); index += 2;  // tag
             memcpy((void*)&tmp_size, (const void*)(buf + index), 2); index += 2;  // size
             index -= 4;
+            if (tmp_tag < 32) options |= 1u << tmp_tag;
 
             // Copy to NAVDATA structure
             switch (tmp_tag) {
@@ -142,6 +179,7 @@ int ARDrone::getNavdata(void)
                     break;
                 case ARDRONE_NAVDATA_TIME_TAG:
                     memcpy((void*)&(navdata.time),            (const void*)(buf + index), MIN(tmp_size, sizeof(navdata.time)));
+                    hasTime = true;
                     break;
                 case ARDRONE_NAVDATA_RAW_MEASURES_TAG:
                     memcpy((void*)&(navdata.raw_measures),    (const void*)(buf + index), MIN(tmp_size, sizeof(navdata.raw_measures)));
@@ -196,6 +234,7 @@ int ARDrone::getNavdata(void)
                     break;
                 case ARDRONE_NAVDATA_VIDEO_STREAM_TAG:
                     memcpy((void*)&(navdata.video_stream),    (const void*)(buf + index), MIN(tmp_size, sizeof(navdata.video_stream)));
+                    hasVideoStream = true;
                     break;
                 case ARDRONE_NAVDATA_GAME_TAG:
                     memcpy((void*)&(navdata.games),           (const void*)(buf + index), MIN(tmp_size, sizeof(navdata.games)));
@@ -233,11 +272,125 @@ int ARDrone::getNavdata(void)
             index += tmp_size;
         }
 
+        // Keep the history (same units as the getters)
+        NAVDATA_SAMPLE sample;
+        sample.time        = navdataTime;
+        sample.droneTime   = hasTime ? (navdata.time.time >> 21) + (navdata.time.time & 0x1FFFFF) * 1.0e-6 : -1.0;
+        sample.frameNumber = hasVideoStream ? (int64_t)navdata.video_stream.frame_number : -1;
+        sample.roll        =  navdata.demo.phi   * 0.001 * DEG_TO_RAD;
+        sample.pitch       = -navdata.demo.theta * 0.001 * DEG_TO_RAD;
+        sample.yaw         = -navdata.demo.psi   * 0.001 * DEG_TO_RAD;
+        sample.altitude    =  navdata.demo.altitude * 0.001;
+        sample.vx          =  navdata.demo.vx * 0.001;
+        sample.vy          = -navdata.demo.vy * 0.001;
+        bool hasVz         = (options & (1u << ARDRONE_NAVDATA_ALTITUDE_TAG)) != 0;
+        sample.vz          = hasVz ? -navdata.altitude.altitude_vz * 0.001 : 0.0;
+        if (!navdataHistory.empty() && navdataHistory.back().time > sample.time) navdataHistory.clear();
+        navdataHistory.push_back(sample);
+        while (navdataHistory.size() > NAVDATA_HISTORY_SIZE) navdataHistory.pop_front();
+
+        // Dead-reckoning
+        if (odometry) odometry->update(sample.time, sample.droneTime, sample.roll, sample.pitch, sample.yaw, sample.altitude, sample.vx, sample.vy, sample.vz, hasVz);
+
+        // State estimator (tag 27 is only GPS on 2.4)
+        if (!(version.major == 2 && version.minor == 4)) options &= ~(1u << ARDRONE_NAVDATA_GPS_TAG);
+        if (estimator) estimator->update(navdata, options, sample.time, sample.droneTime);
+
         // Disable mutex lock
         if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
+
+        return 1;
     }
 
-    return 1;
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Find the capture time of a frame and the Navdata at that time.
+//! @param   packet Video packet of the frame
+//! @param   info Capture time and state (interpolated between Navdata packets)
+//! @return  None
+//! @note    The capture time is taken from the first Navdata reporting the frame in
+//!          video_stream.frame_number, or the PaVE timestamp on the time option,
+//!          or the received time of the frame, whichever is available first.
+// --------------------------------------------------------------------------
+void ARDrone::syncFrame(const ARDRONE_VIDEO_PACKET &packet, ARDRONE_FRAME_INFO *info)
+{
+    memset(info, 0, sizeof(ARDRONE_FRAME_INFO));
+    info->frame_number   = packet.header.frame_number;
+    info->pave_timestamp = packet.header.timestamp;
+    info->timestamp      = packet.timestamp;
+    info->sync           = ARDRONE_SYNC_NONE;
+
+    if (mutexNavdata) pthread_mutex_lock(mutexNavdata);
+
+    // No Navdata yet
+    const std::deque<NAVDATA_SAMPLE> &history = navdataHistory;
+    if (history.empty()) {
+        if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
+        return;
+    }
+
+    // The frame counter went past the frame between two packets
+    double time = -1.0;
+    int64_t number = packet.header.frame_number;
+    if (version.major == ARDRONE_VERSION_2 && number > 0) {
+        for (size_t i = history.size() - 1; i > 0; i--) {
+            const NAVDATA_SAMPLE &prev = history[i - 1], &next = history[i];
+            if (next.frameNumber < 0 || prev.frameNumber < 0) break;
+            if (prev.frameNumber < number && next.frameNumber >= number) {
+                time = (prev.time + next.time) * 0.5;
+                info->sync = ARDRONE_SYNC_FRAME_NUMBER;
+                break;
+            }
+            if (prev.frameNumber < number) break;
+        }
+    }
+
+    // The PaVE timestamp between two packets on the drone's clock
+    if (time < 0.0 && version.major == ARDRONE_VERSION_2) {
+        double droneTime = packet.header.timestamp * 0.001;
+        for (size_t i = history.size() - 1; i > 0; i--) {
+            const NAVDATA_SAMPLE &prev = history[i - 1], &next = history[i];
+            if (next.droneTime < 0.0 || prev.droneTime < 0.0) break;
+            if (prev.droneTime <= droneTime && droneTime <= next.droneTime) {
+                double t = (next.droneTime > prev.droneTime) ? (droneTime - prev.droneTime) / (next.droneTime - prev.droneTime) : 0.0;
+                time = prev.time + (next.time - prev.time) * t;
+                info->sync = ARDRONE_SYNC_DRONE_TIME;
+                break;
+            }
+            if (prev.droneTime < droneTime) break;
+        }
+    }
+
+    // Otherwise when it was received
+    if (time < 0.0) {
+        time = (packet.timestamp > 0.0) ? packet.timestamp : history.back().time;
+        info->sync = ARDRONE_SYNC_RECEIVED;
+    }
+    info->timestamp = time;
+
+    // Interpolate the state at the time
+    size_t i = history.size() - 1;
+    while (i > 0 && history[i - 1].time > time) i--;
+    const NAVDATA_SAMPLE &next = history[i];
+    const NAVDATA_SAMPLE &prev = (i > 0) ? history[i - 1] : next;
+    double t = (next.time > prev.time) ? (time - prev.time) / (next.time - prev.time) : 1.0;
+    t = MAX(0.0, MIN(t, 1.0));
+    double dyaw = next.yaw - prev.yaw;
+    if (dyaw >  M_PI) dyaw -= 2.0 * M_PI;
+    if (dyaw < -M_PI) dyaw += 2.0 * M_PI;
+    info->roll     = prev.roll     + (next.roll     - prev.roll)     * t;
+    info->pitch    = prev.pitch    + (next.pitch    - prev.pitch)    * t;
+    info->yaw      = prev.yaw      + dyaw * t;
+    info->altitude = prev.altitude + (next.altitude - prev.altitude) * t;
+    info->vx       = prev.vx       + (next.vx       - prev.vx)       * t;
+    info->vy       = prev.vy       + (next.vy       - prev.vy)       * t;
+    info->vz       = prev.vz       + (next.vz       - prev.vz)       * t;
+    if (info->yaw >  M_PI) info->yaw -= 2.0 * M_PI;
+    if (info->yaw < -M_PI) info->yaw += 2.0 * M_PI;
+
+    if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
 }
 
 // --------------------------------------------------------------------------
@@ -296,6 +449,20 @@ double ARDrone::getAltitude(void)
     return altitude;
 }
 
+// --------------------------------------------------------------------------
+//! @brief   Get the received time of the latest Navdata.
+//! @return  Received time (kernel timestamp when available) [s]
+// --------------------------------------------------------------------------
+double ARDrone::getNavdataTime(void)
+{
+    // Get the data
+    if (mutexNavdata) pthread_mutex_lock(mutexNavdata);
+    double time = navdataTime;
+    if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
+
+    return time;
+}
+
 // --------------------------------------------------------------------------
 //! @brief   Get estimated velocity of AR.Drone.
 //! @param   vx A pointer to the X velocity variable [m/s]
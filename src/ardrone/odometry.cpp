@@ -0,0 +1,250 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   odometry.cpp
+//! @brief  Dead-reckoning at the Navdata rate
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// Navdata farther apart than this are not integrated [s]
+#define ODOMETRY_MAX_DT (0.5)
+
+// --------------------------------------------------------------------------
+//! @brief   Order memory accesses between the writer and the readers.
+//! @return  None
+// --------------------------------------------------------------------------
+static inline void fence(void)
+{
+    #ifdef _MSC_VER
+    MemoryBarrier();
+    #else
+    __sync_synchronize();
+    #endif
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneOdometry class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneOdometry::ARDroneOdometry()
+{
+    seq = 0;
+    memset(&published, 0, sizeof(published));
+    reset();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneOdometry class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneOdometry::~ARDroneOdometry()
+{
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Restart from a position.
+//! @param   x Position [m]
+//! @param   y Position [m]
+//! @return  None
+//! @note    Call from the thread calling update().
+// --------------------------------------------------------------------------
+void ARDroneOdometry::reset(double x, double y)
+{
+    memset(&current, 0, sizeof(current));
+    current.x = x;
+    current.y = y;
+    lastDroneTime = -1.0;
+    lastVelocity = ARMath::vec3(0.0f, 0.0f, 0.0f);
+    publish();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Integrate a Navdata.
+//! @param   time Received time [s]
+//! @param   drone_time Time option [s] (negative if not sent)
+//! @param   roll Roll angle [rad]
+//! @param   pitch Pitch angle [rad]
+//! @param   yaw Yaw angle [rad]
+//! @param   altitude Altitude [m]
+//! @param   vx Velocity in the body frame [m/s]
+//! @param   vy Velocity in the body frame [m/s]
+//! @param   vz Velocity in the body frame [m/s]
+//! @param   has_vz vz was sent (the altitude option, not in demo mode)
+//! @return  None
+//! @note    The drone's own clock is used for the time step when it is sent,
+//!          so that network jitter does not stretch or shrink the path.
+// --------------------------------------------------------------------------
+void ARDroneOdometry::update(double time, double drone_time, double roll, double pitch, double yaw, double altitude, double vx, double vy, double vz, bool has_vz)
+{
+    // Time step
+    double dt = 0.0;
+    if (current.samples > 0) {
+        if (drone_time >= 0.0 && lastDroneTime >= 0.0) dt = drone_time - lastDroneTime;
+        else                                           dt = time - current.time;
+    }
+    lastDroneTime = drone_time;
+
+    // Velocity in the world frame (RZ * RY * RX * v)
+    ARMath::Mat33 R = ARMath::fromEuler((float)roll, (float)pitch, (float)yaw);
+    ARMath::Vec3 v = R * ARMath::vec3((float)vx, (float)vy, has_vz ? (float)vz : 0.0f);
+
+    // Integrate with the trapezoidal rule (skipped over gaps and clock resets)
+    bool valid = dt > 0.0 && dt < ODOMETRY_MAX_DT;
+    if (valid) {
+        ARMath::Vec3 d = (v + lastVelocity) * (float)(0.5 * dt);
+        if (!has_vz) d.z = (float)(altitude - current.z);
+        current.x += d.x;
+        current.y += d.y;
+        current.distance += sqrt((double)d.x * d.x + (double)d.y * d.y + (double)d.z * d.z);
+    }
+    lastVelocity = v;
+
+    // Without vz, the vertical speed is the rate of the altimeter
+    if (!has_vz) v.z = valid ? (float)((altitude - current.z) / dt) : 0.0f;
+
+    // The altimeter does not drift
+    current.z = altitude;
+
+    // State
+    current.time = time;
+    current.vx = v.x;
+    current.vy = v.y;
+    current.vz = v.z;
+    current.roll = roll;
+    current.pitch = pitch;
+    current.yaw = yaw;
+    current.samples++;
+
+    publish();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Make the current pose visible to the readers.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneOdometry::publish(void)
+{
+    // The sequence number is odd while the pose is written
+    seq = seq + 1;
+    fence();
+    published = current;
+    fence();
+    seq = seq + 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the latest pose.
+//! @param   pose Latest pose
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 No Navdata has been integrated yet
+//! @note    Does not lock, so it can be called from any thread at any rate.
+// --------------------------------------------------------------------------
+int ARDroneOdometry::getPose(ARDRONE_POSE *pose)
+{
+    // Copy until the writer has not touched it meanwhile
+    ARDRONE_POSE tmp;
+    uint32_t before, after;
+    do {
+        before = seq;
+        fence();
+        memcpy(&tmp, (const void*)&published, sizeof(tmp));
+        fence();
+        after = seq;
+    } while ((before & 1) || before != after);
+
+    if (pose) *pose = tmp;
+
+    return (tmp.samples > 0) ? 1 : 0;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start the dead-reckoning on the Navdata thread.
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDrone::startOdometry(void)
+{
+    // Already started
+    if (odometry) return 1;
+
+    // Attach it to the Navdata thread
+    ARDroneOdometry *tmp = new ARDroneOdometry;
+    if (mutexNavdata) pthread_mutex_lock(mutexNavdata);
+    odometry = tmp;
+    if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop the dead-reckoning.
+//! @return  None
+//! @note    Do not call it while other threads are calling getPose().
+//!          The controller reads it under the command mutex, so it is safe for it.
+// --------------------------------------------------------------------------
+void ARDrone::stopOdometry(void)
+{
+    // Not started
+    if (!odometry) return;
+    ARDroneOdometry *tmp = odometry;
+
+    // Detach it from the Navdata thread and the controller on the command thread
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    if (mutexNavdata) pthread_mutex_lock(mutexNavdata);
+    odometry = NULL;
+    if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    delete tmp;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the pose from the dead-reckoning.
+//! @param   pose Latest pose
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Not started or no Navdata yet
+//! @note    Does not lock.
+// --------------------------------------------------------------------------
+int ARDrone::getPose(ARDRONE_POSE *pose)
+{
+    ARDroneOdometry *tmp = odometry;
+    if (!tmp) return 0;
+    return tmp->getPose(pose);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Restart the dead-reckoning from a position.
+//! @param   x Position [m]
+//! @param   y Position [m]
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::resetPose(double x, double y)
+{
+    if (mutexNavdata) pthread_mutex_lock(mutexNavdata);
+    if (odometry) odometry->reset(x, y);
+    if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
+}
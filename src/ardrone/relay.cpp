@@ -0,0 +1,390 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   relay.cpp
+//! @brief  Re-streaming the video to local consumers
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+
+// Relay parameters
+#define RELAY_MAX_WAIT      (50)            // Longest wait for events [ms]
+#define RELAY_MAX_BACKLOG   (512 * 1024)    // Unsent video per consumer before dropping frames [bytes]
+
+// Broken connections are reported by send() instead of SIGPIPE
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL (0)
+#endif
+
+// --------------------------------------------------------------------------
+//! @brief   Close a socket.
+//! @param   sock Socket (set to INVALID_SOCKET)
+//! @return  None
+// --------------------------------------------------------------------------
+static void closeSocket(SOCKET *sock)
+{
+    if (*sock == INVALID_SOCKET) return;
+    #if _WIN32
+    closesocket(*sock);
+    #else
+    ::close(*sock);
+    #endif
+    *sock = INVALID_SOCKET;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set a socket to non-blocking mode.
+//! @param   sock Socket
+//! @return  None
+// --------------------------------------------------------------------------
+static void setNonBlocking(SOCKET sock)
+{
+    #if _WIN32
+    u_long nonblock = 1;
+    ioctlsocket(sock, FIONBIO, &nonblock);
+    #else
+    int flag = fcntl(sock, F_GETFL, 0);
+    if (flag >= 0) fcntl(sock, F_SETFL, flag|O_NONBLOCK);
+    #endif
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneRelay class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneRelay::ARDroneRelay()
+{
+    sockServer = INVALID_SOCKET;
+    pave = true;
+    quit = false;
+    threadRelay = NULL;
+    mutexRelay = NULL;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneRelay class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneRelay::~ARDroneRelay()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start serving the video.
+//! @param   addr IP address to serve on
+//! @param   port Port number
+//! @param   pave Send PaVE frames like AR.Drone 2.0 (false sends an Annex-B H.264 stream for media players)
+//! @return  Result of initialization
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneRelay::open(const char *addr, int port, bool pave)
+{
+    // Stop the previous one
+    close();
+
+    #if _WIN32
+    // Initialize WSA
+    WSAData wsaData;
+    WSAStartup(MAKEWORD(1,1), &wsaData);
+    #endif
+
+    // Create a socket
+    sockServer = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockServer == INVALID_SOCKET) {
+        CVDRONE_ERROR("socket() was failed. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Restart quickly after TIME_WAIT
+    #ifndef _WIN32
+    int reuse = 1;
+    setsockopt(sockServer, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    #endif
+
+    // Listen on the address
+    sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons((u_short)port);
+    server_addr.sin_addr.s_addr = inet_addr(addr);
+    if (bind(sockServer, (sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR || listen(sockServer, 8) == SOCKET_ERROR) {
+        CVDRONE_ERROR("Failed to serve on %s:%d. (%s, %d)\n", addr, port, __FILE__, __LINE__);
+        closeSocket(&sockServer);
+        return 0;
+    }
+    setNonBlocking(sockServer);
+    this->pave = pave;
+
+    // Create a mutex
+    mutexRelay = new pthread_mutex_t;
+    pthread_mutex_init(mutexRelay, NULL);
+
+    // Create a thread
+    quit = false;
+    threadRelay = new pthread_t;
+    if (pthread_create(threadRelay, NULL, runRelay, this) != 0) {
+        CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+        delete threadRelay;
+        threadRelay = NULL;
+        close();
+        return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Send a frame to all consumers.
+//! @param   packet Video packet of AR.Drone 2.0
+//! @return  Number of consumers the frame was queued to
+//! @note    The frame is sent right away; only the rest is left to the thread.
+//!          A consumer starts (and restarts after falling behind) at a key frame.
+// --------------------------------------------------------------------------
+int ARDroneRelay::push(const ARDRONE_VIDEO_PACKET &packet)
+{
+    // Not opened or nothing to send
+    if (!mutexRelay || packet.data.empty()) return 0;
+    bool key = (packet.header.frame_type == ARDRONE_PAVE_FRAME_IDR || packet.header.frame_type == ARDRONE_PAVE_FRAME_I);
+
+    pthread_mutex_lock(mutexRelay);
+
+    int count = 0;
+    for (size_t i = 0; i < clients.size(); i++) {
+        CLIENT *client = &clients[i];
+
+        // Too slow consumer, drop frames until the next key frame
+        if (client->output.size() > RELAY_MAX_BACKLOG) client->waitKeyFrame = true;
+        if (client->waitKeyFrame && (!key || client->output.size() > RELAY_MAX_BACKLOG)) continue;
+        client->waitKeyFrame = false;
+
+        // Queue and send it
+        if (pave) {
+            const uint8_t *bytes = (const uint8_t*)&packet.header;
+            client->output.insert(client->output.end(), bytes, bytes + sizeof(packet.header));
+        }
+        client->output.insert(client->output.end(), packet.data.begin(), packet.data.end());
+        flush(client);
+        count++;
+    }
+
+    pthread_mutex_unlock(mutexRelay);
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the number of consumers.
+//! @return  Number of connections
+// --------------------------------------------------------------------------
+int ARDroneRelay::getClientCount(void)
+{
+    if (!mutexRelay) return 0;
+
+    pthread_mutex_lock(mutexRelay);
+    int count = (int)clients.size();
+    pthread_mutex_unlock(mutexRelay);
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop serving.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneRelay::close(void)
+{
+    // Stop the thread
+    if (threadRelay) {
+        quit = true;
+        pthread_join(*threadRelay, NULL);
+        delete threadRelay;
+        threadRelay = NULL;
+    }
+
+    // Delete the mutex
+    if (mutexRelay) {
+        pthread_mutex_destroy(mutexRelay);
+        delete mutexRelay;
+        mutexRelay = NULL;
+    }
+
+    // Close the connections
+    for (size_t i = 0; i < clients.size(); i++) closeSocket(&clients[i].sock);
+    clients.clear();
+    closeSocket(&sockServer);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Send pending data to a consumer as much as possible.
+//! @param   client TCP connection
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneRelay::flush(CLIENT *client)
+{
+    size_t sent = 0;
+    while (sent < client->output.size()) {
+        int n = (int)send(client->sock, (const char*)&client->output[sent], (int)(client->output.size() - sent), MSG_NOSIGNAL);
+        if (n < 1) break;
+        sent += n;
+    }
+    client->output.erase(client->output.begin(), client->output.begin() + sent);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Thread function for connections and slow consumers.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneRelay::loopRelay(void)
+{
+    char buf[1024];
+
+    while (!quit) {
+        // Sockets to be watched
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(sockServer, &rfds);
+        int maxfd = (int)sockServer;
+        pthread_mutex_lock(mutexRelay);
+        for (size_t i = 0; i < clients.size(); i++) {
+            FD_SET(clients[i].sock, &rfds);
+            if (!clients[i].output.empty()) FD_SET(clients[i].sock, &wfds);
+            maxfd = MAX(maxfd, (int)clients[i].sock);
+        }
+        pthread_mutex_unlock(mutexRelay);
+
+        // Wait for events
+        timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = RELAY_MAX_WAIT * 1000;
+        if (select(maxfd + 1, &rfds, &wfds, NULL, &tv) < 1) continue;
+
+        pthread_mutex_lock(mutexRelay);
+
+        // New consumers
+        if (FD_ISSET(sockServer, &rfds)) {
+            SOCKET sock;
+            while ((sock = accept(sockServer, NULL, NULL)) != INVALID_SOCKET) {
+                // Send frames as soon as possible
+                int nodelay = 1;
+                setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+                setNonBlocking(sock);
+                CLIENT client;
+                client.sock = sock;
+                client.waitKeyFrame = true;
+                clients.push_back(client);
+            }
+        }
+
+        // Existing consumers
+        for (size_t i = 0; i < clients.size(); i++) {
+            CLIENT *client = &clients[i];
+            if (!FD_ISSET(client->sock, &rfds) && !FD_ISSET(client->sock, &wfds)) continue;
+
+            // Anything received is ignored, only a disconnection matters
+            bool closed = false;
+            if (FD_ISSET(client->sock, &rfds)) {
+                int n = (int)recv(client->sock, buf, sizeof(buf), 0);
+                if (n == 0) closed = true;
+                #if _WIN32
+                else if (n < 0 && WSAGetLastError() != WSAEWOULDBLOCK) closed = true;
+                #else
+                else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) closed = true;
+                #endif
+            }
+
+            // Send the rest
+            if (!closed && FD_ISSET(client->sock, &wfds)) flush(client);
+
+            // Disconnected
+            if (closed) {
+                closeSocket(&client->sock);
+                clients.erase(clients.begin() + i--);
+            }
+        }
+
+        pthread_mutex_unlock(mutexRelay);
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start re-streaming the video to local consumers.
+//! @param   addr IP address to serve on
+//! @param   port Port number
+//! @param   pave Send PaVE frames (false sends an Annex-B H.264 stream)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    Only for AR.Drone 2.0. Frames are neither decoded nor re-encoded for consumers.
+// --------------------------------------------------------------------------
+int ARDrone::startRelay(const char *addr, int port, bool pave)
+{
+    // AR.Drone 1.0 sends UVLC pictures
+    if (version.major != ARDRONE_VERSION_2) {
+        CVDRONE_ERROR("Relaying is only for AR.Drone 2.0. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Stop the previous one
+    stopRelay();
+
+    // Create a relay
+    ARDroneRelay *tmp = new ARDroneRelay;
+    if (!tmp->open(addr, port, pave)) {
+        delete tmp;
+        return 0;
+    }
+
+    // Attach it to the video thread
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    relay = tmp;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop re-streaming the video.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::stopRelay(void)
+{
+    // Not relaying
+    if (!relay) return;
+    ARDroneRelay *tmp = relay;
+
+    // Detach it from the video thread
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    relay = NULL;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+    // Close the connections
+    tmp->close();
+    delete tmp;
+}
@@ -0,0 +1,390 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   remux.cpp
+//! @brief  Writing the H.264 stream into MP4/MKV without re-encoding
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+//! @brief   Check if a PaVE frame can start a stream.
+//! @param   header PaVE header
+//! @return  Result of this function
+//! @retval  true  IDR or I-frame
+//! @retval  false Others
+// --------------------------------------------------------------------------
+static bool isKeyFrame(const ARDRONE_PAVE &header)
+{
+    return header.frame_type == ARDRONE_PAVE_FRAME_IDR || header.frame_type == ARDRONE_PAVE_FRAME_I;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneRemuxer class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneRemuxer::ARDroneRemuxer()
+{
+    pFormatCtx = NULL;
+    pStream = NULL;
+    firstTimestamp = 0;
+    lastDts = AV_NOPTS_VALUE;
+    headerWritten = false;
+    failed = false;
+    maxQueue = 0;
+    drops = 0;
+    waitKeyFrame = true;
+    quit = false;
+    threadWrite = NULL;
+    mutexWrite = NULL;
+    condWrite = NULL;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneRemuxer class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneRemuxer::~ARDroneRemuxer()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Create a video file and start the writer thread.
+//! @param   filename Output file (e.g. "flight.mp4", "flight.mkv")
+//! @param   max_queue Maximum number of frames waiting to be written
+//! @return  Result of initialization
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneRemuxer::open(const char *filename, int max_queue)
+{
+    // Close the previous file
+    close();
+
+    // Choose a muxer by the extension
+    if (avformat_alloc_output_context2(&pFormatCtx, NULL, NULL, filename) < 0 || !pFormatCtx) {
+        CVDRONE_ERROR("avformat_alloc_output_context2(%s) was failed. (%s, %d)\n", filename, __FILE__, __LINE__);
+        pFormatCtx = NULL;
+        return 0;
+    }
+
+    // Create the file
+    if (!(pFormatCtx->oformat->flags & AVFMT_NOFILE)) {
+        if (avio_open(&pFormatCtx->pb, filename, AVIO_FLAG_WRITE) < 0) {
+            CVDRONE_ERROR("avio_open(%s) was failed. (%s, %d)\n", filename, __FILE__, __LINE__);
+            avformat_free_context(pFormatCtx);
+            pFormatCtx = NULL;
+            return 0;
+        }
+    }
+
+    // Reset the state (the stream starts at the next key frame)
+    this->filename = filename;
+    pStream = NULL;
+    firstTimestamp = 0;
+    lastDts = AV_NOPTS_VALUE;
+    headerWritten = false;
+    failed = false;
+    maxQueue = MAX(1, max_queue);
+    drops = 0;
+    waitKeyFrame = true;
+    quit = false;
+
+    // Create a mutex and a condition
+    mutexWrite = new pthread_mutex_t;
+    pthread_mutex_init(mutexWrite, NULL);
+    condWrite = new pthread_cond_t;
+    pthread_cond_init(condWrite, NULL);
+
+    // Create a thread
+    threadWrite = new pthread_t;
+    if (pthread_create(threadWrite, NULL, runWrite, this) != 0) {
+        CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+        delete threadWrite;
+        threadWrite = NULL;
+        close();
+        return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Queue a PaVE frame to be written.
+//! @param   packet Video packet of AR.Drone 2.0
+//! @return  Result of this function
+//! @retval  1 Queued
+//! @retval  0 Dropped
+//! @note    When the writer falls behind, frames are dropped until the next key frame.
+// --------------------------------------------------------------------------
+int ARDroneRemuxer::push(const ARDRONE_VIDEO_PACKET &packet)
+{
+    // Not opened or nothing to write
+    if (!threadWrite || packet.data.empty()) return 0;
+
+    pthread_mutex_lock(mutexWrite);
+
+    // The queue is full
+    if ((int)queue.size() >= maxQueue) waitKeyFrame = true;
+
+    // P-frames cannot be decoded without the previous frames
+    if (waitKeyFrame) {
+        if (!isKeyFrame(packet.header) || (int)queue.size() >= maxQueue) {
+            drops++;
+            pthread_mutex_unlock(mutexWrite);
+            return 0;
+        }
+        waitKeyFrame = false;
+    }
+
+    // Queue it
+    queue.push_back(packet);
+    pthread_cond_signal(condWrite);
+    pthread_mutex_unlock(mutexWrite);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the number of dropped frames.
+//! @return  Number of frames
+// --------------------------------------------------------------------------
+int ARDroneRemuxer::getDropCount(void)
+{
+    if (!mutexWrite) return drops;
+
+    pthread_mutex_lock(mutexWrite);
+    int count = drops;
+    pthread_mutex_unlock(mutexWrite);
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Write the queued frames and the trailer, then close the file.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneRemuxer::close(void)
+{
+    // Stop the thread after the queue was flushed
+    if (threadWrite) {
+        pthread_mutex_lock(mutexWrite);
+        quit = true;
+        pthread_cond_signal(condWrite);
+        pthread_mutex_unlock(mutexWrite);
+        pthread_join(*threadWrite, NULL);
+        delete threadWrite;
+        threadWrite = NULL;
+    }
+
+    // Delete the mutex and the condition
+    if (condWrite) {
+        pthread_cond_destroy(condWrite);
+        delete condWrite;
+        condWrite = NULL;
+    }
+    if (mutexWrite) {
+        pthread_mutex_destroy(mutexWrite);
+        delete mutexWrite;
+        mutexWrite = NULL;
+    }
+
+    // Finalize the file
+    if (pFormatCtx) {
+        if (headerWritten) av_write_trailer(pFormatCtx);
+        if (pFormatCtx->pb && !(pFormatCtx->oformat->flags & AVFMT_NOFILE)) avio_close(pFormatCtx->pb);
+        avformat_free_context(pFormatCtx);
+        pFormatCtx = NULL;
+        pStream = NULL;
+        headerWritten = false;
+    }
+
+    queue.clear();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Create the video stream and write the file header.
+//! @param   packet The first key frame (SPS/PPS are taken from it)
+//! @return  Result of initialization
+//! @retval  1 Success
+//! @retval  0 Failure (or not a key frame with SPS/PPS)
+//! @note    On failure of the muxer, "failed" is set and no more frames are written.
+// --------------------------------------------------------------------------
+int ARDroneRemuxer::initStream(const ARDRONE_VIDEO_PACKET &packet)
+{
+    // SPS and PPS are placed at the head of key frames
+    const ARDRONE_PAVE &header = packet.header;
+    size_t extra = header.header1_size + header.header2_size;
+    if (!isKeyFrame(header) || extra == 0 || extra > packet.data.size()) return 0;
+
+    // Create a stream (timestamps are in [ms] like PaVE)
+    pStream = avformat_new_stream(pFormatCtx, NULL);
+    if (!pStream) {
+        CVDRONE_ERROR("avformat_new_stream() was failed. (%s, %d)\n", __FILE__, __LINE__);
+        failed = true;
+        return 0;
+    }
+    AVCodecContext *pCodecCtx = pStream->codec;
+    pCodecCtx->codec_type = AVMEDIA_TYPE_VIDEO;
+    pCodecCtx->codec_id   = AV_CODEC_ID_H264;
+    pCodecCtx->width      = header.display_width;
+    pCodecCtx->height     = header.display_height;
+    pCodecCtx->time_base.num = 1;
+    pCodecCtx->time_base.den = 1000;
+    pStream->time_base = pCodecCtx->time_base;
+    if (pFormatCtx->oformat->flags & AVFMT_GLOBALHEADER) pCodecCtx->flags |= CODEC_FLAG_GLOBAL_HEADER;
+
+    // Annex B SPS/PPS (the muxer converts them for MP4/MKV)
+    pCodecCtx->extradata = (uint8_t*)av_mallocz(extra + FF_INPUT_BUFFER_PADDING_SIZE);
+    memcpy(pCodecCtx->extradata, &packet.data[0], extra);
+    pCodecCtx->extradata_size = (int)extra;
+
+    // Write the header
+    if (avformat_write_header(pFormatCtx, NULL) < 0) {
+        CVDRONE_ERROR("avformat_write_header(%s) was failed. (%s, %d)\n", filename.c_str(), __FILE__, __LINE__);
+        failed = true;
+        return 0;
+    }
+    headerWritten = true;
+
+    // The first frame is at zero
+    firstTimestamp = header.timestamp;
+    lastDts = AV_NOPTS_VALUE;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Write a PaVE frame as is.
+//! @param   packet Video packet
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneRemuxer::writePacket(const ARDRONE_VIDEO_PACKET &packet)
+{
+    AVPacket avpacket;
+    av_init_packet(&avpacket);
+    avpacket.data = (uint8_t*)&packet.data[0];
+    avpacket.size = (int)packet.data.size();
+    avpacket.stream_index = pStream->index;
+    if (isKeyFrame(packet.header)) avpacket.flags |= AV_PKT_FLAG_KEY;
+
+    // PaVE timestamp relative to the first frame (unsigned difference survives wrap-around)
+    // There are no B-frames in the stream, so PTS equals DTS.
+    AVRational ms = {1, 1000};
+    int64_t dts = av_rescale_q((int64_t)(uint32_t)(packet.header.timestamp - firstTimestamp), ms, pStream->time_base);
+    if (lastDts != AV_NOPTS_VALUE && dts <= lastDts) dts = lastDts + 1;
+    avpacket.pts = avpacket.dts = lastDts = dts;
+
+    // Write it
+    if (av_write_frame(pFormatCtx, &avpacket) < 0) {
+        CVDRONE_ERROR("av_write_frame(%s) was failed. (%s, %d)\n", filename.c_str(), __FILE__, __LINE__);
+        return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Thread function for writing.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneRemuxer::loopWrite(void)
+{
+    while (1) {
+        // Wait for frames
+        pthread_mutex_lock(mutexWrite);
+        while (!quit && queue.empty()) pthread_cond_wait(condWrite, mutexWrite);
+        if (queue.empty()) {
+            pthread_mutex_unlock(mutexWrite);
+            break;
+        }
+
+        // Take all of them
+        std::deque<ARDRONE_VIDEO_PACKET> packets;
+        packets.swap(queue);
+        pthread_mutex_unlock(mutexWrite);
+
+        // Write them (the stream starts at a key frame with SPS/PPS)
+        for (size_t i = 0; i < packets.size() && !failed; i++) {
+            if (!headerWritten && !initStream(packets[i])) continue;
+            writePacket(packets[i]);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start writing the H.264 stream into a video file without decoding.
+//! @param   filename Output file (MP4 or MKV, chosen by the extension)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    Only for AR.Drone 2.0. The file starts at the next key frame.
+// --------------------------------------------------------------------------
+int ARDrone::startRemux(const char *filename)
+{
+    // AR.Drone 1.0 sends UVLC pictures
+    if (version.major != ARDRONE_VERSION_2) {
+        CVDRONE_ERROR("Remuxing is only for AR.Drone 2.0. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Stop the previous one
+    stopRemux();
+
+    // Create a remuxer
+    ARDroneRemuxer *tmp = new ARDroneRemuxer;
+    if (!tmp->open(filename)) {
+        delete tmp;
+        return 0;
+    }
+
+    // Attach it to the video thread
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    remuxer = tmp;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop writing the video file.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::stopRemux(void)
+{
+    // Not recording
+    if (!remuxer) return;
+    ARDroneRemuxer *tmp = remuxer;
+
+    // Detach it from the video thread
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    remuxer = NULL;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+    // Flush and close
+    tmp->close();
+    delete tmp;
+}
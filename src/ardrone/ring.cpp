@@ -0,0 +1,382 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   ring.cpp
+//! @brief  Sharing decoded frames with other processes
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Layout of a ring
+//   Header : "CVDRSHM\0", version (uint32), slots (uint32), slot size (uint64), capacity (uint64), latest (uint64)
+//   Slots  : ARDRONE_FRAME_META (padded to 64 bytes) + BGR pixels (capacity), ...
+// Frame N is written to slot N % slots. The seq of a slot is 0 while it is written,
+// so a reader knows a frame is intact when the seq is the same before and after reading it.
+#define RING_MAGIC          "CVDRSHM"
+#define RING_VERSION        (1)
+#define RING_HEADER_SIZE    (64)
+#define RING_META_SIZE      (64)
+#define RING_ALIGN(size)    (((size) + 63) & ~(uint64_t)63)
+
+// Header of a ring
+struct RING_HEADER {
+    char     magic[8];                  // "CVDRSHM"
+    uint32_t version;                   // Layout version
+    uint32_t slots;                     // Number of slots
+    uint64_t slot_size;                 // Bytes per slot
+    uint64_t capacity;                  // Bytes for pixels per slot
+    volatile uint64_t latest;           // Sequence number of the latest frame
+};
+
+// --------------------------------------------------------------------------
+//! @brief   Order memory accesses between processes.
+//! @return  None
+// --------------------------------------------------------------------------
+static inline void fence(void)
+{
+    #ifdef _MSC_VER
+    MemoryBarrier();
+    #else
+    __sync_synchronize();
+    #endif
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneFrameRing class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneFrameRing::ARDroneFrameRing()
+{
+    map = NULL;
+    length = 0;
+    writer = false;
+    seq = 0;
+    #ifdef _WIN32
+    hMap = NULL;
+    #endif
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneFrameRing class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneFrameRing::~ARDroneFrameRing()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Create a ring in shared memory.
+//! @param   name Name of the shared memory (e.g. "/cvdrone")
+//! @param   slots Number of frames kept (readers have slots-1 frame periods to finish a frame)
+//! @param   width Largest width of images [px]
+//! @param   height Largest height of images [px]
+//! @return  Result of initialization
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneFrameRing::create(const char *name, int slots, int width, int height)
+{
+    // Close the previous one
+    close();
+
+    // Size of the ring
+    slots = MAX(2, slots);
+    uint64_t capacity = RING_ALIGN((uint64_t)width * height * 3);
+    uint64_t slot_size = RING_META_SIZE + capacity;
+    length = (size_t)(RING_HEADER_SIZE + slot_size * slots);
+
+    // Create the shared memory
+    #ifdef _WIN32
+    this->name = name;
+    hMap = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)length >> 32), (DWORD)(length & 0xFFFFFFFF), name);
+    if (hMap) map = (uint8_t*)MapViewOfFile(hMap, FILE_MAP_ALL_ACCESS, 0, 0, length);
+    #else
+    this->name = (name[0] == '/') ? name : std::string("/") + name;
+    int fd = shm_open(this->name.c_str(), O_CREAT|O_RDWR, 0666);
+    if (fd >= 0) {
+        // Truncating first clears a ring left by a crashed writer
+        if (ftruncate(fd, 0) == 0 && ftruncate(fd, length) == 0) {
+            void *addr = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) map = (uint8_t*)addr;
+        }
+        ::close(fd);
+    }
+    #endif
+    if (!map) {
+        CVDRONE_ERROR("Failed to create shared memory %s. (%s, %d)\n", name, __FILE__, __LINE__);
+        writer = true;
+        close();
+        return 0;
+    }
+    writer = true;
+    seq = 0;
+
+    // Write the header (the magic comes last, readers check it)
+    memset(map, 0, RING_HEADER_SIZE);
+    RING_HEADER *header = (RING_HEADER*)map;
+    header->version = RING_VERSION;
+    header->slots = slots;
+    header->slot_size = slot_size;
+    header->capacity = capacity;
+    header->latest = 0;
+    fence();
+    memcpy(header->magic, RING_MAGIC, 8);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Map a ring created by another process.
+//! @param   name Name of the shared memory
+//! @return  Result of initialization
+//! @retval  1 Success
+//! @retval  0 Failure (not created yet)
+// --------------------------------------------------------------------------
+int ARDroneFrameRing::open(const char *name)
+{
+    // Close the previous one
+    close();
+
+    // Map the shared memory (read only)
+    #ifdef _WIN32
+    this->name = name;
+    hMap = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (hMap) map = (uint8_t*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (map) {
+        MEMORY_BASIC_INFORMATION info;
+        if (VirtualQuery(map, &info, sizeof(info))) length = info.RegionSize;
+    }
+    #else
+    this->name = (name[0] == '/') ? name : std::string("/") + name;
+    int fd = shm_open(this->name.c_str(), O_RDONLY, 0);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= RING_HEADER_SIZE) {
+        length = (size_t)st.st_size;
+        void *addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED) map = (uint8_t*)addr;
+    }
+    if (fd >= 0) ::close(fd);
+    #endif
+    if (!map) {
+        close();
+        return 0;
+    }
+
+    // Check the header
+    const RING_HEADER *header = (const RING_HEADER*)map;
+    if (memcmp(header->magic, RING_MAGIC, 8) || header->version != RING_VERSION || RING_HEADER_SIZE + header->slot_size * header->slots > length) {
+        CVDRONE_ERROR("%s is not a frame ring. (%s, %d)\n", name, __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the slot of a frame.
+//! @param   seq Sequence number of the frame
+//! @return  Head of the slot
+// --------------------------------------------------------------------------
+uint8_t* ARDroneFrameRing::slot(uint64_t seq)
+{
+    const RING_HEADER *header = (const RING_HEADER*)map;
+    return map + RING_HEADER_SIZE + header->slot_size * (seq % header->slots);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Publish a frame.
+//! @param   bgr BGR pixels (meta.height rows of meta.step bytes)
+//! @param   meta Metadata of the frame (seq is assigned)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneFrameRing::write(const uint8_t *bgr, const ARDRONE_FRAME_META &meta)
+{
+    // Not a writer
+    if (!map || !writer) return 0;
+
+    // Too large
+    RING_HEADER *header = (RING_HEADER*)map;
+    uint64_t size = (uint64_t)meta.step * meta.height;
+    if (size > header->capacity || meta.step < meta.width * 3) return 0;
+
+    // Invalidate the slot
+    uint64_t next = seq + 1;
+    uint8_t *p = slot(next);
+    volatile uint64_t *slotSeq = (volatile uint64_t*)p;
+    *slotSeq = 0;
+    fence();
+
+    // Write the frame
+    ARDRONE_FRAME_META tmp = meta;
+    tmp.seq = 0;
+    memcpy(p, &tmp, sizeof(tmp));
+    memcpy(p + RING_META_SIZE, bgr, (size_t)size);
+    fence();
+
+    // Publish it
+    *slotSeq = next;
+    fence();
+    header->latest = next;
+    seq = next;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Map the latest frame without copying it.
+//! @param   image Image header pointing to the shared memory (read only)
+//! @param   meta Metadata of the frame
+//! @param   after Sequence number of the last frame the caller has
+//! @return  Result of this function
+//! @retval  1 A new frame
+//! @retval  0 No new frame (or it is being overwritten)
+//! @note    Call isValid() after using the image to know it was not overwritten meanwhile.
+// --------------------------------------------------------------------------
+int ARDroneFrameRing::read(cv::Mat *image, ARDRONE_FRAME_META *meta, uint64_t after)
+{
+    // Not mapped
+    if (!map) return 0;
+
+    // The latest frame
+    const RING_HEADER *header = (const RING_HEADER*)map;
+    uint64_t latest = header->latest;
+    fence();
+    if (latest == 0 || latest <= after) return 0;
+
+    // Its metadata (the slot sequence before and after the copy, as the writer orders them)
+    uint8_t *p = slot(latest);
+    if (*(volatile uint64_t*)p != latest) return 0;
+    fence();
+    ARDRONE_FRAME_META tmp;
+    memcpy(&tmp, p, sizeof(tmp));
+    fence();
+    if (*(volatile uint64_t*)p != latest) return 0;
+    tmp.seq = latest;
+
+    // Point the pixels
+    *image = cv::Mat(tmp.height, tmp.width, CV_8UC3, p + RING_META_SIZE, tmp.step);
+    *meta = tmp;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Check that a mapped frame has not been overwritten.
+//! @param   meta Metadata given by read()
+//! @return  Result of this function
+//! @retval  true  The frame is intact
+//! @retval  false The writer has reused the slot
+// --------------------------------------------------------------------------
+bool ARDroneFrameRing::isValid(const ARDRONE_FRAME_META &meta)
+{
+    if (!map || meta.seq == 0) return false;
+    fence();
+    return *(volatile uint64_t*)slot(meta.seq) == meta.seq;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Unmap the ring (the writer also removes it).
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneFrameRing::close(void)
+{
+    #ifdef _WIN32
+    if (map) UnmapViewOfFile(map);
+    if (hMap) CloseHandle(hMap);
+    hMap = NULL;
+    #else
+    if (map) munmap(map, length);
+    if (writer && !name.empty()) shm_unlink(name.c_str());
+    #endif
+    map = NULL;
+    length = 0;
+    writer = false;
+    seq = 0;
+    name.clear();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start sharing decoded frames with other processes.
+//! @param   name Name of the shared memory (e.g. "/cvdrone")
+//! @param   slots Number of frames kept
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    Readers use ARDroneFrameRing::open() with the same name.
+// --------------------------------------------------------------------------
+int ARDrone::startFrameRing(const char *name, int slots)
+{
+    // Stop the previous one
+    stopFrameRing();
+
+    // Largest image of the stream
+    int width  = pCodecCtx ? pCodecCtx->width  : 640;
+    int height = pCodecCtx ? pCodecCtx->height : 360;
+    if (version.major != ARDRONE_VERSION_2) {
+        width  = MAX(width, 320);
+        height = MAX(height, 240);
+    }
+
+    // Create a ring
+    ARDroneFrameRing *tmp = new ARDroneFrameRing;
+    if (!tmp->create(name, slots, width, height)) {
+        delete tmp;
+        return 0;
+    }
+
+    // Attach it to the decoder
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    frameRing = tmp;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop sharing decoded frames.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::stopFrameRing(void)
+{
+    // Not sharing
+    if (!frameRing) return;
+    ARDroneFrameRing *tmp = frameRing;
+
+    // Detach it from the decoder
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    frameRing = NULL;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+    // Remove the ring
+    tmp->close();
+    delete tmp;
+}
@@ -0,0 +1,1267 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   simulator.cpp
+//! @brief  Simulated AR.Drone speaking the network protocol
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// Simulator parameters
+#define SIM_MAX_WAIT        (0.05)          // Longest wait for events [s]
+#define SIM_MAX_BACKLOG     (512 * 1024)    // Unsent video per client before dropping frames [bytes]
+#define SIM_WATCHDOG        (0.25)          // Communication watchdog [s]
+#define SIM_FTP_TIMEOUT     (1.0)           // Wait for an FTP data connection [s]
+#define SIM_TAKEOFF_HEIGHT  (0.8)           // Height after taking off [m]
+#define SIM_MAX_SPEED       (2.5)           // Speed at the maximum tilt [m/s]
+
+// Control states (upper 16 bits of ctrl_state)
+#define SIM_CTRL_LANDED     (2)
+#define SIM_CTRL_FLYING     (3)
+#define SIM_CTRL_TAKEOFF    (6)
+#define SIM_CTRL_LANDING    (8)
+
+// --------------------------------------------------------------------------
+//! @brief   Close a socket.
+//! @param   sock Socket (set to INVALID_SOCKET)
+//! @return  None
+// --------------------------------------------------------------------------
+static void closeSocket(SOCKET *sock)
+{
+    if (*sock == INVALID_SOCKET) return;
+    #if _WIN32
+    closesocket(*sock);
+    #else
+    ::close(*sock);
+    #endif
+    *sock = INVALID_SOCKET;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set a socket to non-blocking mode.
+//! @param   sock Socket
+//! @return  None
+// --------------------------------------------------------------------------
+static void setNonBlocking(SOCKET sock)
+{
+    #if _WIN32
+    u_long nonblock = 1;
+    ioctlsocket(sock, FIONBIO, &nonblock);
+    #else
+    int flag = fcntl(sock, F_GETFL, 0);
+    if (flag >= 0) fcntl(sock, F_SETFL, flag|O_NONBLOCK);
+    #endif
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Check the last socket error.
+//! @return  The operation would block
+// --------------------------------------------------------------------------
+static bool wouldBlock(void)
+{
+    #if _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+    #else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    #endif
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Open a server socket.
+//! @param   addr IP address
+//! @param   port Port number (0 = any)
+//! @param   type SOCK_STREAM (listening) or SOCK_DGRAM
+//! @return  Socket (INVALID_SOCKET on failure)
+// --------------------------------------------------------------------------
+static SOCKET serve(const char *addr, int port, int type)
+{
+    // Create a socket
+    SOCKET sock = socket(AF_INET, type, 0);
+    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+
+    // Restart quickly after TIME_WAIT (this allows port stealing on Windows)
+    #ifndef _WIN32
+    if (type == SOCK_STREAM) {
+        int reuse = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    }
+    #endif
+
+    // Bind it
+    sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons((u_short)port);
+    server_addr.sin_addr.s_addr = inet_addr(addr);
+    if (bind(sock, (sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR || (type == SOCK_STREAM && listen(sock, 8) == SOCKET_ERROR)) {
+        closeSocket(&sock);
+        return INVALID_SOCKET;
+    }
+
+    // Handled by the event loop
+    setNonBlocking(sock);
+
+    return sock;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Read a number from configurations.
+//! @param   configs Configurations
+//! @param   key Key
+//! @param   value Default value
+//! @return  Value
+// --------------------------------------------------------------------------
+static double number(const ARDRONE_CONFIG_PROFILE &configs, const char *key, double value)
+{
+    ARDRONE_CONFIG_PROFILE::const_iterator it = configs.find(key);
+    return (it != configs.end()) ? atof(it->second.c_str()) : value;
+}
+
+// Bit reader for H.264 headers
+struct BITSTREAM {
+    std::vector<uint8_t> data;  // RBSP (emulation prevention bytes removed)
+    size_t pos;                 // Position [bit]
+};
+
+// --------------------------------------------------------------------------
+//! @brief   Initialize a bit reader.
+//! @param   bs Bit reader
+//! @param   data NAL unit payload (after the NAL header)
+//! @param   size Size of the payload
+//! @return  None
+// --------------------------------------------------------------------------
+static void initBits(BITSTREAM *bs, const uint8_t *data, size_t size)
+{
+    bs->data.clear();
+    bs->pos = 0;
+    for (size_t i = 0; i < size; i++) {
+        // Skip 0x03 of 0x000003
+        if (i >= 2 && data[i] == 0x03 && data[i - 1] == 0x00 && data[i - 2] == 0x00) continue;
+        bs->data.push_back(data[i]);
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Read bits (zeros past the end).
+//! @param   bs Bit reader
+//! @param   n Number of bits (up to 32)
+//! @return  Value
+// --------------------------------------------------------------------------
+static unsigned int readBits(BITSTREAM *bs, int n)
+{
+    unsigned int value = 0;
+    while (n-- > 0) {
+        size_t byte = bs->pos >> 3;
+        unsigned int bit = (byte < bs->data.size()) ? (bs->data[byte] >> (7 - (bs->pos & 7))) & 1 : 0;
+        value = (value << 1) | bit;
+        bs->pos++;
+    }
+    return value;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Read an unsigned Exp-Golomb code.
+//! @param   bs Bit reader
+//! @return  Value
+// --------------------------------------------------------------------------
+static unsigned int readUE(BITSTREAM *bs)
+{
+    int zeros = 0;
+    while (readBits(bs, 1) == 0 && zeros < 31) zeros++;
+    return ((1U << zeros) - 1) + readBits(bs, zeros);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Read a signed Exp-Golomb code.
+//! @param   bs Bit reader
+//! @return  Value
+// --------------------------------------------------------------------------
+static int readSE(BITSTREAM *bs)
+{
+    unsigned int k = readUE(bs);
+    return (k & 1) ? (int)((k + 1) / 2) : -(int)(k / 2);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the stream size from a sequence parameter set.
+//! @param   nal NAL unit (from the NAL header)
+//! @param   size Size of the NAL unit
+//! @param   header PaVE header to be updated
+//! @return  None
+// --------------------------------------------------------------------------
+static void parseSPS(const uint8_t *nal, size_t size, ARDRONE_PAVE *header)
+{
+    BITSTREAM bs;
+    initBits(&bs, nal + 1, size - 1);
+
+    // Profile, level and ID
+    unsigned int profile = readBits(&bs, 8);
+    readBits(&bs, 16);
+    readUE(&bs);
+
+    // High profiles
+    unsigned int chroma = 1;
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 || profile == 83 || profile == 86 || profile == 118 || profile == 128) {
+        chroma = readUE(&bs);
+        if (chroma == 3) readBits(&bs, 1);
+        readUE(&bs);
+        readUE(&bs);
+        readBits(&bs, 1);
+
+        // Scaling matrices
+        if (readBits(&bs, 1)) {
+            for (int i = 0; i < ((chroma != 3) ? 8 : 12); i++) {
+                if (!readBits(&bs, 1)) continue;
+                int last = 8, next = 8;
+                for (int j = 0; j < ((i < 6) ? 16 : 64); j++) {
+                    if (next != 0) next = (last + readSE(&bs) + 256) % 256;
+                    last = (next == 0) ? last : next;
+                }
+            }
+        }
+    }
+
+    // Frame numbers and picture order
+    readUE(&bs);
+    unsigned int poc = readUE(&bs);
+    if (poc == 0) readUE(&bs);
+    else if (poc == 1) {
+        readBits(&bs, 1);
+        readSE(&bs);
+        readSE(&bs);
+        unsigned int n = readUE(&bs);
+        for (unsigned int i = 0; i < n; i++) readSE(&bs);
+    }
+    readUE(&bs);
+    readBits(&bs, 1);
+
+    // Size in macroblocks
+    unsigned int width = readUE(&bs) + 1;
+    unsigned int height = readUE(&bs) + 1;
+    unsigned int frame_mbs_only = readBits(&bs, 1);
+    if (!frame_mbs_only) readBits(&bs, 1);
+    readBits(&bs, 1);
+
+    // Cropping
+    unsigned int left = 0, right = 0, top = 0, bottom = 0;
+    if (readBits(&bs, 1)) {
+        left = readUE(&bs);
+        right = readUE(&bs);
+        top = readUE(&bs);
+        bottom = readUE(&bs);
+    }
+
+    // Encoded and displayed sizes
+    unsigned int crop_x = (chroma == 0 || chroma == 3) ? 1 : 2;
+    unsigned int crop_y = ((chroma == 1) ? 2 : 1) * (2 - frame_mbs_only);
+    header->encoded_stream_width  = (uint16_t)(width * 16);
+    header->encoded_stream_height = (uint16_t)(height * 16 * (2 - frame_mbs_only));
+    header->display_width  = (uint16_t)(header->encoded_stream_width  - crop_x * (left + right));
+    header->display_height = (uint16_t)(header->encoded_stream_height - crop_y * (top + bottom));
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Split an Annex-B H.264 stream into PaVE frames.
+//! @param   stream H.264 stream
+//! @param   frames Frames (SPS and PPS are merged into the following frame)
+//! @return  None
+// --------------------------------------------------------------------------
+static void splitH264(const std::vector<uint8_t> &stream, std::vector<ARDRONE_VIDEO_PACKET> *frames)
+{
+    // Find start codes
+    std::vector<size_t> starts;
+    for (size_t i = 0; i + 3 <= stream.size(); i++) {
+        if (stream[i] == 0 && stream[i + 1] == 0 && stream[i + 2] == 1) {
+            starts.push_back((i > 0 && stream[i - 1] == 0) ? i - 1 : i);
+            i += 2;
+        }
+    }
+    starts.push_back(stream.size());
+
+    // PaVE header for H.264 (640x360 until a SPS is found)
+    ARDRONE_VIDEO_PACKET frame;
+    memset(&frame.header, 0, sizeof(frame.header));
+    memcpy(frame.header.signature, "PaVE", 4);
+    frame.header.version = 2;
+    frame.header.video_codec = 4;
+    frame.header.header_size = sizeof(ARDRONE_PAVE);
+    frame.header.encoded_stream_width = 640;
+    frame.header.encoded_stream_height = 368;
+    frame.header.display_width = 640;
+    frame.header.display_height = 360;
+    frame.header.total_chuncks = 1;
+    frame.header.total_slices = 1;
+    frame.header.frame_type = ARDRONE_PAVE_FRAME_P;
+
+    // Group NAL units into access units
+    bool vcl = false;
+    for (size_t i = 0; i + 1 < starts.size(); i++) {
+        size_t begin = starts[i], end = starts[i + 1];
+        size_t head = begin + ((stream[begin + 2] == 1) ? 3 : 4);
+        if (head >= end) continue;
+        const uint8_t *nal = &stream[head];
+        int type = nal[0] & 0x1F;
+
+        // A slice with first_mb_in_slice = 0 or a parameter set starts a new frame
+        bool slice = (type == 1 || type == 5);
+        if (vcl && (!slice || (head + 1 < end && (nal[1] & 0x80)))) {
+            frame.header.payload_size = (uint32_t)frame.data.size();
+            frames->push_back(frame);
+            frame.data.clear();
+            frame.header.header1_size = frame.header.header2_size = 0;
+            vcl = false;
+        }
+
+        // Parameter sets
+        if (type == 7) {
+            parseSPS(nal, end - head, &frame.header);
+            frame.header.header1_size = (uint8_t)MIN(end - begin, 255);
+        }
+        else if (type == 8) frame.header.header2_size = (uint8_t)MIN(end - begin, 255);
+
+        // Frame type
+        if (slice && !vcl) {
+            if (type == 5) frame.header.frame_type = ARDRONE_PAVE_FRAME_IDR;
+            else {
+                BITSTREAM bs;
+                initBits(&bs, nal + 1, MIN(end - head - 1, (size_t)16));
+                readUE(&bs);
+                unsigned int slice_type = readUE(&bs) % 5;
+                frame.header.frame_type = (slice_type == 2 || slice_type == 4) ? ARDRONE_PAVE_FRAME_I : ARDRONE_PAVE_FRAME_P;
+            }
+        }
+        vcl = vcl || slice;
+
+        // Append it with the start code
+        frame.data.insert(frame.data.end(), stream.begin() + begin, stream.begin() + end);
+    }
+
+    // The last one
+    if (vcl) {
+        frame.header.payload_size = (uint32_t)frame.data.size();
+        frames->push_back(frame);
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Split concatenated UVLC pictures.
+//! @param   stream UVLC stream (each picture starts at a 32-bit word)
+//! @param   frames Pictures
+//! @return  None
+// --------------------------------------------------------------------------
+static void splitUVLC(const std::vector<uint8_t> &stream, std::vector<ARDRONE_VIDEO_PACKET> *frames)
+{
+    // Find picture start codes (the first 22 bits of a little-endian word are 0x000020)
+    std::vector<size_t> starts;
+    for (size_t i = 0; i + 4 <= stream.size(); i += 4) {
+        uint32_t word = stream[i] | (stream[i + 1] << 8) | (stream[i + 2] << 16) | ((uint32_t)stream[i + 3] << 24);
+        if ((word >> 10) == 0x20) starts.push_back(i);
+    }
+    if (starts.empty() || starts[0] != 0) starts.insert(starts.begin(), 0);
+    starts.push_back(stream.size());
+
+    // Split them
+    for (size_t i = 0; i + 1 < starts.size(); i++) {
+        if (starts[i] == starts[i + 1]) continue;
+        ARDRONE_VIDEO_PACKET frame;
+        memset(&frame.header, 0, sizeof(frame.header));
+        frame.data.assign(stream.begin() + starts[i], stream.begin() + starts[i + 1]);
+        frame.header.payload_size = (uint32_t)frame.data.size();
+        frames->push_back(frame);
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneSimulator class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneSimulator::ARDroneSimulator()
+{
+    // IP address and version
+    memset(ip, 0, sizeof(ip));
+    memset(&version, 0, sizeof(version));
+
+    // Sockets
+    sockFtp = sockControl = sockStream = INVALID_SOCKET;
+    sockNavdata = sockVideo = sockCommand = INVALID_SOCKET;
+    hasNavdataClient = hasVideoClient = false;
+
+    // Rates
+    navdataRate = 0;
+    videoRate = 30;
+
+    // Statistics
+    commandCount = navdataCount = frameCount = 0;
+
+    // Thread
+    quit = false;
+    threadSim = NULL;
+    mutexSim = NULL;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneSimulator class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneSimulator::~ARDroneSimulator()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Start serving the AR.Drone protocol.
+//! @param   addr IP address to serve on
+//! @param   version Firmware version ("2.x.x" streams H.264 over TCP, "1.x.x" streams UVLC over UDP)
+//! @param   video_file Video to be streamed in a loop (NULL streams empty PaVE frames)
+//! @return  Result of initialization
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneSimulator::open(const char *addr, const char *version, const char *video_file)
+{
+    // Stop the previous one
+    close();
+
+    #if _WIN32
+    // Initialize WSA
+    WSAData wsaData;
+    WSAStartup(MAKEWORD(1,1), &wsaData);
+    #endif
+
+    // Save IP address and version
+    strncpy(ip, addr, 15);
+    if (sscanf(version, "%d.%d.%d", &this->version.major, &this->version.minor, &this->version.revision) != 3) {
+        CVDRONE_ERROR("Invalid version %s. (%s, %d)\n", version, __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Open the ports
+    sockFtp     = serve(ip, ARDRONE_FTP_PORT,     SOCK_STREAM);
+    sockControl = serve(ip, ARDRONE_CONTROL_PORT, SOCK_STREAM);
+    sockNavdata = serve(ip, ARDRONE_NAVDATA_PORT, SOCK_DGRAM);
+    sockCommand = serve(ip, ARDRONE_AT_PORT,      SOCK_DGRAM);
+    if (this->version.major == ARDRONE_VERSION_2) sockStream = serve(ip, ARDRONE_VIDEO_PORT, SOCK_STREAM);
+    else                                          sockVideo  = serve(ip, ARDRONE_VIDEO_PORT, SOCK_DGRAM);
+    if (sockFtp == INVALID_SOCKET || sockControl == INVALID_SOCKET || sockNavdata == INVALID_SOCKET || sockCommand == INVALID_SOCKET || (sockStream == INVALID_SOCKET && sockVideo == INVALID_SOCKET)) {
+        CVDRONE_ERROR("Failed to serve on %s. (%s, %d)\n", ip, __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+
+    // Load the video
+    frames.clear();
+    if (video_file && !loadVideo(video_file)) {
+        CVDRONE_ERROR("Failed to load %s. (%s, %d)\n", video_file, __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+    frameIndex = 0;
+    streamPosition = 0;
+
+    // Default configurations
+    bool drone2 = (this->version.major == ARDRONE_VERSION_2);
+    configs.clear();
+    configs["general:num_version_config"]   = "1";
+    configs["general:num_version_mb"]       = drone2 ? "33" : "17";
+    configs["general:num_version_soft"]     = version;
+    configs["general:drone_serial"]         = "SIMULATOR";
+    configs["general:ardrone_name"]         = "CV Drone simulator";
+    configs["general:flying_time"]          = "0";
+    configs["general:navdata_demo"]         = "TRUE";
+    configs["general:navdata_options"]      = "65537";
+    configs["general:com_watchdog"]         = "2";
+    configs["general:video_enable"]         = "TRUE";
+    configs["general:vision_enable"]        = "TRUE";
+    configs["general:vbat_min"]             = "9000";
+    configs["control:altitude_max"]         = "3000";
+    configs["control:altitude_min"]         = "50";
+    configs["control:control_level"]        = "0";
+    configs["control:euler_angle_max"]      = "0.2094395";
+    configs["control:control_iphone_tilt"]  = "0.3490658";
+    configs["control:control_vz_max"]       = "700";
+    configs["control:control_yaw"]          = "1.745329";
+    configs["control:outdoor"]              = "FALSE";
+    configs["control:flight_without_shell"] = "FALSE";
+    configs["control:flying_mode"]          = "0";
+    configs["network:ssid_single_player"]   = "ardrone_simulator";
+    configs["video:camif_fps"]              = "30";
+    configs["video:codec_fps"]              = "30";
+    configs["video:bitrate"]                = "1000";
+    configs["video:max_bitrate"]            = "4000";
+    configs["video:bitrate_ctrl_mode"]      = "0";
+    configs["video:video_codec"]            = drone2 ? "129" : "32";
+    configs["video:video_channel"]          = "0";
+    configs["video:video_on_usb"]           = "FALSE";
+    configs["leds:leds_anim"]               = "0,0,0";
+    configs["detect:detect_type"]           = "3";
+    configs["detect:enemy_colors"]          = "1";
+    configs["custom:application_id"]        = "00000000";
+    configs["custom:profile_id"]            = "00000000";
+    configs["custom:session_id"]            = "00000000";
+
+    // Simulated drone
+    state = ARDRONE_VIDEO_MASK | ARDRONE_VISION_MASK | ARDRONE_CAMERA_MASK | ARDRONE_NAVDATA_DEMO_MASK | ARDRONE_COM_WATCHDOG_MASK;
+    sequence = lastSeq = lastRef = 0;
+    pcmdFlag = 0;
+    for (int i = 0; i < 4; i++) pcmd[i] = 0.0f;
+    altitude = roll = pitch = yaw = 0.0;
+    vx = vy = vz = 0.0;
+    battery = 100.0;
+
+    // Timings
+    startTime = lastUpdate = nextNavdata = nextVideo = lastCommand = gettime();
+
+    // Statistics
+    commandCount = navdataCount = frameCount = 0;
+
+    // Create a mutex
+    mutexSim = new pthread_mutex_t;
+    pthread_mutex_init(mutexSim, NULL);
+
+    // Create a thread
+    quit = false;
+    threadSim = new pthread_t;
+    if (pthread_create(threadSim, NULL, runSim, this) != 0) {
+        CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+        delete threadSim;
+        threadSim = NULL;
+        close();
+        return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop serving.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::close(void)
+{
+    // Stop the thread
+    if (threadSim) {
+        quit = true;
+        pthread_join(*threadSim, NULL);
+        delete threadSim;
+        threadSim = NULL;
+    }
+
+    // Delete the mutex
+    if (mutexSim) {
+        pthread_mutex_destroy(mutexSim);
+        delete mutexSim;
+        mutexSim = NULL;
+    }
+
+    // Close the connections
+    for (size_t i = 0; i < clients.size(); i++) {
+        closeSocket(&clients[i].sock);
+        closeSocket(&clients[i].passive);
+    }
+    clients.clear();
+    hasNavdataClient = hasVideoClient = false;
+
+    // Close the ports
+    closeSocket(&sockFtp);
+    closeSocket(&sockControl);
+    closeSocket(&sockStream);
+    closeSocket(&sockNavdata);
+    closeSocket(&sockVideo);
+    closeSocket(&sockCommand);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the rate of Navdata.
+//! @param   hz Packets per second (0 = 15Hz in demo mode, 200Hz otherwise)
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::setNavdataRate(int hz)
+{
+    if (mutexSim) pthread_mutex_lock(mutexSim);
+    navdataRate = MAX(hz, 0);
+    if (mutexSim) pthread_mutex_unlock(mutexSim);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set the frame rate of video.
+//! @param   fps Frames per second
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::setVideoRate(int fps)
+{
+    if (mutexSim) pthread_mutex_lock(mutexSim);
+    videoRate = MAX(fps, 1);
+    if (mutexSim) pthread_mutex_unlock(mutexSim);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set a configuration served on the control port.
+//! @param   key Key (e.g. "control:altitude_max")
+//! @param   value Value
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::setConfigValue(const char *key, const char *value)
+{
+    if (mutexSim) pthread_mutex_lock(mutexSim);
+    configs[key] = value;
+    if (mutexSim) pthread_mutex_unlock(mutexSim);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get a configuration (including ones written by AT*CONFIG).
+//! @param   key Key (e.g. "control:altitude_max")
+//! @return  Value (empty if unknown)
+// --------------------------------------------------------------------------
+std::string ARDroneSimulator::getConfigValue(const char *key)
+{
+    if (mutexSim) pthread_mutex_lock(mutexSim);
+    ARDRONE_CONFIG_PROFILE::const_iterator it = configs.find(key);
+    std::string value = (it != configs.end()) ? it->second : std::string();
+    if (mutexSim) pthread_mutex_unlock(mutexSim);
+
+    return value;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the number of received AT commands.
+//! @return  Number of commands
+// --------------------------------------------------------------------------
+unsigned int ARDroneSimulator::getCommandCount(void)
+{
+    if (mutexSim) pthread_mutex_lock(mutexSim);
+    unsigned int count = commandCount;
+    if (mutexSim) pthread_mutex_unlock(mutexSim);
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the number of sent Navdata packets.
+//! @return  Number of packets
+// --------------------------------------------------------------------------
+unsigned int ARDroneSimulator::getNavdataCount(void)
+{
+    if (mutexSim) pthread_mutex_lock(mutexSim);
+    unsigned int count = navdataCount;
+    if (mutexSim) pthread_mutex_unlock(mutexSim);
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the number of sent video frames.
+//! @return  Number of frames
+// --------------------------------------------------------------------------
+unsigned int ARDroneSimulator::getFrameCount(void)
+{
+    if (mutexSim) pthread_mutex_lock(mutexSim);
+    unsigned int count = frameCount;
+    if (mutexSim) pthread_mutex_unlock(mutexSim);
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Load a video file.
+//! @param   filename H.264 (Annex-B) or UVLC file
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneSimulator::loadVideo(const char *filename)
+{
+    // Read the whole file
+    FILE *file = fopen(filename, "rb");
+    if (!file) return 0;
+    std::vector<uint8_t> stream;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) stream.insert(stream.end(), buf, buf + n);
+    fclose(file);
+
+    // Split into frames
+    if (version.major == ARDRONE_VERSION_2) splitH264(stream, &frames);
+    else                                    splitUVLC(stream, &frames);
+
+    return frames.empty() ? 0 : 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Thread function for the simulator.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::loopSim(void)
+{
+    std::vector<char> buf(65536);
+
+    while (!quit) {
+        // Simulate the drone and send periodic data
+        if (mutexSim) pthread_mutex_lock(mutexSim);
+        double now = gettime();
+        update(now);
+        int rate = (navdataRate > 0) ? navdataRate : ((configs["general:navdata_demo"] == "TRUE") ? 15 : 200);
+        if (now >= nextNavdata) {
+            sendNavdata(now);
+            nextNavdata += 1.0 / rate;
+            if (nextNavdata < now) nextNavdata = now + 1.0 / rate;
+        }
+        if (now >= nextVideo) {
+            sendVideo(now);
+            nextVideo += 1.0 / videoRate;
+            if (nextVideo < now) nextVideo = now + 1.0 / videoRate;
+        }
+        double wait = MIN(MIN(nextNavdata, nextVideo) - now, SIM_MAX_WAIT);
+
+        // FTP transfers whose data connection never came
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (clients[i].retrDeadline > 0.0 && now >= clients[i].retrDeadline) finishRetr(&clients[i], false);
+        }
+
+        // Sockets to be watched
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        SOCKET socks[6] = {sockFtp, sockControl, sockStream, sockNavdata, sockVideo, sockCommand};
+        int maxfd = 0;
+        for (int i = 0; i < 6; i++) {
+            if (socks[i] == INVALID_SOCKET) continue;
+            FD_SET(socks[i], &rfds);
+            maxfd = MAX(maxfd, (int)socks[i]);
+        }
+        for (size_t i = 0; i < clients.size(); i++) {
+            FD_SET(clients[i].sock, &rfds);
+            if (!clients[i].output.empty()) FD_SET(clients[i].sock, &wfds);
+            maxfd = MAX(maxfd, (int)clients[i].sock);
+
+            // FTP data connection of RETR
+            if (clients[i].retrDeadline > 0.0 && clients[i].passive != INVALID_SOCKET) {
+                FD_SET(clients[i].passive, &rfds);
+                maxfd = MAX(maxfd, (int)clients[i].passive);
+            }
+        }
+        if (mutexSim) pthread_mutex_unlock(mutexSim);
+
+        // Wait for events
+        timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = (long)(MAX(wait, 0.0) * 1000000);
+        if (select(maxfd + 1, &rfds, &wfds, NULL, &tv) < 1) continue;
+
+        if (mutexSim) pthread_mutex_lock(mutexSim);
+
+        // Accept connections first (a request for configurations needs its connection)
+        SOCKET listeners[3] = {sockFtp, sockControl, sockStream};
+        int ports[3] = {ARDRONE_FTP_PORT, ARDRONE_CONTROL_PORT, ARDRONE_VIDEO_PORT};
+        for (int i = 0; i < 3; i++) {
+            if (listeners[i] == INVALID_SOCKET || !FD_ISSET(listeners[i], &rfds)) continue;
+            SOCKET sock;
+            while ((sock = accept(listeners[i], NULL, NULL)) != INVALID_SOCKET) {
+                setNonBlocking(sock);
+                CLIENT client;
+                client.sock = sock;
+                client.port = ports[i];
+                client.passive = INVALID_SOCKET;
+                client.retrDeadline = 0.0;
+                client.waitKeyFrame = true;
+                clients.push_back(client);
+
+                // FTP welcome message
+                if (client.port == ARDRONE_FTP_PORT) {
+                    const char *welcome = "220 Operation successful\r\n";
+                    clients.back().output.assign(welcome, welcome + strlen(welcome));
+                    flush(&clients.back());
+                }
+            }
+        }
+
+        // AT commands (multiple commands may share a datagram)
+        if (FD_ISSET(sockCommand, &rfds)) {
+            int n;
+            while ((n = (int)recvfrom(sockCommand, &buf[0], (int)buf.size() - 1, 0, NULL, NULL)) > 0) {
+                buf[n] = '\0';
+                char *command = &buf[0];
+                while (*command) {
+                    char *end = command + strcspn(command, "\r\n");
+                    bool last = (*end == '\0');
+                    *end = '\0';
+                    if (end > command) handleCommand(command);
+                    if (last) break;
+                    command = end + 1;
+                }
+            }
+        }
+
+        // Navdata requests tell us the client
+        if (FD_ISSET(sockNavdata, &rfds)) {
+            sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            while (recvfrom(sockNavdata, &buf[0], (int)buf.size(), 0, (sockaddr*)&addr, &len) > 0) {
+                navdataClient = addr;
+                hasNavdataClient = true;
+                len = sizeof(addr);
+            }
+        }
+
+        // Video requests (AR.Drone 1.0)
+        if (sockVideo != INVALID_SOCKET && FD_ISSET(sockVideo, &rfds)) {
+            sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            while (recvfrom(sockVideo, &buf[0], (int)buf.size(), 0, (sockaddr*)&addr, &len) > 0) {
+                videoClient = addr;
+                hasVideoClient = true;
+                len = sizeof(addr);
+            }
+        }
+
+        // TCP clients
+        for (size_t i = 0; i < clients.size(); i++) {
+            CLIENT *client = &clients[i];
+            bool closed = false;
+
+            // Receive
+            if (FD_ISSET(client->sock, &rfds)) {
+                int n = (int)recv(client->sock, &buf[0], (int)buf.size(), 0);
+                if (n > 0) {
+                    if (client->port == ARDRONE_FTP_PORT) {
+                        client->input.append(&buf[0], n);
+                        handleFtp(client);
+                    }
+                }
+                else if (n == 0 || !wouldBlock()) closed = true;
+            }
+
+            // FTP data connection accepted
+            if (!closed && client->retrDeadline > 0.0 && client->passive != INVALID_SOCKET && FD_ISSET(client->passive, &rfds)) finishRetr(client, true);
+
+            // Send the rest
+            if (!closed && FD_ISSET(client->sock, &wfds)) flush(client);
+
+            // Disconnected
+            if (closed) {
+                closeSocket(&client->sock);
+                closeSocket(&client->passive);
+                clients.erase(clients.begin() + i--);
+            }
+        }
+
+        if (mutexSim) pthread_mutex_unlock(mutexSim);
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Simulate the drone.
+//! @param   now Current time [s]
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::update(double now)
+{
+    // Elapsed time
+    double dt = MIN(now - lastUpdate, 0.1);
+    lastUpdate = now;
+    if (dt <= 0.0) return;
+
+    // Communication watchdog
+    if (now - lastCommand > SIM_WATCHDOG) state |= ARDRONE_COM_WATCHDOG_MASK;
+
+    // Limits
+    double max_angle = number(configs, "control:euler_angle_max", 0.21);
+    double max_vz    = number(configs, "control:control_vz_max", 700.0) * 0.001;
+    double max_yaw   = number(configs, "control:control_yaw", 1.75);
+    double max_alt   = number(configs, "control:altitude_max", 3000.0) * 0.001;
+
+    // Emergency
+    bool takeoff = (lastRef & (1U << 9)) != 0;
+    if (state & ARDRONE_EMERGENCY_MASK) {
+        state &= ~ARDRONE_FLY_MASK;
+        altitude = roll = pitch = vx = vy = vz = 0.0;
+        return;
+    }
+
+    // On the ground
+    if (!(state & ARDRONE_FLY_MASK)) {
+        if (takeoff) state |= ARDRONE_FLY_MASK;
+        return;
+    }
+
+    // Landing
+    if (!takeoff) {
+        roll = pitch = vx = vy = 0.0;
+        vz = -0.5;
+        altitude += vz * dt;
+        if (altitude <= 0.0) {
+            state &= ~ARDRONE_FLY_MASK;
+            altitude = vz = 0.0;
+        }
+        return;
+    }
+
+    // Attitude (hovering if not in progressive mode)
+    double k = MIN(dt * 10.0, 1.0);
+    bool progressive = (pcmdFlag & 1) != 0;
+    roll  += ((progressive ? pcmd[0] * max_angle : 0.0) - roll)  * k;
+    pitch += ((progressive ? pcmd[1] * max_angle : 0.0) - pitch) * k;
+    yaw   += pcmd[3] * max_yaw * dt;
+    while (yaw >  CV_PI) yaw -= 2.0 * CV_PI;
+    while (yaw < -CV_PI) yaw += 2.0 * CV_PI;
+
+    // Velocities follow the tilt
+    double l = MIN(dt * 2.0, 1.0);
+    vx += (-pitch / max_angle * SIM_MAX_SPEED - vx) * l;
+    vy += ( roll  / max_angle * SIM_MAX_SPEED - vy) * l;
+
+    // Climb up to the takeoff height, then follow the command
+    vz = (altitude < SIM_TAKEOFF_HEIGHT && fabs(pcmd[2]) < 0.1) ? 0.5 : pcmd[2] * max_vz;
+    altitude = MAX(MIN(altitude + vz * dt, max_alt), 0.0);
+
+    // Battery
+    battery = MAX(battery - dt * 0.1, 0.0);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Handle an AT command.
+//! @param   command AT command without the terminator
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::handleCommand(const char *command)
+{
+    // Name and sequence number
+    char name[32];
+    unsigned int seq;
+    int len = 0;
+    if (sscanf(command, "AT*%31[^=]=%u%n", name, &seq, &len) < 2) return;
+    const char *args = command + len;
+
+    // Received a command
+    commandCount++;
+    lastCommand = gettime();
+    state &= ~ARDRONE_COM_WATCHDOG_MASK;
+
+    // Sequence number (1 restarts it, older ones are ignored)
+    if (seq == 1) lastSeq = 0;
+    if (seq <= lastSeq) return;
+    lastSeq = seq;
+
+    // Take off / Landing / Emergency
+    if (!strcmp(name, "REF")) {
+        unsigned int ref = 0;
+        sscanf(args, ",%u", &ref);
+        if ((ref & (1U << 8)) && !(lastRef & (1U << 8))) {
+            if (state & ARDRONE_EMERGENCY_MASK) state &= ~ARDRONE_EMERGENCY_MASK;
+            else if (state & ARDRONE_FLY_MASK)  state |= ARDRONE_EMERGENCY_MASK;
+        }
+        lastRef = ref;
+    }
+    // Move
+    else if (!strcmp(name, "PCMD") || !strcmp(name, "PCMD_MAG")) {
+        int v[4] = {0, 0, 0, 0};
+        if (sscanf(args, ",%d,%d,%d,%d,%d", &pcmdFlag, &v[0], &v[1], &v[2], &v[3]) == 5) {
+            memcpy(pcmd, v, sizeof(pcmd));
+        }
+    }
+    // Configuration
+    else if (!strcmp(name, "CONFIG")) {
+        const char *key = strchr(args, '"');
+        const char *key_end = key ? strchr(key + 1, '"') : NULL;
+        const char *value = key_end ? strchr(key_end + 1, '"') : NULL;
+        const char *value_end = value ? strchr(value + 1, '"') : NULL;
+        if (value_end) {
+            configs[std::string(key + 1, key_end)] = std::string(value + 1, value_end);
+            state |= ARDRONE_COMMAND_MASK;
+
+            // Navdata mode
+            if (configs["general:navdata_demo"] == "TRUE") state |= ARDRONE_NAVDATA_DEMO_MASK;
+            else                                           state &= ~ARDRONE_NAVDATA_DEMO_MASK;
+        }
+    }
+    // Control
+    else if (!strcmp(name, "CTRL")) {
+        int mode = 0;
+        sscanf(args, ",%d", &mode);
+        if (mode == 5) state &= ~ARDRONE_COMMAND_MASK;
+        if (mode == 4) sendConfigs();
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Handle FTP commands (only for version.txt).
+//! @param   client FTP connection
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::handleFtp(CLIENT *client)
+{
+    // Commands after RETR wait for its reply
+    size_t pos;
+    while (client->retrDeadline <= 0.0 && (pos = client->input.find('\n')) != std::string::npos) {
+        // A line
+        std::string line = client->input.substr(0, pos);
+        client->input.erase(0, pos + 1);
+        while (!line.empty() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == '\0')) line.erase(line.size() - 1);
+        while (!line.empty() && line[0] == '\0') line.erase(0, 1);
+
+        // Reply
+        char reply[256];
+        if (!line.compare(0, 4, "USER") || !line.compare(0, 4, "PASS")) {
+            strcpy(reply, "230 Login successful\r\n");
+        }
+        else if (!line.compare(0, 4, "TYPE")) {
+            strcpy(reply, "200 Operation successful\r\n");
+        }
+        else if (!line.compare(0, 4, "PASV")) {
+            // Open a data port
+            closeSocket(&client->passive);
+            client->passive = serve(ip, 0, SOCK_STREAM);
+            sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            if (client->passive == INVALID_SOCKET || getsockname(client->passive, (sockaddr*)&addr, &len) == SOCKET_ERROR) {
+                strcpy(reply, "425 Can't open data connection\r\n");
+            }
+            else {
+                int h[4] = {0, 0, 0, 0};
+                sscanf(ip, "%d.%d.%d.%d", &h[0], &h[1], &h[2], &h[3]);
+                int port = ntohs(addr.sin_port);
+                sprintf(reply, "227 PASV ok (%d,%d,%d,%d,%d,%d)\r\n", h[0], h[1], h[2], h[3], port >> 8, port & 0xFF);
+            }
+        }
+        else if (!line.compare(0, 4, "RETR")) {
+            if (line.find("version.txt") == std::string::npos) strcpy(reply, "550 Failed to open file\r\n");
+            else if (client->passive == INVALID_SOCKET)         strcpy(reply, "425 Use PASV first\r\n");
+            else {
+                // Replied when the data connection is accepted by loopSim()
+                client->retrDeadline = gettime() + SIM_FTP_TIMEOUT;
+                continue;
+            }
+        }
+        else if (!line.compare(0, 4, "QUIT")) {
+            strcpy(reply, "221 Operation successful\r\n");
+        }
+        else if (line.empty()) continue;
+        else strcpy(reply, "502 Command not implemented\r\n");
+
+        client->output.insert(client->output.end(), reply, reply + strlen(reply));
+    }
+
+    flush(client);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Send version.txt on the FTP data connection and reply to RETR.
+//! @param   client FTP connection
+//! @param   accepted The data connection is ready (false = timeout)
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::finishRetr(CLIENT *client, bool accepted)
+{
+    SOCKET data = accepted ? accept(client->passive, NULL, NULL) : INVALID_SOCKET;
+    closeSocket(&client->passive);
+    client->retrDeadline = 0.0;
+
+    // Send the version
+    const char *reply = "425 Can't open data connection\r\n";
+    if (data != INVALID_SOCKET) {
+        char text[64];
+        int n = sprintf(text, "%d.%d.%d\n", version.major, version.minor, version.revision);
+        send(data, text, n, 0);
+        closeSocket(&data);
+        reply = "226 Operation successful\r\n";
+    }
+    client->output.insert(client->output.end(), reply, reply + strlen(reply));
+
+    // Commands received meanwhile
+    handleFtp(client);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Send pending data to a client as much as possible.
+//! @param   client TCP connection
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::flush(CLIENT *client)
+{
+    size_t sent = 0;
+    while (sent < client->output.size()) {
+        int n = (int)send(client->sock, (const char*)&client->output[sent], (int)(client->output.size() - sent), 0);
+        if (n < 1) break;
+        sent += n;
+    }
+    client->output.erase(client->output.begin(), client->output.begin() + sent);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Send a Navdata packet.
+//! @param   now Current time [s]
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::sendNavdata(double now)
+{
+    // Nobody requested
+    if (!hasNavdataClient) return;
+
+    char buf[1024];
+    int index = 0;
+
+    // Header
+    unsigned int header[4] = {0x55667788, state, ++sequence, 0};
+    memcpy(buf + index, header, sizeof(header)); index += sizeof(header);
+
+    // Demo
+    int ctrl = (state & ARDRONE_FLY_MASK) ? ((lastRef & (1U << 9)) ? ((altitude < SIM_TAKEOFF_HEIGHT && vz > 0.0) ? SIM_CTRL_TAKEOFF : SIM_CTRL_FLYING) : SIM_CTRL_LANDING) : SIM_CTRL_LANDED;
+    ARDRONE_NAVDATA::NAVDATA_DEMO demo;
+    memset(&demo, 0, sizeof(demo));
+    demo.tag = ARDRONE_NAVDATA_DEMO_TAG;
+    demo.size = sizeof(demo);
+    demo.ctrl_state = ctrl << 16;
+    demo.vbat_flying_percentage = (unsigned int)battery;
+    demo.theta = (float)(pitch * RAD_TO_DEG * 1000.0);
+    demo.phi = (float)(roll * RAD_TO_DEG * 1000.0);
+    demo.psi = (float)(yaw * RAD_TO_DEG * 1000.0);
+    demo.altitude = (int)(altitude * 1000.0);
+    demo.vx = (float)(vx * 1000.0);
+    demo.vy = (float)(vy * 1000.0);
+    demo.vz = (float)(vz * 1000.0);
+    demo.num_frames = frameCount;
+    memcpy(buf + index, &demo, sizeof(demo)); index += sizeof(demo);
+
+    // Timestamp (11 bits for seconds, 21 bits for microseconds)
+    double elapsed = now - startTime;
+    ARDRONE_NAVDATA::NAVDATA_TIME time;
+    time.tag = ARDRONE_NAVDATA_TIME_TAG;
+    time.size = sizeof(time);
+    time.time = (((unsigned int)elapsed & 0x7FF) << 21) | ((unsigned int)((elapsed - floor(elapsed)) * 1000000) & 0x1FFFFF);
+    memcpy(buf + index, &time, sizeof(time)); index += sizeof(time);
+
+    // Altitude
+    ARDRONE_NAVDATA::NAVDATA_ALTITUDE alt;
+    memset(&alt, 0, sizeof(alt));
+    alt.tag = ARDRONE_NAVDATA_ALTITUDE_TAG;
+    alt.size = sizeof(alt);
+    alt.altitude_vision = alt.altitude_ref = alt.altitude_raw = demo.altitude;
+    alt.altitude_vz = (float)(-vz * 1000.0);
+    memcpy(buf + index, &alt, sizeof(alt)); index += sizeof(alt);
+
+    // Video stream (the number of the latest frame)
+    ARDRONE_NAVDATA::NAVDATA_VIDEO_STREAM video;
+    memset(&video, 0, sizeof(video));
+    video.tag = ARDRONE_NAVDATA_VIDEO_STREAM_TAG;
+    video.size = sizeof(video);
+    video.frame_number = frameCount;
+    video.frame_size = frames.empty() ? 0 : frames[(frameIndex + frames.size() - 1) % frames.size()].header.payload_size;
+    video.atcmd_ref_seq = lastSeq;
+    memcpy(buf + index, &video, sizeof(video)); index += sizeof(video);
+
+    // Checksum
+    ARDRONE_NAVDATA::NAVDATA_CKS cks;
+    cks.tag = ARDRONE_NAVDATA_CKS_TAG;
+    cks.size = sizeof(cks);
+    cks.cks = 0;
+    for (int i = 0; i < index; i++) cks.cks += (uint8_t)buf[i];
+    memcpy(buf + index, &cks, sizeof(cks)); index += sizeof(cks);
+
+    // Send it
+    if (sendto(sockNavdata, buf, index, 0, (sockaddr*)&navdataClient, sizeof(navdataClient)) > 0) navdataCount++;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Send a video frame.
+//! @param   now Current time [s]
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::sendVideo(double now)
+{
+    // AR.Drone 2.0
+    if (version.major == ARDRONE_VERSION_2) {
+        // The next frame (an empty one without a video file)
+        ARDRONE_VIDEO_PACKET empty;
+        const ARDRONE_VIDEO_PACKET *frame = &empty;
+        if (frames.empty()) {
+            memset(&empty.header, 0, sizeof(empty.header));
+            memcpy(empty.header.signature, "PaVE", 4);
+            empty.header.version = 2;
+            empty.header.video_codec = 4;
+            empty.header.header_size = sizeof(ARDRONE_PAVE);
+            empty.header.encoded_stream_width = 640;
+            empty.header.encoded_stream_height = 368;
+            empty.header.display_width = 640;
+            empty.header.display_height = 360;
+            empty.header.total_chuncks = 1;
+            empty.header.total_slices = 1;
+            empty.header.frame_type = ARDRONE_PAVE_FRAME_P;
+        }
+        else frame = &frames[frameIndex];
+
+        // Complete the header
+        ARDRONE_PAVE header = frame->header;
+        header.frame_number = frameCount + 1;
+        header.timestamp = (uint32_t)((now - startTime) * 1000.0);
+        header.stream_byte_position_lw = (uint32_t)(streamPosition & 0xFFFFFFFF);
+        header.stream_byte_position_uw = (uint32_t)(streamPosition >> 32);
+        bool key = (header.frame_type == ARDRONE_PAVE_FRAME_IDR || header.frame_type == ARDRONE_PAVE_FRAME_I || frames.empty());
+
+        // Queue it to the clients
+        for (size_t i = 0; i < clients.size(); i++) {
+            CLIENT *client = &clients[i];
+            if (client->port != ARDRONE_VIDEO_PORT) continue;
+
+            // Too slow client, drop frames until the next key frame
+            if (client->output.size() > SIM_MAX_BACKLOG) client->waitKeyFrame = true;
+            if (client->waitKeyFrame && (!key || client->output.size() > SIM_MAX_BACKLOG)) continue;
+            client->waitKeyFrame = false;
+
+            const uint8_t *bytes = (const uint8_t*)&header;
+            client->output.insert(client->output.end(), bytes, bytes + sizeof(header));
+            client->output.insert(client->output.end(), frame->data.begin(), frame->data.end());
+            flush(client);
+        }
+        streamPosition += frame->data.size();
+    }
+    // AR.Drone 1.0
+    else {
+        // Nobody requested or nothing to send
+        if (!hasVideoClient || frames.empty()) return;
+        const ARDRONE_VIDEO_PACKET &frame = frames[frameIndex];
+        sendto(sockVideo, (const char*)&frame.data[0], (int)frame.data.size(), 0, (sockaddr*)&videoClient, sizeof(videoClient));
+    }
+
+    // Next frame
+    frameCount++;
+    if (!frames.empty()) frameIndex = (frameIndex + 1) % frames.size();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Send configurations to the clients on the control port.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneSimulator::sendConfigs(void)
+{
+    // "key = value" lines
+    std::string text;
+    for (ARDRONE_CONFIG_PROFILE::const_iterator it = configs.begin(); it != configs.end(); ++it) {
+        text += it->first + " = " + it->second + "\n";
+    }
+
+    // Send them
+    for (size_t i = 0; i < clients.size(); i++) {
+        if (clients[i].port != ARDRONE_CONTROL_PORT) continue;
+        clients[i].output.insert(clients[i].output.end(), text.begin(), text.end());
+        flush(&clients[i]);
+    }
+}
@@ -46,11 +46,12 @@ TCPSocket::~TCPSocket()
 }
 
 // --------------------------------------------------------------------------
-// TCPSocket::open(IP address, Port number)
+// TCPSocket::open(IP address, Port number, Local IP address, Local port number, Network device)
 // Description  : Initialize specified  socket.
+//                The socket is bound to the local address/port/device if specified.
 // Return value : SUCCESS: 1  FAILURE: 0
 // --------------------------------------------------------------------------
-int TCPSocket::open(const char *addr, int port)
+int TCPSocket::open(const char *addr, int port, const char *local_addr, int local_port, const char *device)
 {
     #if _WIN32
     // Initialize WSA
@@ -71,6 +72,31 @@ int TCPSocket::open(const char *addr, int port)
     server_addr.sin_port = htons((u_short)port);
     server_addr.sin_addr.s_addr = inet_addr(addr);
 
+    // Bind the socket to the network device
+    if (device && device[0]) {
+        #ifdef SO_BINDTODEVICE
+        if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, device, (socklen_t)strlen(device) + 1) == SOCKET_ERROR) {
+            printf("ERROR: setsockopt(SO_BINDTODEVICE) failed. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
+        #else
+        printf("ERROR: Binding to a network device is not supported. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+        #endif
+    }
+
+    // Bind the socket to the local address
+    if ((local_addr && local_addr[0]) || local_port > 0) {
+        memset(&client_addr, 0, sizeof(client_addr));
+        client_addr.sin_family = AF_INET;
+        client_addr.sin_port = htons((u_short)local_port);
+        client_addr.sin_addr.s_addr = (local_addr && local_addr[0]) ? inet_addr(local_addr) : htonl(INADDR_ANY);
+        if (bind(sock, (sockaddr*)&client_addr, sizeof(client_addr)) == SOCKET_ERROR) {
+            printf("ERROR: bind() failed. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
+    }
+
     // Connect the socket
     if (connect(sock, (sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
         printf("ERROR: connect() failed. (%s, %d)\n", __FILE__, __LINE__);
@@ -114,13 +140,6 @@ int TCPSocket::open(const char *addr, int port)
     //}
     //#endif
 
-    // Enable re-use address option
-    int reuse = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) == SOCKET_ERROR) {
-        printf("ERROR: setsockopt() failed. (%s, %d)\n", __FILE__, __LINE__);
-        return 0;
-    }
-
     return 1;
 }
 
@@ -184,6 +203,43 @@ int TCPSocket::receive(void *data, size_t size)
     return received;
 }
 
+// --------------------------------------------------------------------------
+// TCPSocket::receiveAny(Receiving data, Size of data)
+// Description  : Receive the data which is available now (up to the size).
+// Return value : SUCCESS: Number of received bytes  TIMEOUT: 0  CLOSED: -1
+// --------------------------------------------------------------------------
+int TCPSocket::receiveAny(void *data, size_t size)
+{
+    // The socket is invalid
+    if (sock == INVALID_SOCKET) return -1;
+
+    // Receive data
+    int n = (int)recv(sock, (char*)data, size, 0);
+    if (n > 0) return n;
+
+    // Connection closed
+    if (n == 0) return -1;
+
+    // Timeout
+    #if _WIN32
+    if (WSAGetLastError() == WSAETIMEDOUT || WSAGetLastError() == WSAEWOULDBLOCK) return 0;
+    #else
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+    #endif
+
+    return -1;
+}
+
+// --------------------------------------------------------------------------
+// TCPSocket::getSocket()
+// Description  : Get the socket descriptor.
+// Return value : Socket descriptor (INVALID_SOCKET if not opened)
+// --------------------------------------------------------------------------
+SOCKET TCPSocket::getSocket(void)
+{
+    return sock;
+}
+
 // --------------------------------------------------------------------------
 // TCPSocket::close()
 // Description  : Finalize the socket.
@@ -0,0 +1,430 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   trajectory.cpp
+//! @brief  Trajectory streamed through the controller
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// Planning
+#define TRAJECTORY_SPEED        (0.5)                   // Default speed [m/s]
+#define TRAJECTORY_YAW_RATE     (45.0 * DEG_TO_RAD)     // Average yaw rate [rad/s]
+#define TRAJECTORY_MIN_TIME     (0.2)                   // Shortest segment [s]
+
+// Following
+#define TRAJECTORY_LAG          (0.5)                   // Distance where the time starts slowing down [m]
+#define TRAJECTORY_TOLERANCE    (0.2)                   // Distance to accept the last waypoint [m]
+#define TRAJECTORY_SETTLE       (5.0)                   // Time to wait for it after the end [s]
+
+// --------------------------------------------------------------------------
+//! @brief   Wrap an angle.
+//! @param   angle Angle [rad]
+//! @return  Angle in -PI to PI [rad]
+// --------------------------------------------------------------------------
+static inline double wrap(double angle)
+{
+    return atan2(sin(angle), cos(angle));
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneTrajectory class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneTrajectory::ARDroneTrajectory()
+{
+    period = 0.0;
+    clear();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneTrajectory class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneTrajectory::~ARDroneTrajectory()
+{
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Remove all the waypoints.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneTrajectory::clear(void)
+{
+    waypoints.clear();
+    samples.clear();
+    reached.clear();
+    elapsed = error = 0.0;
+    waypoint = 0;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Add a waypoint.
+//! @param   waypoint Waypoint
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneTrajectory::addWaypoint(const ARDRONE_WAYPOINT &waypoint)
+{
+    waypoints.push_back(waypoint);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Add a waypoint.
+//! @param   x X [m]
+//! @param   y Y [m]
+//! @param   z Altitude [m]
+//! @param   yaw Yaw [rad]
+//! @param   speed Average speed to this waypoint [m/s]
+//! @param   hold Time to stay at this waypoint [s]
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneTrajectory::addWaypoint(double x, double y, double z, double yaw, double speed, double hold)
+{
+    ARDRONE_WAYPOINT waypoint = { x, y, z, yaw, speed, hold };
+    addWaypoint(waypoint);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the number of the waypoints.
+//! @return  Number of the waypoints
+// --------------------------------------------------------------------------
+int ARDroneTrajectory::getWaypoints(void)
+{
+    return (int)waypoints.size();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Sample the trajectory from the start point.
+//! @param   start Start point (position and yaw)
+//! @param   period Sampling period [s] (period of the controller)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 No waypoint
+//! @note    Segments are cubic Hermite curves. The velocity at a waypoint is
+//!          the central difference of its neighbours, or zero at the ends
+//!          and where it holds. Stopping segments are made longer so that
+//!          the average speed stays as requested.
+// --------------------------------------------------------------------------
+int ARDroneTrajectory::build(const ARDRONE_SETPOINT &start, double period)
+{
+    samples.clear();
+    reached.clear();
+    elapsed = error = 0.0;
+    waypoint = 0;
+
+    const int n = (int)waypoints.size();
+    if (n < 1 || period <= 0.0) return 0;
+    this->period = period;
+
+    // Points (yaw unwrapped to take the shorter turn)
+    std::vector<ARDRONE_WAYPOINT> p(n + 1);
+    p[0].x = start.x;
+    p[0].y = start.y;
+    p[0].z = start.z;
+    p[0].yaw = start.yaw;
+    p[0].speed = 0.0;
+    p[0].hold = 0.0;
+    for (int i = 0; i < n; i++) {
+        p[i + 1] = waypoints[i];
+        p[i + 1].yaw = p[i].yaw + wrap(waypoints[i].yaw - p[i].yaw);
+        if (p[i + 1].speed <= 0.0) p[i + 1].speed = TRAJECTORY_SPEED;
+    }
+
+    // Stops
+    std::vector<bool> rest(n + 1);
+    rest[0] = rest[n] = true;
+    for (int i = 1; i < n; i++) rest[i] = p[i].hold > 0.0;
+
+    // Duration of the segments
+    std::vector<double> T(n);
+    for (int i = 0; i < n; i++) {
+        double dx = p[i + 1].x - p[i].x, dy = p[i + 1].y - p[i].y, dz = p[i + 1].z - p[i].z;
+        double t = sqrt(dx * dx + dy * dy + dz * dz) / p[i + 1].speed;
+        t *= 1.0 + 0.25 * ((rest[i] ? 1 : 0) + (rest[i + 1] ? 1 : 0));
+        T[i] = MAX(TRAJECTORY_MIN_TIME, MAX(t, fabs(p[i + 1].yaw - p[i].yaw) / TRAJECTORY_YAW_RATE));
+    }
+
+    // Velocity at the points
+    std::vector<ARDRONE_WAYPOINT> v(n + 1);
+    for (int i = 0; i <= n; i++) {
+        memset(&v[i], 0, sizeof(ARDRONE_WAYPOINT));
+        if (rest[i]) continue;
+        double t = T[i - 1] + T[i];
+        v[i].x = (p[i + 1].x - p[i - 1].x) / t;
+        v[i].y = (p[i + 1].y - p[i - 1].y) / t;
+        v[i].z = (p[i + 1].z - p[i - 1].z) / t;
+    }
+
+    // Sample at a fixed period (no accumulated rounding)
+    int segment = 0;
+    double begin = 0.0;
+    for (int k = 0; segment < n; k++) {
+        double now = k * period;
+
+        // Next segment (moving, then holding)
+        while (segment < n && now >= begin + T[segment] + p[segment + 1].hold) {
+            begin += T[segment] + p[segment + 1].hold;
+            segment++;
+        }
+        if (segment >= n) break;
+
+        const ARDRONE_WAYPOINT &a = p[segment], &b = p[segment + 1], &va = v[segment], &vb = v[segment + 1];
+        double t = now - begin, d = T[segment];
+        ARDRONE_SETPOINT sp;
+        sp.mode = ARDRONE_CONTROL_ALL;
+        if (t < d) {
+            // Hermite basis and their derivatives
+            double s = t / d, s2 = s * s, s3 = s2 * s;
+            double h00 = 2.0 * s3 - 3.0 * s2 + 1.0, h10 = s3 - 2.0 * s2 + s, h01 = -2.0 * s3 + 3.0 * s2, h11 = s3 - s2;
+            double g00 = (6.0 * s2 - 6.0 * s) / d,  g10 = 3.0 * s2 - 4.0 * s + 1.0, g01 = -g00, g11 = 3.0 * s2 - 2.0 * s;
+            sp.x    = h00 * a.x + h10 * d * va.x + h01 * b.x + h11 * d * vb.x;
+            sp.y    = h00 * a.y + h10 * d * va.y + h01 * b.y + h11 * d * vb.y;
+            sp.z    = h00 * a.z + h10 * d * va.z + h01 * b.z + h11 * d * vb.z;
+            sp.vx   = g00 * a.x + g10 * va.x + g01 * b.x + g11 * vb.x;
+            sp.vy   = g00 * a.y + g10 * va.y + g01 * b.y + g11 * vb.y;
+            sp.vz   = g00 * a.z + g10 * va.z + g01 * b.z + g11 * vb.z;
+            sp.yaw  = h00 * a.yaw + h01 * b.yaw;
+            sp.vyaw = g00 * a.yaw + g01 * b.yaw;
+            reached.push_back(segment);
+        }
+        else {
+            // Holding
+            sp.x = b.x;
+            sp.y = b.y;
+            sp.z = b.z;
+            sp.yaw = b.yaw;
+            sp.vx = sp.vy = sp.vz = sp.vyaw = 0.0;
+            reached.push_back(segment + 1);
+        }
+        samples.push_back(sp);
+    }
+
+    // Last waypoint
+    ARDRONE_SETPOINT last = { p[n].x, p[n].y, p[n].z, p[n].yaw, 0.0, 0.0, 0.0, 0.0, ARDRONE_CONTROL_ALL };
+    samples.push_back(last);
+    reached.push_back(n);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the planned duration.
+//! @return  Duration [s]
+// --------------------------------------------------------------------------
+double ARDroneTrajectory::getDuration(void)
+{
+    return samples.empty() ? 0.0 : (samples.size() - 1) * period;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Advance along the trajectory.
+//! @param   pose Current state
+//! @param   dt Time step [s]
+//! @param   setpoint Setpoint for the controller
+//! @return  Events (ARDRONE_TRAJECTORY_EVENT bits)
+//! @note    The time slows down, and stops, while the drone lags behind the
+//!          setpoint, so that it is not dragged along a shortcut.
+// --------------------------------------------------------------------------
+int ARDroneTrajectory::advance(const ARDRONE_POSE &pose, double dt, ARDRONE_SETPOINT *setpoint)
+{
+    if (samples.empty()) return ARDRONE_TRAJECTORY_FINISHED;
+    const int last = (int)samples.size() - 1;
+    const double duration = last * period;
+
+    // Tracking error from the current setpoint
+    int i = MIN(last, (int)(MIN(elapsed, duration) / period));
+    double f = MIN(1.0, MIN(elapsed, duration) / period - i);
+    const ARDRONE_SETPOINT &a = samples[i], &b = samples[MIN(last, i + 1)];
+    double dx = pose.x - (a.x + (b.x - a.x) * f);
+    double dy = pose.y - (a.y + (b.y - a.y) * f);
+    double dz = pose.z - (a.z + (b.z - a.z) * f);
+    error = sqrt(dx * dx + dy * dy + dz * dz);
+
+    // Time scaling (1 within TRAJECTORY_LAG, 0 at double of it)
+    double rate = MAX(0.0, MIN(1.0, 2.0 - error / TRAJECTORY_LAG));
+    elapsed += dt * rate;
+
+    // Interpolate the samples
+    i = MIN(last, (int)(MIN(elapsed, duration) / period));
+    f = MIN(1.0, MIN(elapsed, duration) / period - i);
+    const ARDRONE_SETPOINT &c = samples[i], &d = samples[MIN(last, i + 1)];
+    setpoint->x    = c.x + (d.x - c.x) * f;
+    setpoint->y    = c.y + (d.y - c.y) * f;
+    setpoint->z    = c.z + (d.z - c.z) * f;
+    setpoint->yaw  = c.yaw + (d.yaw - c.yaw) * f;
+    setpoint->vx   = (c.vx + (d.vx - c.vx) * f) * rate;
+    setpoint->vy   = (c.vy + (d.vy - c.vy) * f) * rate;
+    setpoint->vz   = (c.vz + (d.vz - c.vz) * f) * rate;
+    setpoint->vyaw = (c.vyaw + (d.vyaw - c.vyaw) * f) * rate;
+    setpoint->mode = ARDRONE_CONTROL_ALL;
+
+    // Events
+    int events = 0;
+    if (reached[i] > waypoint) {
+        waypoint = reached[i];
+        events |= ARDRONE_TRAJECTORY_WAYPOINT;
+    }
+    if (elapsed >= duration && (error < TRAJECTORY_TOLERANCE || elapsed >= duration + TRAJECTORY_SETTLE)) {
+        events |= ARDRONE_TRAJECTORY_FINISHED;
+    }
+
+    return events;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the progress.
+//! @param   progress Progress
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDroneTrajectory::getProgress(ARDRONE_TRAJECTORY_PROGRESS *progress)
+{
+    progress->waypoint  = waypoint;
+    progress->waypoints = (int)waypoints.size();
+    progress->duration  = getDuration();
+    progress->elapsed   = MIN(elapsed, progress->duration);
+    progress->error     = error;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Fly a trajectory.
+//! @param   trajectory Waypoints (copied)
+//! @param   callback Progress callback (or NULL)
+//! @param   arg Argument of the callback
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    It starts from the current setpoint, or from the current state.
+//!          The running trajectory is preempted.
+// --------------------------------------------------------------------------
+int ARDrone::startTrajectory(const ARDroneTrajectory &trajectory, ARDRONE_TRAJECTORY_CALLBACK callback, void *arg)
+{
+    // The controller streams the setpoints
+    if (!controller && !startController()) return 0;
+
+    // Start point
+    ARDRONE_SETPOINT start;
+    double period = 0.0;
+    ARDRONE_POSE pose;
+    int source = 0;
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    if (controller) {
+        controller->getSetpoint(&start);
+        period = controller->getPeriod();
+        source = getControlState(&pose);
+    }
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+    if (period <= 0.0) return 0;
+    if (!source) {
+        CVDRONE_ERROR("The trajectory needs the estimator or the odometry. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+    if (start.mode != ARDRONE_CONTROL_ALL) {
+        start.x = pose.x;
+        start.y = pose.y;
+        start.z = pose.z;
+        start.yaw = pose.yaw;
+    }
+
+    // Sample it ahead of time
+    ARDroneTrajectory *tmp = new ARDroneTrajectory(trajectory);
+    if (!tmp->build(start, period)) {
+        CVDRONE_ERROR("The trajectory has no waypoint. (%s, %d)\n", __FILE__, __LINE__);
+        delete tmp;
+        return 0;
+    }
+
+    // Replace the running one
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    ARDroneTrajectory *old = this->trajectory;
+    ARDRONE_TRAJECTORY_CALLBACK oldCallback = trajectoryCallback;
+    void *oldArg = trajectoryArg;
+    this->trajectory = tmp;
+    trajectoryCallback = callback;
+    trajectoryArg = arg;
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    // Preempted
+    if (old) {
+        ARDRONE_TRAJECTORY_PROGRESS progress;
+        old->getProgress(&progress);
+        if (oldCallback) oldCallback(ARDRONE_TRAJECTORY_PREEMPTED, progress, oldArg);
+        delete old;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop the trajectory.
+//! @return  None
+//! @note    The controller holds the current setpoint.
+// --------------------------------------------------------------------------
+void ARDrone::stopTrajectory(void)
+{
+    // Not started
+    if (!trajectory) return;
+
+    // Detach it, and stop the feed-forward
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    ARDroneTrajectory *tmp = trajectory;
+    ARDRONE_TRAJECTORY_CALLBACK callback = trajectoryCallback;
+    void *arg = trajectoryArg;
+    trajectory = NULL;
+    trajectoryCallback = NULL;
+    trajectoryArg = NULL;
+    if (tmp && controller) {
+        ARDRONE_SETPOINT setpoint;
+        controller->getSetpoint(&setpoint);
+        setpoint.vx = setpoint.vy = setpoint.vz = setpoint.vyaw = 0.0;
+        controller->setSetpoint(setpoint);
+    }
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    // Preempted
+    if (tmp) {
+        ARDRONE_TRAJECTORY_PROGRESS progress;
+        tmp->getProgress(&progress);
+        if (callback) callback(ARDRONE_TRAJECTORY_PREEMPTED, progress, arg);
+        delete tmp;
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the progress of the trajectory.
+//! @param   progress Progress
+//! @return  Result of this function
+//! @retval  1 Running
+//! @retval  0 Not running
+// --------------------------------------------------------------------------
+int ARDrone::getTrajectoryProgress(ARDRONE_TRAJECTORY_PROGRESS *progress)
+{
+    int result = 0;
+    if (mutexCommand) pthread_mutex_lock(mutexCommand);
+    if (trajectory) {
+        trajectory->getProgress(progress);
+        result = 1;
+    }
+    if (mutexCommand) pthread_mutex_unlock(mutexCommand);
+
+    return result;
+}
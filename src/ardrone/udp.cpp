@@ -34,6 +34,8 @@
 UDPSocket::UDPSocket()
 {
     sock = INVALID_SOCKET;
+    recorder = NULL;
+    recordType = 0;
 }
 
 // --------------------------------------------------------------------------
@@ -46,11 +48,12 @@ UDPSocket::~UDPSocket()
 }
 
 // --------------------------------------------------------------------------
-// UDPSocket::open(IP address, Port number)
+// UDPSocket::open(IP address, Port number, Local IP address, Local port number, Network device)
 // Description  : Initialize specified  socket.
+//                The socket is bound to the local address/port/device if specified.
 // Return value : SUCCESS: 1  FAILURE: 0
 // --------------------------------------------------------------------------
-int UDPSocket::open(const char *addr, int port)
+int UDPSocket::open(const char *addr, int port, const char *local_addr, int local_port, const char *device)
 {
     #if _WIN32
     // Initialize WSA
@@ -74,8 +77,21 @@ int UDPSocket::open(const char *addr, int port)
     // Set the port and address of client
     memset(&client_addr, 0, sizeof(client_addr));
     client_addr.sin_family = AF_INET;
-    client_addr.sin_port = htons(0);
-    client_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    client_addr.sin_port = htons((u_short)local_port);
+    client_addr.sin_addr.s_addr = (local_addr && local_addr[0]) ? inet_addr(local_addr) : htonl(INADDR_ANY);
+
+    // Bind the socket to the network device
+    if (device && device[0]) {
+        #ifdef SO_BINDTODEVICE
+        if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, device, (socklen_t)strlen(device) + 1) == SOCKET_ERROR) {
+            printf("ERROR: setsockopt(SO_BINDTODEVICE) failed. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
+        #else
+        printf("ERROR: Binding to a network device is not supported. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+        #endif
+    }
 
     // Bind the socket
     if (bind(sock, (sockaddr*)&client_addr, sizeof(client_addr)) == SOCKET_ERROR) {
@@ -102,12 +118,13 @@ int UDPSocket::open(const char *addr, int port)
     //}
     //#endif
 
-    // Enable re-use address option
-    int reuse = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) == SOCKET_ERROR) {
-        printf("ERROR: setsockopt() failed. (%s, %d)\n", __FILE__, __LINE__);
-        return 0;
-    }
+    // Do not enable SO_REUSEADDR, so that other sockets cannot share (and steal from) our port
+
+    // Enable kernel receive timestamps
+    #ifdef SO_TIMESTAMPNS
+    int timestamp = 1;
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, (const char*)&timestamp, sizeof(timestamp));
+    #endif
 
     return 1;
 }
@@ -126,6 +143,9 @@ int UDPSocket::send2(void *data, size_t size)
     int n = (int)sendto(sock, (char*)data, size, 0, (sockaddr*)&server_addr, sizeof(server_addr));
     if (n < 1) return 0;
 
+    // Record it
+    if (recorder) recorder->write(recordType, data, n);
+
     return n;
 }
 
@@ -167,12 +187,172 @@ int UDPSocket::receive(void *data, size_t size)
     int n = (int)recvfrom(sock, (char*)data, size, 0, (sockaddr*)&addr, &len);
     if (n < 1) return 0;
 
-    // Server has the same IP address of client
-    //if (addr.sin_addr.S_un.S_addr != server_addr.sin_addr.S_un.S_addr) return 0;
+    // Discard data from others than the server
+    if (addr.sin_addr.s_addr != server_addr.sin_addr.s_addr) return 0;
 
     return n;
 }
 
+// --------------------------------------------------------------------------
+// UDPSocket::sendMany(Packets, Number of packets)
+// Description  : Send the packets with as few system calls as possible.
+// Return value : SUCCESS: Number of sent packets  FAILURE: 0
+// --------------------------------------------------------------------------
+int UDPSocket::sendMany(UDP_PACKET *packets, int count)
+{
+    // The socket is invalid
+    if (sock == INVALID_SOCKET) return 0;
+
+    #if defined(__linux__) && defined(MSG_WAITFORONE)
+    // Send them by sendmmsg()
+    int sent = 0;
+    while (sent < count) {
+        mmsghdr msgs[UDP_MAX_BATCH];
+        iovec iovs[UDP_MAX_BATCH];
+        int n = MIN(count - sent, UDP_MAX_BATCH);
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < n; i++) {
+            iovs[i].iov_base = packets[sent + i].data;
+            iovs[i].iov_len  = packets[sent + i].size;
+            msgs[i].msg_hdr.msg_name    = &server_addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(server_addr);
+            msgs[i].msg_hdr.msg_iov     = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+        }
+        int result = sendmmsg(sock, msgs, n, 0);
+        if (result < 1) break;
+        sent += result;
+    }
+
+    // Record them
+    if (recorder) {
+        for (int i = 0; i < sent; i++) recorder->write(recordType, packets[i].data, packets[i].size);
+    }
+
+    return sent;
+    #else
+    // Send them one by one
+    int sent = 0;
+    while (sent < count && send2(packets[sent].data, packets[sent].size)) sent++;
+    return sent;
+    #endif
+}
+
+// --------------------------------------------------------------------------
+// UDPSocket::receiveMany(Packets, Number of packets, Timeout [ms])
+// Description  : Receive queued packets with as few system calls as possible.
+//                Blocks until at least one packet arrives (or timeout),
+//                then returns all the packets already queued (up to count).
+// Return value : SUCCESS: Number of received packets  FAILURE/TIMEOUT: 0
+// --------------------------------------------------------------------------
+int UDPSocket::receiveMany(UDP_PACKET *packets, int count, int timeout)
+{
+    // The socket is invalid
+    if (sock == INVALID_SOCKET || count < 1) return 0;
+
+    // Wait for data
+    if (timeout >= 0) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        timeval tv;
+        tv.tv_sec  = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        if (select((int)sock + 1, &fds, NULL, NULL, &tv) < 1) return 0;
+    }
+
+    #if defined(__linux__) && defined(MSG_WAITFORONE)
+    // Receive them by recvmmsg()
+    mmsghdr msgs[UDP_MAX_BATCH];
+    iovec iovs[UDP_MAX_BATCH];
+    sockaddr_in addrs[UDP_MAX_BATCH];
+    char controls[UDP_MAX_BATCH][CMSG_SPACE(sizeof(timespec))];
+    int n = MIN(count, UDP_MAX_BATCH);
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < n; i++) {
+        iovs[i].iov_base = packets[i].data;
+        iovs[i].iov_len  = packets[i].capacity;
+        msgs[i].msg_hdr.msg_name       = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen    = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov        = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen     = 1;
+        msgs[i].msg_hdr.msg_control    = controls[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+    }
+    int received = recvmmsg(sock, msgs, n, MSG_WAITFORONE, NULL);
+    if (received < 1) return 0;
+    double now = gettime();
+
+    // Keep the packets from the server
+    int m = 0;
+    for (int i = 0; i < received; i++) {
+        if (addrs[i].sin_addr.s_addr != server_addr.sin_addr.s_addr) continue;
+
+        // Kernel timestamp
+        double timestamp = now;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                timestamp = ts.tv_sec + ts.tv_nsec * 1.0e-9;
+            }
+        }
+
+        // Move it forward
+        if (m != i) std::swap(packets[m], packets[i]);
+        packets[m].size = (int)msgs[i].msg_len;
+        packets[m].timestamp = timestamp;
+        m++;
+    }
+    return m;
+    #else
+    // Receive them one by one
+    int m = 0;
+    while (m < count) {
+        // Only the first one may block
+        if (m > 0) {
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(sock, &fds);
+            timeval tv = {0, 0};
+            if (select((int)sock + 1, &fds, NULL, NULL, &tv) < 1) break;
+        }
+
+        // Receive a packet (from the server only)
+        int size = receive(packets[m].data, packets[m].capacity);
+        if (size < 1) {
+            if (m == 0) return 0;
+            continue;
+        }
+        packets[m].size = size;
+        packets[m].timestamp = gettime();
+        m++;
+    }
+    return m;
+    #endif
+}
+
+// --------------------------------------------------------------------------
+// UDPSocket::setRecorder(Recorder, Type of records)
+// Description  : Record all sent data (NULL to stop).
+// Return value : NONE
+// --------------------------------------------------------------------------
+void UDPSocket::setRecorder(ARDroneRecorder *recorder, int type)
+{
+    this->recorder = recorder;
+    recordType = type;
+}
+
+// --------------------------------------------------------------------------
+// UDPSocket::getSocket()
+// Description  : Get the socket descriptor.
+// Return value : Socket descriptor (INVALID_SOCKET if not opened)
+// --------------------------------------------------------------------------
+SOCKET UDPSocket::getSocket(void)
+{
+    return sock;
+}
+
 // --------------------------------------------------------------------------
 // UDPSocket::close()
 // Description  : Finalize the socket.
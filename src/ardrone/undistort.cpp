@@ -0,0 +1,254 @@
+// -------------------------------------------------------------------------
+// CV Drone (= OpenCV + AR.Drone)
+// Copyright(C) 2016 puku0x
+// https://github.com/puku0x/cvdrone
+//
+// This source file is part of CV Drone library.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of EITHER:
+// (1) The GNU Lesser General Public License as published by the Free
+//     Software Foundation; either version 2.1 of the License, or (at
+//     your option) any later version. The text of the GNU Lesser
+//     General Public License is included with this library in the
+//     file cvdrone-license-LGPL.txt.
+// (2) The BSD-style license that is included with this library in
+//     the file cvdrone-license-BSD.txt.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files
+// cvdrone-license-LGPL.txt and cvdrone-license-BSD.txt for more details.
+//
+//! @file   undistort.cpp
+//! @brief  Lens undistortion
+//
+// -------------------------------------------------------------------------
+
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+//! @brief   Constructor of ARDroneUndistorter class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneUndistorter::ARDroneUndistorter()
+{
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Destructor of ARDroneUndistorter class
+//! @return  None
+// --------------------------------------------------------------------------
+ARDroneUndistorter::~ARDroneUndistorter()
+{
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Load a calibration file.
+//! @param   filename XML/YAML file with "intrinsic" and "distortion" (written by sample_camera_calibration)
+//! @param   channel Camera channel of the calibration (0 = front, 1 = bottom)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDroneUndistorter::load(const char *filename, int channel)
+{
+    // Open the file
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        CVDRONE_ERROR("Failed to open %s. (%s, %d)\n", filename, __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Camera parameters
+    cv::Mat camera_matrix, dist_coeffs;
+    fs["intrinsic"] >> camera_matrix;
+    fs["distortion"] >> dist_coeffs;
+
+    return setCalibration(channel, camera_matrix, dist_coeffs);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Set a calibration.
+//! @param   channel Camera channel of the calibration (0 = front, 1 = bottom)
+//! @param   camera_matrix 3x3 camera matrix
+//! @param   dist_coeffs Distortion coefficients (k1, k2, p1, p2[, k3...])
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    The maps are built for the size of the first image.
+// --------------------------------------------------------------------------
+int ARDroneUndistorter::setCalibration(int channel, const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs)
+{
+    // Not a camera matrix
+    if (camera_matrix.rows != 3 || camera_matrix.cols != 3) {
+        CVDRONE_ERROR("Invalid camera matrix. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    CHANNEL &c = channels[channel];
+    camera_matrix.convertTo(c.cameraMatrix, CV_64F);
+    if (dist_coeffs.empty()) c.distCoeffs = cv::Mat::zeros(1, 4, CV_64F);
+    else dist_coeffs.convertTo(c.distCoeffs, CV_64F);
+    c.size = cv::Size();
+    c.map1.release();
+    c.map2.release();
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Check if a channel is calibrated.
+//! @param   channel Camera channel
+//! @return  Result of this function
+//! @retval  true  Calibrated
+//! @retval  false Not calibrated
+// --------------------------------------------------------------------------
+bool ARDroneUndistorter::hasCalibration(int channel)
+{
+    return channels.find(channel) != channels.end();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Rectify an image.
+//! @param   src Raw image
+//! @param   dst Rectified image (allocated if needed, must not share src)
+//! @param   channel Camera channel of the image
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure (not calibrated)
+//! @note    Fixed-point maps (CV_16SC2) are built once for each image size.
+// --------------------------------------------------------------------------
+int ARDroneUndistorter::remap(const cv::Mat &src, cv::Mat &dst, int channel)
+{
+    std::map<int, CHANNEL>::iterator it = channels.find(channel);
+    if (it == channels.end() || src.empty()) return 0;
+    CHANNEL &c = it->second;
+
+    // Build the maps
+    if (c.map1.empty() || c.size != src.size()) {
+        cv::initUndistortRectifyMap(c.cameraMatrix, c.distCoeffs, cv::Mat(), c.cameraMatrix, src.size(), CV_16SC2, c.map1, c.map2);
+        c.size = src.size();
+    }
+
+    // Rectify
+    cv::remap(src, dst, c.map1, c.map2, cv::INTER_LINEAR);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Undistort points instead of an image.
+//! @param   src Points in the raw image [px]
+//! @param   dst Points in the rectified image [px]
+//! @param   channel Camera channel of the image
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure (not calibrated)
+// --------------------------------------------------------------------------
+int ARDroneUndistorter::undistortPoints(const std::vector<cv::Point2f> &src, std::vector<cv::Point2f> *dst, int channel)
+{
+    std::map<int, CHANNEL>::iterator it = channels.find(channel);
+    if (it == channels.end() || !dst) return 0;
+
+    // Nothing to do
+    if (src.empty()) {
+        dst->clear();
+        return 1;
+    }
+
+    // Same camera matrix as the rectified image
+    cv::undistortPoints(src, *dst, it->second.cameraMatrix, it->second.distCoeffs, cv::noArray(), it->second.cameraMatrix);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get the camera matrix of rectified images.
+//! @param   channel Camera channel
+//! @return  3x3 camera matrix (empty if not calibrated)
+// --------------------------------------------------------------------------
+cv::Mat ARDroneUndistorter::getCameraMatrix(int channel)
+{
+    std::map<int, CHANNEL>::iterator it = channels.find(channel);
+    if (it == channels.end()) return cv::Mat();
+    return it->second.cameraMatrix.clone();
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Rectify the decoded frames.
+//! @param   filename Calibration file (see ARDroneUndistorter::load())
+//! @param   channel Camera channel of the calibration (0 = front, 1 = bottom)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    The decoder thread remaps into the published buffer, so getImage(),
+//!          getLuma() and the frame ring give rectified frames of calibrated
+//!          channels. Call it again to add another channel.
+// --------------------------------------------------------------------------
+int ARDrone::startUndistort(const char *filename, int channel)
+{
+    // AR.Drone 1.0 decodes UVLC pictures directly into the BGR buffer
+    if (version.major != ARDRONE_VERSION_2) {
+        CVDRONE_ERROR("Undistortion on the decoder is only for AR.Drone 2.0. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Add the channel to the current calibrations
+    int result = 0;
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    if (undistorter) result = undistorter->load(filename, channel);
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+    if (undistorter) return result;
+
+    // Load the calibration
+    ARDroneUndistorter *tmp = new ARDroneUndistorter;
+    if (!tmp->load(filename, channel)) {
+        delete tmp;
+        return 0;
+    }
+
+    // Attach it to the decoder
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    undistorter = tmp;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Stop rectifying the decoded frames.
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::stopUndistort(void)
+{
+    // Not rectifying
+    if (!undistorter) return;
+    ARDroneUndistorter *tmp = undistorter;
+
+    // Detach it from the decoder
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    undistorter = NULL;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+    delete tmp;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Undistort points with the calibration of the decoder.
+//! @param   src Points in the raw image [px]
+//! @param   dst Points in the rectified image [px]
+//! @param   channel Camera channel of the image
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure (not calibrated)
+//! @note    For detections made on raw images (e.g. from the relay or the remuxer).
+// --------------------------------------------------------------------------
+int ARDrone::undistortPoints(const std::vector<cv::Point2f> &src, std::vector<cv::Point2f> *dst, int channel)
+{
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    int result = undistorter ? undistorter->undistortPoints(src, dst, channel) : 0;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+    return result;
+}
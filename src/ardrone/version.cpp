@@ -38,7 +38,7 @@ int ARDrone::getVersionInfo(void)
     TCPSocket socket1, socket2;
 
     // Open the IP address and port
-    if (!socket1.open(ip, ARDRONE_FTP_PORT)) {
+    if (!socket1.open(ip, ARDRONE_FTP_PORT, localIp, 0, netDevice)) {
         CVDRONE_ERROR("TCPSocket::open(port=%d) failed. (%s, %d)\n", ARDRONE_FTP_PORT, __FILE__, __LINE__);
         return 0;
     }
@@ -60,7 +60,7 @@ int ARDrone::getVersionInfo(void)
     dataport = (a << 8) + b;
 
     // Open the IP address and port
-    if (!socket2.open(ip, dataport)) {
+    if (!socket2.open(ip, dataport, localIp, 0, netDevice)) {
         CVDRONE_ERROR("TCPSocket::open(port=%d) failed. (%s, %d)\n", dataport, __FILE__, __LINE__);
         return 0;
     }
@@ -34,6 +34,38 @@
 // - AR.Drone Development - 2.1.2 AR.Drone 2.0 Video Decording: FFMPEG + SDL2.0 -
 //   http://ardrone-ailab-u-tokyo.blogspot.jp/2012/07/212-ardrone-20-video-decording-ffmpeg.html
 
+// Consumed bytes kept at the head of the stream buffer before compacting it
+#define VIDEO_COMPACT_SIZE (1 << 18)
+
+// --------------------------------------------------------------------------
+//! @brief   Find a PaVE header at the read offset of the buffer.
+//! @param   buffer Received stream
+//! @param   offset Read offset (moved over data before the header)
+//! @param   header A pointer to the header
+//! @return  Result of this function
+//! @retval  1 Found
+//! @retval  0 Not found (yet)
+// --------------------------------------------------------------------------
+static int findPaVE(const std::vector<uint8_t> &buffer, size_t &offset, ARDRONE_PAVE *header)
+{
+    while (1) {
+        // Search the signature (garbage before it is skipped)
+        while (offset + 4 <= buffer.size() && memcmp(&buffer[offset], "PaVE", 4)) offset++;
+
+        // Wait for the whole header
+        if (buffer.size() < offset + sizeof(ARDRONE_PAVE)) return 0;
+        memcpy(header, &buffer[offset], sizeof(ARDRONE_PAVE));
+
+        // Broken header, search the next signature
+        if (header->header_size < sizeof(ARDRONE_PAVE) || header->payload_size > 0x100000) {
+            offset += 4;
+            continue;
+        }
+
+        return 1;
+    }
+}
+
 // --------------------------------------------------------------------------
 //! @brief   Initialize video.
 //! @return  Result of initialization
@@ -45,26 +77,77 @@ int ARDrone::initVideo(void)
     // AR.Drone 2.0
     if (version.major == ARDRONE_VERSION_2) {
         // Open the IP address and port
-        char filename[256];
-        sprintf(filename, "tcp://%s:%d", ip, ARDRONE_VIDEO_PORT);
-        if (avformat_open_input(&pFormatCtx, filename, NULL, NULL) < 0) {
-            CVDRONE_ERROR("avformat_open_input() was failed. (%s, %d)\n", __FILE__, __LINE__);
+        if (!sockStream.open(ip, ARDRONE_VIDEO_PORT, localIp, 0, netDevice)) {
+            CVDRONE_ERROR("TCPSocket::open(port=%d) was failed. (%s, %d)\n", ARDRONE_VIDEO_PORT, __FILE__, __LINE__);
             return 0;
         }
 
-        // Retrive and dump stream information
-        avformat_find_stream_info(pFormatCtx, NULL);
-        av_dump_format(pFormatCtx, 0, filename, 0);
+        // Wait for the first PaVE header to get the size of the stream
+        streamBuffer.clear();
+        streamOffset = 0;
+        ARDRONE_PAVE header;
+        int found = 0;
+        for (int i = 0; i < 50 && !found; i++) {
+            if (receiveVideo() < 0) break;
+            found = findPaVE(streamBuffer, streamOffset, &header);
+        }
+        if (!found) {
+            CVDRONE_ERROR("No PaVE header was received. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
 
+        // Initialize the decoder
+        if (!initDecoder(header)) return 0;
+    }
+    // AR.Drone 1.0
+    else {
+        // Open the IP address and port
+        if (!sockVideo.open(ip, ARDRONE_VIDEO_PORT, localIp, 0, netDevice)) {
+            CVDRONE_ERROR("UDPSocket::open(port=%d) was failed. (%s, %d)\n", ARDRONE_VIDEO_PORT, __FILE__, __LINE__);
+            return 0;
+        }
+
+        // Initialize the decoder
+        ARDRONE_PAVE header;
+        memset(&header, 0, sizeof(header));
+        if (!initDecoder(header)) return 0;
+    }
+
+    // Create a thread (ARDroneFleet drives managed drones by itself)
+    if (!managed) {
+        threadVideo = new pthread_t;
+        if (pthread_create(threadVideo, NULL, runVideo, this) != 0) {
+            CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Initialize the video decoder and the image.
+//! @param   header The first PaVE header (only for AR.Drone 2.0)
+//! @return  Result of initialization
+//! @retval  1 Success
+//! @retval  0 Failure
+// --------------------------------------------------------------------------
+int ARDrone::initDecoder(const ARDRONE_PAVE &header)
+{
+    // AR.Drone 2.0
+    if (version.major == ARDRONE_VERSION_2) {
         // Find the decoder for the video stream
-        pCodecCtx = pFormatCtx->streams[0]->codec;
-        AVCodec *pCodec = avcodec_find_decoder(pCodecCtx->codec_id);
+        AVCodec *pCodec = avcodec_find_decoder(AV_CODEC_ID_H264);
         if (pCodec == NULL) {
             CVDRONE_ERROR("avcodec_find_decoder() was failed. (%s, %d)\n", __FILE__, __LINE__);
             return 0;
         }
 
         // Open codec
+        pCodecCtx = avcodec_alloc_context3(pCodec);
+        pCodecCtx->width   = header.encoded_stream_width;
+        pCodecCtx->height  = header.encoded_stream_height;
+        pCodecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
         if (avcodec_open2(pCodecCtx, pCodec, NULL) < 0) {
             CVDRONE_ERROR("avcodec_open2() was failed. (%s, %d)\n", __FILE__, __LINE__);
             return 0;
@@ -88,12 +171,6 @@ int ARDrone::initVideo(void)
     }
     // AR.Drone 1.0
     else {
-        // Open the IP address and port
-        if (!sockVideo.open(ip, ARDRONE_VIDEO_PORT)) {
-            CVDRONE_ERROR("UDPSocket::open(port=%d) was failed. (%s, %d)\n", ARDRONE_VIDEO_PORT, __FILE__, __LINE__);
-            return 0;
-        }
-
         // Set codec
         pCodecCtx = avcodec_alloc_context3(NULL);
         pCodecCtx->width = 320;
@@ -117,13 +194,6 @@ int ARDrone::initVideo(void)
     mutexVideo = new pthread_mutex_t;
     pthread_mutex_init(mutexVideo, NULL);
 
-    // Create a thread
-    threadVideo = new pthread_t;
-    if (pthread_create(threadVideo, NULL, runVideo, this) != 0) {
-        CVDRONE_ERROR("pthread_create() was failed. (%s, %d)\n", __FILE__, __LINE__);
-        return 0;
-    }
-
     return 1;
 }
 
@@ -149,54 +219,252 @@ void ARDrone::loopVideo(void)
 // --------------------------------------------------------------------------
 int ARDrone::getVideo(void)
 {
+    // AR.Drone 1.0 needs a request for each picture
+    if (version.major != ARDRONE_VERSION_2) sockVideo.sendf("\x01\x00\x00\x00");
+
+    // Receive data
+    if (receiveVideo() < 0) return 0;
+
+    // Decode all complete packets
+    ARDRONE_VIDEO_PACKET packet;
+    while (extractVideo(&packet)) {
+        decodeVideo(packet);
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Receive available video data.
+//! @return  Number of received bytes
+//! @retval  0 Nothing received (timeout)
+//! @retval -1 The connection was closed
+// --------------------------------------------------------------------------
+int ARDrone::receiveVideo(void)
+{
+    uint8_t buf[122880];
+
+    // AR.Drone 2.0
+    if (version.major == ARDRONE_VERSION_2) {
+        // Drop the consumed data once in a while (not on every packet)
+        if (streamOffset >= streamBuffer.size()) {
+            streamBuffer.clear();
+            streamOffset = 0;
+        }
+        else if (streamOffset > VIDEO_COMPACT_SIZE) {
+            streamBuffer.erase(streamBuffer.begin(), streamBuffer.begin() + streamOffset);
+            streamOffset = 0;
+        }
+
+        // Append to the stream
+        int size = sockStream.receiveAny((void*)buf, sizeof(buf));
+        if (size > 0) streamBuffer.insert(streamBuffer.end(), buf, buf + size);
+        return size;
+    }
+    // AR.Drone 1.0
+    else {
+        // A datagram has a whole picture
+        int size = sockVideo.receive((void*)buf, sizeof(buf));
+        if (size > 0) {
+            streamBuffer.assign(buf, buf + size);
+            streamOffset = 0;
+        }
+        return size;
+    }
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Extract a complete video packet from received data.
+//! @param   packet A pointer to the packet
+//! @return  Result of this function
+//! @retval  1 Extracted
+//! @retval  0 No complete packet
+// --------------------------------------------------------------------------
+int ARDrone::extractVideo(ARDRONE_VIDEO_PACKET *packet)
+{
+    // AR.Drone 2.0
+    if (version.major == ARDRONE_VERSION_2) {
+        // Find a header
+        ARDRONE_PAVE header;
+        if (!findPaVE(streamBuffer, streamOffset, &header)) return 0;
+
+        // Wait for the whole payload
+        size_t total = header.header_size + header.payload_size;
+        if (streamBuffer.size() < streamOffset + total) return 0;
+
+        // Extract it (the buffer is compacted by receiveVideo())
+        packet->header = header;
+        packet->data.assign(streamBuffer.begin() + streamOffset + header.header_size, streamBuffer.begin() + streamOffset + total);
+        streamOffset += total;
+    }
+    // AR.Drone 1.0
+    else {
+        // Nothing received
+        if (streamBuffer.empty()) return 0;
+        streamOffset = 0;
+
+        // Extract it
+        memset(&packet->header, 0, sizeof(packet->header));
+        packet->header.payload_size = (uint32_t)streamBuffer.size();
+        packet->data.swap(streamBuffer);
+        streamBuffer.clear();
+    }
+
+    // Received time
+    packet->timestamp = gettime();
+
+    // Record it
+    recordVideo(*packet);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Pass a video packet to the recorders and the relay.
+//! @param   packet Video packet
+//! @return  None
+// --------------------------------------------------------------------------
+void ARDrone::recordVideo(const ARDRONE_VIDEO_PACKET &packet)
+{
+    // Nothing to do
+    if (!recorder && !remuxer && !relay) return;
+
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+
+    // Session log
+    if (recorder) {
+        if (version.major == ARDRONE_VERSION_2) recorder->write(ARDRONE_LOG_VIDEO, &packet.header, sizeof(packet.header), packet.data.empty() ? NULL : &packet.data[0], packet.data.size());
+        else                                    recorder->write(ARDRONE_LOG_VIDEO, &packet.data[0], packet.data.size());
+    }
+
+    // Passthrough video file (copied and written on its own thread)
+    if (remuxer) remuxer->push(packet);
+
+    // Local consumers
+    if (relay) relay->push(packet);
+
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Decode a video packet into the BGR buffer.
+//! @param   packet Video packet
+//! @return  Result of this function
+//! @retval  1 A new image was decoded
+//! @retval  0 No image
+// --------------------------------------------------------------------------
+int ARDrone::decodeVideo(const ARDRONE_VIDEO_PACKET &packet)
+{
+    // Nothing to decode
+    if (packet.data.empty() || !pCodecCtx) return 0;
+
     // AR.Drone 2.0
     if (version.major == ARDRONE_VERSION_2) {
-        AVPacket packet;
+        // Decode the frame
+        AVPacket avpacket;
+        av_init_packet(&avpacket);
+        avpacket.data = (uint8_t*)&packet.data[0];
+        avpacket.size = (int)packet.data.size();
         int frameFinished = 0;
+        avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &avpacket);
 
-        // Read all frames
-        while (av_read_frame(pFormatCtx, &packet) >= 0) {
-            // Decode the frame
-            avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet);
+        // Decoded all frames
+        if (frameFinished) {
+            // Navdata at the capture
+            ARDRONE_FRAME_INFO info;
+            syncFrame(packet, &info);
 
-            // Decoded all frames
-            if (frameFinished) {
-                // Convert to BGR
-                if (mutexVideo) pthread_mutex_lock(mutexVideo);
-                sws_scale(pConvertCtx, (const uint8_t* const*)pFrame->data, pFrame->linesize, 0, pCodecCtx->height, pFrameBGR->data, pFrameBGR->linesize);
-                newImage = true;
-                if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+            // Camera of the frame (gathered before locking the video)
+            int channel = undistorter ? atoi(getConfigValue("video:video_channel").c_str()) : 0;
 
-                // Free the packet and break immidiately
-                av_free_packet(&packet);
-                return 1;
-                //break;
+            if (mutexVideo) pthread_mutex_lock(mutexVideo);
+            cv::Mat luma(pCodecCtx->height, pCodecCtx->width, CV_8UC1, pFrame->data[0], pFrame->linesize[0]);
+
+            // Convert to BGR and rectify it into the published buffer
+            if (undistorter && undistorter->hasCalibration(channel)) {
+                bufferRaw.create(pCodecCtx->height, pCodecCtx->width, CV_8UC3);
+                uint8_t *data[4] = { bufferRaw.data, NULL, NULL, NULL };
+                int linesize[4] = { (int)bufferRaw.step, 0, 0, 0 };
+                sws_scale(pConvertCtx, (const uint8_t* const*)pFrame->data, pFrame->linesize, 0, pCodecCtx->height, data, linesize);
+                cv::Mat bgr(pCodecCtx->height, pCodecCtx->width, CV_8UC3, pFrameBGR->data[0], pFrameBGR->linesize[0]);
+                undistorter->remap(bufferRaw, bgr, channel);
+                undistorter->remap(luma, bufferLuma, channel);
             }
+            // Convert to BGR
+            else {
+                sws_scale(pConvertCtx, (const uint8_t* const*)pFrame->data, pFrame->linesize, 0, pCodecCtx->height, pFrameBGR->data, pFrameBGR->linesize);
+                luma.copyTo(bufferLuma);
+            }
+            frameInfo = info;
+            newImage = true;
+            if (mutexVideo) pthread_mutex_unlock(mutexVideo);
 
-            // Free the packet
-            av_free_packet(&packet);
+            // Share it with other processes
+            shareFrame(packet.header);
+            return 1;
         }
-        return 0;
     }
     // AR.Drone 1.0
     else {
-        // Send request
-        sockVideo.sendf("\x01\x00\x00\x00");
+        // Navdata at the capture
+        ARDRONE_FRAME_INFO info;
+        syncFrame(packet, &info);
+
+        // Decode UVLC video
+        if (mutexVideo) pthread_mutex_lock(mutexVideo);
+        UVLC::DecodeVideo((uint8_t*)&packet.data[0], (int)packet.data.size(), bufferBGR, &pCodecCtx->width, &pCodecCtx->height);
+        frameInfo = info;
+        newImage = true;
+        if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+        // Share it with other processes
+        shareFrame(packet.header);
+        return 1;
+    }
 
-        // Receive data
-        uint8_t buf[122880];
-        int size = sockVideo.receive((void*)&buf, sizeof(buf));
+    return 0;
+}
 
-        // Received something
-        if (size > 0) {
-            // Decode UVLC video
-            if (mutexVideo) pthread_mutex_lock(mutexVideo);
-            UVLC::DecodeVideo(buf, size, bufferBGR, &pCodecCtx->width, &pCodecCtx->height);
-            if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+// --------------------------------------------------------------------------
+//! @brief   Publish the decoded image to the shared frame ring.
+//! @param   header PaVE header of the frame (zero for AR.Drone 1.0)
+//! @return  None
+//! @note    Called by the decoding thread, the only writer of the BGR buffer.
+// --------------------------------------------------------------------------
+void ARDrone::shareFrame(const ARDRONE_PAVE &header)
+{
+    // Nobody shares
+    if (!frameRing) return;
+
+    // Metadata (gathered before locking the video)
+    ARDRONE_FRAME_META meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.timestamp = gettime();
+    meta.pave_timestamp = header.timestamp;
+    meta.frame_number = header.frame_number;
+    if (mutexNavdata) pthread_mutex_lock(mutexNavdata);
+    meta.navdata_sequence = navdata.sequence;
+    if (mutexNavdata) pthread_mutex_unlock(mutexNavdata);
+    meta.channel = atoi(getConfigValue("video:video_channel").c_str());
+
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+    if (frameRing) {
+        // AR.Drone 2.0
+        if (version.major == ARDRONE_VERSION_2) {
+            meta.width  = pCodecCtx->width;
+            meta.height = (pCodecCtx->height == 368) ? 360 : pCodecCtx->height;
+            meta.step   = pFrameBGR->linesize[0];
+            frameRing->write(pFrameBGR->data[0], meta);
+        }
+        // AR.Drone 1.0
+        else {
+            meta.width  = pCodecCtx->width;
+            meta.height = pCodecCtx->height;
+            meta.step   = pCodecCtx->width * 3;
+            frameRing->write(bufferBGR, meta);
         }
     }
-
-    return 1;
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
 }
 
 // --------------------------------------------------------------------------
@@ -205,6 +473,17 @@ int ARDrone::getVideo(void)
 //! @retval  NULL Failure
 // --------------------------------------------------------------------------
 ARDRONE_IMAGE ARDrone::getImage(void)
+{
+    return getImage(NULL);
+}
+
+// --------------------------------------------------------------------------
+//! @brief   Get an image with the Navdata at its capture.
+//! @param   info Capture time and state of the image (NULL to ignore)
+//! @return  An OpenCV image data (IplImage or cv::Mat)
+//! @retval  NULL Failure
+// --------------------------------------------------------------------------
+ARDRONE_IMAGE ARDrone::getImage(ARDRONE_FRAME_INFO *info)
 {
     // There is no image
     if (!img) return ARDRONE_IMAGE(NULL);
@@ -231,6 +510,9 @@ ARDRONE_IMAGE ARDrone::getImage(void)
         else memcpy(img->imageData, bufferBGR, pCodecCtx->width * pCodecCtx->height * sizeof(uint8_t) * 3);
     }
     
+    // Navdata of the image
+    if (info) *info = frameInfo;
+
     // The latest image has been read, so change newImage accordingly
     newImage = false;
 
@@ -240,6 +522,49 @@ ARDRONE_IMAGE ARDrone::getImage(void)
     return ARDRONE_IMAGE(img);
 }
 
+// --------------------------------------------------------------------------
+//! @brief   Get the luma (Y plane) of the latest image.
+//! @param   luma Grayscale image
+//! @param   info Capture time and state of the image (NULL to ignore)
+//! @return  Result of this function
+//! @retval  1 Success
+//! @retval  0 Failure
+//! @note    For AR.Drone 2.0 the Y plane of the decoder is copied without the BGR
+//!          conversion. AR.Drone 1.0 images are converted from BGR.
+// --------------------------------------------------------------------------
+int ARDrone::getLuma(cv::Mat *luma, ARDRONE_FRAME_INFO *info)
+{
+    // There is no image
+    if (!img || !luma) return 0;
+
+    // Enable mutex lock
+    if (mutexVideo) pthread_mutex_lock(mutexVideo);
+
+    // AR.Drone 2.0
+    if (version.major == ARDRONE_VERSION_2) {
+        if (bufferLuma.empty()) {
+            if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+            return 0;
+        }
+        bufferLuma(cv::Rect(0, 0, bufferLuma.cols, (bufferLuma.rows == 368) ? 360 : bufferLuma.rows)).copyTo(*luma);
+    }
+    // AR.Drone 1.0
+    else {
+        cv::cvtColor(cv::Mat(pCodecCtx->height, pCodecCtx->width, CV_8UC3, bufferBGR), *luma, cv::COLOR_BGR2GRAY);
+    }
+
+    // Navdata of the image
+    if (info) *info = frameInfo;
+
+    // The latest image has been read
+    newImage = false;
+
+    // Disable mutex lock
+    if (mutexVideo) pthread_mutex_unlock(mutexVideo);
+
+    return 1;
+}
+
 // --------------------------------------------------------------------------
 //! @brief   A variation of getImage() like cv::VideoCapture.
 //! @return  An OpenCV image data (cv::Mat)
@@ -321,6 +646,8 @@ void ARDrone::finalizeVideo(void)
             av_free(bufferBGR);
             bufferBGR = NULL;
         }
+        bufferLuma.release();
+        bufferRaw.release();
 
         // Deallocate the convert context
         if (pConvertCtx) {
@@ -331,14 +658,12 @@ void ARDrone::finalizeVideo(void)
         // Deallocate the codec
         if (pCodecCtx) {
             avcodec_close(pCodecCtx);
+            av_free(pCodecCtx);
             pCodecCtx = NULL;
         }
 
-        // Deallocate the format context
-        if (pFormatCtx) {
-            avformat_close_input(&pFormatCtx);
-            pFormatCtx = NULL;
-        }
+        // Close the socket
+        sockStream.close();
     }
     // AR.Drone 1.0
     else {
@@ -357,4 +682,8 @@ void ARDrone::finalizeVideo(void)
         // Close the socket
         sockVideo.close();
     }
+
+    // Clear received data
+    streamBuffer.clear();
+    streamOffset = 0;
 }